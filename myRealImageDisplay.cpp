@@ -6,12 +6,59 @@
 #include <wx/filename.h>       // File path utilities
 #include <wx/listctrl.h>       // List control (grid-like view)
 #include <wx/dynlib.h>         // Dynamic library loading (plugins)
+#include <wx/datetime.h>       // Timestamps
+#include <wx/timer.h>          // Periodic refresh
+#include <wx/wfstream.h>       // File streams for export
+#include <wx/zstream.h>        // gzip output
+#include <wx/zipstrm.h>        // NumPy .npz archives
+#include <wx/clipbrd.h>        // Copy out of the results log
 #include <fstream>             // File I/O
 #include <vector>              // Dynamic arrays
 #include <algorithm>           // Algorithms like max_element
 #include <limits>              // Numeric limits
 #include <unordered_set>
+#include <unordered_map>
 #include <cmath>
+#include <random>              // Synthetic pattern noise
+#include <thread>              // Parallel loops
+#include <chrono>
+#include <atomic>              // Lock-free instrumentation counters
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <functional>
+#include <charconv>            // Fast number formatting for export
+#include <complex>             // Frame FFTs
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>  // Hardware performance counters
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#ifdef _WIN32
+#include <windows.h>           // File mapping
+#else
+#include <sys/mman.h>          // Memory-mapped profile store
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>              // Event pipes read with a timeout
+#endif
+#include <cstring>
+#ifdef HAVE_HDF5
+#include <hdf5.h>              // HDF5/NeXus export and import
+#endif
+#ifdef HAVE_FFTW
+#include <fftw3.h>             // Frame FFTs (otherwise the built-in transform)
+#endif
+#include <map>
+#include <list>
+#include <deque>
+#include <future>
 
 using namespace std;
 
@@ -19,539 +66,6754 @@ using namespace std;
 static constexpr double PI = 3.14159265358979323846;
 static const size_t MAX_HISTORY = 16;        // Maximum number of undo steps
 static const long HEADER_OFFSET = 3072;      // Legacy image file header offset
+static const int LEGACY_WIDTH = 2082;        // Legacy raw frame dimensions (BGRA, 4 bytes per pixel)
+static const int LEGACY_HEIGHT = 2217;
+static const int LEGACY_PIXEL_DEPTH = 4;
 
-struct RadialAvgPoint {
-    int R;
-    double avg;
-    int samples; // unique pixels counted (optional but useful)
-};
+// ---------------------------------------------------------------------------
+// Hardware performance counters (Linux perf_event_open; unavailable elsewhere)
+// ---------------------------------------------------------------------------
 
-// Class to manage Regions of Interest (ROIs)
-class ROIManager {
-public:
-    void AddROI(const wxRect& roi) { m_rois.push_back(roi); } // Add ROI
-    void Clear() { m_rois.clear(); }                          // Clear all ROIs
-    const vector<wxRect>& GetROIs() const { return m_rois; }  // Get list of ROIs
-private:
-    vector<wxRect> m_rois;  // Stores rectangles for ROIs
+struct CounterSample {
+    uint64_t cycles = 0, instructions = 0, cacheMisses = 0, branchMisses = 0;
+
+    CounterSample operator-(const CounterSample& o) const {
+        return { cycles - o.cycles, instructions - o.instructions, cacheMisses - o.cacheMisses, branchMisses - o.branchMisses };
+    }
+    CounterSample& operator+=(const CounterSample& o) {
+        cycles += o.cycles; instructions += o.instructions; cacheMisses += o.cacheMisses; branchMisses += o.branchMisses;
+        return *this;
+    }
+    double Ipc() const { return cycles ? (double)instructions / (double)cycles : 0.0; }
 };
 
-// Frame to display textual results
-class ResultsFrame : public wxFrame {
+// User-space cycles, instructions, cache misses and branch misses of the calling thread.
+// Counters are inherited by threads it spawns, so ParallelFor workers are included once
+// they have joined. Values are cumulative; callers subtract two Read()s.
+class HardwareCounters {
 public:
-    ResultsFrame(wxWindow* parent)
-        : wxFrame(parent, wxID_ANY, "Results", wxDefaultPosition, wxSize(400, 300)) {
-        // Multiline, read-only text control
-        m_textCtrl = new wxTextCtrl(this, wxID_ANY, "", wxDefaultPosition, wxDefaultSize,
-            wxTE_MULTILINE | wxTE_READONLY);
-
-        // Layout manager
-        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
-        sizer->Add(m_textCtrl, 1, wxEXPAND | wxALL, 10);
-        SetSizer(sizer);
+    HardwareCounters() {
+#ifdef __linux__
+        const uint64_t configs[4] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int i = 0; i < 4; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            m_fd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if (m_fd[i] < 0 && m_error.IsEmpty()) m_error = wxString::Format("perf_event_open: %s", strerror(errno));
+        }
+#else
+        m_error = "hardware counters need Linux perf_event_open";
+#endif
+    }
+    ~HardwareCounters() {
+#ifdef __linux__
+        for (int fd : m_fd) if (fd >= 0) close(fd);
+#endif
+    }
+    HardwareCounters(const HardwareCounters&) = delete;
+    HardwareCounters& operator=(const HardwareCounters&) = delete;
+
+    // Cycles and instructions are required; the miss counters read zero if the PMU lacks them
+    bool IsOpen() const { return m_fd[0] >= 0 && m_fd[1] >= 0; }
+    wxString GetError() const { return m_error; }
+
+    CounterSample Read() const {
+        CounterSample s;
+        s.cycles = ReadOne(m_fd[0]);
+        s.instructions = ReadOne(m_fd[1]);
+        s.cacheMisses = ReadOne(m_fd[2]);
+        s.branchMisses = ReadOne(m_fd[3]);
+        return s;
     }
 
-    void AddResult(const wxString& result) {
-        if (m_textCtrl) m_textCtrl->AppendText(result + "\n"); // Append line of text
+    // Per-thread instance used by PerfScope while stage sampling is on
+    static HardwareCounters& ForThisThread() {
+        thread_local HardwareCounters counters;
+        return counters;
     }
+    static bool StageSamplingEnabled() { return s_stageSampling.load(memory_order_relaxed); }
+    static void EnableStageSampling(bool on) { s_stageSampling.store(on, memory_order_relaxed); }
 
 private:
-    wxTextCtrl* m_textCtrl{ nullptr }; // Text control to show results
+    int m_fd[4] = { -1, -1, -1, -1 };
+    wxString m_error;
+    static atomic<bool> s_stageSampling;
+
+    // Scales for multiplexing when the PMU had to time-share the counters
+    static uint64_t ReadOne(int fd) {
+#ifdef __linux__
+        if (fd < 0) return 0;
+        uint64_t v[3] = { 0, 0, 0 };   // value, time enabled, time running
+        if (read(fd, v, sizeof(v)) != (ssize_t)sizeof(v)) return 0;
+        if (v[2] == 0) return 0;
+        return v[2] < v[1] ? (uint64_t)((double)v[0] * (double)v[1] / (double)v[2]) : v[0];
+#else
+        (void)fd;
+        return 0;
+#endif
+    }
 };
 
-// Class to load image plugins dynamically
-class PluginLoader {
-public:
-    static bool LoadPlugin(const wxString& path, wxImage& img) {
-        if (path.IsEmpty()) return false;
+atomic<bool> HardwareCounters::s_stageSampling{ false };
 
-        wxDynamicLibrary* lib = new wxDynamicLibrary(path); // Load library
-        if (!lib->IsLoaded()) {
-            delete lib;
-            return false;
-        }
+// ---------------------------------------------------------------------------
+// Hot-path instrumentation: scoped timers feeding per-thread latency histograms
+// ---------------------------------------------------------------------------
 
-        typedef void (*ApplyFilterFn)(wxImage&); // Function type for plugin
-        ApplyFilterFn func = reinterpret_cast<ApplyFilterFn>(lib->GetSymbol("ApplyFilter"));
-        if (!func) {
-            wxMessageBox("ApplyFilter() not found in plugin!", "Plugin Error", wxICON_ERROR);
-            lib->Unload();
-            delete lib;
-            return false;
-        }
+enum class PerfOp { Load, Decode, Rescale, Paint, Integrate, Histogram, Plugin, Export, Outliers, Correlate, Fft, Sparse, Count };
 
-        try
-        {
-            func(img);
-        }
-        catch (...)
-        {
-            wxMessageBox("Plugin crashed while applying filter.", "Plugin Error", wxICON_ERROR);
-            lib->Unload();
-            delete lib;
-            return false;
-        }
+static const char* PerfOpName(PerfOp op) {
+    static const char* names[] = { "load", "decode", "rescale", "paint", "integrate", "histogram", "plugin", "export", "outliers", "correlate", "fft", "sparse" };
+    return names[(int)op];
+}
 
-        m_libs.push_back(lib);
-        return true;
+// Log-linear latency histogram: 16 linear sub-buckets per power of two (~3% resolution),
+// nanoseconds up to ~2.4 h. Only the owning thread writes, so updates are plain relaxed
+// load/store pairs (no locked instructions) and readers merge without blocking it.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB = 1 << SUB_BITS;
+    static constexpr int MAX_MSB = 43;
+    static constexpr int BUCKETS = (MAX_MSB - SUB_BITS + 2) * SUB;
+
+    void Record(uint64_t ns) {
+        auto& c = m_counts[BucketOf(ns)];
+        c.store(c.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    uint64_t Count(int bucket) const { return m_counts[bucket].load(memory_order_relaxed); }
+
+    static int BucketOf(uint64_t v) {
+        if (v < (uint64_t)SUB) return (int)v;
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanReverse64(&idx, v);
+        int msb = (int)idx;
+#else
+        int msb = 63 - __builtin_clzll(v);
+#endif
+        if (msb > MAX_MSB) return BUCKETS - 1;
+        const int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB + (int)((v >> shift) & (SUB - 1));
     }
+    // Lowest value that falls into a bucket
+    static uint64_t BucketLow(int b) {
+        if (b < SUB) return (uint64_t)b;
+        return (uint64_t)(SUB + b % SUB) << (b / SUB - 1);
+    }
+    static double BucketMid(int b) { return 0.5 * (double)(BucketLow(b) + BucketLow(b + 1)); }
+
 private:
-    static vector<wxDynamicLibrary*> m_libs; // Track loaded plugins
+    atomic<uint64_t> m_counts[BUCKETS] = {};
 };
 
-vector<wxDynamicLibrary*> PluginLoader::m_libs;
-// Frame to display histogram of an image
-class HistogramFrame : public wxFrame {
+struct LatencySummary {
+    uint64_t count = 0;
+    double meanUs = 0, p50Us = 0, p95Us = 0, p99Us = 0, maxUs = 0;
+};
+
+// Process-wide registry of per-thread histogram blocks. A thread claims a block on its first
+// sample and hands it back when it exits, so pools that spawn short-lived threads reuse blocks.
+class PerfStats {
 public:
-    HistogramFrame(wxWindow* parent, const wxImage& img)
-        : wxFrame(parent, wxID_ANY, "Histogram", wxDefaultPosition, wxSize(420, 200)) {
-        if (!img.IsOk()) {
-            new wxStaticText(this, wxID_ANY, "No image", wxDefaultPosition);
-            return;
+    static void Record(PerfOp op, uint64_t ns) { Local().hist[(int)op].Record(ns); }
+
+    static LatencySummary Summarize(PerfOp op) {
+        vector<uint64_t> merged = Merge(op);
+        LatencySummary s;
+        double sumNs = 0;
+        int last = -1;
+        for (int b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            if (!merged[b]) continue;
+            s.count += merged[b];
+            sumNs += merged[b] * LatencyHistogram::BucketMid(b);
+            last = b;
         }
+        if (s.count == 0) return s;
+
+        auto percentile = [&](double q) {
+            const uint64_t target = max<uint64_t>(1, (uint64_t)ceil(q * (double)s.count));
+            uint64_t cum = 0;
+            for (int b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+                cum += merged[b];
+                if (cum >= target) return LatencyHistogram::BucketMid(b) / 1000.0;
+            }
+            return LatencyHistogram::BucketMid(last) / 1000.0;
+        };
+        s.meanUs = sumNs / (double)s.count / 1000.0;
+        s.p50Us = percentile(0.50);
+        s.p95Us = percentile(0.95);
+        s.p99Us = percentile(0.99);
+        s.maxUs = (double)LatencyHistogram::BucketLow(last + 1) / 1000.0;
+        return s;
+    }
 
-        // Compute luminance histogram (grayscale)
-        vector<int> hist(256, 0);
-        unsigned char* data = img.GetData();
-        int w = img.GetWidth(), h = img.GetHeight();
+    // Counter totals from stages timed while hardware sampling was on
+    struct CounterTotals {
+        uint64_t calls = 0;
+        uint64_t pixels = 0;
+        CounterSample counters;
+    };
+
+    static void RecordCounters(PerfOp op, const CounterSample& delta, uint64_t pixels) {
+        lock_guard<mutex> lock(s_mutex);
+        auto& t = s_counters[(int)op];
+        ++t.calls;
+        t.pixels += pixels;
+        t.counters += delta;
+    }
+    static CounterTotals GetCounters(PerfOp op) {
+        lock_guard<mutex> lock(s_mutex);
+        return s_counters[(int)op];
+    }
 
-        for (int i = 0; i < w * h; ++i) {
-            int r = data[i * 3 + 0];
-            int g = data[i * 3 + 1];
-            int b = data[i * 3 + 2];
-            int lum = (int)round(0.299 * r + 0.587 * g + 0.114 * b); // Luminosity formula
-            lum = clamp(lum, 0, 255);
-            ++hist[lum];
+    // Forget everything recorded so far (writers are never touched; a baseline is subtracted instead)
+    static void Reset() {
+        lock_guard<mutex> lock(s_mutex);
+        for (auto& t : s_counters) t = CounterTotals();
+        for (int op = 0; op < (int)PerfOp::Count; ++op) {
+            s_baseline[op].assign(LatencyHistogram::BUCKETS, 0);
+            for (const auto& block : s_blocks)
+                for (int b = 0; b < LatencyHistogram::BUCKETS; ++b)
+                    s_baseline[op][b] += block->hist[op].Count(b);
         }
+    }
 
-        int maxVal = *max_element(hist.begin(), hist.end()); // For normalization
-        wxBitmap bmp(256, 100);
-        wxMemoryDC dc(bmp);
-        dc.SetBackground(*wxWHITE_BRUSH);
-        dc.Clear();
+    static bool Dump(const wxString& path) {
+        ofstream out(path.mb_str());
+        if (!out) return false;
+        out << "# latency summary, " << wxDateTime::Now().FormatISOCombined(' ').ToStdString() << "\n";
+        out << "operation,count,mean_us,p50_us,p95_us,p99_us,max_us,ipc,cache_miss_per_px,branch_miss_per_px\n";
+        for (int op = 0; op < (int)PerfOp::Count; ++op) {
+            const LatencySummary s = Summarize((PerfOp)op);
+            const CounterTotals c = GetCounters((PerfOp)op);
+            out << PerfOpName((PerfOp)op) << "," << s.count << "," << s.meanUs << "," << s.p50Us << ","
+                << s.p95Us << "," << s.p99Us << "," << s.maxUs << ",";
+            if (c.calls) out << c.counters.Ipc();
+            out << ",";
+            if (c.pixels) out << (double)c.counters.cacheMisses / c.pixels;
+            out << ",";
+            if (c.pixels) out << (double)c.counters.branchMisses / c.pixels;
+            out << "\n";
+        }
+        return (bool)out;
+    }
 
-        // Draw histogram bars
-        for (int x = 0; x < 256; ++x) {
-            int barHeight = (maxVal > 0) ? (int)((double)hist[x] * 100.0 / maxVal) : 0;
-            dc.DrawRectangle(x, 100 - barHeight, 1, barHeight);
+private:
+    struct ThreadBlock { LatencyHistogram hist[(int)PerfOp::Count]; };
+
+    // Returns the block to the free list when its thread exits
+    struct LocalSlot {
+        ThreadBlock* block = nullptr;
+        ~LocalSlot() {
+            if (!block) return;
+            lock_guard<mutex> lock(s_mutex);
+            s_free.push_back(block);
         }
-        dc.SelectObject(wxNullBitmap);
+    };
+
+    static ThreadBlock& Local() {
+        thread_local LocalSlot slot;
+        if (!slot.block) {
+            lock_guard<mutex> lock(s_mutex);
+            if (!s_free.empty()) { slot.block = s_free.back(); s_free.pop_back(); }
+            else { s_blocks.push_back(make_unique<ThreadBlock>()); slot.block = s_blocks.back().get(); }
+        }
+        return *slot.block;
+    }
 
-        wxStaticBitmap* sb = new wxStaticBitmap(this, wxID_ANY, bmp);
-        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
-        sizer->Add(sb, 1, wxEXPAND | wxALL, 10);
-        SetSizer(sizer);
+    static vector<uint64_t> Merge(PerfOp op) {
+        lock_guard<mutex> lock(s_mutex);
+        vector<uint64_t> merged(LatencyHistogram::BUCKETS, 0);
+        for (const auto& block : s_blocks)
+            for (int b = 0; b < LatencyHistogram::BUCKETS; ++b)
+                merged[b] += block->hist[(int)op].Count(b);
+        const auto& base = s_baseline[(int)op];
+        for (size_t b = 0; b < base.size(); ++b) merged[b] -= min(merged[b], base[b]);
+        return merged;
     }
+
+    static mutex s_mutex;
+    static vector<unique_ptr<ThreadBlock>> s_blocks;   // Never freed: blocks outlive their threads
+    static vector<ThreadBlock*> s_free;
+    static vector<uint64_t> s_baseline[(int)PerfOp::Count];
+    static CounterTotals s_counters[(int)PerfOp::Count];
 };
 
-// Frame to view a stack of images (slices)
-class StackViewer : public wxFrame {
+mutex PerfStats::s_mutex;
+vector<unique_ptr<PerfStats::ThreadBlock>> PerfStats::s_blocks;
+vector<PerfStats::ThreadBlock*> PerfStats::s_free;
+vector<uint64_t> PerfStats::s_baseline[(int)PerfOp::Count];
+PerfStats::CounterTotals PerfStats::s_counters[(int)PerfOp::Count];
+
+// ---------------------------------------------------------------------------
+// Chrome trace-event recording (open the JSON in Perfetto or chrome://tracing)
+// ---------------------------------------------------------------------------
+
+// Switchable at runtime. When off, a scope costs one relaxed atomic load; when on, each
+// finished scope appends a complete ("X") event to a buffer owned by the calling thread.
+class TraceRecorder {
 public:
-    StackViewer(wxWindow* parent, const vector<wxImage>& slices)
-        : wxFrame(parent, wxID_ANY, "Stack Viewer", wxDefaultPosition, wxSize(800, 600)),
-        m_slices(slices), m_index(0) {
-        wxBoxSizer* vbox = new wxBoxSizer(wxVERTICAL);
+    static bool Enabled() { return s_enabled.load(memory_order_relaxed); }
 
-        if (m_slices.empty()) {
-            vbox->Add(new wxStaticText(this, wxID_ANY, "No slices to display"), 1, wxALL | wxALIGN_CENTER, 10);
-            SetSizer(vbox);
-            return;
+    static void Start() {
+        {
+            lock_guard<mutex> lock(s_mutex);
+            for (const auto& buf : s_buffers) {
+                lock_guard<mutex> bufLock(buf->lock);
+                buf->events.clear();
+                buf->dropped = 0;
+            }
         }
+        s_enabled.store(true, memory_order_relaxed);
+    }
+    static void Stop() { s_enabled.store(false, memory_order_relaxed); }
 
-        // Display first slice
-        m_bitmap = new wxStaticBitmap(this, wxID_ANY, wxBitmap(m_slices[0]));
-        m_slider = new wxSlider(this, wxID_ANY, 0, 0, (int)m_slices.size() - 1);
+    // Microseconds since process start (shared time base for all threads)
+    static double NowUs() {
+        return chrono::duration<double, micro>(chrono::steady_clock::now() - s_epoch).count();
+    }
 
-        wxBoxSizer* bottom = new wxBoxSizer(wxHORIZONTAL);
-        m_label = new wxStaticText(this, wxID_ANY, GetSliceLabel());
+    static void Record(const char* name, const char* category, double startUs, double durUs, const string& detail = string()) {
+        ThreadBuffer& buf = Local();
+        lock_guard<mutex> lock(buf.lock);   // Uncontended except while Save() runs
+        if (buf.events.size() >= MAX_EVENTS_PER_THREAD) { ++buf.dropped; return; }
+        buf.events.push_back({ name, category, detail, startUs, durUs });
+    }
 
-        vbox->Add(m_bitmap, 1, wxEXPAND);
-        vbox->Add(m_slider, 0, wxEXPAND | wxALL, 5);
-        bottom->Add(m_label, 0, wxALIGN_CENTER_VERTICAL | wxLEFT, 10);
-        vbox->Add(bottom, 0, wxEXPAND);
-        SetSizer(vbox);
+    static void SetThreadName(const string& name) {
+        ThreadBuffer& buf = Local();
+        lock_guard<mutex> lock(buf.lock);
+        buf.name = name;
+    }
 
-        // Bind slider to slice change
-        m_slider->Bind(wxEVT_SLIDER, &StackViewer::OnSlide, this);
+    static bool Save(const wxString& path, size_t* outEvents = nullptr) {
+        ofstream out(path.mb_str());
+        if (!out) return false;
+
+        out.setf(ios::fixed);
+        out.precision(3);   // Microsecond timestamps keep ns resolution over long sessions
+
+        size_t total = 0;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        auto sep = [&]() { if (!first) out << ",\n"; first = false; };
+
+        lock_guard<mutex> lock(s_mutex);
+        for (const auto& buf : s_buffers) {
+            lock_guard<mutex> bufLock(buf->lock);
+            sep();
+            out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buf->tid
+                << ",\"args\":{\"name\":\"" << JsonEscape(buf->name) << "\"}}";
+            for (const auto& e : buf->events) {
+                sep();
+                out << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << buf->tid << ",\"name\":\"" << e.name
+                    << "\",\"cat\":\"" << e.category << "\",\"ts\":" << e.startUs << ",\"dur\":" << e.durUs;
+                if (!e.detail.empty()) out << ",\"args\":{\"detail\":\"" << JsonEscape(e.detail) << "\"}";
+                out << "}";
+            }
+            if (buf->dropped) {
+                sep();
+                out << "{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" << buf->tid << ",\"name\":\"dropped "
+                    << buf->dropped << " events\",\"ts\":" << NowUs() << "}";
+            }
+            total += buf->events.size();
+        }
+        out << "\n]}\n";
+        if (outEvents) *outEvents = total;
+        return (bool)out;
     }
 
 private:
-    vector<wxImage> m_slices;        // Image stack
-    int m_index = 0;                  // Current slice index
-    wxStaticBitmap* m_bitmap{ nullptr };
-    wxSlider* m_slider{ nullptr };
-    wxStaticText* m_label{ nullptr };
+    static const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+    struct TraceEvent {
+        const char* name;       // Static strings only
+        const char* category;
+        string detail;          // Optional argument (e.g. file path)
+        double startUs, durUs;
+    };
+
+    struct ThreadBuffer {
+        int tid = 0;
+        string name;
+        mutex lock;
+        vector<TraceEvent> events;
+        size_t dropped = 0;
+    };
+
+    // Buffers are recycled when a thread exits; its events stay until the next Start()
+    struct LocalSlot {
+        ThreadBuffer* buf = nullptr;
+        ~LocalSlot() {
+            if (!buf) return;
+            lock_guard<mutex> lock(s_mutex);
+            s_free.push_back(buf);
+        }
+    };
 
-    // Update displayed slice when slider moves
-    void OnSlide(wxCommandEvent& /*evt*/) {
-        if (m_slices.empty() || !m_bitmap) return;
-        m_index = m_slider->GetValue();
-        if (m_index >= 0 && m_index < (int)m_slices.size()) {
-            m_bitmap->SetBitmap(wxBitmap(m_slices[m_index]));
-            if (m_label) m_label->SetLabel(GetSliceLabel());
+    static ThreadBuffer& Local() {
+        thread_local LocalSlot slot;
+        if (!slot.buf) {
+            lock_guard<mutex> lock(s_mutex);
+            if (!s_free.empty()) { slot.buf = s_free.back(); s_free.pop_back(); }
+            else {
+                s_buffers.push_back(make_unique<ThreadBuffer>());
+                slot.buf = s_buffers.back().get();
+                slot.buf->tid = (int)s_buffers.size();
+                slot.buf->name = "thread " + to_string(slot.buf->tid);
+            }
         }
+        return *slot.buf;
     }
 
-    wxString GetSliceLabel() const { return wxString::Format("Slice %d / %d", m_index + 1, (int)m_slices.size()); }
+    static string JsonEscape(const string& in) {
+        string out;
+        out.reserve(in.size());
+        for (char c : in) {
+            if (c == '"' || c == '\\') { out += '\\'; out += c; }
+            else if ((unsigned char)c < 0x20) out += ' ';
+            else out += c;
+        }
+        return out;
+    }
+
+    static atomic<bool> s_enabled;
+    static const chrono::steady_clock::time_point s_epoch;
+    static mutex s_mutex;
+    static vector<unique_ptr<ThreadBuffer>> s_buffers;
+    static vector<ThreadBuffer*> s_free;
 };
 
-// Scrollable panel to display and interact with a single image
-class ImagePanel : public wxScrolledWindow
-{
-public:
-    ImagePanel(wxWindow* parent)
-        : wxScrolledWindow(parent, wxID_ANY) {
-        SetBackgroundStyle(wxBG_STYLE_PAINT);
-        SetBackgroundColour(*wxWHITE);
-        SetScrollRate(10, 10);
+atomic<bool> TraceRecorder::s_enabled{ false };
+const chrono::steady_clock::time_point TraceRecorder::s_epoch = chrono::steady_clock::now();
+mutex TraceRecorder::s_mutex;
+vector<unique_ptr<TraceRecorder::ThreadBuffer>> TraceRecorder::s_buffers;
+vector<TraceRecorder::ThreadBuffer*> TraceRecorder::s_free;
 
-        // Bind events
-        Bind(wxEVT_PAINT, &ImagePanel::OnPaint, this);
-        Bind(wxEVT_MENU, &ImagePanel::OnCopy, this, wxID_COPY);
-        Bind(wxEVT_MENU, &ImagePanel::OnPaste, this, wxID_PASTE);
-        Bind(wxEVT_MENU, &ImagePanel::OnSave, this, wxID_SAVE);
-        Bind(wxEVT_MENU, &ImagePanel::OnUndo, this, wxID_UNDO);
-        Bind(wxEVT_CONTEXT_MENU, &ImagePanel::OnContextMenu, this);
-        Bind(wxEVT_LEFT_DOWN, &ImagePanel::OnLeftDown, this);
-        Bind(wxEVT_MOTION, &ImagePanel::OnMouseMove, this);
-        Bind(wxEVT_MOUSEWHEEL, &ImagePanel::OnMouseWheel, this);
-        Bind(wxEVT_LEFT_UP, &ImagePanel::OnLeftUp, this);
-        Bind(wxEVT_CHAR_HOOK, &ImagePanel::OnKeyDown, this);
+// RAII trace span for work that is not a PerfOp (scheduler tasks, individual I/O requests)
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category, const char* detail = nullptr)
+        : m_name(name), m_category(category), m_active(TraceRecorder::Enabled()) {
+        if (!m_active) return;
+        if (detail) m_detail = detail;
+        m_startUs = TraceRecorder::NowUs();
     }
-
-    // Copy selection to internal clipboard
-    void OnCopy(wxCommandEvent&) { CopySelection(); }
-    void OnPaste(wxCommandEvent&) { PasteClipboard(wxPoint(10, 10), BLEND); }
-    void OnUndo(wxCommandEvent&) { Undo(); }
-
-    // Save current image to disk
-    void OnSave(wxCommandEvent&) {
-        wxFileDialog dlg(this, "Save Image", "", "", "PNG files (*.png)|*.png", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
-        if (dlg.ShowModal() == wxID_OK) {
-            if (!m_originalImg.SaveFile(dlg.GetPath(), wxBITMAP_TYPE_PNG))
-                wxMessageBox("Failed to save image", "Save", wxICON_ERROR);
-        }
+    ~TraceScope() {
+        if (m_active) TraceRecorder::Record(m_name, m_category, m_startUs, TraceRecorder::NowUs() - m_startUs, m_detail);
     }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+private:
+    const char* m_name;
+    const char* m_category;
+    bool m_active;
+    double m_startUs = 0;
+    string m_detail;
+};
 
-    // Set new image and manage undo history
-    void SetImage(const wxImage& img) {
-        if (m_originalImg.IsOk()) {
-            m_history.push_back(m_originalImg);
-            if (m_history.size() > MAX_HISTORY) m_history.erase(m_history.begin());
+// RAII timer: records the lifetime of the scope under the given operation (and, while
+// tracing, emits it as a pipeline-stage span)
+class PerfScope {
+public:
+    explicit PerfScope(PerfOp op) : m_op(op), m_sampling(HardwareCounters::StageSamplingEnabled()) {
+        if (m_sampling) m_counters = HardwareCounters::ForThisThread().Read();
+        m_start = chrono::steady_clock::now();
+    }
+    ~PerfScope() {
+        const auto end = chrono::steady_clock::now();
+        const auto ns = chrono::duration_cast<chrono::nanoseconds>(end - m_start).count();
+        PerfStats::Record(m_op, (uint64_t)max<long long>(0, ns));
+        if (m_sampling && HardwareCounters::ForThisThread().IsOpen())
+            PerfStats::RecordCounters(m_op, HardwareCounters::ForThisThread().Read() - m_counters, m_pixels);
+        if (TraceRecorder::Enabled()) {
+            const double durUs = ns / 1000.0;
+            const char* category = m_op == PerfOp::Paint ? "paint" : m_op == PerfOp::Load ? "io" : "stage";
+            TraceRecorder::Record(PerfOpName(m_op), category, TraceRecorder::NowUs() - durUs, durUs);
         }
-        m_originalImg = img;
-        ZoomFit();
     }
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
 
-    ROIManager m_roiManager;              // ROI manager
-    wxImage GetOriginalImage() const { return m_originalImg; }
-    wxRect GetSelectionRect() const { return m_selection; }
-    double GetZoomFactor() const { return m_zoomFactor; }
+    // Work size for per-pixel counter rates
+    void SetPixels(uint64_t pixels) { m_pixels = pixels; }
 
-    void ClearSelection() { m_selection = wxRect(); Refresh(); }
+private:
+    PerfOp m_op;
+    bool m_sampling;
+    CounterSample m_counters;
+    uint64_t m_pixels = 0;
+    chrono::steady_clock::time_point m_start;
+};
 
-    // Zoom controls
-    void ZoomIn() { m_zoomFactor *= 1.2; m_fitMode = false; ApplyZoom(); }
-    void ZoomOut() { m_zoomFactor /= 1.2; if (m_zoomFactor < 0.01) m_zoomFactor = 0.01; m_fitMode = false; ApplyZoom(); }
-    void ZoomFit() { m_fitMode = true; ApplyZoom(); }
+// ---------------------------------------------------------------------------
+// Memory accounting: bytes held per subsystem (tag) and per window (owner)
+// ---------------------------------------------------------------------------
 
-    // Copy selected region
-    void CopySelection() {
-        if (!m_selection.IsEmpty() && m_originalImg.IsOk())
-            m_clipboard = m_originalImg.GetSubImage(m_selection);
+enum class MemTag { Image, Display, History, Clipboard, Histogram, Stack, Cache, Profiles, Log, Tables, Calibration, Correlation, Count };
+
+static const char* MemTagName(MemTag tag) {
+    static const char* names[] = { "image", "display bitmap", "undo history", "clipboard", "histogram", "stack slices", "frame cache", "profiles", "results log", "ROI tables", "calibration", "correlation" };
+    return names[(int)tag];
+}
+
+// Logical sizes of the holders we account for
+static uint64_t ImageBytes(const wxImage& img) {
+    if (!img.IsOk()) return 0;
+    return (uint64_t)img.GetWidth() * img.GetHeight() * (img.HasAlpha() ? 4 : 3);
+}
+static uint64_t BitmapBytes(const wxBitmap& bmp) {
+    return bmp.IsOk() ? (uint64_t)bmp.GetWidth() * bmp.GetHeight() * 4 : 0;
+}
+
+// Process-wide ledger. Holders report size changes through MemCharge; when the total
+// exceeds the budget, registered evictors (caches first, then undo history) release memory.
+class MemoryAccounting {
+public:
+    struct Usage { uint64_t current = 0, peak = 0; };
+    struct OwnerUsage {
+        wxString label;
+        uint64_t bytes[(int)MemTag::Count] = {};
+        uint64_t total = 0, peak = 0;
+    };
+    typedef function<uint64_t(uint64_t bytesWanted)> Evictor;   // Returns bytes released
+
+    static int RegisterOwner(const wxString& label) {
+        lock_guard<mutex> lock(s_mutex);
+        const int id = ++s_nextOwner;
+        s_owners[id].label = label;
+        return id;
+    }
+    static void RenameOwner(int owner, const wxString& label) {
+        lock_guard<mutex> lock(s_mutex);
+        auto it = s_owners.find(owner);
+        if (it != s_owners.end()) it->second.label = label;
+    }
+    static void UnregisterOwner(int owner) {
+        lock_guard<mutex> lock(s_mutex);
+        s_owners.erase(owner);
     }
 
-    // Keyboard shortcuts for Ctrl+C, V, Z
-    void OnKeyDown(wxKeyEvent& event) {
-        if (event.ControlDown()) {
-            int key = event.GetKeyCode();
-            if (key == 'C') CopySelection();
-            else if (key == 'V') PasteClipboard(wxPoint(10, 10), BLEND);
-            else if (key == 'Z') Undo();
-            else event.Skip();
+    static void Add(MemTag tag, int owner, int64_t delta) {
+        if (delta == 0) return;
+        lock_guard<mutex> lock(s_mutex);
+        Apply(s_tags[(int)tag], delta);
+        Apply(s_total, delta);
+        auto it = s_owners.find(owner);
+        if (it != s_owners.end()) {
+            OwnerUsage& o = it->second;
+            o.bytes[(int)tag] = (uint64_t)max<int64_t>(0, (int64_t)o.bytes[(int)tag] + delta);
+            o.total = (uint64_t)max<int64_t>(0, (int64_t)o.total + delta);
+            o.peak = max(o.peak, o.total);
         }
-        else { event.Skip(); }
     }
 
-    // Undo last image change
-    void Undo() {
-        if (!m_history.empty()) {
-            m_originalImg = m_history.back();
-            m_history.pop_back();
-            ZoomFit();
-        }
-        else {
-            wxMessageBox("No previous image to undo.", "Undo", wxICON_INFORMATION);
-        }
+    static Usage Tag(MemTag tag) { lock_guard<mutex> lock(s_mutex); return s_tags[(int)tag]; }
+    static Usage Total() { lock_guard<mutex> lock(s_mutex); return s_total; }
+    static vector<OwnerUsage> Owners() {
+        lock_guard<mutex> lock(s_mutex);
+        vector<OwnerUsage> out;
+        for (const auto& kv : s_owners) out.push_back(kv.second);
+        sort(out.begin(), out.end(), [](const OwnerUsage& a, const OwnerUsage& b) { return a.total > b.total; });
+        return out;
     }
 
-private:
-    wxBitmap m_bitmap;                   // Display bitmap
-    wxImage m_originalImg;               // Original image data
-    double m_zoomFactor = 1.0;          // Zoom factor
-    bool m_fitMode = true;               // Fit-to-window flag
-    wxRect m_selection;                  // User selection rectangle
-    bool m_selecting = false;            // True when dragging selection
-    wxPoint m_startPoint;                // Start of selection
-    wxImage m_clipboard;                 // Copy/paste buffer
-    bool m_showROIs = false;             // Display ROIs
+    // 0 disables the budget
+    static void SetBudget(uint64_t bytes) { s_budget.store(bytes, memory_order_relaxed); EnforceBudget(); }
+    static uint64_t GetBudget() { return s_budget.load(memory_order_relaxed); }
 
-    enum BlendMode { AND, OR, XOR, BLEND }; // Blend modes for pasting
-    enum DrawMode { NONE, TEXT, RECT, ELLIPSE, ARROW, POLYGON }; // Drawing modes
-    DrawMode m_drawMode = NONE;
-    vector<wxImage> m_history;           // Undo history
+    // Lower priority values are evicted first
+    static int RegisterEvictor(int priority, Evictor fn) {
+        lock_guard<mutex> lock(s_mutex);
+        const int id = ++s_nextEvictor;
+        s_evictors.insert({ priority, { id, move(fn) } });
+        return id;
+    }
+    static void UnregisterEvictor(int id) {
+        lock_guard<mutex> lock(s_mutex);
+        for (auto it = s_evictors.begin(); it != s_evictors.end(); ++it)
+            if (it->second.first == id) { s_evictors.erase(it); return; }
+    }
 
-    // Apply zoom or fit-to-window
-    void ApplyZoom() {
-        if (!m_originalImg.IsOk()) return;
+    // Run evictors until the total is back under budget. Called from the GUI thread after
+    // growth; evictors call back into Add, so the ledger lock is not held while they run.
+    static void EnforceBudget() { MakeRoom(0); }
 
-        wxSize panelSize = GetClientSize();
-        int newW = (int)(m_originalImg.GetWidth() * m_zoomFactor);
-        int newH = (int)(m_originalImg.GetHeight() * m_zoomFactor);
+    // Run evictors until `bytes` more fit under the budget, before a large allocation; false
+    // when they still do not. Always true without a budget. GUI thread only, like EnforceBudget.
+    static bool MakeRoom(uint64_t bytes) {
+        const uint64_t budget = GetBudget();
+        if (budget == 0) return true;
+        if (bytes > budget) return false;   // Evicting everything would not help
+        if (s_enforcing) return Total().current + bytes <= budget;
+        s_enforcing = true;
 
-        if (m_fitMode && m_originalImg.GetWidth() > 0 && m_originalImg.GetHeight() > 0) {
-            double scaleX = (double)panelSize.x / m_originalImg.GetWidth();
-            double scaleY = (double)panelSize.y / m_originalImg.GetHeight();
-            m_zoomFactor = min(scaleX, scaleY);
-            if (m_zoomFactor <= 0) m_zoomFactor = 1.0;
-            newW = (int)(m_originalImg.GetWidth() * m_zoomFactor);
-            newH = (int)(m_originalImg.GetHeight() * m_zoomFactor);
+        vector<pair<int, Evictor>> evictors;
+        {
+            lock_guard<mutex> lock(s_mutex);
+            for (const auto& kv : s_evictors) evictors.push_back(kv.second);
+        }
+        for (auto& e : evictors) {
+            const uint64_t total = Total().current;
+            if (total + bytes <= budget) break;
+            e.second(total + bytes - budget);
         }
+        s_enforcing = false;
+        return Total().current + bytes <= budget;
+    }
 
-        wxImage scaled = m_originalImg.Scale(newW, newH, wxIMAGE_QUALITY_HIGH);
-        m_bitmap = wxBitmap(scaled);
+    // Resident set size of the whole process, 0 where unsupported
+    static uint64_t ProcessResidentBytes() {
+#ifdef __linux__
+        ifstream statm("/proc/self/statm");
+        uint64_t pages = 0, resident = 0;
+        if (statm >> pages >> resident) return resident * (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+        return 0;
+    }
 
-        SetVirtualSize(newW, newH);
-        Refresh();
+private:
+    static void Apply(Usage& u, int64_t delta) {
+        u.current = (uint64_t)max<int64_t>(0, (int64_t)u.current + delta);
+        u.peak = max(u.peak, u.current);
+    }
 
-        wxFrame* frame = dynamic_cast<wxFrame*>(GetParent());
-        if (frame) {
-            wxString zoomStr = m_fitMode ? wxString("Zoom: Fit") : wxString::Format("Zoom: %.0f%%", m_zoomFactor * 100);
-            frame->SetStatusText(zoomStr, 1);
-        }
+    static mutex s_mutex;
+    static Usage s_tags[(int)MemTag::Count];
+    static Usage s_total;
+    static map<int, OwnerUsage> s_owners;
+    static int s_nextOwner;
+    static multimap<int, pair<int, Evictor>> s_evictors;
+    static int s_nextEvictor;
+    static atomic<uint64_t> s_budget;
+    static bool s_enforcing;
+};
+
+mutex MemoryAccounting::s_mutex;
+MemoryAccounting::Usage MemoryAccounting::s_tags[(int)MemTag::Count];
+MemoryAccounting::Usage MemoryAccounting::s_total;
+map<int, MemoryAccounting::OwnerUsage> MemoryAccounting::s_owners;
+int MemoryAccounting::s_nextOwner = 0;
+multimap<int, pair<int, MemoryAccounting::Evictor>> MemoryAccounting::s_evictors;
+int MemoryAccounting::s_nextEvictor = 0;
+atomic<uint64_t> MemoryAccounting::s_budget{ 0 };
+bool MemoryAccounting::s_enforcing = false;
+
+// Bytes held under one tag by one owner; released on destruction
+class MemCharge {
+public:
+    explicit MemCharge(MemTag tag, int owner = 0) : m_tag(tag), m_owner(owner) {}
+    ~MemCharge() { Set(0); }
+    MemCharge(const MemCharge&) = delete;
+    MemCharge& operator=(const MemCharge&) = delete;
+
+    void Set(uint64_t bytes) {
+        MemoryAccounting::Add(m_tag, m_owner, (int64_t)bytes - (int64_t)m_bytes);
+        m_bytes = bytes;
+    }
+    void SetOwner(int owner) {
+        const uint64_t bytes = m_bytes;
+        Set(0);
+        m_owner = owner;
+        Set(bytes);
     }
+    uint64_t Get() const { return m_bytes; }
 
-    // Context menu on right-click
-    void OnContextMenu(wxContextMenuEvent& event) {
-        wxMenu menu;
-        menu.Append(wxID_COPY, "Copy Selection");
-        menu.Append(wxID_PASTE, "Paste Clipboard");
-        menu.Append(wxID_SAVE, "Save Image As...");
-        menu.AppendSeparator();
-        menu.Append(wxID_UNDO, "Undo");
+private:
+    MemTag m_tag;
+    int m_owner;
+    uint64_t m_bytes = 0;
+};
 
-        wxPoint pos = event.GetPosition();
-        if (pos == wxDefaultPosition) pos = ScreenToClient(wxGetMousePosition());
-        PopupMenu(&menu, pos);
+// Set on ParallelFor workers so nested loops run inline instead of oversubscribing the machine
+static thread_local bool t_inParallelFor = false;
+
+// Run fn(chunkBegin, chunkEnd) over [begin, end) split into one contiguous chunk per hardware
+// thread. Each chunk is traced as a scheduler task. Called from inside a worker, it runs inline.
+template <class Fn>
+static void ParallelFor(int begin, int end, Fn&& fn) {
+    const int n = end - begin;
+    if (n <= 0) return;
+    const int threads = t_inParallelFor ? 1 : (int)min<unsigned>(max(1u, thread::hardware_concurrency()), (unsigned)n);
+    if (threads == 1) {
+        TraceScope task("task", "scheduler");
+        fn(begin, end);
+        return;
     }
 
-    // Paint event
-    void OnPaint(wxPaintEvent& /*event*/) {
-        wxAutoBufferedPaintDC dc(this);
-        DoPrepareDC(dc);
-        dc.Clear();
+    const int chunk = (n + threads - 1) / threads;
+    vector<thread> workers;
+    for (int b = begin; b < end; b += chunk) {
+        const int e = min(end, b + chunk);
+        workers.emplace_back([&fn, b, e] {
+            t_inParallelFor = true;
+            if (TraceRecorder::Enabled()) TraceRecorder::SetThreadName("worker");
+            TraceScope task("task", "scheduler");
+            fn(b, e);
+            });
+    }
+    for (auto& w : workers) w.join();
+}
 
-        if (m_bitmap.IsOk()) dc.DrawBitmap(m_bitmap, 0, 0, true);
-        else {
-            dc.SetPen(*wxTRANSPARENT_PEN);
-            dc.DrawText("No image loaded", 10, 10);
+struct RadialAvgPoint {
+    int R;
+    double avg;
+    int samples; // unique pixels counted (optional but useful)
+    double err = numeric_limits<double>::quiet_NaN();   // Standard error of avg
+};
+
+// Statistics of one rectangular ROI
+struct RoiStats {
+    uint64_t pixels = 0;
+    double sum = 0.0;
+    double mean = numeric_limits<double>::quiet_NaN();
+    double variance = numeric_limits<double>::quiet_NaN();   // Population variance
+    int min = 0;
+    int max = 0;
+};
+
+// Run-length pixel mask: horizontal runs [x0, x1) sorted by row, then column, never touching
+// within a row. Iterating runs visits exactly the member pixels with no per-pixel shape test.
+struct PixelRun {
+    int y, x0, x1;
+};
+
+class RunMask {
+public:
+    // Runs must arrive in row-major order; a run adjacent to the previous one is merged into it
+    void AddRun(int y, int x0, int x1) {
+        if (x1 <= x0) return;
+        if (!m_runs.empty() && m_runs.back().y == y && m_runs.back().x1 == x0) m_runs.back().x1 = x1;
+        else m_runs.push_back({ y, x0, x1 });
+        m_pixels += (uint64_t)(x1 - x0);
+    }
+
+    void Clear() { m_runs.clear(); m_pixels = 0; }
+    bool IsEmpty() const { return m_runs.empty(); }
+    uint64_t Pixels() const { return m_pixels; }
+    uint64_t Bytes() const { return m_runs.size() * sizeof(PixelRun); }
+    const vector<PixelRun>& Runs() const { return m_runs; }
+
+    bool Contains(int x, int y) const {
+        auto it = upper_bound(m_runs.begin(), m_runs.end(), make_pair(y, x),
+            [](const pair<int, int>& p, const PixelRun& r) { return p.first < r.y || (p.first == r.y && p.second < r.x0); });
+        if (it == m_runs.begin()) return false;
+        --it;
+        return it->y == y && x < it->x1;
+    }
+
+private:
+    vector<PixelRun> m_runs;
+    uint64_t m_pixels = 0;
+};
+
+// Non-rectangular ROI. Angles are degrees clockwise from +x on screen (image y points down);
+// a sector runs from angle0 to angle1 and may wrap through 360.
+struct RoiShape {
+    enum Kind { Polygon, Ellipse, Sector };
+    Kind kind = Polygon;
+    vector<wxRealPoint> vertices;   // Polygon
+    double cx = 0, cy = 0;          // Ellipse and sector center
+    double rx = 0, ry = 0;          // Ellipse semi-axes
+    double rInner = 0, rOuter = 0;  // Sector radii
+    double angle0 = 0, angle1 = 360;
+
+    bool FullCircle() const { return angle1 - angle0 >= 360.0; }
+
+    wxRect Bounds() const {
+        double x0 = cx - rx, y0 = cy - ry, x1 = cx + rx, y1 = cy + ry;
+        if (kind == Sector) { x0 = cx - rOuter; y0 = cy - rOuter; x1 = cx + rOuter; y1 = cy + rOuter; }
+        if (kind == Polygon && !vertices.empty()) {
+            x0 = x1 = vertices[0].x; y0 = y1 = vertices[0].y;
+            for (const auto& v : vertices) { x0 = min(x0, v.x); y0 = min(y0, v.y); x1 = max(x1, v.x); y1 = max(y1, v.y); }
         }
+        const int ix = (int)floor(x0), iy = (int)floor(y0);
+        return wxRect(ix, iy, (int)ceil(x1) - ix + 1, (int)ceil(y1) - iy + 1);
+    }
 
-        // Draw ROIs
-        if (m_showROIs) {
-            for (const auto& roi : m_roiManager.GetROIs()) {
-                dc.SetPen(*wxGREEN_PEN);
-                dc.SetBrush(*wxTRANSPARENT_BRUSH);
-                dc.DrawRectangle(roi);
+    bool Contains(double x, double y) const {
+        const double dx = x - cx, dy = y - cy;
+        switch (kind) {
+        case Ellipse:
+            return rx > 0 && ry > 0 && (dx / rx) * (dx / rx) + (dy / ry) * (dy / ry) <= 1.0;
+        case Sector: {
+            const double r2 = dx * dx + dy * dy;
+            if (r2 < rInner * rInner || r2 > rOuter * rOuter) return false;
+            if (FullCircle()) return true;
+            const double a = atan2(dy, dx) * 180.0 / PI;
+            return fmod(fmod(a - angle0, 360.0) + 360.0, 360.0) <= fmod(fmod(angle1 - angle0, 360.0) + 360.0, 360.0);
+        }
+        default: {
+            bool inside = false;   // Even-odd rule
+            for (size_t i = 0, j = vertices.size() - 1; i < vertices.size(); j = i++) {
+                const wxRealPoint& a = vertices[i];
+                const wxRealPoint& b = vertices[j];
+                if ((a.y > y) != (b.y > y) && x < b.x + (a.x - b.x) * (y - b.y) / (a.y - b.y)) inside = !inside;
             }
+            return inside;
         }
+        }
+    }
 
-        // Draw selection rectangle
-        if (!m_selection.IsEmpty()) {
-            dc.SetPen(*wxRED_PEN);
-            dc.SetBrush(*wxTRANSPARENT_BRUSH);
-            dc.DrawRectangle(m_selection);
+    // Positions along row y where membership can change: edge crossings, circle chords, ray hits
+    void RowBreaks(double y, vector<double>& xs) const {
+        const double dy = y - cy;
+        auto chord = [&](double r) {
+            if (r > 0 && fabs(dy) < r) { const double hw = sqrt(r * r - dy * dy); xs.push_back(cx - hw); xs.push_back(cx + hw); }
+        };
+        switch (kind) {
+        case Ellipse:
+            if (ry > 0 && fabs(dy) < ry) { const double hw = rx * sqrt(1.0 - (dy / ry) * (dy / ry)); xs.push_back(cx - hw); xs.push_back(cx + hw); }
+            break;
+        case Sector:
+            chord(rOuter);
+            chord(rInner);
+            if (!FullCircle()) {
+                for (double deg : { angle0, angle1 }) {
+                    const double s = sin(deg * PI / 180.0), c = cos(deg * PI / 180.0);
+                    if (fabs(s) > 1e-12 && dy / s > 0) xs.push_back(cx + dy / s * c);
+                }
+                xs.push_back(cx);
+            }
+            break;
+        default:
+            for (size_t i = 0, j = vertices.size() - 1; i < vertices.size(); j = i++) {
+                const wxRealPoint& a = vertices[i];
+                const wxRealPoint& b = vertices[j];
+                if ((a.y > y) != (b.y > y)) xs.push_back(b.x + (a.x - b.x) * (y - b.y) / (a.y - b.y));
+            }
         }
+    }
 
-        if (m_drawMode == RECT && !m_selection.IsEmpty()) {
-            dc.SetPen(*wxBLUE_PEN);
-            dc.SetBrush(*wxTRANSPARENT_BRUSH);
-            dc.DrawRectangle(m_selection);
+    // Closed outlines for drawing; a full annulus has two
+    vector<vector<wxPoint>> Outlines() const {
+        auto at = [&](double r, double deg) {
+            return wxPoint((int)lround(cx + r * cos(deg * PI / 180.0)), (int)lround(cy + r * sin(deg * PI / 180.0)));
+        };
+        vector<vector<wxPoint>> out(1);
+        if (kind == Polygon) {
+            for (const auto& v : vertices) out[0].push_back(wxPoint((int)lround(v.x), (int)lround(v.y)));
+        }
+        else if (kind == Ellipse) {
+            for (int k = 0; k < 64; ++k) {
+                const double t = 2.0 * PI * k / 64;
+                out[0].push_back(wxPoint((int)lround(cx + rx * cos(t)), (int)lround(cy + ry * sin(t))));
+            }
         }
+        else if (FullCircle()) {
+            out.resize(rInner > 0 ? 2 : 1);
+            for (int k = 0; k < 64; ++k) {
+                out[0].push_back(at(rOuter, k * 360.0 / 64));
+                if (rInner > 0) out[1].push_back(at(rInner, k * 360.0 / 64));
+            }
+        }
+        else {
+            const double span = fmod(fmod(angle1 - angle0, 360.0) + 360.0, 360.0);
+            const int n = max(2, (int)ceil(span / 5.0));
+            for (int k = 0; k <= n; ++k) out[0].push_back(at(rOuter, angle0 + span * k / n));
+            for (int k = n; k >= 0; --k) out[0].push_back(at(rInner, angle0 + span * k / n));
+        }
+        return out;
     }
+};
 
-    void ToggleROIs() { m_showROIs = !m_showROIs; Refresh(); }
+// Scanline rasterization clipped to a w x h frame: a pixel belongs to the shape when its center
+// does. Each row is cut at the shape's break points and every piece is classified by its midpoint.
+static RunMask RasterizeShape(const RoiShape& shape, int w, int h) {
+    RunMask mask;
+    const wxRect b = shape.Bounds();
+    const int bx0 = max(0, b.x), by0 = max(0, b.y);
+    const int bx1 = min(w, b.x + b.width), by1 = min(h, b.y + b.height);
+    vector<double> xs;
+    for (int y = by0; y < by1; ++y) {
+        const double py = y + 0.5;
+        xs.assign({ (double)bx0, (double)bx1 });
+        shape.RowBreaks(py, xs);
+        sort(xs.begin(), xs.end());
+        for (size_t i = 0; i + 1 < xs.size(); ++i) {
+            const double a = max(xs[i], (double)bx0), c = min(xs[i + 1], (double)bx1);
+            if (c <= a || !shape.Contains(0.5 * (a + c), py)) continue;
+            mask.AddRun(y, (int)ceil(a - 0.5), (int)ceil(c - 0.5));
+        }
+    }
+    return mask;
+}
 
-    // Mouse events
-    void OnLeftDown(wxMouseEvent& event) {
-        m_startPoint = CalcUnscrolledPosition(event.GetPosition());
-        m_selecting = true;
-        CaptureMouse();
+// "polygon x,y,x,y,...", "ellipse cx,cy,rx,ry", "annulus cx,cy,rin,rout" or
+// "sector cx,cy,rin,rout,angle0,angle1"
+static bool ParseRoiShape(const wxString& spec, RoiShape& out) {
+    wxString kind = spec.BeforeFirst(' ').Lower();
+    vector<double> v;
+    for (wxString part : wxSplit(spec.AfterFirst(' '), ',')) {
+        double d;
+        if (!part.Trim().Trim(false).ToDouble(&d)) return false;
+        v.push_back(d);
+    }
+    RoiShape s;
+    if (kind == "polygon" && v.size() >= 6 && v.size() % 2 == 0) {
+        s.kind = RoiShape::Polygon;
+        for (size_t i = 0; i < v.size(); i += 2) s.vertices.push_back(wxRealPoint(v[i], v[i + 1]));
+    }
+    else if (kind == "ellipse" && v.size() == 4 && v[2] > 0 && v[3] > 0) {
+        s.kind = RoiShape::Ellipse;
+        s.cx = v[0]; s.cy = v[1]; s.rx = v[2]; s.ry = v[3];
     }
+    else if ((kind == "annulus" && v.size() == 4) || (kind == "sector" && v.size() == 6)) {
+        s.kind = RoiShape::Sector;
+        s.cx = v[0]; s.cy = v[1]; s.rInner = v[2]; s.rOuter = v[3];
+        if (v.size() == 6) { s.angle0 = v[4]; s.angle1 = v[5] < v[4] ? v[5] + 360.0 : v[5]; }
+        if (s.rInner < 0 || s.rOuter <= s.rInner) return false;
+    }
+    else return false;
+    out = s;
+    return true;
+}
 
-    void OnLeftUp(wxMouseEvent& event) {
-        if (m_selecting) {
-            wxPoint endPoint = CalcUnscrolledPosition(event.GetPosition());
-            int x1 = min(m_startPoint.x, endPoint.x);
-            int y1 = min(m_startPoint.y, endPoint.y);
-            int x2 = max(m_startPoint.x, endPoint.x);
-            int y2 = max(m_startPoint.y, endPoint.y);
-            // Clamp and set selection rectangle
-            x1 = max(0, x1); y1 = max(0, y1);
-            x2 = max(x1, x2); y2 = max(y1, y2);
-            m_selection = wxRect(wxPoint(x1, y1), wxSize(x2 - x1 + 1, y2 - y1 + 1));
-            m_selecting = false;
-            if (HasCapture()) ReleaseMouse();
-            Refresh();
-        }
+static wxString FormatRoiShape(const RoiShape& s) {
+    if (s.kind == RoiShape::Ellipse) return wxString::Format("ellipse %g,%g,%g,%g", s.cx, s.cy, s.rx, s.ry);
+    if (s.kind == RoiShape::Sector) {
+        if (s.FullCircle()) return wxString::Format("annulus %g,%g,%g,%g", s.cx, s.cy, s.rInner, s.rOuter);
+        return wxString::Format("sector %g,%g,%g,%g,%g,%g", s.cx, s.cy, s.rInner, s.rOuter, s.angle0, fmod(s.angle1, 360.0));
     }
+    wxString spec = "polygon ";
+    for (size_t i = 0; i < s.vertices.size(); ++i)
+        spec += wxString::Format(i ? ",%g,%g" : "%g,%g", s.vertices[i].x, s.vertices[i].y);
+    return spec;
+}
 
-    void OnMouseMove(wxMouseEvent& event) {
-        wxPoint pos = CalcUnscrolledPosition(event.GetPosition());
+// Per-frame lookup tables for rectangle statistics: summed-area tables of the grey values and
+// their squares, and a sparse table of square min/max blocks (level k holds the extrema of the
+// 2^k x 2^k block at each pixel). Built once per frame; a rectangle then costs four lookups per
+// sum, O(1), and min/max costs up to 2 * (long side / short side + 1) overlapping squares, O(1)
+// only for rectangles of bounded aspect ratio (at most 4 squares when square). A 2D
+// table of 2^kx x 2^ky blocks would make every shape O(1) but needs log2(w) * log2(h) planes,
+// gigabytes for a detector frame. Buffers are kept across Build() calls, so tracking a stack of
+// equally sized frames allocates once.
+class FrameTables {
+public:
+    // Grey values are the red channel. Extrema add log2(min(w,h)) byte planes per statistic.
+    bool Build(const wxImage& img, bool extrema = true) {
+        if (!img.IsOk()) return false;
+        m_w = img.GetWidth();
+        m_h = img.GetHeight();
+        const size_t stride = (size_t)m_w + 1;
+        m_sum.resize(stride * (m_h + 1));
+        m_sq.resize(stride * (m_h + 1));
+        const unsigned char* rgb = img.GetData();
+
+        // Row prefix sums, then a column pass over bands of columns
+        fill(m_sum.begin(), m_sum.begin() + stride, 0);
+        fill(m_sq.begin(), m_sq.begin() + stride, 0);
+        ParallelFor(0, m_h, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                const unsigned char* src = rgb + (size_t)y * m_w * 3;
+                uint64_t* s = &m_sum[(y + 1) * stride];
+                uint64_t* q = &m_sq[(y + 1) * stride];
+                s[0] = q[0] = 0;
+                for (int x = 0; x < m_w; ++x) {
+                    const uint64_t v = src[x * 3];
+                    s[x + 1] = s[x] + v;
+                    q[x + 1] = q[x] + v * v;
+                }
+            }
+            });
+        ParallelFor(1, m_w + 1, [&](int x0, int x1) {
+            for (int y = 1; y <= m_h; ++y) {
+                uint64_t* s = &m_sum[y * stride];
+                uint64_t* q = &m_sq[y * stride];
+                const uint64_t* sp = s - stride;
+                const uint64_t* qp = q - stride;
+                for (int x = x0; x < x1; ++x) { s[x] += sp[x]; q[x] += qp[x]; }
+            }
+            });
+
+        m_levels = 0;
+        if (!extrema) { m_min.clear(); m_max.clear(); return true; }
+        const size_t plane = (size_t)m_w * m_h;
+        while ((2 << m_levels) <= min(m_w, m_h)) ++m_levels;
+        ++m_levels;
+        m_min.resize(plane * m_levels);
+        m_max.resize(plane * m_levels);
+        ParallelFor(0, m_h, [&](int y0, int y1) {
+            for (size_t i = (size_t)y0 * m_w; i < (size_t)y1 * m_w; ++i) m_min[i] = m_max[i] = rgb[i * 3];
+            });
+        for (int k = 1; k < m_levels; ++k) {
+            const int half = 1 << (k - 1), side = 1 << k;
+            const unsigned char* pmin = &m_min[plane * (k - 1)];
+            const unsigned char* pmax = &m_max[plane * (k - 1)];
+            unsigned char* cmin = &m_min[plane * k];
+            unsigned char* cmax = &m_max[plane * k];
+            ParallelFor(0, m_h - side + 1, [&](int y0, int y1) {
+                for (int y = y0; y < y1; ++y) {
+                    const size_t a = (size_t)y * m_w, b = a + (size_t)half * m_w;
+                    for (int x = 0; x + side <= m_w; ++x) {
+                        cmin[a + x] = min(min(pmin[a + x], pmin[a + x + half]), min(pmin[b + x], pmin[b + x + half]));
+                        cmax[a + x] = max(max(pmax[a + x], pmax[a + x + half]), max(pmax[b + x], pmax[b + x + half]));
+                    }
+                }
+                });
+        }
+        return true;
+    }
 
-        if (event.Dragging() && event.LeftIsDown() && m_selecting) {
-            int x1 = min(m_startPoint.x, pos.x);
-            int y1 = min(m_startPoint.y, pos.y);
-            int x2 = max(m_startPoint.x, pos.x);
-            int y2 = max(m_startPoint.y, pos.y);
-            x1 = max(0, x1); y1 = max(0, y1);
-            x2 = max(x1, x2); y2 = max(y1, y2);
-            m_selection = wxRect(wxPoint(x1, y1), wxSize(x2 - x1 + 1, y2 - y1 + 1));
-            Refresh();
+    int Width() const { return m_w; }
+    int Height() const { return m_h; }
+    bool HasExtrema() const { return m_levels > 0; }
+
+    // Sum of values and of squares over [x0, x1) x [y0, y1), which must lie inside the frame
+    uint64_t Sum(int x0, int y0, int x1, int y1) const { return Rect(m_sum, x0, y0, x1, y1); }
+    uint64_t SumSq(int x0, int y0, int x1, int y1) const { return Rect(m_sq, x0, y0, x1, y1); }
+    uint64_t Bytes() const { return (m_sum.size() + m_sq.size()) * sizeof(uint64_t) + m_min.size() + m_max.size(); }
+
+    // Rectangle clipped to the frame; an empty intersection yields pixels == 0
+    RoiStats Stats(const wxRect& roi) const {
+        RoiStats st;
+        const int x0 = max(0, roi.x), y0 = max(0, roi.y);
+        const int x1 = min(m_w, roi.x + roi.width), y1 = min(m_h, roi.y + roi.height);
+        if (x1 <= x0 || y1 <= y0) return st;
+
+        const size_t stride = (size_t)m_w + 1;
+        auto rect = [&](const vector<uint64_t>& t) {
+            return t[y1 * stride + x1] - t[y0 * stride + x1] - t[y1 * stride + x0] + t[y0 * stride + x0];
+        };
+        st.pixels = (uint64_t)(x1 - x0) * (y1 - y0);
+        const uint64_t sum = rect(m_sum), sq = rect(m_sq);
+        st.sum = (double)sum;
+        st.mean = st.sum / st.pixels;
+        st.variance = max(0.0, ((double)sq - st.sum * st.mean) / st.pixels);
+
+        if (m_levels > 0) {
+            // Cover the rectangle with the largest squares that fit; the last square of each
+            // axis is pushed back against the far edge, so squares overlap instead of overrunning.
+            // A long thin rectangle takes about its aspect ratio in squares.
+            int k = 0;
+            while (k + 1 < m_levels && (2 << k) <= min(x1 - x0, y1 - y0)) ++k;
+            const int side = 1 << k;
+            const size_t plane = (size_t)m_w * m_h * k;
+            int lo = 255, hi = 0;
+            for (int y = y0;; y = min(y + side, y1 - side)) {
+                for (int x = x0;; x = min(x + side, x1 - side)) {
+                    const size_t i = plane + (size_t)y * m_w + x;
+                    lo = min<int>(lo, m_min[i]);
+                    hi = max<int>(hi, m_max[i]);
+                    if (x + side >= x1) break;
+                }
+                if (y + side >= y1) break;
+            }
+            st.min = lo;
+            st.max = hi;
         }
+        return st;
+    }
 
-        ShowPixelInfo(pos);
+    // Statistics over a run-length mask: sums cost O(1) per run; extrema scan the run's pixels
+    RoiStats Stats(const RunMask& mask) const {
+        RoiStats st;
+        const size_t stride = (size_t)m_w + 1;
+        uint64_t sum = 0, sq = 0;
+        int lo = 255, hi = 0;
+        for (const PixelRun& r : mask.Runs()) {
+            if (r.y < 0 || r.y >= m_h) continue;
+            const int x0 = max(0, r.x0), x1 = min(m_w, r.x1);
+            if (x1 <= x0) continue;
+            const size_t top = r.y * stride, bottom = top + stride;
+            sum += m_sum[bottom + x1] - m_sum[top + x1] - m_sum[bottom + x0] + m_sum[top + x0];
+            sq += m_sq[bottom + x1] - m_sq[top + x1] - m_sq[bottom + x0] + m_sq[top + x0];
+            st.pixels += (uint64_t)(x1 - x0);
+            if (m_levels > 0) {
+                const unsigned char* row = &m_min[(size_t)r.y * m_w];
+                for (int x = x0; x < x1; ++x) { lo = min<int>(lo, row[x]); hi = max<int>(hi, row[x]); }
+            }
+        }
+        if (st.pixels == 0) return st;
+        st.sum = (double)sum;
+        st.mean = st.sum / st.pixels;
+        st.variance = max(0.0, ((double)sq - st.sum * st.mean) / st.pixels);
+        if (m_levels > 0) { st.min = lo; st.max = hi; }
+        return st;
     }
 
-    void OnMouseWheel(wxMouseEvent& event) {
-        int rot = event.GetWheelRotation();
-        if (rot > 0) ZoomIn(); else ZoomOut();
+private:
+    uint64_t Rect(const vector<uint64_t>& t, int x0, int y0, int x1, int y1) const {
+        const size_t stride = (size_t)m_w + 1;
+        return t[y1 * stride + x1] - t[y0 * stride + x1] - t[y1 * stride + x0] + t[y0 * stride + x0];
     }
 
-    void ShowPixelInfo(const wxPoint& pos) {
-        if (!m_originalImg.IsOk()) return;
-        if (pos.x < 0 || pos.y < 0 || pos.x >= m_originalImg.GetWidth() || pos.y >= m_originalImg.GetHeight()) return;
+    int m_w = 0, m_h = 0;
+    int m_levels = 0;                  // Sparse-table levels, 0 when extrema were not built
+    vector<uint64_t> m_sum, m_sq;      // (w+1) x (h+1), row-major, zero first row and column
+    vector<unsigned char> m_min, m_max;
+};
 
-        unsigned char* data = m_originalImg.GetData();
-        int idx = (pos.y * m_originalImg.GetWidth() + pos.x) * 3;
-        int r = data[idx];
-        int g = data[idx + 1];
-        int b = data[idx + 2];
+// Uniform-grid spatial index of rectangles keyed by integer id. An item is listed in every cell
+// its bounds touch, so viewport and point queries visit only the cells they overlap: with marks
+// smaller than a cell that is a handful of candidates per query however many items there are.
+class GridIndex {
+public:
+    explicit GridIndex(int cellSize = 64) : m_cell(cellSize) {}
 
-        wxFrame* frame = dynamic_cast<wxFrame*>(GetParent());
-        if (frame) {
-            frame->SetStatusText(wxString::Format("X: %d Y: %d R: %d G: %d B: %d", pos.x, pos.y, r, g, b), 0);
-        }
+    void Insert(int id, const wxRect& bounds) {
+        m_bounds[id] = bounds;
+        ForCells(bounds, [&](uint64_t key) { m_cells[key].push_back(id); });
     }
 
-    void CutSelection() {
-        CopySelection();
-        if (!m_originalImg.IsOk() || m_selection.IsEmpty()) return;
+    void Remove(int id) {
+        auto it = m_bounds.find(id);
+        if (it == m_bounds.end()) return;
+        ForCells(it->second, [&](uint64_t key) {
+            auto cell = m_cells.find(key);
+            if (cell == m_cells.end()) return;
+            auto& ids = cell->second;
+            ids.erase(remove(ids.begin(), ids.end(), id), ids.end());
+            if (ids.empty()) m_cells.erase(cell);
+            });
+        m_bounds.erase(it);
+    }
 
-        wxImage img = m_originalImg;
-        unsigned char* data = img.GetData();
-        int w = img.GetWidth(), h = img.GetHeight();
+    void Clear() { m_cells.clear(); m_bounds.clear(); }
+    size_t Size() const { return m_bounds.size(); }
+
+    // Ids whose bounds intersect `area`, ascending
+    void Query(const wxRect& area, vector<int>& out) const {
+        out.clear();
+        ForCells(area, [&](uint64_t key) {
+            auto cell = m_cells.find(key);
+            if (cell == m_cells.end()) return;
+            for (int id : cell->second) if (m_bounds.at(id).Intersects(area)) out.push_back(id);
+            });
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+    }
 
-        int x0 = clamp(m_selection.x, 0, w - 1);
-        int y0 = clamp(m_selection.y, 0, h - 1);
-        int x1 = clamp(m_selection.x + m_selection.GetWidth() - 1, 0, w - 1);
-        int y1 = clamp(m_selection.y + m_selection.GetHeight() - 1, 0, h - 1);
+    // Ids whose bounds contain `pt`, ascending; a single cell lookup
+    void QueryPoint(const wxPoint& pt, vector<int>& out) const {
+        out.clear();
+        auto cell = m_cells.find(Key(CellOf(pt.x), CellOf(pt.y)));
+        if (cell == m_cells.end()) return;
+        for (int id : cell->second) if (m_bounds.at(id).Contains(pt)) out.push_back(id);
+        sort(out.begin(), out.end());
+    }
 
-        for (int y = y0; y <= y1; ++y) {
-            for (int x = x0; x <= x1; ++x) {
-                int idx = (y * w + x) * 3;
-                data[idx] = data[idx + 1] = data[idx + 2] = 255; // white-out
-            }
-        }
-        SetImage(img);
+private:
+    int CellOf(int v) const { return v >= 0 ? v / m_cell : -((-v - 1) / m_cell) - 1; }
+    static uint64_t Key(int cx, int cy) { return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy; }
+
+    template <class Fn>
+    void ForCells(const wxRect& r, Fn&& fn) const {
+        if (r.IsEmpty()) return;
+        const int cx1 = CellOf(r.x + r.width - 1), cy1 = CellOf(r.y + r.height - 1);
+        for (int cy = CellOf(r.y); cy <= cy1; ++cy)
+            for (int cx = CellOf(r.x); cx <= cx1; ++cx) fn(Key(cx, cy));
     }
 
-    void PasteClipboard(wxPoint dest, BlendMode mode) {
-        if (!m_clipboard.IsOk() || !m_originalImg.IsOk()) return;
+    int m_cell;
+    unordered_map<uint64_t, vector<int>> m_cells;
+    unordered_map<int, wxRect> m_bounds;
+};
 
-        wxImage img = m_originalImg;
-        unsigned char* dst = img.GetData();
-        unsigned char* src = m_clipboard.GetData();
-        int w = m_clipboard.GetWidth(), h = m_clipboard.GetHeight();
+// Class to manage Regions of Interest (ROIs)
+class ROIManager {
+public:
+    void AddROI(const wxRect& roi) {                          // Add ROI
+        m_index.Insert((int)m_rois.size(), roi);
+        m_rois.push_back(roi);
+    }
+    void RemoveROI(size_t i) {                                // Later ROIs move down one index
+        if (i >= m_rois.size()) return;
+        m_rois.erase(m_rois.begin() + i);
+        m_index.Clear();
+        for (size_t k = 0; k < m_rois.size(); ++k) m_index.Insert((int)k, m_rois[k]);
+    }
+    void Clear() { m_rois.clear(); m_index.Clear(); m_shapes.clear(); m_shapeIndex.Clear(); }   // Clear all ROIs
+    const vector<wxRect>& GetROIs() const { return m_rois; }  // Get list of ROIs
+    bool IsEmpty() const { return m_rois.empty(); }
 
-        for (int y = 0; y < h; ++y) {
-            for (int x = 0; x < w; ++x) {
-                int dx = dest.x + x, dy = dest.y + y;
-                if (dx >= img.GetWidth() || dy >= img.GetHeight() || dx < 0 || dy < 0) continue;
+    // Indices of the ROIs overlapping `area` (e.g. the visible part of the image)
+    void Visible(const wxRect& area, vector<int>& out) const { m_index.Query(area, out); }
 
-                int di = (dy * img.GetWidth() + dx) * 3;
-                int si = (y * w + x) * 3;
+    // Topmost (last added) ROI containing `pt`, or -1
+    int HitTest(const wxPoint& pt) const {
+        vector<int> hits;
+        m_index.QueryPoint(pt, hits);
+        return hits.empty() ? -1 : hits.back();
+    }
 
-                for (int c = 0; c < 3; ++c) {
-                    switch (mode) {
-                    case AND: dst[di + c] &= src[si + c]; break;
-                    case OR:  dst[di + c] |= src[si + c]; break;
-                    case XOR: dst[di + c] ^= src[si + c]; break;
-                    case BLEND: dst[di + c] = (dst[di + c] + src[si + c]) / 2; break;
-                    }
-                }
-            }
+    // Non-rectangular ROIs. Each keeps its rasterized mask for the last frame size asked for;
+    // replacing the shape drops it. The cache is filled lazily under a lock, and masks are handed
+    // out shared, so readers on other threads keep theirs when it is rebuilt for another size.
+    size_t AddShape(const RoiShape& shape) {
+        lock_guard<mutex> lock(m_maskMutex);
+        m_shapes.push_back({ shape, nullptr, wxSize(-1, -1) });
+        m_shapeIndex.Insert((int)m_shapes.size() - 1, shape.Bounds());
+        return m_shapes.size() - 1;
+    }
+    void SetShape(size_t i, const RoiShape& shape) {
+        if (i >= m_shapes.size()) return;
+        lock_guard<mutex> lock(m_maskMutex);
+        m_shapes[i] = { shape, nullptr, wxSize(-1, -1) };
+        m_shapeIndex.Remove((int)i);
+        m_shapeIndex.Insert((int)i, shape.Bounds());
+    }
+    void RemoveShape(size_t i) {                              // Later shapes move down one index
+        if (i >= m_shapes.size()) return;
+        lock_guard<mutex> lock(m_maskMutex);
+        m_shapes.erase(m_shapes.begin() + i);
+        m_shapeIndex.Clear();
+        for (size_t k = 0; k < m_shapes.size(); ++k) m_shapeIndex.Insert((int)k, m_shapes[k].shape.Bounds());
+    }
+    size_t ShapeCount() const { return m_shapes.size(); }
+    const RoiShape& GetShape(size_t i) const { return m_shapes[i].shape; }
+
+    shared_ptr<const RunMask> GetMask(size_t i, int w, int h) const {
+        lock_guard<mutex> lock(m_maskMutex);
+        ShapeEntry& e = m_shapes[i];
+        if (!e.mask || e.maskSize != wxSize(w, h)) {
+            e.mask = make_shared<const RunMask>(RasterizeShape(e.shape, w, h));
+            e.maskSize = wxSize(w, h);
         }
-        SetImage(img);
+        return e.mask;
     }
-};
 
-static inline bool InBounds(int x, int y, int w, int h) {
-    return (x >= 0 && y >= 0 && x < w && y < h);
-}
+    void VisibleShapes(const wxRect& area, vector<int>& out) const { m_shapeIndex.Query(area, out); }
 
-static inline unsigned char GetGray(const wxImage& img, int x, int y) {
-    const int w = img.GetWidth();
-    const unsigned char* data = img.GetData();
-    return data[(y * w + x) * 3]; // grayscale stored in all channels
-}
+    // Topmost shape whose area contains `pt`, or -1
+    int HitTestShape(const wxPoint& pt) const {
+        vector<int> hits;
+        m_shapeIndex.QueryPoint(pt, hits);
+        for (auto it = hits.rbegin(); it != hits.rend(); ++it)
+            if (m_shapes[*it].shape.Contains(pt.x + 0.5, pt.y + 0.5)) return *it;
+        return -1;
+    }
 
-static double CircularAverageNearest(const wxImage& img, int cx, int cy, int R, int* outUniqueSamples = nullptr) {
-    if (!img.IsOk() || R <= 0) return numeric_limits<double>::quiet_NaN();
+    // Statistics of every ROI, in order, from one frame's tables
+    vector<RoiStats> ComputeStats(const FrameTables& tables) const {
+        vector<RoiStats> stats;
+        stats.reserve(m_rois.size());
+        for (const auto& roi : m_rois) stats.push_back(tables.Stats(roi));
+        return stats;
+    }
+private:
+    struct ShapeEntry {
+        RoiShape shape;
+        shared_ptr<const RunMask> mask;
+        wxSize maskSize;    // Frame size the mask was rasterized for
+    };
 
-    const int w = img.GetWidth();
-    const int h = img.GetHeight();
+    vector<wxRect> m_rois;  // Stores rectangles for ROIs
+    GridIndex m_index;      // Spatial index over m_rois
+    mutable vector<ShapeEntry> m_shapes;
+    mutable mutex m_maskMutex;      // Guards the lazily built masks in m_shapes
+    GridIndex m_shapeIndex;
+};
 
-    // If the circle is completely outside, early out (optional)
-    if (cx + R < 0 || cx - R >= w || cy + R < 0 || cy - R >= h)
-        return numeric_limits<double>::quiet_NaN();
+// Vector marks drawn over the image
+enum class AnnotationShape { Text, Rect, Ellipse, Arrow, Polygon, Marker };
 
-    const int N = max(8, (int)lround(2.0 * PI * (double)R));
+struct Annotation {
+    AnnotationShape shape;
+    vector<wxPoint> points;   // Rect/Ellipse: two corners; Arrow: tail, head; Polygon: vertices; Text/Marker: anchor
+    wxString text;
+    wxRect bounds;            // Filled in by AnnotationLayer::Add
+};
 
-    // Pack (x,y) into 64-bit key to dedupe
-    unordered_set<long long> visited;
+// Annotations under a grid index, so painting touches only the visible ones and hit-testing
+// only those near the cursor. Ids are stable; removed slots are left empty.
+class AnnotationLayer {
+public:
+    int Add(Annotation a) {
+        a.bounds = Bounds(a);
+        const int id = (int)m_items.size();
+        m_items.push_back(a);
+        m_alive.push_back(true);
+        m_index.Insert(id, a.bounds);
+        return id;
+    }
+
+    void Remove(int id) {
+        if (id < 0 || id >= (int)m_items.size() || !m_alive[id]) return;
+        m_alive[id] = false;
+        m_index.Remove(id);
+    }
+
+    // Ids are never reused, so a caller holding ids from before a Clear() cannot remove newer annotations
+    void Clear() { fill(m_alive.begin(), m_alive.end(), false); m_index.Clear(); }
+    size_t Count() const { return m_index.Size(); }
+    const Annotation& Get(int id) const { return m_items[id]; }
+
+    // Topmost annotation whose outline or area is within `tolerance` pixels of `pt`, or -1
+    int HitTest(const wxPoint& pt, int tolerance = 3) const {
+        vector<int> ids;
+        m_index.Query(wxRect(pt.x - tolerance, pt.y - tolerance, 2 * tolerance + 1, 2 * tolerance + 1), ids);
+        for (auto it = ids.rbegin(); it != ids.rend(); ++it)
+            if (Hits(m_items[*it], pt, tolerance)) return *it;
+        return -1;
+    }
+
+    void Draw(wxDC& dc, const wxRect& viewport) const {
+        vector<int> ids;
+        m_index.Query(viewport, ids);
+        dc.SetBrush(*wxTRANSPARENT_BRUSH);
+        dc.SetPen(*wxCYAN_PEN);
+        for (int id : ids) {
+            const Annotation& a = m_items[id];
+            const vector<wxPoint>& p = a.points;
+            switch (a.shape) {
+            case AnnotationShape::Text: dc.DrawText(a.text, p[0]); break;
+            case AnnotationShape::Rect: dc.DrawRectangle(wxRect(p[0], p[1])); break;
+            case AnnotationShape::Ellipse: dc.DrawEllipse(wxRect(p[0], p[1])); break;
+            case AnnotationShape::Arrow: {
+                dc.DrawLine(p[0], p[1]);
+                const double ang = atan2((double)(p[0].y - p[1].y), (double)(p[0].x - p[1].x));
+                for (double side : { -0.4, 0.4 })
+                    dc.DrawLine(p[1], wxPoint(p[1].x + (int)lround(ARROW_HEAD * cos(ang + side)), p[1].y + (int)lround(ARROW_HEAD * sin(ang + side))));
+                break;
+            }
+            case AnnotationShape::Polygon: dc.DrawPolygon((int)p.size(), p.data()); break;
+            case AnnotationShape::Marker:
+                dc.DrawLine(p[0].x - MARKER_RADIUS, p[0].y, p[0].x + MARKER_RADIUS + 1, p[0].y);
+                dc.DrawLine(p[0].x, p[0].y - MARKER_RADIUS, p[0].x, p[0].y + MARKER_RADIUS + 1);
+                break;
+            }
+        }
+    }
+
+private:
+    static const int ARROW_HEAD = 10;
+    static const int MARKER_RADIUS = 4;
+
+    static wxRect Bounds(const Annotation& a) {
+        const wxPoint& p0 = a.points[0];
+        if (a.shape == AnnotationShape::Text)   // No DC here; an estimate of the default font is enough to index
+            return wxRect(p0.x, p0.y, max(1, 7 * (int)a.text.length()), 14);
+        if (a.shape == AnnotationShape::Marker)
+            return wxRect(p0.x - MARKER_RADIUS, p0.y - MARKER_RADIUS, 2 * MARKER_RADIUS + 1, 2 * MARKER_RADIUS + 1);
+        int x0 = p0.x, y0 = p0.y, x1 = p0.x, y1 = p0.y;
+        for (const auto& p : a.points) { x0 = min(x0, p.x); y0 = min(y0, p.y); x1 = max(x1, p.x); y1 = max(y1, p.y); }
+        wxRect r(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+        if (a.shape == AnnotationShape::Arrow) r.Inflate(ARROW_HEAD);
+        return r;
+    }
+
+    static double SegmentDistance(const wxPoint& p, const wxPoint& a, const wxPoint& b) {
+        const double dx = b.x - a.x, dy = b.y - a.y, len2 = dx * dx + dy * dy;
+        const double t = len2 > 0 ? clamp(((p.x - a.x) * dx + (p.y - a.y) * dy) / len2, 0.0, 1.0) : 0.0;
+        return hypot(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+    }
+
+    static bool Hits(const Annotation& a, const wxPoint& pt, int tol) {
+        const vector<wxPoint>& p = a.points;
+        switch (a.shape) {
+        case AnnotationShape::Arrow:
+            return SegmentDistance(pt, p[0], p[1]) <= tol;
+        case AnnotationShape::Ellipse: {
+            const wxRect r(p[0], p[1]);
+            const double rx = r.width / 2.0 + tol, ry = r.height / 2.0 + tol;
+            const double nx = (pt.x - (r.x + (r.width - 1) / 2.0)) / rx, ny = (pt.y - (r.y + (r.height - 1) / 2.0)) / ry;
+            return nx * nx + ny * ny <= 1.0;
+        }
+        case AnnotationShape::Polygon: {
+            bool inside = false;
+            for (size_t i = 0, j = p.size() - 1; i < p.size(); j = i++) {
+                if (SegmentDistance(pt, p[i], p[j]) <= tol) return true;
+                if ((p[i].y > pt.y) != (p[j].y > pt.y) &&
+                    pt.x < p[j].x + (double)(p[i].x - p[j].x) * (pt.y - p[j].y) / (p[i].y - p[j].y)) inside = !inside;
+            }
+            return inside;
+        }
+        default: {
+            wxRect r = a.bounds;
+            return r.Inflate(tol).Contains(pt);
+        }
+        }
+    }
+
+    vector<Annotation> m_items;
+    vector<bool> m_alive;
+    GridIndex m_index;
+};
+
+// Frame to display textual results
+enum class LogLevel { Info, Warning, Error };
+
+static const char* LogLevelName(LogLevel level) {
+    static const char* names[] = { "info", "warning", "error" };
+    return names[(int)level];
+}
+
+// One line of the results log
+struct ResultRecord {
+    wxDateTime time;
+    wxString source;
+    LogLevel level;
+    wxString message;
+    double value;   // Numeric payload, NaN when the line has none
+};
+
+// Bounded log written from any thread and read by one viewer. Producers only append to a
+// pending batch under a short lock; the viewer moves whole batches into the ring, so a producer
+// never waits on the UI. Once full, the ring overwrites its oldest records. Records are addressed
+// by sequence number; [FirstSeq(), EndSeq()) are retained.
+class ResultLog {
+public:
+    explicit ResultLog(size_t capacity) : m_ring(capacity) {}
+
+    void Add(ResultRecord rec) {
+        lock_guard<mutex> lock(m_pendingMutex);
+        m_pending.push_back(move(rec));
+    }
+
+    // Move pending records into the ring; returns how many arrived. Viewer thread only.
+    size_t Drain() {
+        vector<ResultRecord> batch;
+        {
+            lock_guard<mutex> lock(m_pendingMutex);
+            batch.swap(m_pending);
+        }
+        for (auto& rec : batch) {
+            ResultRecord& slot = m_ring[m_end % m_ring.size()];
+            if (m_end >= m_ring.size()) m_textBytes -= RecordBytes(slot);
+            slot = move(rec);
+            m_textBytes += RecordBytes(slot);
+            ++m_end;
+        }
+        return batch.size();
+    }
+
+    void Clear() { m_first = m_end; }
+
+    uint64_t FirstSeq() const { return max(m_first, m_end > m_ring.size() ? m_end - m_ring.size() : 0); }
+    uint64_t EndSeq() const { return m_end; }
+    const ResultRecord& At(uint64_t seq) const { return m_ring[seq % m_ring.size()]; }
+
+    // Approximate footprint of the retained records
+    uint64_t Bytes() const { return m_ring.size() * sizeof(ResultRecord) + m_textBytes; }
+
+private:
+    static uint64_t RecordBytes(const ResultRecord& r) { return (r.message.length() + r.source.length()) * sizeof(wxChar); }
+
+    mutex m_pendingMutex;
+    vector<ResultRecord> m_pending;
+    vector<ResultRecord> m_ring;
+    uint64_t m_end = 0;      // Sequence number of the next record
+    uint64_t m_first = 0;    // Records before this were cleared
+    uint64_t m_textBytes = 0;
+};
+
+// Report-mode list that asks its owner for cell text, so only visible rows are formatted
+class VirtualListCtrl : public wxListCtrl {
+public:
+    VirtualListCtrl(wxWindow* parent, function<wxString(long, long)> text)
+        : wxListCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_VIRTUAL), m_text(move(text)) {}
+
+protected:
+    wxString OnGetItemText(long item, long column) const override { return m_text(item, column); }
+
+private:
+    function<wxString(long, long)> m_text;
+};
+
+// Results log window. AddResult may be called from any thread; the list catches up ten times
+// a second, however many lines arrived in between.
+class ResultsFrame : public wxFrame {
+public:
+    static const size_t CAPACITY = 100000;   // Records kept before the oldest are dropped
+
+    ResultsFrame(wxWindow* parent)
+        : wxFrame(parent, wxID_ANY, "Results", wxDefaultPosition, wxSize(640, 360)), m_log(CAPACITY), m_timer(this) {
+        m_list = new VirtualListCtrl(this, [this](long item, long column) { return CellText(item, column); });
+        const char* columns[] = { "Time", "Source", "Level", "Message", "Value" };
+        const int widths[] = { 95, 80, 60, 320, 80 };
+        for (int c = 0; c < 5; ++c) m_list->InsertColumn(c, columns[c], c == 4 ? wxLIST_FORMAT_RIGHT : wxLIST_FORMAT_LEFT, widths[c]);
+
+        wxBoxSizer* barBox = new wxBoxSizer(wxHORIZONTAL);
+        m_filterText = new wxTextCtrl(this, wxID_ANY, "", wxDefaultPosition, wxSize(180, -1));
+        m_levelChoice = new wxChoice(this, wxID_ANY);
+        m_levelChoice->Append("All levels");
+        m_levelChoice->Append("Warnings and errors");
+        m_levelChoice->Append("Errors");
+        m_levelChoice->SetSelection(0);
+        wxButton* copyBtn = new wxButton(this, wxID_ANY, "Copy");
+        wxButton* clearBtn = new wxButton(this, wxID_ANY, "Clear");
+        barBox->Add(new wxStaticText(this, wxID_ANY, "Filter:"), 0, wxALIGN_CENTER_VERTICAL | wxALL, 5);
+        barBox->Add(m_filterText, 1, wxALL, 5);
+        barBox->Add(m_levelChoice, 0, wxALL, 5);
+        barBox->Add(copyBtn, 0, wxALL, 5);
+        barBox->Add(clearBtn, 0, wxALL, 5);
+
+        // Layout manager
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        sizer->Add(barBox, 0, wxEXPAND);
+        sizer->Add(m_list, 1, wxEXPAND | wxALL, 5);
+        SetSizer(sizer);
+
+        m_filterText->Bind(wxEVT_TEXT, [this](wxCommandEvent&) { RebuildView(); });
+        m_levelChoice->Bind(wxEVT_CHOICE, [this](wxCommandEvent&) { RebuildView(); });
+        copyBtn->Bind(wxEVT_BUTTON, &ResultsFrame::OnCopy, this);
+        clearBtn->Bind(wxEVT_BUTTON, [this](wxCommandEvent&) { m_log.Clear(); RebuildView(); });
+        Bind(wxEVT_TIMER, [this](wxTimerEvent&) { OnRefresh(); });
+        m_timer.Start(100);
+    }
+
+    // Thread-safe
+    void AddResult(const wxString& message, const wxString& source = wxString(), LogLevel level = LogLevel::Info,
+        double value = numeric_limits<double>::quiet_NaN()) {
+        m_log.Add({ wxDateTime::UNow(), source, level, message, value });
+    }
+
+private:
+    VirtualListCtrl* m_list{ nullptr };
+    wxTextCtrl* m_filterText{ nullptr };
+    wxChoice* m_levelChoice{ nullptr };
+    ResultLog m_log;
+    deque<uint64_t> m_view;       // Sequence numbers of the records shown, oldest first
+    uint64_t m_viewEnd = 0;       // Records before this have been considered for the view
+    wxTimer m_timer;              // Coalesces UI updates
+    MemCharge m_mem{ MemTag::Log };
+
+    bool Matches(const ResultRecord& r) const {
+        if ((int)r.level < m_levelChoice->GetSelection()) return false;
+        const wxString filter = m_filterText->GetValue().Lower();
+        return filter.IsEmpty() || r.message.Lower().Contains(filter) || r.source.Lower().Contains(filter);
+    }
+
+    wxString CellText(long item, long column) const {
+        if (item < 0 || (size_t)item >= m_view.size()) return wxString();
+        const ResultRecord& r = m_log.At(m_view[item]);
+        switch (column) {
+        case 0: return r.time.Format("%H:%M:%S.%l");
+        case 1: return r.source;
+        case 2: return LogLevelName(r.level);
+        case 3: return r.message;
+        default: return isfinite(r.value) ? wxString::Format("%g", r.value) : wxString();
+        }
+    }
+
+    void OnRefresh() {
+        if (m_log.Drain() == 0) return;
+        const long before = (long)m_view.size();
+        const bool following = before == 0 || m_list->GetTopItem() + m_list->GetCountPerPage() >= before;
+
+        for (uint64_t seq = max(m_viewEnd, m_log.FirstSeq()); seq < m_log.EndSeq(); ++seq)
+            if (Matches(m_log.At(seq))) m_view.push_back(seq);
+        m_viewEnd = m_log.EndSeq();
+        while (!m_view.empty() && m_view.front() < m_log.FirstSeq()) m_view.pop_front();
+
+        ShowView();
+        if (following && !m_view.empty()) m_list->EnsureVisible((long)m_view.size() - 1);
+    }
+
+    void RebuildView() {
+        m_log.Drain();
+        m_view.clear();
+        for (uint64_t seq = m_log.FirstSeq(); seq < m_log.EndSeq(); ++seq)
+            if (Matches(m_log.At(seq))) m_view.push_back(seq);
+        m_viewEnd = m_log.EndSeq();
+        ShowView();
+    }
+
+    void ShowView() {
+        m_list->SetItemCount((long)m_view.size());
+        if (!m_view.empty()) m_list->RefreshItems(m_list->GetTopItem(), min<long>((long)m_view.size() - 1, m_list->GetTopItem() + m_list->GetCountPerPage()));
+        m_mem.Set(m_log.Bytes() + m_view.size() * sizeof(uint64_t));
+    }
+
+    // Selected rows (or every shown row) as tab-separated text
+    void OnCopy(wxCommandEvent&) {
+        wxString text;
+        auto appendRow = [&](long item) {
+            for (int c = 0; c < 5; ++c) text += CellText(item, c) + (c < 4 ? "\t" : "\n");
+        };
+        long item = m_list->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+        if (item == -1) for (long i = 0; i < (long)m_view.size(); ++i) appendRow(i);
+        for (; item != -1; item = m_list->GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED)) appendRow(item);
+
+        if (wxTheClipboard->Open()) {
+            wxTheClipboard->SetData(new wxTextDataObject(text));
+            wxTheClipboard->Close();
+        }
+    }
+};
+
+// Live view of the latency histograms (p50/p95/p99 per operation)
+class DiagnosticsFrame : public wxFrame {
+public:
+    DiagnosticsFrame(wxWindow* parent)
+        : wxFrame(parent, wxID_ANY, "Diagnostics", wxDefaultPosition, wxSize(880, 320)), m_timer(this) {
+        m_list = new wxListCtrl(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_SINGLE_SEL);
+        const char* columns[] = { "Operation", "Count", "Mean (ms)", "p50 (ms)", "p95 (ms)", "p99 (ms)", "Max (ms)",
+                                  "IPC", "Cache miss/px", "Branch miss/px" };
+        for (int c = 0; c < 10; ++c)
+            m_list->InsertColumn(c, columns[c], c == 0 ? wxLIST_FORMAT_LEFT : wxLIST_FORMAT_RIGHT, c == 0 ? 100 : 75);
+        for (int op = 0; op < (int)PerfOp::Count; ++op)
+            m_list->InsertItem(op, PerfOpName((PerfOp)op));
+
+        wxBoxSizer* btnBox = new wxBoxSizer(wxHORIZONTAL);
+        wxButton* resetBtn = new wxButton(this, wxID_ANY, "Reset");
+        wxButton* dumpBtn = new wxButton(this, wxID_ANY, "Save...");
+        m_countersCheck = new wxCheckBox(this, wxID_ANY, "Hardware counters");
+        m_countersCheck->SetValue(HardwareCounters::StageSamplingEnabled());
+        btnBox->Add(resetBtn, 0, wxALL, 5);
+        btnBox->Add(dumpBtn, 0, wxALL, 5);
+        btnBox->Add(m_countersCheck, 0, wxALIGN_CENTER_VERTICAL | wxALL, 5);
+
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        sizer->Add(m_list, 1, wxEXPAND | wxALL, 5);
+        sizer->Add(btnBox, 0, wxALIGN_LEFT);
+        SetSizer(sizer);
+
+        resetBtn->Bind(wxEVT_BUTTON, [this](wxCommandEvent&) { PerfStats::Reset(); RefreshStats(); });
+        dumpBtn->Bind(wxEVT_BUTTON, &DiagnosticsFrame::OnDump, this);
+        m_countersCheck->Bind(wxEVT_CHECKBOX, &DiagnosticsFrame::OnToggleCounters, this);
+        Bind(wxEVT_TIMER, [this](wxTimerEvent&) { RefreshStats(); });
+
+        RefreshStats();
+        m_timer.Start(1000);
+    }
+
+private:
+    wxListCtrl* m_list{ nullptr };
+    wxCheckBox* m_countersCheck{ nullptr };
+    wxTimer m_timer;   // Refreshes the table once per second
+
+    void OnToggleCounters(wxCommandEvent&) {
+        const bool on = m_countersCheck->GetValue();
+        if (on && !HardwareCounters::ForThisThread().IsOpen()) {
+            wxMessageBox("Hardware counters unavailable: " + HardwareCounters::ForThisThread().GetError(), "Diagnostics", wxICON_WARNING);
+            m_countersCheck->SetValue(false);
+            return;
+        }
+        HardwareCounters::EnableStageSampling(on);
+    }
+
+    void RefreshStats() {
+        for (int op = 0; op < (int)PerfOp::Count; ++op) {
+            const LatencySummary st = PerfStats::Summarize((PerfOp)op);
+            m_list->SetItem(op, 1, wxString::Format("%llu", (unsigned long long)st.count));
+            const double values[] = { st.meanUs, st.p50Us, st.p95Us, st.p99Us, st.maxUs };
+            for (int c = 0; c < 5; ++c)
+                m_list->SetItem(op, c + 2, st.count ? wxString::Format("%.3f", values[c] / 1000.0) : wxString("-"));
+
+            const PerfStats::CounterTotals ct = PerfStats::GetCounters((PerfOp)op);
+            m_list->SetItem(op, 7, ct.calls ? wxString::Format("%.2f", ct.counters.Ipc()) : wxString("-"));
+            m_list->SetItem(op, 8, ct.pixels ? wxString::Format("%.4f", (double)ct.counters.cacheMisses / ct.pixels) : wxString("-"));
+            m_list->SetItem(op, 9, ct.pixels ? wxString::Format("%.4f", (double)ct.counters.branchMisses / ct.pixels) : wxString("-"));
+        }
+    }
+
+    void OnDump(wxCommandEvent&) {
+        wxFileDialog dlg(this, "Save latency summary", "", "latency.csv", "CSV files (*.csv)|*.csv", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (dlg.ShowModal() != wxID_OK) return;
+        if (!PerfStats::Dump(dlg.GetPath()))
+            wxMessageBox("Could not write latency summary.", "Diagnostics", wxICON_ERROR);
+    }
+};
+
+// Live memory ledger: per subsystem and per window, with peaks and the global budget
+class MemoryFrame : public wxFrame {
+public:
+    MemoryFrame(wxWindow* parent)
+        : wxFrame(parent, wxID_ANY, "Memory", wxDefaultPosition, wxSize(560, 520)), m_timer(this) {
+        m_tagList = new wxListCtrl(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_SINGLE_SEL);
+        m_tagList->InsertColumn(0, "Subsystem", wxLIST_FORMAT_LEFT, 160);
+        m_tagList->InsertColumn(1, "Current", wxLIST_FORMAT_RIGHT, 110);
+        m_tagList->InsertColumn(2, "Peak", wxLIST_FORMAT_RIGHT, 110);
+        for (int t = 0; t < (int)MemTag::Count; ++t) m_tagList->InsertItem(t, MemTagName((MemTag)t));
+        m_tagList->InsertItem((int)MemTag::Count, "total tracked");
+        m_tagList->InsertItem((int)MemTag::Count + 1, "process resident");
+
+        m_ownerList = new wxListCtrl(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_SINGLE_SEL);
+        m_ownerList->InsertColumn(0, "Window", wxLIST_FORMAT_LEFT, 220);
+        m_ownerList->InsertColumn(1, "Current", wxLIST_FORMAT_RIGHT, 110);
+        m_ownerList->InsertColumn(2, "Peak", wxLIST_FORMAT_RIGHT, 110);
+
+        wxBoxSizer* budgetBox = new wxBoxSizer(wxHORIZONTAL);
+        const uint64_t budget = MemoryAccounting::GetBudget();
+        m_budgetCtrl = new wxTextCtrl(this, wxID_ANY, wxString::Format("%llu", (unsigned long long)(budget >> 20)));
+        wxButton* applyBtn = new wxButton(this, wxID_ANY, "Apply");
+        budgetBox->Add(new wxStaticText(this, wxID_ANY, "Budget (MB, 0 = none):"), 0, wxALIGN_CENTER_VERTICAL | wxALL, 5);
+        budgetBox->Add(m_budgetCtrl, 0, wxALL, 5);
+        budgetBox->Add(applyBtn, 0, wxALL, 5);
+
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        sizer->Add(m_tagList, 1, wxEXPAND | wxALL, 5);
+        sizer->Add(m_ownerList, 1, wxEXPAND | wxALL, 5);
+        sizer->Add(budgetBox, 0, wxALIGN_LEFT);
+        SetSizer(sizer);
+
+        applyBtn->Bind(wxEVT_BUTTON, &MemoryFrame::OnApplyBudget, this);
+        Bind(wxEVT_TIMER, [this](wxTimerEvent&) { RefreshUsage(); });
+
+        RefreshUsage();
+        m_timer.Start(1000);
+    }
+
+private:
+    wxListCtrl* m_tagList{ nullptr };
+    wxListCtrl* m_ownerList{ nullptr };
+    wxTextCtrl* m_budgetCtrl{ nullptr };
+    wxTimer m_timer;   // Refreshes once per second
+
+    static wxString FormatBytes(uint64_t bytes) {
+        return wxString::Format("%.1f MB", (double)bytes / (1024.0 * 1024.0));
+    }
+
+    void RefreshUsage() {
+        for (int t = 0; t < (int)MemTag::Count; ++t) {
+            const MemoryAccounting::Usage u = MemoryAccounting::Tag((MemTag)t);
+            m_tagList->SetItem(t, 1, FormatBytes(u.current));
+            m_tagList->SetItem(t, 2, FormatBytes(u.peak));
+        }
+        const MemoryAccounting::Usage total = MemoryAccounting::Total();
+        m_tagList->SetItem((int)MemTag::Count, 1, FormatBytes(total.current));
+        m_tagList->SetItem((int)MemTag::Count, 2, FormatBytes(total.peak));
+        const uint64_t rss = MemoryAccounting::ProcessResidentBytes();
+        m_tagList->SetItem((int)MemTag::Count + 1, 1, rss ? FormatBytes(rss) : wxString("n/a"));
+
+        // Largest window first: the one to close when the machine starts swapping
+        const vector<MemoryAccounting::OwnerUsage> owners = MemoryAccounting::Owners();
+        m_ownerList->DeleteAllItems();
+        for (size_t i = 0; i < owners.size(); ++i) {
+            long idx = m_ownerList->InsertItem((long)i, owners[i].label);
+            m_ownerList->SetItem(idx, 1, FormatBytes(owners[i].total));
+            m_ownerList->SetItem(idx, 2, FormatBytes(owners[i].peak));
+        }
+    }
+
+    void OnApplyBudget(wxCommandEvent&) {
+        unsigned long mb = 0;
+        if (!m_budgetCtrl->GetValue().ToULong(&mb)) {
+            wxMessageBox("Enter the budget as a whole number of megabytes.", "Memory", wxICON_WARNING);
+            return;
+        }
+        MemoryAccounting::SetBudget((uint64_t)mb << 20);
+        RefreshUsage();
+    }
+};
+
+// Class to load image plugins dynamically
+class PluginLoader {
+public:
+    static bool LoadPlugin(const wxString& path, wxImage& img) {
+        if (path.IsEmpty()) return false;
+
+        wxDynamicLibrary* lib = new wxDynamicLibrary(path); // Load library
+        if (!lib->IsLoaded()) {
+            delete lib;
+            return false;
+        }
+
+        typedef void (*ApplyFilterFn)(wxImage&); // Function type for plugin
+        ApplyFilterFn func = reinterpret_cast<ApplyFilterFn>(lib->GetSymbol("ApplyFilter"));
+        if (!func) {
+            wxMessageBox("ApplyFilter() not found in plugin!", "Plugin Error", wxICON_ERROR);
+            lib->Unload();
+            delete lib;
+            return false;
+        }
+
+        try
+        {
+            PerfScope timer(PerfOp::Plugin);
+            func(img);
+        }
+        catch (...)
+        {
+            wxMessageBox("Plugin crashed while applying filter.", "Plugin Error", wxICON_ERROR);
+            lib->Unload();
+            delete lib;
+            return false;
+        }
+
+        m_libs.push_back(lib);
+        return true;
+    }
+private:
+    static vector<wxDynamicLibrary*> m_libs; // Track loaded plugins
+};
+
+vector<wxDynamicLibrary*> PluginLoader::m_libs;
+
+// 256-bin luminance histogram of an RGB image
+static vector<int> ComputeLuminanceHistogram(const wxImage& img) {
+    vector<int> hist(256, 0);
+    unsigned char* data = img.GetData();
+    int w = img.GetWidth(), h = img.GetHeight();
+
+    for (int i = 0; i < w * h; ++i) {
+        int r = data[i * 3 + 0];
+        int g = data[i * 3 + 1];
+        int b = data[i * 3 + 2];
+        int lum = (int)round(0.299 * r + 0.587 * g + 0.114 * b); // Luminosity formula
+        lum = clamp(lum, 0, 255);
+        ++hist[lum];
+    }
+    return hist;
+}
+
+// Frame to display histogram of an image
+class HistogramFrame : public wxFrame {
+public:
+    HistogramFrame(wxWindow* parent, const wxImage& img, int memOwner = 0)
+        : wxFrame(parent, wxID_ANY, "Histogram", wxDefaultPosition, wxSize(420, 200)), m_mem(MemTag::Histogram, memOwner) {
+        if (!img.IsOk()) {
+            new wxStaticText(this, wxID_ANY, "No image", wxDefaultPosition);
+            return;
+        }
+
+        // Compute luminance histogram (grayscale)
+        vector<int> hist;
+        {
+            PerfScope timer(PerfOp::Histogram);
+            timer.SetPixels((uint64_t)img.GetWidth() * img.GetHeight());
+            hist = ComputeLuminanceHistogram(img);
+        }
+
+        int maxVal = *max_element(hist.begin(), hist.end()); // For normalization
+        wxBitmap bmp(256, 100);
+        wxMemoryDC dc(bmp);
+        dc.SetBackground(*wxWHITE_BRUSH);
+        dc.Clear();
+
+        // Draw histogram bars
+        for (int x = 0; x < 256; ++x) {
+            int barHeight = (maxVal > 0) ? (int)((double)hist[x] * 100.0 / maxVal) : 0;
+            dc.DrawRectangle(x, 100 - barHeight, 1, barHeight);
+        }
+        dc.SelectObject(wxNullBitmap);
+        m_mem.Set(BitmapBytes(bmp) + hist.size() * sizeof(int));
+
+        wxStaticBitmap* sb = new wxStaticBitmap(this, wxID_ANY, bmp);
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        sizer->Add(sb, 1, wxEXPAND | wxALL, 10);
+        SetSizer(sizer);
+    }
+
+private:
+    MemCharge m_mem;
+};
+
+// Frame to view a stack of images (slices)
+class StackViewer : public wxFrame {
+public:
+    StackViewer(wxWindow* parent, const vector<wxImage>& slices)
+        : wxFrame(parent, wxID_ANY, "Stack Viewer", wxDefaultPosition, wxSize(800, 600)),
+        m_slices(slices), m_index(0),
+        m_memOwner(MemoryAccounting::RegisterOwner(wxString::Format("Stack Viewer (%d slices)", (int)slices.size()))),
+        m_memSlices(MemTag::Stack, m_memOwner) {
+        wxBoxSizer* vbox = new wxBoxSizer(wxVERTICAL);
+
+        uint64_t bytes = 0;
+        for (const auto& slice : m_slices) bytes += ImageBytes(slice);
+        m_memSlices.Set(bytes);
+        MemoryAccounting::EnforceBudget();
+
+        if (m_slices.empty()) {
+            vbox->Add(new wxStaticText(this, wxID_ANY, "No slices to display"), 1, wxALL | wxALIGN_CENTER, 10);
+            SetSizer(vbox);
+            return;
+        }
+
+        // Display first slice
+        m_bitmap = new wxStaticBitmap(this, wxID_ANY, wxBitmap(m_slices[0]));
+        m_slider = new wxSlider(this, wxID_ANY, 0, 0, (int)m_slices.size() - 1);
+
+        wxBoxSizer* bottom = new wxBoxSizer(wxHORIZONTAL);
+        m_label = new wxStaticText(this, wxID_ANY, GetSliceLabel());
+
+        vbox->Add(m_bitmap, 1, wxEXPAND);
+        vbox->Add(m_slider, 0, wxEXPAND | wxALL, 5);
+        bottom->Add(m_label, 0, wxALIGN_CENTER_VERTICAL | wxLEFT, 10);
+        vbox->Add(bottom, 0, wxEXPAND);
+        SetSizer(vbox);
+
+        // Bind slider to slice change
+        m_slider->Bind(wxEVT_SLIDER, &StackViewer::OnSlide, this);
+    }
+
+    ~StackViewer() override { MemoryAccounting::UnregisterOwner(m_memOwner); }
+
+private:
+    vector<wxImage> m_slices;        // Image stack
+    int m_index = 0;                  // Current slice index
+    int m_memOwner;
+    MemCharge m_memSlices;
+    wxStaticBitmap* m_bitmap{ nullptr };
+    wxSlider* m_slider{ nullptr };
+    wxStaticText* m_label{ nullptr };
+
+    // Update displayed slice when slider moves
+    void OnSlide(wxCommandEvent& /*evt*/) {
+        if (m_slices.empty() || !m_bitmap) return;
+        m_index = m_slider->GetValue();
+        if (m_index >= 0 && m_index < (int)m_slices.size()) {
+            m_bitmap->SetBitmap(wxBitmap(m_slices[m_index]));
+            if (m_label) m_label->SetLabel(GetSliceLabel());
+        }
+    }
+
+    wxString GetSliceLabel() const { return wxString::Format("Slice %d / %d", m_index + 1, (int)m_slices.size()); }
+};
+
+// Scrollable panel to display and interact with a single image
+class ImagePanel : public wxScrolledWindow
+{
+public:
+    ImagePanel(wxWindow* parent)
+        : wxScrolledWindow(parent, wxID_ANY) {
+        SetBackgroundStyle(wxBG_STYLE_PAINT);
+        SetBackgroundColour(*wxWHITE);
+        SetScrollRate(10, 10);
+
+        // Bind events
+        Bind(wxEVT_PAINT, &ImagePanel::OnPaint, this);
+        Bind(wxEVT_MENU, &ImagePanel::OnCopy, this, wxID_COPY);
+        Bind(wxEVT_MENU, &ImagePanel::OnPaste, this, wxID_PASTE);
+        Bind(wxEVT_MENU, &ImagePanel::OnSave, this, wxID_SAVE);
+        Bind(wxEVT_MENU, &ImagePanel::OnUndo, this, wxID_UNDO);
+        Bind(wxEVT_CONTEXT_MENU, &ImagePanel::OnContextMenu, this);
+        Bind(wxEVT_LEFT_DOWN, &ImagePanel::OnLeftDown, this);
+        Bind(wxEVT_MOTION, &ImagePanel::OnMouseMove, this);
+        Bind(wxEVT_MOUSEWHEEL, &ImagePanel::OnMouseWheel, this);
+        Bind(wxEVT_LEFT_UP, &ImagePanel::OnLeftUp, this);
+        Bind(wxEVT_LEFT_DCLICK, &ImagePanel::OnLeftDClick, this);
+        Bind(wxEVT_CHAR_HOOK, &ImagePanel::OnKeyDown, this);
+
+        // Context-menu drawing modes and overlay toggles
+        for (int mode = NONE; mode <= POLYGON; ++mode) {
+            m_drawModeIds[mode] = wxWindow::NewControlId();
+            Bind(wxEVT_MENU, [this, mode](wxCommandEvent&) { m_drawMode = (DrawMode)mode; m_polygon.clear(); Refresh(); }, m_drawModeIds[mode]);
+        }
+        m_showROIsId = wxWindow::NewControlId();
+        m_clearAnnotationsId = wxWindow::NewControlId();
+        Bind(wxEVT_MENU, [this](wxCommandEvent&) { ToggleROIs(); }, m_showROIsId);
+        Bind(wxEVT_MENU, [this](wxCommandEvent&) { m_annotations.Clear(); m_polygon.clear(); Refresh(); }, m_clearAnnotationsId);
+
+        // Undo history is released under memory pressure, after caches
+        m_evictorId = MemoryAccounting::RegisterEvictor(10, [this](uint64_t wanted) { return EvictHistory(wanted); });
+    }
+
+    ~ImagePanel() override { MemoryAccounting::UnregisterEvictor(m_evictorId); }
+
+    // Attribute this panel's images to a window in the memory ledger
+    void SetMemoryOwner(int owner) {
+        m_memImage.SetOwner(owner);
+        m_memDisplay.SetOwner(owner);
+        m_memHistory.SetOwner(owner);
+        m_memClipboard.SetOwner(owner);
+    }
+
+    // Copy selection to internal clipboard
+    void OnCopy(wxCommandEvent&) { CopySelection(); }
+    void OnPaste(wxCommandEvent&) { PasteClipboard(wxPoint(10, 10), BLEND); }
+    void OnUndo(wxCommandEvent&) { Undo(); }
+
+    // Save current image to disk
+    void OnSave(wxCommandEvent&) {
+        wxFileDialog dlg(this, "Save Image", "", "", "PNG files (*.png)|*.png", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (dlg.ShowModal() == wxID_OK) {
+            PerfScope timer(PerfOp::Export);
+            if (!m_originalImg.SaveFile(dlg.GetPath(), wxBITMAP_TYPE_PNG))
+                wxMessageBox("Failed to save image", "Save", wxICON_ERROR);
+        }
+    }
+
+    // Set new image and manage undo history
+    void SetImage(const wxImage& img) {
+        if (m_originalImg.IsOk()) {
+            m_history.push_back(m_originalImg);
+            if (m_history.size() > MAX_HISTORY) m_history.erase(m_history.begin());
+        }
+        m_originalImg = img;
+        m_pixelMask.Clear();
+        ZoomFit();
+        UpdateMemoryAccounting();
+        MemoryAccounting::EnforceBudget();
+    }
+
+    // Replace the image without an undo step, keeping zoom, overlays and the pixel mask (live views)
+    void ShowLiveImage(const wxImage& img) {
+        m_originalImg = img;
+        ApplyZoom();
+        UpdateMemoryAccounting();
+    }
+
+    ROIManager m_roiManager;              // ROI manager
+    wxImage GetOriginalImage() const { return m_originalImg; }
+    wxRect GetSelectionRect() const { return m_selection; }
+    double GetZoomFactor() const { return m_zoomFactor; }
+
+    // The selection in image pixels, clipped to the image; empty when nothing is selected
+    wxRect GetImageSelection() const {
+        if (m_selection.IsEmpty() || !m_originalImg.IsOk()) return wxRect();
+        return ToImage(m_selection).Intersect(wxRect(0, 0, m_originalImg.GetWidth(), m_originalImg.GetHeight()));
+    }
+
+    void ClearSelection() { m_selection = wxRect(); Refresh(); }
+
+    // Turn the current selection into an ROI and show the ROI overlay
+    bool AddSelectionAsROI() {
+        const wxRect roi = GetImageSelection();
+        if (roi.IsEmpty()) return false;
+        m_roiManager.AddROI(roi);
+        m_showROIs = true;
+        ClearSelection();
+        return true;
+    }
+    void ClearROIs() { m_roiManager.Clear(); Refresh(); }
+
+    int AddAnnotation(const Annotation& a) { const int id = m_annotations.Add(a); Refresh(); return id; }
+    void RemoveAnnotation(int id) { m_annotations.Remove(id); Refresh(); }
+    void AddROI(const wxRect& roi) { m_roiManager.AddROI(roi); m_showROIs = true; Refresh(); }
+
+    // Non-rectangular ROIs; replacing one invalidates its cached mask
+    size_t AddShapeROI(const RoiShape& shape) { const size_t i = m_roiManager.AddShape(shape); m_showROIs = true; Refresh(); return i; }
+    void SetShapeROI(size_t i, const RoiShape& shape) { m_roiManager.SetShape(i, shape); Refresh(); }
+
+    // Delete the annotation under the mouse, or else the ROI under it
+    void RemoveAtCursor() {
+        const int mark = m_annotations.HitTest(m_hoverPoint);
+        const int roi = m_showROIs ? m_roiManager.HitTest(m_hoverPoint) : -1;
+        const int shape = m_showROIs ? m_roiManager.HitTestShape(m_hoverPoint) : -1;
+        if (mark >= 0) m_annotations.Remove(mark);
+        else if (roi >= 0) m_roiManager.RemoveROI(roi);
+        else if (shape >= 0) m_roiManager.RemoveShape(shape);
+        else return;
+        Refresh();
+    }
+    const ROIManager& GetROIManager() const { return m_roiManager; }
+
+    // Pixels left out of integrations (hot pixels, zingers); cleared whenever the image changes
+    void SetPixelMask(const RunMask& mask) { m_pixelMask = mask; Refresh(); }
+    const RunMask& GetPixelMask() const { return m_pixelMask; }
+
+    // Zoom controls
+    void ZoomIn() { m_zoomFactor *= 1.2; m_fitMode = false; ApplyZoom(); }
+    void ZoomOut() { m_zoomFactor /= 1.2; if (m_zoomFactor < 0.01) m_zoomFactor = 0.01; m_fitMode = false; ApplyZoom(); }
+    void ZoomFit() { m_fitMode = true; ApplyZoom(); }
+
+    // Copy selected region
+    void CopySelection() {
+        if (!m_selection.IsEmpty() && m_originalImg.IsOk())
+            m_clipboard = m_originalImg.GetSubImage(m_selection);
+        UpdateMemoryAccounting();
+    }
+
+    // Keyboard shortcuts for Ctrl+C, V, Z
+    void OnKeyDown(wxKeyEvent& event) {
+        if (event.ControlDown()) {
+            int key = event.GetKeyCode();
+            if (key == 'C') CopySelection();
+            else if (key == 'V') PasteClipboard(wxPoint(10, 10), BLEND);
+            else if (key == 'Z') Undo();
+            else event.Skip();
+        }
+        else if (event.GetKeyCode() == WXK_DELETE && event.ShiftDown()) ClearROIs();
+        else if (event.GetKeyCode() == WXK_DELETE) RemoveAtCursor();
+        else if (event.GetKeyCode() == WXK_ESCAPE && !m_polygon.empty()) { m_polygon.clear(); Refresh(); }
+        else { event.Skip(); }
+    }
+
+    // Undo last image change
+    void Undo() {
+        if (!m_history.empty()) {
+            m_originalImg = m_history.back();
+            m_history.pop_back();
+            m_pixelMask.Clear();
+            ZoomFit();
+            UpdateMemoryAccounting();
+        }
+        else {
+            wxMessageBox("No previous image to undo.", "Undo", wxICON_INFORMATION);
+        }
+    }
+
+private:
+    wxBitmap m_bitmap;                   // Display bitmap
+    wxImage m_originalImg;               // Original image data
+    double m_zoomFactor = 1.0;          // Zoom factor
+    bool m_fitMode = true;               // Fit-to-window flag
+    wxRect m_selection;                  // User selection rectangle
+    bool m_selecting = false;            // True when dragging selection
+    wxPoint m_startPoint;                // Start of selection
+    wxImage m_clipboard;                 // Copy/paste buffer
+    bool m_showROIs = false;             // Display ROIs
+
+    enum BlendMode { AND, OR, XOR, BLEND }; // Blend modes for pasting
+    enum DrawMode { NONE, TEXT, RECT, ELLIPSE, ARROW, POLYGON }; // Drawing modes
+    DrawMode m_drawMode = NONE;
+    int m_drawModeIds[POLYGON + 1];
+    int m_showROIsId = 0;
+    int m_clearAnnotationsId = 0;
+    AnnotationLayer m_annotations;       // Indexed vector marks
+    RunMask m_pixelMask;                 // Excluded pixels, drawn in red
+    vector<wxPoint> m_polygon;           // Vertices of the polygon being drawn, in image pixels
+    wxPoint m_hoverPoint;                // Last mouse position in image pixels, for Delete
+    vector<wxImage> m_history;           // Undo history
+
+    MemCharge m_memImage{ MemTag::Image };
+    MemCharge m_memDisplay{ MemTag::Display };
+    MemCharge m_memHistory{ MemTag::History };
+    MemCharge m_memClipboard{ MemTag::Clipboard };
+    int m_evictorId = 0;
+
+    void UpdateMemoryAccounting() {
+        uint64_t history = 0;
+        for (const auto& h : m_history) history += ImageBytes(h);
+        m_memImage.Set(ImageBytes(m_originalImg));
+        m_memDisplay.Set(BitmapBytes(m_bitmap));
+        m_memHistory.Set(history);
+        m_memClipboard.Set(ImageBytes(m_clipboard));
+    }
+
+    // Drop the oldest undo steps until `wanted` bytes are released (or history is empty)
+    uint64_t EvictHistory(uint64_t wanted) {
+        uint64_t freed = 0;
+        while (!m_history.empty() && freed < wanted) {
+            freed += ImageBytes(m_history.front());
+            m_history.erase(m_history.begin());
+        }
+        UpdateMemoryAccounting();
+        return freed;
+    }
+
+    // Display (unscrolled) coordinates to image pixels; ROIs, annotations and the pixel mask live in image pixels
+    wxPoint ToImage(const wxPoint& p) const {
+        return wxPoint((int)floor(p.x / m_zoomFactor), (int)floor(p.y / m_zoomFactor));
+    }
+    wxRect ToImage(const wxRect& r) const {
+        const wxPoint p0 = ToImage(r.GetTopLeft());
+        const int x1 = (int)ceil((r.x + r.width) / m_zoomFactor), y1 = (int)ceil((r.y + r.height) / m_zoomFactor);
+        return wxRect(p0.x, p0.y, max(0, x1 - p0.x), max(0, y1 - p0.y));
+    }
+
+    // Apply zoom or fit-to-window
+    void ApplyZoom() {
+        if (!m_originalImg.IsOk()) return;
+
+        wxSize panelSize = GetClientSize();
+        int newW = (int)(m_originalImg.GetWidth() * m_zoomFactor);
+        int newH = (int)(m_originalImg.GetHeight() * m_zoomFactor);
+
+        if (m_fitMode && m_originalImg.GetWidth() > 0 && m_originalImg.GetHeight() > 0) {
+            double scaleX = (double)panelSize.x / m_originalImg.GetWidth();
+            double scaleY = (double)panelSize.y / m_originalImg.GetHeight();
+            m_zoomFactor = min(scaleX, scaleY);
+            if (m_zoomFactor <= 0) m_zoomFactor = 1.0;
+            newW = (int)(m_originalImg.GetWidth() * m_zoomFactor);
+            newH = (int)(m_originalImg.GetHeight() * m_zoomFactor);
+        }
+
+        {
+            PerfScope timer(PerfOp::Rescale);
+            timer.SetPixels((uint64_t)newW * newH);
+            wxImage scaled = m_originalImg.Scale(newW, newH, wxIMAGE_QUALITY_HIGH);
+            m_bitmap = wxBitmap(scaled);
+        }
+        m_memDisplay.Set(BitmapBytes(m_bitmap));
+
+        SetVirtualSize(newW, newH);
+        Refresh();
+
+        wxFrame* frame = dynamic_cast<wxFrame*>(GetParent());
+        if (frame) {
+            wxString zoomStr = m_fitMode ? wxString("Zoom: Fit") : wxString::Format("Zoom: %.0f%%", m_zoomFactor * 100);
+            frame->SetStatusText(zoomStr, 1);
+        }
+    }
+
+    // Context menu on right-click
+    void OnContextMenu(wxContextMenuEvent& event) {
+        wxMenu menu;
+        menu.Append(wxID_COPY, "Copy Selection");
+        menu.Append(wxID_PASTE, "Paste Clipboard");
+        menu.Append(wxID_SAVE, "Save Image As...");
+        menu.AppendSeparator();
+        menu.Append(wxID_UNDO, "Undo");
+        menu.AppendSeparator();
+
+        wxMenu* draw = new wxMenu;
+        static const char* modeNames[] = { "Select", "Text", "Rectangle", "Ellipse", "Arrow", "Polygon (double-click to close)" };
+        for (int mode = NONE; mode <= POLYGON; ++mode) {
+            draw->AppendRadioItem(m_drawModeIds[mode], modeNames[mode]);
+            if (mode == m_drawMode) draw->Check(m_drawModeIds[mode], true);
+        }
+        menu.AppendSubMenu(draw, "Annotate");
+        menu.AppendCheckItem(m_showROIsId, "Show ROIs");
+        menu.Check(m_showROIsId, m_showROIs);
+        menu.Append(m_clearAnnotationsId, "Clear Annotations");
+
+        wxPoint pos = event.GetPosition();
+        if (pos == wxDefaultPosition) pos = ScreenToClient(wxGetMousePosition());
+        PopupMenu(&menu, pos);
+    }
+
+    // Paint event
+    void OnPaint(wxPaintEvent& /*event*/) {
+        PerfScope timer(PerfOp::Paint);
+        wxAutoBufferedPaintDC dc(this);
+        DoPrepareDC(dc);
+        dc.Clear();
+
+        if (m_bitmap.IsOk()) dc.DrawBitmap(m_bitmap, 0, 0, true);
+        else {
+            dc.SetPen(*wxTRANSPARENT_PEN);
+            dc.DrawText("No image loaded", 10, 10);
+        }
+
+        // Draw ROIs and annotations that intersect the visible area, at the bitmap's scale
+        const wxRect viewport = ToImage(wxRect(CalcUnscrolledPosition(wxPoint(0, 0)), GetClientSize()));
+        dc.SetUserScale(m_zoomFactor, m_zoomFactor);
+        if (m_showROIs) {
+            vector<int> visible;
+            m_roiManager.Visible(viewport, visible);
+            dc.SetPen(*wxGREEN_PEN);
+            dc.SetBrush(*wxTRANSPARENT_BRUSH);
+            for (int i : visible) dc.DrawRectangle(m_roiManager.GetROIs()[i]);
+            m_roiManager.VisibleShapes(viewport, visible);
+            for (int i : visible)
+                for (const auto& outline : m_roiManager.GetShape(i).Outlines())
+                    dc.DrawPolygon((int)outline.size(), outline.data());
+        }
+        m_annotations.Draw(dc, viewport);
+        if (!m_pixelMask.IsEmpty()) {
+            // Runs are in row order: start at the first visible row
+            const auto& runs = m_pixelMask.Runs();
+            auto it = lower_bound(runs.begin(), runs.end(), viewport.GetTop(), [](const PixelRun& r, int y) { return r.y < y; });
+            dc.SetPen(*wxRED_PEN);
+            for (; it != runs.end() && it->y <= viewport.GetBottom(); ++it)
+                if (it->x1 > viewport.GetLeft() && it->x0 <= viewport.GetRight()) dc.DrawLine(it->x0, it->y, it->x1, it->y);
+        }
+        if (m_polygon.size() > 1) {
+            dc.SetPen(*wxCYAN_PEN);
+            dc.DrawLines((int)m_polygon.size(), m_polygon.data());
+        }
+        dc.SetUserScale(1.0, 1.0);
+
+        // Draw selection rectangle
+        if (!m_selection.IsEmpty()) {
+            dc.SetPen(*wxRED_PEN);
+            dc.SetBrush(*wxTRANSPARENT_BRUSH);
+            dc.DrawRectangle(m_selection);
+        }
+
+        if ((m_drawMode == RECT || m_drawMode == ARROW) && !m_selection.IsEmpty()) {
+            dc.SetPen(*wxBLUE_PEN);
+            dc.SetBrush(*wxTRANSPARENT_BRUSH);
+            dc.DrawRectangle(m_selection);
+        }
+        if (m_drawMode == ELLIPSE && !m_selection.IsEmpty()) {
+            dc.SetPen(*wxBLUE_PEN);
+            dc.SetBrush(*wxTRANSPARENT_BRUSH);
+            dc.DrawEllipse(m_selection);
+        }
+    }
+
+    void ToggleROIs() { m_showROIs = !m_showROIs; Refresh(); }
+
+    // Mouse events
+    void OnLeftDown(wxMouseEvent& event) {
+        m_startPoint = CalcUnscrolledPosition(event.GetPosition());
+        if (m_drawMode == POLYGON) {
+            m_polygon.push_back(ToImage(m_startPoint));
+            Refresh();
+            return;
+        }
+        if (m_drawMode == TEXT) {
+            const wxString text = wxGetTextFromUser("Annotation text", "Annotate", "", this);
+            if (!text.IsEmpty()) AddAnnotation({ AnnotationShape::Text, { ToImage(m_startPoint) }, text, wxRect() });
+            return;
+        }
+        m_selecting = true;
+        CaptureMouse();
+    }
+
+    // Close the polygon being drawn
+    void OnLeftDClick(wxMouseEvent& /*event*/) {
+        if (m_drawMode != POLYGON) return;
+        if (m_polygon.size() >= 3) AddAnnotation({ AnnotationShape::Polygon, m_polygon, wxString(), wxRect() });
+        m_polygon.clear();
+        Refresh();
+    }
+
+    void OnLeftUp(wxMouseEvent& event) {
+        if (m_selecting) {
+            wxPoint endPoint = CalcUnscrolledPosition(event.GetPosition());
+            int x1 = min(m_startPoint.x, endPoint.x);
+            int y1 = min(m_startPoint.y, endPoint.y);
+            int x2 = max(m_startPoint.x, endPoint.x);
+            int y2 = max(m_startPoint.y, endPoint.y);
+            // Clamp and set selection rectangle
+            x1 = max(0, x1); y1 = max(0, y1);
+            x2 = max(x1, x2); y2 = max(y1, y2);
+            m_selection = wxRect(wxPoint(x1, y1), wxSize(x2 - x1 + 1, y2 - y1 + 1));
+            m_selecting = false;
+            if (HasCapture()) ReleaseMouse();
+            // In a shape mode the drag becomes an annotation instead of a selection
+            if (m_drawMode == RECT || m_drawMode == ELLIPSE)
+                AddAnnotation({ m_drawMode == RECT ? AnnotationShape::Rect : AnnotationShape::Ellipse,
+                    { ToImage(wxPoint(x1, y1)), ToImage(wxPoint(x2, y2)) }, wxString(), wxRect() });
+            else if (m_drawMode == ARROW && endPoint != m_startPoint)
+                AddAnnotation({ AnnotationShape::Arrow, { ToImage(m_startPoint), ToImage(endPoint) }, wxString(), wxRect() });
+            if (m_drawMode != NONE) m_selection = wxRect();
+            Refresh();
+        }
+    }
+
+    void OnMouseMove(wxMouseEvent& event) {
+        wxPoint pos = CalcUnscrolledPosition(event.GetPosition());
+
+        if (event.Dragging() && event.LeftIsDown() && m_selecting) {
+            int x1 = min(m_startPoint.x, pos.x);
+            int y1 = min(m_startPoint.y, pos.y);
+            int x2 = max(m_startPoint.x, pos.x);
+            int y2 = max(m_startPoint.y, pos.y);
+            x1 = max(0, x1); y1 = max(0, y1);
+            x2 = max(x1, x2); y2 = max(y1, y2);
+            m_selection = wxRect(wxPoint(x1, y1), wxSize(x2 - x1 + 1, y2 - y1 + 1));
+            Refresh();
+        }
+
+        m_hoverPoint = ToImage(pos);
+        ShowPixelInfo(m_hoverPoint);
+    }
+
+    void OnMouseWheel(wxMouseEvent& event) {
+        int rot = event.GetWheelRotation();
+        if (rot > 0) ZoomIn(); else ZoomOut();
+    }
+
+    void ShowPixelInfo(const wxPoint& pos) {
+        if (!m_originalImg.IsOk()) return;
+        if (pos.x < 0 || pos.y < 0 || pos.x >= m_originalImg.GetWidth() || pos.y >= m_originalImg.GetHeight()) return;
+
+        unsigned char* data = m_originalImg.GetData();
+        int idx = (pos.y * m_originalImg.GetWidth() + pos.x) * 3;
+        int r = data[idx];
+        int g = data[idx + 1];
+        int b = data[idx + 2];
+
+        wxString info = wxString::Format("X: %d Y: %d R: %d G: %d B: %d", pos.x, pos.y, r, g, b);
+        const int roi = m_showROIs ? m_roiManager.HitTest(pos) : -1;
+        if (roi >= 0) info += wxString::Format("  |  ROI %d", roi);
+        const int shape = m_showROIs ? m_roiManager.HitTestShape(pos) : -1;
+        if (shape >= 0) info += wxString::Format("  |  mask ROI %d", shape);
+        const int mark = m_annotations.HitTest(pos);
+        if (mark >= 0) info += wxString::Format("  |  annotation %d", mark);
+
+        wxFrame* frame = dynamic_cast<wxFrame*>(GetParent());
+        if (frame) {
+            frame->SetStatusText(info, 0);
+        }
+    }
+
+    void CutSelection() {
+        CopySelection();
+        if (!m_originalImg.IsOk() || m_selection.IsEmpty()) return;
+
+        wxImage img = m_originalImg.Copy();   // Pixels may be shared with other windows
+        unsigned char* data = img.GetData();
+        int w = img.GetWidth(), h = img.GetHeight();
+
+        int x0 = clamp(m_selection.x, 0, w - 1);
+        int y0 = clamp(m_selection.y, 0, h - 1);
+        int x1 = clamp(m_selection.x + m_selection.GetWidth() - 1, 0, w - 1);
+        int y1 = clamp(m_selection.y + m_selection.GetHeight() - 1, 0, h - 1);
+
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                int idx = (y * w + x) * 3;
+                data[idx] = data[idx + 1] = data[idx + 2] = 255; // white-out
+            }
+        }
+        SetImage(img);
+    }
+
+    void PasteClipboard(wxPoint dest, BlendMode mode) {
+        if (!m_clipboard.IsOk() || !m_originalImg.IsOk()) return;
+
+        wxImage img = m_originalImg.Copy();   // Pixels may be shared with other windows
+        unsigned char* dst = img.GetData();
+        unsigned char* src = m_clipboard.GetData();
+        int w = m_clipboard.GetWidth(), h = m_clipboard.GetHeight();
+
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                int dx = dest.x + x, dy = dest.y + y;
+                if (dx >= img.GetWidth() || dy >= img.GetHeight() || dx < 0 || dy < 0) continue;
+
+                int di = (dy * img.GetWidth() + dx) * 3;
+                int si = (y * w + x) * 3;
+
+                for (int c = 0; c < 3; ++c) {
+                    switch (mode) {
+                    case AND: dst[di + c] &= src[si + c]; break;
+                    case OR:  dst[di + c] |= src[si + c]; break;
+                    case XOR: dst[di + c] ^= src[si + c]; break;
+                    case BLEND: dst[di + c] = (dst[di + c] + src[si + c]) / 2; break;
+                    }
+                }
+            }
+        }
+        SetImage(img);
+    }
+};
+
+static inline bool InBounds(int x, int y, int w, int h) {
+    return (x >= 0 && y >= 0 && x < w && y < h);
+}
+
+static inline unsigned char GetGray(const wxImage& img, int x, int y) {
+    const int w = img.GetWidth();
+    const unsigned char* data = img.GetData();
+    return data[(y * w + x) * 3]; // grayscale stored in all channels
+}
+
+static double CircularAverageNearest(const wxImage& img, int cx, int cy, int R, int* outUniqueSamples = nullptr, double* outStdErr = nullptr,
+    const RunMask* exclude = nullptr) {
+    if (!img.IsOk() || R <= 0) return numeric_limits<double>::quiet_NaN();
+
+    const int w = img.GetWidth();
+    const int h = img.GetHeight();
+
+    // If the circle is completely outside, early out (optional)
+    if (cx + R < 0 || cx - R >= w || cy + R < 0 || cy - R >= h)
+        return numeric_limits<double>::quiet_NaN();
+
+    const int N = max(8, (int)lround(2.0 * PI * (double)R));
+
+    // Pack (x,y) into 64-bit key to dedupe
+    unordered_set<long long> visited;
     visited.reserve((size_t)N * 2);
 
-    double sum = 0.0;
-    int count = 0;
+    double sum = 0.0, sumSq = 0.0;
+    int count = 0;
+
+    for (int k = 0; k < N; ++k) {
+        const double theta = (2.0 * PI * (double)k) / (double)N;
+        const double fx = (double)cx + (double)R * cos(theta);
+        const double fy = (double)cy + (double)R * sin(theta);
+
+        const int x = (int)lround(fx);
+        const int y = (int)lround(fy);
+
+        if (!InBounds(x, y, w, h)) continue;
+
+        const long long key = ((long long)x << 32) ^ (unsigned int)y;
+        if (visited.insert(key).second && !(exclude && exclude->Contains(x, y))) {
+            const double v = (double)GetGray(img, x, y);
+            sum += v;
+            sumSq += v * v;
+            ++count;
+        }
+    }
+
+    if (outUniqueSamples) *outUniqueSamples = count;
+    if (outStdErr) {
+        const double var = count > 1 ? max(0.0, (sumSq - sum * sum / count) / (count - 1)) : 0.0;
+        *outStdErr = count > 1 ? sqrt(var / count) : numeric_limits<double>::quiet_NaN();
+    }
+    if (count == 0) return numeric_limits<double>::quiet_NaN();
+    return sum / (double)count;
+}
+
+// Dark, background and flat corrections folded into one affine map per pixel,
+// corrected = pedestal + (grey - offset) * gain, applied by the decoders as each pixel is converted.
+// Frames stay 8-bit, so the pedestal keeps negative residuals down to -pedestal instead of clipping
+// them to 0; profiles of corrected frames carry it as a constant offset.
+struct FrameCorrection {
+    int width = 0, height = 0;
+    vector<float> offset;
+    vector<float> gain;           // Empty without a flat
+    double pedestal = 0.0;
+
+    bool Fits(int w, int h, wxString* error) const {
+        if (w == width && h == height) return true;
+        if (error) *error = wxString::Format("Calibration frames are %dx%d but the frame is %dx%d.", width, height, w, h);
+        return false;
+    }
+    unsigned char Apply(size_t i, double grey) const {
+        double v = grey - offset[i];
+        if (!gain.empty()) v *= gain[i];
+        v += pedestal;
+        return (unsigned char)lround(min(255.0, max(0.0, v)));
+    }
+    uint64_t Bytes() const { return (offset.size() + gain.size()) * sizeof(float); }
+};
+
+// Convert legacy BGRA pixels to grey replicated in all three RGB channels, corrected on the way
+static void DecodeBgraToGray(const unsigned char* bgra, unsigned char* rgb, size_t pixels, const FrameCorrection* corr = nullptr) {
+    for (size_t i = 0; i < pixels; ++i) {
+        unsigned char r = bgra[i * 4 + 2];
+        unsigned char g = bgra[i * 4 + 1];
+        unsigned char b = bgra[i * 4 + 0];
+        const double lum = 0.299 * r + 0.587 * g + 0.114 * b;
+        unsigned char grey = corr ? corr->Apply(i, lum) : (unsigned char)round(lum);
+        rgb[i * 3 + 0] = grey;
+        rgb[i * 3 + 1] = grey;
+        rgb[i * 3 + 2] = grey;
+    }
+}
+
+// Nearest-neighbor circular averages for R = Rmin, Rmin+step, ..., Rmax. Radii without
+// valid samples are kept as NaN so the profile has gaps rather than missing rows.
+// Pixels in `exclude` (hot pixels, zingers) are left out.
+static vector<RadialAvgPoint> RadialSweep(const wxImage& img, int cx, int cy, int Rmin, int Rmax, int step, int* outValid = nullptr,
+    const RunMask* exclude = nullptr) {
+    vector<RadialAvgPoint> data;
+    data.reserve((size_t)((Rmax - Rmin) / step + 1));
+
+    int validCount = 0;
+    for (int R = Rmin; R <= Rmax; R += step) {
+        int samples = 0;
+        double err = 0.0;
+        double avg = CircularAverageNearest(img, cx, cy, R, &samples, &err, exclude);
+
+        if (std::isfinite(avg) && samples > 0) {
+            data.push_back({ R, avg, samples, err });
+            ++validCount;
+        }
+        else {
+            data.push_back({ R, std::numeric_limits<double>::quiet_NaN(), samples });
+        }
+    }
+    if (outValid) *outValid = validCount;
+    return data;
+}
+
+// Radial profile of the pixels inside a mask: each pixel goes to the ring R = Rmin + k*step
+// nearest its distance from (cx, cy). Sectors and other integration masks are walked run by run;
+// pixels also in `exclude` are skipped.
+static vector<RadialAvgPoint> RadialProfileInMask(const wxImage& img, const RunMask& mask, double cx, double cy,
+    int Rmin, int Rmax, int step, int* outValid = nullptr, const RunMask* exclude = nullptr) {
+    const int bins = Rmax >= Rmin && step > 0 ? (Rmax - Rmin) / step + 1 : 0;
+    vector<double> sum(bins), sumSq(bins);
+    vector<int> count(bins);
+    const int w = img.GetWidth(), h = img.GetHeight();
+    for (const PixelRun& r : mask.Runs()) {
+        if (r.y < 0 || r.y >= h) continue;
+        const double dy = r.y + 0.5 - cy;
+        for (int x = max(0, r.x0); x < min(w, r.x1); ++x) {
+            const double dx = x + 0.5 - cx;
+            const long k = lround((sqrt(dx * dx + dy * dy) - Rmin) / step);
+            if (k < 0 || k >= bins || (exclude && exclude->Contains(x, r.y))) continue;
+            const double v = GetGray(img, x, r.y);
+            sum[k] += v;
+            sumSq[k] += v * v;
+            ++count[k];
+        }
+    }
+
+    vector<RadialAvgPoint> data;
+    data.reserve(bins);
+    int validCount = 0;
+    for (int k = 0; k < bins; ++k) {
+        const int n = count[k];
+        if (n == 0) { data.push_back({ Rmin + k * step, numeric_limits<double>::quiet_NaN(), 0 }); continue; }
+        const double var = n > 1 ? max(0.0, (sumSq[k] - sum[k] * sum[k] / n) / (n - 1)) : 0.0;
+        data.push_back({ Rmin + k * step, sum[k] / n, n, n > 1 ? sqrt(var / n) : numeric_limits<double>::quiet_NaN() });
+        ++validCount;
+    }
+    if (outValid) *outValid = validCount;
+    return data;
+}
+
+// ---------------------------------------------------------------------------
+// Hot pixels and cosmic rays
+// ---------------------------------------------------------------------------
+
+struct OutlierParams {
+    int radius = 2;              // Window is (2*radius+1)^2, truncated at the frame edges
+    double sigma = 6.0;          // Threshold above the local median, in local robust sigmas
+    double minExcess = 8.0;      // ...and at least this many grey levels
+};
+
+// Pixels standing far above their neighbourhood: v - median > max(minExcess, sigma * IQR/1.349).
+// Medians and quartiles come from running 256-bin histograms (Perreault & Hebert): each column
+// keeps a histogram of the window's rows that slides down a row at a time, and the window
+// histogram slides right by adding one column and dropping another, so the cost per pixel does
+// not grow with the radius. Only a 16-bin coarse level slides at every pixel; a block of 16 fine
+// bins is brought up to date when a quantile lands in it, which on smooth backgrounds is the
+// same block pixel after pixel. Quartiles are only looked up for pixels already above
+// median + minExcess. Row bands run in parallel, each with its own column histograms.
+static RunMask FindOutlierPixels(const wxImage& img, const OutlierParams& p) {
+    RunMask mask;
+    if (!img.IsOk()) return mask;
+    const int w = img.GetWidth(), h = img.GetHeight();
+    const int r = clamp(p.radius, 1, 100);   // Window counts stay within uint16
+    const unsigned char* rgb = img.GetData();
+    vector<vector<PixelRun>> rowRuns(h);
+
+    ParallelFor(0, h, [&](int y0, int y1) {
+        vector<uint16_t> col((size_t)w * 256), colCoarse((size_t)w * 16);
+        auto addRow = [&](int y, int d) {
+            const unsigned char* row = rgb + (size_t)y * w * 3;
+            for (int x = 0; x < w; ++x) {
+                const int v = row[x * 3];
+                col[(size_t)x * 256 + v] += d;
+                colCoarse[(size_t)x * 16 + (v >> 4)] += d;
+            }
+        };
+        uint16_t K[256], KC[16];
+        int fineAt[16];          // Window centre at which each fine block of K was last updated
+        auto addCoarse = [&](int x, int d) {
+            const uint16_t* cc = &colCoarse[(size_t)x * 16];
+            for (int b = 0; b < 16; ++b) KC[b] += d * cc[b];
+        };
+        auto addFine = [&](int x, int block, int d) {
+            const uint16_t* c = &col[(size_t)x * 256 + block * 16];
+            uint16_t* k = &K[block * 16];
+            for (int b = 0; b < 16; ++b) k[b] += d * c[b];
+        };
+        // Catch fine block `block` up to the window centred at x: replay the columns that entered
+        // and left since its last update, or rebuild it when that is more work
+        auto updateFine = [&](int block, int x) {
+            const int from = fineAt[block];
+            if (from < 0 || x - from > 2 * r + 1) {
+                memset(&K[block * 16], 0, 16 * sizeof(uint16_t));
+                for (int xx = max(0, x - r); xx <= min(w - 1, x + r); ++xx) addFine(xx, block, 1);
+            }
+            else for (int xc = from + 1; xc <= x; ++xc) {
+                if (xc + r < w) addFine(xc + r, block, 1);
+                if (xc - r - 1 >= 0) addFine(xc - r - 1, block, -1);
+            }
+            fineAt[block] = x;
+        };
+        // Grey level of the sample with the given rank (0-based) in the window centred at x
+        auto quantile = [&](int rank, int x) {
+            int b = 0;
+            for (; b < 15 && rank >= KC[b]; ++b) rank -= KC[b];
+            updateFine(b, x);
+            int v = b * 16;
+            for (; v < b * 16 + 15 && rank >= K[v]; ++v) rank -= K[v];
+            return v;
+        };
+
+        for (int y = max(0, y0 - r); y <= min(h - 1, y0 + r); ++y) addRow(y, 1);
+        for (int y = y0; y < y1; ++y) {
+            if (y > y0) {
+                if (y + r < h) addRow(y + r, 1);
+                if (y - r - 1 >= 0) addRow(y - r - 1, -1);
+            }
+            const int rows = min(h - 1, y + r) - max(0, y - r) + 1;
+            memset(KC, 0, sizeof(KC));
+            fill(fineAt, fineAt + 16, -1);
+            for (int x = 0; x <= min(w - 1, r); ++x) addCoarse(x, 1);
+            const unsigned char* row = rgb + (size_t)y * w * 3;
+            for (int x = 0; x < w; ++x) {
+                if (x > 0) {
+                    if (x + r < w) addCoarse(x + r, 1);
+                    if (x - r - 1 >= 0) addCoarse(x - r - 1, -1);
+                }
+                const int n = rows * (min(w - 1, x + r) - max(0, x - r) + 1);
+                const int v = row[x * 3];
+                const int median = quantile((n - 1) / 2, x);
+                if (v - median <= p.minExcess) continue;
+                const double spread = max(1.0, (quantile(3 * (n - 1) / 4, x) - quantile((n - 1) / 4, x)) / 1.349);
+                if (v - median <= p.sigma * spread) continue;
+                vector<PixelRun>& runs = rowRuns[y];
+                if (!runs.empty() && runs.back().x1 == x) ++runs.back().x1;
+                else runs.push_back({ y, x, x + 1 });
+            }
+        }
+        });
+
+    for (const auto& runs : rowRuns)
+        for (const PixelRun& run : runs) mask.AddRun(run.y, run.x0, run.x1);
+    return mask;
+}
+
+// ---------------------------------------------------------------------------
+// Peaks of 1D profiles
+// ---------------------------------------------------------------------------
+
+struct PeakParams {
+    int halfWindow = 3;          // Savitzky-Golay half-width in bins
+    double minProminence = 4.0;  // In units of the profile's noise (robust sigma of the smoothing residual)
+};
+
+struct ProfilePeak {
+    double position;             // Sub-bin apex, in axis units
+    double height;               // Apex above the local baseline
+    double background;           // Baseline under the apex
+    double fwhm;
+    double area;                 // Above the baseline, between the peak's two bases
+};
+
+// Peaks of y(x). Non-finite samples are dropped first. The profile is smoothed and differentiated
+// with quadratic Savitzky-Golay filters; each +/- sign change of the derivative is a candidate,
+// refined by a parabola through the smoothed apex. The baseline is the straight line under the peak
+// that touches the profile on either side within a few half-widths, which copes with the steep,
+// curved backgrounds of scattering profiles. Candidates less prominent than minProminence noise
+// sigmas are dropped.
+static vector<ProfilePeak> FindProfilePeaks(const vector<double>& x, const vector<double>& y, const PeakParams& params) {
+    vector<double> xs, ys;
+    for (size_t i = 0; i < x.size() && i < y.size(); ++i)
+        if (isfinite(x[i]) && isfinite(y[i])) { xs.push_back(x[i]); ys.push_back(y[i]); }
+    const int n = (int)xs.size();
+    vector<ProfilePeak> peaks;
+    if (n < 5) return peaks;
+
+    vector<double> sm(n), d(n);
+    for (int i = 0; i < n; ++i) {
+        const int m = min(params.halfWindow, min(i, n - 1 - i));   // Window shrinks at the ends
+        if (m == 0) { sm[i] = ys[i]; d[i] = i == 0 ? ys[1] - ys[0] : ys[i] - ys[i - 1]; continue; }
+        const double norm = (4.0 * m * m - 1.0) * (2.0 * m + 3.0) / 3.0;
+        double s = 0.0, dd = 0.0;
+        for (int j = -m; j <= m; ++j) {
+            s += (3.0 * m * m + 3.0 * m - 1.0 - 5.0 * j * j) * ys[i + j];
+            dd += j * ys[i + j];
+        }
+        sm[i] = s / norm;
+        d[i] = dd * 3.0 / (m * (m + 1.0) * (2.0 * m + 1.0));
+    }
+
+    // Robust noise level: scaled median absolute deviation of the smoothing residual
+    vector<double> r(n);
+    for (int i = 0; i < n; ++i) r[i] = ys[i] - sm[i];
+    nth_element(r.begin(), r.begin() + n / 2, r.end());
+    const double med = r[n / 2];
+    for (double& v : r) v = fabs(v - med);
+    nth_element(r.begin(), r.begin() + n / 2, r.end());
+    double range = 0.0;
+    for (double v : ys) range = max(range, fabs(v));
+    const double noise = max(1.4826 * r[n / 2], 1e-9 * (range + 1.0));
+
+    int last = -1;
+    for (int i = 1; i < n; ++i) {
+        if (!(d[i - 1] > 0 && d[i] <= 0)) continue;
+        int k = sm[i - 1] > sm[i] ? i - 1 : i;
+        while (k + 1 < n && sm[k + 1] > sm[k]) ++k;
+        while (k > 0 && sm[k - 1] > sm[k]) --k;
+        if (k == last || k == 0 || k == n - 1) continue;
+        last = k;
+
+        // Rough width: half-height crossings above the higher of the two nearest valleys
+        int l = k, rr = k;
+        while (l > 0 && sm[l - 1] <= sm[l]) --l;
+        while (rr < n - 1 && sm[rr + 1] <= sm[rr]) ++rr;
+        if (l == k || rr == k) continue;
+        const double halfLevel = 0.5 * (sm[k] + max(sm[l], sm[rr]));
+        int hl = k, hr = k;
+        while (hl > l && sm[hl] > halfLevel) --hl;
+        while (hr < rr && sm[hr] > halfLevel) ++hr;
+        const int reach = 4 * max(1, min(k - hl, hr - k)) + 2;
+
+        // Bases: the bridge under the peak across +-reach, i.e. the line touching the profile on
+        // both sides without cutting it. On a curved background this stays under the peak's
+        // tails instead of running to a distant minimum.
+        l = max(0, k - reach);
+        rr = min(n - 1, k + reach);
+        for (bool moved = true; moved;) {
+            moved = false;
+            const double slope = (sm[rr] - sm[l]) / (xs[rr] - xs[l]);
+            int nl = l, nr = rr;
+            double dl = 0.0, dr = 0.0;
+            for (int j = l + 1; j < k; ++j) {
+                const double below = sm[l] + slope * (xs[j] - xs[l]) - sm[j];
+                if (below > dl) { dl = below; nl = j; }
+            }
+            for (int j = k + 1; j < rr; ++j) {
+                const double below = sm[l] + slope * (xs[j] - xs[l]) - sm[j];
+                if (below > dr) { dr = below; nr = j; }
+            }
+            if (nl != l || nr != rr) { l = nl; rr = nr; moved = true; }
+        }
+        auto baseline = [&](double xv) { return sm[l] + (sm[rr] - sm[l]) * (xv - xs[l]) / (xs[rr] - xs[l]); };
+
+        const double a = sm[k - 1], b = sm[k], c = sm[k + 1];
+        const double den = a - 2.0 * b + c;
+        const double delta = den < 0 ? clamp(0.5 * (a - c) / den, -0.5, 0.5) : 0.0;
+        const double apex = b - 0.25 * (a - c) * delta;
+        const double position = xs[k] + delta * (delta > 0 ? xs[k + 1] - xs[k] : xs[k] - xs[k - 1]);
+        const double background = baseline(position);
+        const double height = apex - background;
+        if (height < params.minProminence * noise) continue;
+
+        // Half-maximum crossings of the baseline-subtracted smoothed profile
+        auto above = [&](int j) { return sm[j] - baseline(xs[j]); };
+        auto cross = [&](int inner, int outer) {
+            const double t = (0.5 * height - above(outer)) / (above(inner) - above(outer));
+            return xs[outer] + t * (xs[inner] - xs[outer]);
+        };
+        double left = xs[l], right = xs[rr];
+        for (int j = k; j > l; --j) if (above(j - 1) < 0.5 * height) { left = cross(j, j - 1); break; }
+        for (int j = k; j < rr; ++j) if (above(j + 1) < 0.5 * height) { right = cross(j, j + 1); break; }
+
+        double area = 0.0;
+        for (int j = l; j < rr; ++j)
+            area += 0.5 * ((ys[j] - baseline(xs[j])) + (ys[j + 1] - baseline(xs[j + 1]))) * (xs[j + 1] - xs[j]);
+        peaks.push_back({ position, height, background, right - left, area });
+    }
+    return peaks;
+}
+
+static vector<ProfilePeak> FindProfilePeaks(const vector<RadialAvgPoint>& profile, const PeakParams& params) {
+    vector<double> x, y;
+    for (const auto& p : profile) { x.push_back(p.R); y.push_back(p.avg); }
+    return FindProfilePeaks(x, y, params);
+}
+
+// ---------------------------------------------------------------------------
+// Profile fitting (Levenberg-Marquardt)
+// ---------------------------------------------------------------------------
+
+enum class FitModel { Gaussian, Lorentzian, PseudoVoigt, Guinier, Porod, Sphere };
+
+struct FitSpec {
+    FitModel model = FitModel::Gaussian;
+    int bgDegree = 1;            // Polynomial background under the peak models, -1 for none
+    double xMin = -numeric_limits<double>::infinity();
+    double xMax = numeric_limits<double>::infinity();
+    int maxIterations = 200;
+
+    bool IsPeak() const { return model == FitModel::Gaussian || model == FitModel::Lorentzian || model == FitModel::PseudoVoigt; }
+
+    // Peaks: amplitude, centre, FWHM[, eta], then background coefficients b0 + b1 x + ...
+    vector<string> ParamNames() const {
+        switch (model) {
+        case FitModel::Guinier: return { "I0", "Rg" };
+        case FitModel::Porod: return { "K", "B" };
+        case FitModel::Sphere: return { "scale", "R", "B" };
+        default: break;
+        }
+        vector<string> names = { "A", "x0", "fwhm" };
+        if (model == FitModel::PseudoVoigt) names.push_back("eta");
+        for (int k = 0; k <= bgDegree; ++k) names.push_back("b" + to_string(k));
+        return names;
+    }
+};
+
+struct FitResult {
+    vector<double> params, errors;
+    double chi2 = numeric_limits<double>::quiet_NaN();   // Reduced chi-square
+    int points = 0;
+    int iterations = 0;
+    bool converged = false;
+};
+
+// Model values f[i] and, when J is given, the Jacobian J[k * n + i] = df(x_i)/dp_k. Each
+// column is filled by a flat loop over x, so the compiler vectorizes the per-point work.
+static void EvalFitModel(const FitSpec& spec, const double* p, const double* x, int n, double* f, double* J) {
+    switch (spec.model) {
+    case FitModel::Guinier:
+        for (int i = 0; i < n; ++i) {
+            const double e = exp(-x[i] * x[i] * p[1] * p[1] / 3.0);
+            f[i] = p[0] * e;
+            if (J) { J[i] = e; J[n + i] = -2.0 / 3.0 * p[0] * e * x[i] * x[i] * p[1]; }
+        }
+        return;
+    case FitModel::Porod:
+        for (int i = 0; i < n; ++i) {
+            const double q4 = 1.0 / (x[i] * x[i] * x[i] * x[i]);
+            f[i] = p[0] * q4 + p[1];
+            if (J) { J[i] = q4; J[n + i] = 1.0; }
+        }
+        return;
+    case FitModel::Sphere:
+        // P(qR) = F^2 with F = 3 (sin v - v cos v) / v^3 and dF/dv = 3 sin v / v^2 - 3 F / v
+        for (int i = 0; i < n; ++i) {
+            const double v = x[i] * p[1];
+            double F, dF;
+            if (fabs(v) < 1e-3) { F = 1.0 - v * v / 10.0; dF = -v / 5.0; }
+            else {
+                const double s = sin(v), c = cos(v);
+                F = 3.0 * (s - v * c) / (v * v * v);
+                dF = 3.0 * s / (v * v) - 3.0 * F / v;
+            }
+            f[i] = p[0] * F * F + p[2];
+            if (J) { J[i] = F * F; J[n + i] = p[0] * 2.0 * F * dF * x[i]; J[2 * n + i] = 1.0; }
+        }
+        return;
+    default:
+        break;
+    }
+
+    // Peak on a polynomial background; u = (x - x0) / fwhm
+    const double A = p[0], x0 = p[1], w = p[2];
+    const double eta = spec.model == FitModel::PseudoVoigt ? p[3] : spec.model == FitModel::Lorentzian ? 1.0 : 0.0;
+    const int bg = spec.model == FitModel::PseudoVoigt ? 4 : 3;
+    const double c = 4.0 * log(2.0);
+    for (int i = 0; i < n; ++i) {
+        const double u = (x[i] - x0) / w;
+        const double G = exp(-c * u * u), L = 1.0 / (1.0 + 4.0 * u * u);
+        const double shape = eta * L + (1.0 - eta) * G;
+        const double dShape = eta * 8.0 * u * L * L + (1.0 - eta) * 2.0 * c * u * G;   // -d(shape)/du
+        double b = 0.0, xk = 1.0;
+        for (int k = 0; k <= spec.bgDegree; ++k, xk *= x[i]) {
+            b += p[bg + k] * xk;
+            if (J) J[(bg + k) * n + i] = xk;
+        }
+        f[i] = A * shape + b;
+        if (J) {
+            J[i] = shape;
+            J[n + i] = A * dShape / w;
+            J[2 * n + i] = A * dShape * u / w;
+            if (spec.model == FitModel::PseudoVoigt) J[3 * n + i] = A * (L - G);
+        }
+    }
+}
+
+// Keeps parameters physical: positive widths and sizes, eta within 0..1
+static void ConstrainFitParams(const FitSpec& spec, vector<double>& p) {
+    if (spec.IsPeak()) {
+        p[2] = max(fabs(p[2]), 1e-9);
+        if (spec.model == FitModel::PseudoVoigt) p[3] = clamp(p[3], 0.0, 1.0);
+    }
+    else if (spec.model != FitModel::Porod) p[1] = fabs(p[1]);
+}
+
+// Solves the symmetric positive definite system A x = b in place (b becomes x)
+static bool CholeskySolve(vector<double> A, double* b, int m) {
+    for (int j = 0; j < m; ++j) {
+        double d = A[j * m + j];
+        for (int k = 0; k < j; ++k) d -= A[j * m + k] * A[j * m + k];
+        if (!(d > 0)) return false;
+        d = sqrt(d);
+        A[j * m + j] = d;
+        for (int i = j + 1; i < m; ++i) {
+            double s = A[i * m + j];
+            for (int k = 0; k < j; ++k) s -= A[i * m + k] * A[j * m + k];
+            A[i * m + j] = s / d;
+        }
+    }
+    for (int i = 0; i < m; ++i) {
+        for (int k = 0; k < i; ++k) b[i] -= A[i * m + k] * b[k];
+        b[i] /= A[i * m + i];
+    }
+    for (int i = m - 1; i >= 0; --i) {
+        for (int k = i + 1; k < m; ++k) b[i] -= A[k * m + i] * b[k];
+        b[i] /= A[i * m + i];
+    }
+    return true;
+}
+
+// Least-squares fit of y(x) from the starting parameters p. Points outside the spec's range or
+// with non-finite values are skipped; when every point has a positive sigma the fit is weighted
+// by 1/sigma^2, otherwise unweighted with errors scaled by the reduced chi-square.
+static FitResult FitProfile(const FitSpec& spec, const vector<double>& x, const vector<double>& y, const vector<double>& sigma, vector<double> p) {
+    FitResult res;
+    const int m = (int)spec.ParamNames().size();
+    if ((int)p.size() != m) return res;
+    vector<double> xs, ys, ws;
+    bool weighted = true;
+    for (size_t i = 0; i < x.size() && i < y.size(); ++i) {
+        if (!isfinite(x[i]) || !isfinite(y[i]) || x[i] < spec.xMin || x[i] > spec.xMax) continue;
+        if (spec.model == FitModel::Porod && x[i] == 0.0) continue;
+        xs.push_back(x[i]);
+        ys.push_back(y[i]);
+        const double s = i < sigma.size() ? sigma[i] : numeric_limits<double>::quiet_NaN();
+        if (!(s > 0) || !isfinite(s)) weighted = false;
+        ws.push_back(s);
+    }
+    const int n = (int)xs.size();
+    res.points = n;
+    if (n <= m) return res;
+    for (double& w : ws) w = weighted ? 1.0 / w : 1.0;
+
+    vector<double> f(n), J((size_t)m * n), trial(m);
+    auto chiSq = [&](const vector<double>& q, bool jacobian) {
+        EvalFitModel(spec, q.data(), xs.data(), n, f.data(), jacobian ? J.data() : nullptr);
+        double s = 0.0;
+        for (int i = 0; i < n; ++i) { f[i] = (ys[i] - f[i]) * ws[i]; s += f[i] * f[i]; }   // f becomes the weighted residual
+        return s;
+    };
+
+    ConstrainFitParams(spec, p);
+    double chi2 = chiSq(p, true);
+    vector<double> A((size_t)m * m), g(m), delta(m);
+    double lambda = 1e-3;
+    bool normalsStale = true;
+    for (res.iterations = 0; res.iterations < spec.maxIterations && isfinite(chi2); ++res.iterations) {
+        if (normalsStale) {
+            // Normal equations J^T W J and J^T W r
+            for (int a = 0; a < m; ++a) {
+                const double* Ja = &J[(size_t)a * n];
+                double gs = 0.0;
+                for (int i = 0; i < n; ++i) gs += Ja[i] * ws[i] * f[i];
+                g[a] = gs;
+                for (int b = 0; b <= a; ++b) {
+                    const double* Jb = &J[(size_t)b * n];
+                    double s = 0.0;
+                    for (int i = 0; i < n; ++i) s += Ja[i] * Jb[i] * ws[i] * ws[i];
+                    A[a * m + b] = A[b * m + a] = s;
+                }
+            }
+            normalsStale = false;
+        }
+
+        vector<double> damped = A;
+        for (int a = 0; a < m; ++a) damped[a * m + a] += lambda * max(A[a * m + a], 1e-300);
+        delta = g;
+        if (!CholeskySolve(damped, delta.data(), m)) { lambda *= 10.0; if (lambda > 1e12) break; continue; }
+        for (int a = 0; a < m; ++a) trial[a] = p[a] + delta[a];
+        ConstrainFitParams(spec, trial);
+        const double trialChi2 = chiSq(trial, false);
+
+        if (isfinite(trialChi2) && trialChi2 < chi2) {
+            const double gain = (chi2 - trialChi2) / chi2;
+            double step = 0.0;
+            for (int a = 0; a < m; ++a) step = max(step, fabs(trial[a] - p[a]) / (fabs(p[a]) + 1e-12));
+            p = trial;
+            chi2 = chiSq(p, true);
+            normalsStale = true;
+            lambda = max(lambda / 10.0, 1e-12);
+            if (gain < 1e-10 || step < 1e-9) { res.converged = true; break; }
+        }
+        else {
+            chiSq(p, false);   // Restore the residuals of the accepted parameters
+            lambda *= 10.0;
+            if (lambda > 1e12) { res.converged = true; break; }   // No downhill step left: at a minimum
+        }
+    }
+    if (!isfinite(chi2)) res.converged = false;
+
+    // Parameter errors from the diagonal of (J^T W J)^-1
+    chiSq(p, true);
+    for (int a = 0; a < m; ++a)
+        for (int b = 0; b <= a; ++b) {
+            double s = 0.0;
+            for (int i = 0; i < n; ++i) s += J[(size_t)a * n + i] * J[(size_t)b * n + i] * ws[i] * ws[i];
+            A[a * m + b] = A[b * m + a] = s;
+        }
+    res.chi2 = chi2 / (n - m);
+    res.params = p;
+    res.errors.assign(m, numeric_limits<double>::quiet_NaN());
+    for (int a = 0; a < m; ++a) {
+        vector<double> e(m, 0.0);
+        e[a] = 1.0;
+        if (CholeskySolve(A, e.data(), m)) res.errors[a] = sqrt(e[a] * (weighted ? 1.0 : res.chi2));
+    }
+    return res;
+}
+
+// Starting parameters from the data: the most prominent peak for peak models, a Guinier
+// line through the lowest-q quarter for Guinier and sphere, the high-q tail for Porod
+static vector<double> GuessFitParams(const FitSpec& spec, const vector<double>& x, const vector<double>& y) {
+    vector<double> xs, ys;
+    for (size_t i = 0; i < x.size() && i < y.size(); ++i)
+        if (isfinite(x[i]) && isfinite(y[i]) && x[i] >= spec.xMin && x[i] <= spec.xMax) { xs.push_back(x[i]); ys.push_back(y[i]); }
+    vector<double> p(spec.ParamNames().size(), 0.0);
+    if (xs.size() < 3) return p;
+
+    if (spec.IsPeak()) {
+        const auto peaks = FindProfilePeaks(xs, ys, PeakParams());
+        const auto best = max_element(peaks.begin(), peaks.end(),
+            [](const ProfilePeak& a, const ProfilePeak& b) { return a.height < b.height; });
+        if (best != peaks.end()) {
+            p[0] = best->height; p[1] = best->position; p[2] = best->fwhm > 0 ? best->fwhm : (xs.back() - xs.front()) / 10.0;
+            if (spec.bgDegree >= 0) p[spec.model == FitModel::PseudoVoigt ? 4 : 3] = best->background;
+        }
+        else {
+            const size_t k = max_element(ys.begin(), ys.end()) - ys.begin();
+            const double lo = *min_element(ys.begin(), ys.end());
+            p[0] = ys[k] - lo; p[1] = xs[k]; p[2] = (xs.back() - xs.front()) / 10.0;
+            if (spec.bgDegree >= 0) p[spec.model == FitModel::PseudoVoigt ? 4 : 3] = lo;
+        }
+        if (spec.model == FitModel::PseudoVoigt) p[3] = 0.5;
+        return p;
+    }
+
+    if (spec.model == FitModel::Porod) {
+        vector<double> k;
+        for (size_t i = xs.size() / 2; i < xs.size(); ++i) k.push_back(ys[i] * pow(xs[i], 4));
+        nth_element(k.begin(), k.begin() + k.size() / 2, k.end());
+        p[0] = k[k.size() / 2];
+        return p;
+    }
+
+    // ln I = ln I0 - Rg^2 q^2 / 3 over the first quarter of positive points
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int cnt = 0;
+    for (size_t i = 0; i < xs.size() && cnt < max<int>(3, (int)xs.size() / 4); ++i) {
+        if (ys[i] <= 0) continue;
+        const double q2 = xs[i] * xs[i], l = log(ys[i]);
+        sx += q2; sy += l; sxx += q2 * q2; sxy += q2 * l; ++cnt;
+    }
+    const double den = cnt * sxx - sx * sx;
+    const double slope = cnt >= 2 && den != 0 ? (cnt * sxy - sx * sy) / den : 0.0;
+    const double I0 = cnt > 0 ? exp((sy - slope * sx) / cnt) : ys.front();
+    double Rg = sqrt(max(-3.0 * slope, 0.0));
+    if (!(Rg > 0)) Rg = 1.0 / max(1e-12, xs.back());
+    p[0] = I0;
+    p[1] = spec.model == FitModel::Sphere ? sqrt(5.0 / 3.0) * Rg : Rg;
+    return p;
+}
+
+// "model[,bgDegree[,xmin,xmax]]", e.g. "gaussian,1" or "guinier,0,0.01,0.05"
+static bool ParseFitSpec(const wxString& text, FitSpec& spec, wxString* error) {
+    wxArrayString parts = wxSplit(text, ',');
+    for (auto& s : parts) s.Trim().Trim(false);
+    static const pair<const char*, FitModel> names[] = {
+        { "gaussian", FitModel::Gaussian }, { "lorentzian", FitModel::Lorentzian }, { "pseudovoigt", FitModel::PseudoVoigt },
+        { "guinier", FitModel::Guinier }, { "porod", FitModel::Porod }, { "sphere", FitModel::Sphere } };
+    bool found = false;
+    for (const auto& nm : names)
+        if (!parts.empty() && parts[0].Lower() == nm.first) { spec.model = nm.second; found = true; }
+    long degree = spec.bgDegree;
+    bool ok = found && (parts.size() == 1 || parts.size() == 2 || parts.size() == 4);
+    if (ok && parts.size() >= 2) ok = parts[1].ToLong(&degree) && degree >= -1 && degree <= 3;
+    if (ok && parts.size() == 4) ok = parts[2].ToDouble(&spec.xMin) && parts[3].ToDouble(&spec.xMax) && spec.xMin < spec.xMax;
+    if (!ok) {
+        if (error) *error = "Use model[,bgDegree[,xmin,xmax]] with model gaussian, lorentzian, pseudovoigt, guinier, porod or sphere "
+            "and a background degree of -1..3, e.g. gaussian,1";
+        return false;
+    }
+    spec.bgDegree = (int)degree;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Spot finding
+// ---------------------------------------------------------------------------
+
+struct SpotParams {
+    int window = 7;            // Half-width of the local background box
+    double sigma = 5.0;        // Threshold above the local mean, in local standard deviations
+    double minAbove = 2.0;     // ...and at least this many grey levels above it
+    int minPixels = 2;
+    int maxPixels = 10000;
+};
+
+struct Spot {
+    double x, y;               // Background-subtracted centroid; pixel centers are at +0.5
+    double intensity;          // Sum of value minus local mean over the spot
+    double sigmaX, sigmaY;     // Weighted spread about the centroid
+    int pixels;
+    int peak;
+    wxRect bounds;
+};
+
+// Bragg spots of one frame. A pixel is foreground when it stands out from the mean of the
+// (2*window+1)^2 box around it, read in O(1) from the frame's summed-area tables. Foreground
+// pixels are joined 8-connected by union-find: row bands are labeled in parallel (each band only
+// touches its own pixels), then the seams between bands are merged. Spots are ordered by first
+// pixel in raster order. The optional mask receives every pixel of the spots kept.
+static vector<Spot> FindSpots(const wxImage& img, const FrameTables& tables, const SpotParams& p, RunMask* outMask = nullptr) {
+    vector<Spot> spots;
+    if (!img.IsOk() || tables.Width() != img.GetWidth() || tables.Height() != img.GetHeight()) return spots;
+    const int w = img.GetWidth(), h = img.GetHeight(), k = p.window;
+    const unsigned char* rgb = img.GetData();
+    auto grey = [&](size_t i) { return (int)rgb[i * 3]; };
+    auto localMean = [&](int x, int y, double* var) {
+        const int x0 = max(0, x - k), y0 = max(0, y - k), x1 = min(w, x + k + 1), y1 = min(h, y + k + 1);
+        const double n = (double)(x1 - x0) * (y1 - y0);
+        const double mean = tables.Sum(x0, y0, x1, y1) / n;
+        if (var) *var = max(0.0, tables.SumSq(x0, y0, x1, y1) / n - mean * mean);
+        return mean;
+    };
+
+    // parent[i] == -1 marks background
+    vector<int> parent((size_t)w * h);
+    auto find = [&](int i) {
+        while (parent[i] != i) { parent[i] = parent[parent[i]]; i = parent[i]; }
+        return i;
+    };
+    auto unite = [&](int a, int b) {
+        a = find(a); b = find(b);
+        if (a != b) parent[max(a, b)] = min(a, b);   // Root is the earliest pixel
+    };
+    const double sigma2 = p.sigma * p.sigma;
+    const int bands = min(h, (int)max(1u, thread::hardware_concurrency()) * 4);
+    const int bandRows = (h + bands - 1) / max(1, bands);
+    ParallelFor(0, bands, [&](int b0, int b1) {
+        for (int band = b0; band < b1; ++band) {
+            const int y0 = band * bandRows, y1 = min(h, y0 + bandRows);
+            for (int y = y0; y < y1; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    const int i = y * w + x;
+                    double var;
+                    const double d = grey(i) - localMean(x, y, &var);
+                    if (d < p.minAbove || d * d < sigma2 * var) { parent[i] = -1; continue; }
+                    parent[i] = i;
+                    if (x > 0 && parent[i - 1] >= 0) unite(i, i - 1);
+                    if (y > y0) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            if (x + dx < 0 || x + dx >= w) continue;
+                            if (parent[i - w + dx] >= 0) unite(i, i - w + dx);
+                        }
+                    }
+                }
+            }
+        }
+        });
+    for (int y = bandRows; y < h; y += bandRows) {   // Seams
+        for (int x = 0; x < w; ++x) {
+            const int i = y * w + x;
+            if (parent[i] < 0) continue;
+            for (int dx = -1; dx <= 1; ++dx)
+                if (x + dx >= 0 && x + dx < w && parent[i - w + dx] >= 0) unite(i, i - w + dx);
+        }
+    }
+
+    // Per-band accumulation keyed by root, then a merge. Roots are read without compression.
+    struct Accum { double sw = 0, sx = 0, sy = 0, sxx = 0, syy = 0; int n = 0, peak = 0, x0 = numeric_limits<int>::max(), y0 = numeric_limits<int>::max(), x1 = -1, y1 = -1; };
+    vector<unordered_map<int, Accum>> partial(bands);
+    auto root = [&](int i) { while (parent[i] != i) i = parent[i]; return i; };
+    ParallelFor(0, bands, [&](int b0, int b1) {
+        for (int band = b0; band < b1; ++band) {
+            for (int y = band * bandRows; y < min(h, (band + 1) * bandRows); ++y) {
+                for (int x = 0; x < w; ++x) {
+                    const int i = y * w + x;
+                    if (parent[i] < 0) continue;
+                    const int v = grey(i);
+                    const double wgt = v - localMean(x, y, nullptr);
+                    const double cx = x + 0.5, cy = y + 0.5;
+                    Accum& a = partial[band][root(i)];
+                    a.sw += wgt; a.sx += wgt * cx; a.sy += wgt * cy; a.sxx += wgt * cx * cx; a.syy += wgt * cy * cy;
+                    ++a.n;
+                    a.peak = max(a.peak, v);
+                    a.x0 = min(a.x0, x); a.y0 = min(a.y0, y); a.x1 = max(a.x1, x); a.y1 = max(a.y1, y);
+                }
+            }
+        }
+        });
+    map<int, Accum> merged;
+    for (auto& part : partial) {
+        for (const auto& [r, a] : part) {
+            Accum& m = merged[r];
+            m.sw += a.sw; m.sx += a.sx; m.sy += a.sy; m.sxx += a.sxx; m.syy += a.syy;
+            m.n += a.n;
+            m.peak = max(m.peak, a.peak);
+            m.x0 = min(m.x0, a.x0); m.y0 = min(m.y0, a.y0); m.x1 = max(m.x1, a.x1); m.y1 = max(m.y1, a.y1);
+        }
+    }
+
+    unordered_set<int> kept;
+    for (const auto& [r, a] : merged) {
+        if (a.n < p.minPixels || a.n > p.maxPixels || a.sw <= 0) continue;
+        const double x = a.sx / a.sw, y = a.sy / a.sw;
+        spots.push_back({ x, y, a.sw, sqrt(max(0.0, a.sxx / a.sw - x * x)), sqrt(max(0.0, a.syy / a.sw - y * y)),
+            a.n, a.peak, wxRect(a.x0, a.y0, a.x1 - a.x0 + 1, a.y1 - a.y0 + 1) });
+        if (outMask) kept.insert(r);
+    }
+    if (outMask) {
+        outMask->Clear();
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) {
+                const int i = y * w + x;
+                if (parent[i] >= 0 && kept.count(root(i))) outMask->AddRun(y, x, x + 1);
+            }
+    }
+    return spots;
+}
+
+// ---------------------------------------------------------------------------
+// Synthetic scattering patterns (benchmarks and integrator validation)
+// ---------------------------------------------------------------------------
+
+struct SyntheticRing {
+    double radius;     // Ring radius (pixels from beam center)
+    double amplitude;  // Peak height above the form factor
+    double width;      // Gaussian sigma (pixels)
+};
+
+// Everything needed to re-render a frame; serialized into the raw header so the
+// analytic profile travels with the data
+struct SyntheticPatternParams {
+    int width = LEGACY_WIDTH;
+    int height = LEGACY_HEIGHT;
+    double cx = LEGACY_WIDTH / 2.0;         // Beam center (may be off-center)
+    double cy = LEGACY_HEIGHT / 2.0;
+    double background = 4.0;                // Flat background level
+    double guinierAmp = 180.0;              // Form factor I(r) = A * exp(-r^2 / (3 Rg^2))
+    double guinierRg = 150.0;
+    vector<SyntheticRing> rings{ { 300, 90, 3 }, { 520, 60, 4 }, { 735, 40, 5 } }; // Debye-Scherrer rings
+    double beamstopRadius = 40.0;           // Pixels inside this radius read zero
+    int moduleWidth = 487, moduleHeight = 195; // Detector module tiling (0 disables gaps)
+    int gapX = 7, gapY = 17;                // Dead columns/rows between modules
+    bool poisson = true;                    // Apply Poisson counting noise
+    unsigned seed = 1;
+};
+
+static const char* SYNTHETIC_TAG = "SYNTH1";  // Marks a generated raw header
+
+// Noise-free, unmasked intensity at radius r from the beam center
+static double SyntheticProfile(const SyntheticPatternParams& p, double r) {
+    double I = p.background;
+    if (p.guinierRg > 0) I += p.guinierAmp * exp(-(r * r) / (3.0 * p.guinierRg * p.guinierRg));
+    for (const auto& ring : p.rings) {
+        if (ring.width <= 0) continue;
+        const double d = (r - ring.radius) / ring.width;
+        I += ring.amplitude * exp(-0.5 * d * d);
+    }
+    return I;
+}
+
+// True for pixels hidden by the beamstop or lying in a module gap
+static bool SyntheticPixelMasked(const SyntheticPatternParams& p, int x, int y) {
+    const double dx = x - p.cx, dy = y - p.cy;
+    if (dx * dx + dy * dy < p.beamstopRadius * p.beamstopRadius) return true;
+    if (p.moduleWidth > 0 && p.gapX > 0 && x % (p.moduleWidth + p.gapX) >= p.moduleWidth) return true;
+    if (p.moduleHeight > 0 && p.gapY > 0 && y % (p.moduleHeight + p.gapY) >= p.moduleHeight) return true;
+    return false;
+}
+
+// Beamstop and gap pixels of a generated frame (plus any in `extra`) as runs, so a check of the
+// frame can leave out the same pixels the generator left at zero
+static RunMask SyntheticMaskRuns(const SyntheticPatternParams& p, const RunMask* extra = nullptr) {
+    RunMask mask;
+    for (int y = 0; y < p.height; ++y) {
+        int start = -1;
+        for (int x = 0; x <= p.width; ++x) {
+            const bool masked = x < p.width && (SyntheticPixelMasked(p, x, y) || (extra && extra->Contains(x, y)));
+            if (masked && start < 0) start = x;
+            else if (!masked && start >= 0) { mask.AddRun(y, start, x); start = -1; }
+        }
+    }
+    return mask;
+}
+
+// Space-separated key=value form, e.g. "cx=1041 cy=1108 rings=300:90:3;520:60:4 poisson=1"
+static wxString FormatSyntheticSpec(const SyntheticPatternParams& p) {
+    wxString rings;
+    for (const auto& r : p.rings) {
+        if (!rings.IsEmpty()) rings += ";";
+        rings += wxString::Format("%g:%g:%g", r.radius, r.amplitude, r.width);
+    }
+    return wxString::Format("w=%d h=%d cx=%g cy=%g bg=%g amp=%g rg=%g rings=%s stop=%g module=%dx%d gap=%dx%d poisson=%d seed=%u",
+        p.width, p.height, p.cx, p.cy, p.background, p.guinierAmp, p.guinierRg, rings,
+        p.beamstopRadius, p.moduleWidth, p.moduleHeight, p.gapX, p.gapY, p.poisson ? 1 : 0, p.seed);
+}
+
+// Parse a spec produced by FormatSyntheticSpec (or typed by the user); keys not given keep their values
+static bool ParseSyntheticSpec(const wxString& spec, SyntheticPatternParams& p) {
+    auto parsePair = [](const wxString& v, long& a, long& b) {
+        return v.BeforeFirst('x').ToLong(&a) && v.AfterFirst('x').ToLong(&b);
+    };
+
+    for (const auto& token : wxSplit(spec, ' ')) {
+        if (token.IsEmpty()) continue;
+        const wxString key = token.BeforeFirst('=');
+        const wxString val = token.AfterFirst('=');
+        long l = 0, l2 = 0;
+        double d = 0;
+
+        if (key == "w" && val.ToLong(&l) && l > 0) p.width = (int)l;
+        else if (key == "h" && val.ToLong(&l) && l > 0) p.height = (int)l;
+        else if (key == "cx" && val.ToDouble(&d)) p.cx = d;
+        else if (key == "cy" && val.ToDouble(&d)) p.cy = d;
+        else if (key == "bg" && val.ToDouble(&d)) p.background = d;
+        else if (key == "amp" && val.ToDouble(&d)) p.guinierAmp = d;
+        else if (key == "rg" && val.ToDouble(&d)) p.guinierRg = d;
+        else if (key == "stop" && val.ToDouble(&d)) p.beamstopRadius = d;
+        else if (key == "module" && parsePair(val, l, l2)) { p.moduleWidth = (int)l; p.moduleHeight = (int)l2; }
+        else if (key == "gap" && parsePair(val, l, l2)) { p.gapX = (int)l; p.gapY = (int)l2; }
+        else if (key == "poisson" && val.ToLong(&l)) p.poisson = (l != 0);
+        else if (key == "seed" && val.ToLong(&l)) p.seed = (unsigned)l;
+        else if (key == "rings") {
+            p.rings.clear();
+            for (const auto& r : wxSplit(val, ';')) {
+                wxArrayString f = wxSplit(r, ':');
+                SyntheticRing ring{};
+                if (f.size() != 3 || !f[0].ToDouble(&ring.radius) || !f[1].ToDouble(&ring.amplitude) || !f[2].ToDouble(&ring.width))
+                    return false;
+                p.rings.push_back(ring);
+            }
+        }
+        else return false;
+    }
+    return p.width > 0 && p.height > 0;
+}
+
+// Poisson deviate with mean lambda. std::poisson_distribution rebuilds its tables for every new
+// mean, which dominates rendering; this uses Knuth's method for small means and Hoermann's
+// transformed rejection (PTRS) above that.
+static int SamplePoisson(double lambda, mt19937& rng) {
+    auto uni = [](mt19937& g) { return (g() + 0.5) * (1.0 / 4294967296.0); };  // (0,1), one draw
+    if (lambda < 10.0) {
+        const double L = exp(-lambda);
+        int k = 0;
+        double prod = uni(rng);
+        while (prod > L) { ++k; prod *= uni(rng); }
+        return k;
+    }
+
+    const double slam = sqrt(lambda), loglam = log(lambda);
+    const double b = 0.931 + 2.53 * slam;
+    const double a = -0.059 + 0.02483 * b;
+    const double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+    const double vr = 0.9277 - 3.6224 / (b - 2);
+    for (;;) {
+        const double U = uni(rng) - 0.5;
+        const double V = uni(rng);
+        const double us = 0.5 - fabs(U);
+        const double k = floor((2 * a / us + b) * U + lambda + 0.43);
+        if (us >= 0.07 && V <= vr) return (int)k;
+        if (k < 0 || (us < 0.013 && V > us)) continue;
+        if (log(V) + log(invalpha) - log(a / (us * us) + b) <= -lambda + k * loglam - lgamma(k + 1))
+            return (int)k;
+    }
+}
+
+// Render the pattern as 8-bit grey, rows in parallel. Each row seeds its own
+// generator so the output does not depend on the thread count.
+static vector<unsigned char> RenderSyntheticPattern(const SyntheticPatternParams& p) {
+    vector<unsigned char> gray((size_t)p.width * p.height, 0);
+
+    ParallelFor(0, p.height, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            mt19937 rng(p.seed * 2654435761u + (unsigned)y);
+            unsigned char* row = gray.data() + (size_t)y * p.width;
+            for (int x = 0; x < p.width; ++x) {
+                if (SyntheticPixelMasked(p, x, y)) continue;
+                double I = SyntheticProfile(p, hypot(x - p.cx, y - p.cy));
+                if (p.poisson && I > 0) I = (double)SamplePoisson(I, rng);
+                row[x] = (unsigned char)clamp((int)lround(I), 0, 255);
+            }
+        }
+        });
+    return gray;
+}
+
+// Write grey data in the legacy raw layout: 3072-byte header, then BGRA pixels.
+// The header starts with the synthetic tag and spec so the loader can recover the ground truth.
+static bool WriteLegacyRawFrame(const wxString& path, const vector<unsigned char>& gray, const SyntheticPatternParams& p) {
+    if (p.width != LEGACY_WIDTH || p.height != LEGACY_HEIGHT) return false;
+
+    TraceScope io("write", "io", path.mb_str());
+    ofstream out(path.mb_str(), ios::binary);
+    if (!out) return false;
+
+    vector<char> header((size_t)HEADER_OFFSET, 0);
+    const string tag = string(SYNTHETIC_TAG) + " " + FormatSyntheticSpec(p).ToStdString();
+    copy_n(tag.begin(), min(tag.size(), header.size() - 1), header.begin());
+    out.write(header.data(), (streamsize)header.size());
+
+    // Expand one row at a time to keep the write buffer small
+    vector<unsigned char> row((size_t)p.width * LEGACY_PIXEL_DEPTH);
+    for (int y = 0; y < p.height; ++y) {
+        const unsigned char* src = gray.data() + (size_t)y * p.width;
+        for (int x = 0; x < p.width; ++x) {
+            row[x * 4 + 0] = row[x * 4 + 1] = row[x * 4 + 2] = src[x];
+            row[x * 4 + 3] = 255;
+        }
+        out.write(reinterpret_cast<const char*>(row.data()), (streamsize)row.size());
+    }
+    return (bool)out;
+}
+
+// Write grey data through a wxImage handler (PNG/TIFF). The spec goes to a ".synth" sidecar.
+static bool WriteNativeFrame(const wxString& path, wxBitmapType type, const vector<unsigned char>& gray, const SyntheticPatternParams& p) {
+    wxImage img(p.width, p.height, false);
+    unsigned char* rgb = img.GetData();
+    if (!rgb) return false;
+    for (size_t i = 0; i < gray.size(); ++i) rgb[i * 3 + 0] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = gray[i];
+    TraceScope io("write", "io", path.mb_str());
+    if (!img.SaveFile(path, type)) return false;
+
+    ofstream side((path + ".synth").mb_str());
+    side << SYNTHETIC_TAG << " " << FormatSyntheticSpec(p).ToStdString() << "\n";
+    return (bool)side;
+}
+
+// ---------------------------------------------------------------------------
+// NumPy .npy arrays (format 1.0 written, 1.0-3.0 read; little-endian, C order)
+// ---------------------------------------------------------------------------
+
+// Magic, version, header length and the dict, padded so the data starts 64-byte aligned
+static string NpyHeader(const char* descr, const vector<uint64_t>& shape) {
+    string dict = string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (";
+    for (size_t i = 0; i < shape.size(); ++i) dict += (i ? ", " : "") + to_string(shape[i]);
+    dict += shape.size() == 1 ? ",), }" : "), }";
+    const size_t total = (10 + dict.size() + 1 + 63) / 64 * 64;
+    dict.append(total - 10 - dict.size() - 1, ' ');
+    dict += '\n';
+    string header("\x93NUMPY\x01\x00", 8);
+    header += (char)(dict.size() & 0xff);
+    header += (char)(dict.size() >> 8);
+    return header + dict;
+}
+
+static bool WriteNpyHeader(wxOutputStream& out, const char* descr, const vector<uint64_t>& shape) {
+    const string header = NpyHeader(descr, shape);
+    out.Write(header.data(), header.size());
+    return out.LastWrite() == header.size();
+}
+
+// Whole array from one contiguous buffer
+static bool WriteNpy(wxOutputStream& out, const char* descr, const vector<uint64_t>& shape, const void* data, size_t bytes) {
+    if (!WriteNpyHeader(out, descr, shape)) return false;
+    if (bytes == 0) return true;
+    out.Write(data, bytes);
+    return out.LastWrite() == bytes;
+}
+
+struct NpyArray {
+    char kind = 0;             // 'u', 'i', 'f', 'b' or 'S'
+    int itemSize = 0;
+    vector<uint64_t> shape;
+    vector<unsigned char> data;
+
+    uint64_t Count() const {
+        uint64_t n = 1;
+        for (uint64_t d : shape) n *= d;
+        return n;
+    }
+
+    // Numeric element i as double (0 for strings). Only the sizes ReadNpy accepts are handled.
+    double At(size_t i) const {
+        const unsigned char* p = data.data() + i * itemSize;
+        auto load = [p](auto v) { memcpy(&v, p, sizeof(v)); return (double)v; };
+        switch (kind) {
+        case 'b':
+        case 'u': {
+            double v = 0.0;
+            switch (itemSize) {
+            case 1: v = *p; break;
+            case 2: v = load(uint16_t()); break;
+            case 4: v = load(uint32_t()); break;
+            case 8: v = load(uint64_t()); break;
+            }
+            return kind == 'b' ? (v != 0.0 ? 1.0 : 0.0) : v;
+        }
+        case 'i':
+            switch (itemSize) {
+            case 1: return (int8_t)*p;
+            case 2: return load(int16_t());
+            case 4: return load(int32_t());
+            case 8: return load(int64_t());
+            }
+            return 0.0;
+        case 'f':
+            switch (itemSize) {
+            case 4: return load(float());
+            case 8: return load(double());
+            }
+            return 0.0;
+        }
+        return 0.0;
+    }
+
+    // Element sizes At can read for a numeric kind
+    static bool SupportedSize(char kind, int itemSize) {
+        if (kind == 'S') return itemSize > 0;
+        if (kind == 'f') return itemSize == 4 || itemSize == 8;
+        return itemSize == 1 || itemSize == 2 || itemSize == 4 || itemSize == 8;
+    }
+};
+
+static bool ReadNpy(wxInputStream& in, NpyArray& out, wxString* error) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return false; };
+    unsigned char pre[10];
+    if (!in.ReadAll(pre, 8) || memcmp(pre, "\x93NUMPY", 6) != 0) return fail("Not a NumPy .npy array.");
+    uint32_t headerLen = 0;
+    if (pre[6] == 1) {
+        if (!in.ReadAll(pre + 8, 2)) return fail("Truncated .npy header.");
+        headerLen = pre[8] | (pre[9] << 8);
+    }
+    else {
+        unsigned char len[4];
+        if (!in.ReadAll(len, 4)) return fail("Truncated .npy header.");
+        headerLen = len[0] | (len[1] << 8) | (len[2] << 16) | ((uint32_t)len[3] << 24);
+    }
+    string dict(headerLen, '\0');
+    if (!in.ReadAll(&dict[0], headerLen)) return fail("Truncated .npy header.");
+
+    // The header is a Python dict literal with fixed keys; pick the three fields out directly
+    const size_t d = dict.find("'descr'");
+    const size_t q1 = d == string::npos ? d : dict.find('\'', d + 7);
+    const size_t q2 = q1 == string::npos ? q1 : dict.find('\'', q1 + 1);
+    if (q2 == string::npos || q2 - q1 < 4) return fail("Malformed .npy header.");
+    const string descr = dict.substr(q1 + 1, q2 - q1 - 1);
+    if (descr[0] == '>' && descr.substr(2) != "1") return fail("Big-endian .npy arrays are not supported.");
+    out.kind = descr[1];
+    out.itemSize = atoi(descr.c_str() + 2);
+    if (string("uifbS").find(out.kind) == string::npos || !NpyArray::SupportedSize(out.kind, out.itemSize)) return fail("Unsupported .npy dtype: " + wxString(descr));
+
+    const size_t s = dict.find("'shape'");
+    const size_t open = s == string::npos ? s : dict.find('(', s);
+    const size_t close = open == string::npos ? open : dict.find(')', open);
+    if (close == string::npos) return fail("Malformed .npy header.");
+    out.shape.clear();
+    for (size_t i = open + 1; i < close;) {
+        if (isdigit((unsigned char)dict[i])) {
+            out.shape.push_back(strtoull(dict.c_str() + i, nullptr, 10));
+            while (i < close && isdigit((unsigned char)dict[i])) ++i;
+        }
+        else ++i;
+    }
+    if (dict.find("'fortran_order': True") != string::npos && out.shape.size() > 1)
+        return fail("Fortran-ordered .npy arrays are not supported.");
+
+    const uint64_t bytes = out.Count() * (uint64_t)out.itemSize;
+    if (bytes > ((uint64_t)1 << 40)) return fail("The .npy array is too large.");
+    out.data.resize((size_t)bytes);
+    if (bytes && !in.ReadAll(out.data.data(), (size_t)bytes)) return fail("Truncated .npy data.");
+    return true;
+}
+
+// Values to grey replicated in RGB. Data already within 0..255 keeps its values; anything else
+// is stretched over its finite min..max. Non-finite values become 0. A correction is applied
+// to the raw value as each pixel is written. Masters are in grey levels and a stretch differs
+// from frame to frame, so correcting a stretched frame is refused (false).
+template <class Get>
+static bool ValuesToGray(size_t n, Get value, unsigned char* rgb, const FrameCorrection* corr = nullptr) {
+    double lo = numeric_limits<double>::infinity(), hi = -lo;
+    for (size_t i = 0; i < n; ++i) {
+        const double v = value(i);
+        if (isfinite(v)) { lo = min(lo, v); hi = max(hi, v); }
+    }
+    const bool direct = lo >= 0.0 && hi <= 255.0;
+    if (corr && !direct) return false;
+    const double scale = direct ? 1.0 : (hi > lo ? 255.0 / (hi - lo) : 0.0);
+    const double offset = direct ? 0.0 : lo;
+    for (size_t i = 0; i < n; ++i) {
+        const double v = value(i);
+        const double g = isfinite(v) ? (v - offset) * scale : 0.0;
+        rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = corr ? corr->Apply(i, g) : (unsigned char)lround(min(255.0, max(0.0, g)));
+    }
+    return true;
+}
+
+static const char* const STRETCHED_CORRECTION_ERROR = "Dark, background and flat corrections apply to frames stored in grey "
+    "levels (0..255). This frame's values are rescaled on loading, so it cannot be corrected; clear the corrections to open it.";
+
+// 2D numeric array as a grey frame
+static bool NpyToFrame(const NpyArray& a, wxImage& img, wxString* error, const FrameCorrection* corr) {
+    if (a.shape.size() != 2 || a.kind == 'S' || a.Count() == 0) {
+        if (error) *error = "The .npy array is not a two-dimensional numeric frame.";
+        return false;
+    }
+    if (corr && !corr->Fits((int)a.shape[1], (int)a.shape[0], error)) return false;
+    img = wxImage((int)a.shape[1], (int)a.shape[0], false);
+    if (!img.GetData()) { if (error) *error = "Failed to allocate image buffer."; return false; }
+    if (!ValuesToGray((size_t)a.Count(), [&a](size_t i) { return a.At(i); }, img.GetData(), corr)) {
+        if (error) *error = STRETCHED_CORRECTION_ERROR;
+        return false;
+    }
+    return true;
+}
+
+static bool ReadNpyFrame(const wxString& path, wxImage& img, wxString* error, const FrameCorrection* corr = nullptr) {
+    wxFileInputStream file(path);
+    if (!file.IsOk()) { if (error) *error = "Failed to open file: " + path; return false; }
+    NpyArray a;
+    return ReadNpy(file, a, error) && NpyToFrame(a, img, error, corr);
+}
+
+// All arrays of an .npz archive by name (without the .npy suffix)
+static bool ReadNpz(const wxString& path, map<string, NpyArray>& arrays, wxString* error) {
+    wxFileInputStream file(path);
+    if (!file.IsOk()) { if (error) *error = "Could not open " + path; return false; }
+    wxZipInputStream zip(file);
+    unique_ptr<wxZipEntry> entry;
+    while (entry.reset(zip.GetNextEntry()), entry) {
+        string name(entry->GetName().utf8_str());
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0) name.resize(name.size() - 4);
+        if (!ReadNpy(zip, arrays[name], error)) return false;
+    }
+    return true;
+}
+
+// True when an .npz holds a "frame" array (as written by the frame export), which is then
+// opened as an image rather than imported as profiles. Reads only the directory entries.
+static bool NpzHasFrame(const wxString& path) {
+    wxFileInputStream file(path);
+    if (!file.IsOk()) return false;
+    wxZipInputStream zip(file);
+    unique_ptr<wxZipEntry> entry;
+    while (entry.reset(zip.GetNextEntry()), entry)
+        if (entry->GetName() == "frame.npy" || entry->GetName() == "frame") return true;
+    return false;
+}
+
+// The "frame" array of an .npz archive as a grey frame
+static bool ReadNpzFrame(const wxString& path, wxImage& img, wxString* error, const FrameCorrection* corr = nullptr) {
+    map<string, NpyArray> arrays;
+    if (!ReadNpz(path, arrays, error)) return false;
+    auto frame = arrays.find("frame");
+    if (frame == arrays.end()) {
+        if (error) *error = "No frame array in " + path;
+        return false;
+    }
+    return NpyToFrame(frame->second, img, error, corr);
+}
+
+// ---------------------------------------------------------------------------
+// Master calibration frames (dark, flat)
+// ---------------------------------------------------------------------------
+
+// Per-pixel mean and variance of a stack of frames, in decoded grey levels
+struct MasterFrame {
+    int width = 0, height = 0;
+    uint32_t frames = 0;          // Frames that went in
+    vector<float> mean, variance;
+    vector<uint32_t> count;       // Samples kept per pixel; fewer than frames where outliers were rejected
+
+    bool IsOk() const { return width > 0 && height > 0 && mean.size() == (size_t)width * height; }
+    uint64_t Bytes() const { return mean.size() * 4 + variance.size() * 4 + count.size() * 4; }
+};
+
+// mean, variance (float32) and count (uint32) arrays of height x width in an .npz
+static bool WriteMasterFrame(const wxString& path, const MasterFrame& m) {
+    wxFileOutputStream file(path);
+    if (!file.IsOk() || !m.IsOk()) return false;
+    wxZipOutputStream zip(file, 0);
+    const vector<uint64_t> shape = { (uint64_t)m.height, (uint64_t)m.width };
+    const size_t n = m.mean.size();
+    const bool ok =
+        zip.PutNextEntry("mean.npy") && WriteNpy(zip, "<f4", shape, m.mean.data(), n * 4) &&
+        zip.PutNextEntry("variance.npy") && WriteNpy(zip, "<f4", shape, m.variance.data(), m.variance.size() * 4) &&
+        zip.PutNextEntry("count.npy") && WriteNpy(zip, "<u4", shape, m.count.data(), m.count.size() * 4) &&
+        zip.PutNextEntry("frames.npy") && WriteNpy(zip, "<u4", { 1 }, &m.frames, 4);
+    return zip.Close() && ok && file.Close();
+}
+
+// An .npz from WriteMasterFrame, or any 2D .npy taken as the mean
+static bool ReadMasterFrame(const wxString& path, MasterFrame& m, wxString* error) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return false; };
+    map<string, NpyArray> arrays;
+    if (wxFileName(path).GetExt().Lower() == "npy") {
+        wxFileInputStream file(path);
+        if (!file.IsOk()) return fail("Could not open " + path);
+        if (!ReadNpy(file, arrays["mean"], error)) return false;
+    }
+    else if (!ReadNpz(path, arrays, error)) return false;
+
+    auto mean = arrays.find("mean");
+    if (mean == arrays.end() || mean->second.shape.size() != 2 || mean->second.kind == 'S' || mean->second.Count() == 0)
+        return fail("No two-dimensional mean frame in " + path);
+    const NpyArray& a = mean->second;
+    m = MasterFrame();
+    m.height = (int)a.shape[0];
+    m.width = (int)a.shape[1];
+    m.mean.resize((size_t)a.Count());
+    for (size_t i = 0; i < m.mean.size(); ++i) m.mean[i] = (float)a.At(i);
+    auto var = arrays.find("variance");
+    if (var != arrays.end() && var->second.shape == a.shape) {
+        m.variance.resize(m.mean.size());
+        for (size_t i = 0; i < m.variance.size(); ++i) m.variance[i] = (float)var->second.At(i);
+    }
+    auto cnt = arrays.find("count");
+    if (cnt != arrays.end() && cnt->second.shape == a.shape) {
+        m.count.resize(m.mean.size());
+        for (size_t i = 0; i < m.count.size(); ++i) m.count[i] = (uint32_t)cnt->second.At(i);
+    }
+    auto frames = arrays.find("frames");
+    if (frames != arrays.end() && frames->second.Count() == 1) m.frames = (uint32_t)frames->second.At(0);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Sparse frames
+// ---------------------------------------------------------------------------
+
+// Pixel-to-ring lookup for one detector geometry: each pixel goes to the ring R = Rmin + k*step
+// nearest its centre's distance from (cx, cy), as in RadialProfileInMask over the whole frame.
+// Built once and shared by every frame of that size, so integration is a table lookup per pixel.
+struct RadialBinMap {
+    int width = 0, height = 0;
+    double cx = 0.0, cy = 0.0;
+    int Rmin = 0, Rmax = 0, step = 1;
+    vector<int32_t> bin;          // Per pixel; -1 outside the rings or excluded
+    vector<uint32_t> pixels;      // Pixels per ring
+
+    int Bins() const { return (int)pixels.size(); }
+    uint64_t Bytes() const { return bin.size() * 4 + pixels.size() * 4; }
+    bool Matches(int w, int h, double x, double y, int rmin, int rmax, int s) const {
+        return w == width && h == height && x == cx && y == cy && rmin == Rmin && rmax == Rmax && s == step;
+    }
+
+    void Build(int w, int h, double x, double y, int rmin, int rmax, int s, const RunMask* exclude = nullptr) {
+        width = w; height = h; cx = x; cy = y; Rmin = rmin; Rmax = rmax; step = s;
+        const int bins = rmax >= rmin && s > 0 ? (rmax - rmin) / s + 1 : 0;
+        bin.assign((size_t)w * h, -1);
+        pixels.assign(bins, 0);
+        ParallelFor(0, h, [&](int y0, int y1) {
+            for (int py = y0; py < y1; ++py) {
+                const double dy = py + 0.5 - cy;
+                int32_t* row = &bin[(size_t)py * w];
+                for (int px = 0; px < w; ++px) {
+                    const double dx = px + 0.5 - cx;
+                    const long k = lround((sqrt(dx * dx + dy * dy) - Rmin) / step);
+                    if (k >= 0 && k < bins) row[px] = (int32_t)k;
+                }
+            }
+            });
+        if (exclude) {
+            for (const PixelRun& r : exclude->Runs()) {
+                if (r.y < 0 || r.y >= h) continue;
+                for (int px = max(0, r.x0); px < min(w, r.x1); ++px) bin[(size_t)r.y * w + px] = -1;
+            }
+        }
+        for (int32_t k : bin) if (k >= 0) ++pixels[k];
+    }
+};
+
+// A frame as its nonzero pixels: ascending indices y*width+x and their counts. Low-count
+// frames (photon counting, event slices) are mostly zeros, so everything that iterates only
+// the nonzeros costs in proportion to the counts rather than to the detector size.
+struct SparseFrame {
+    int width = 0, height = 0;
+    vector<uint32_t> index;
+    vector<uint32_t> counts;
+
+    size_t Nonzero() const { return index.size(); }
+    double Density() const { return width > 0 && height > 0 ? (double)index.size() / ((double)width * height) : 0.0; }
+    uint64_t Bytes() const { return (index.size() + counts.size()) * 4; }
+    uint64_t Total() const {
+        uint64_t n = 0;
+        for (uint32_t c : counts) n += c;
+        return n;
+    }
+};
+
+// Nonzero grey levels of a decoded frame
+static SparseFrame MakeSparseFrame(const wxImage& img) {
+    SparseFrame f;
+    f.width = img.GetWidth();
+    f.height = img.GetHeight();
+    const unsigned char* rgb = img.GetData();
+    const size_t n = (size_t)f.width * f.height;
+    for (size_t i = 0; i < n; ++i) {
+        if (rgb[i * 3] == 0) continue;
+        f.index.push_back((uint32_t)i);
+        f.counts.push_back(rgb[i * 3]);
+    }
+    return f;
+}
+
+// Dense grey image for display, counts times `scale`; anything above 255 saturates
+static wxImage SparseToImage(const SparseFrame& f, double scale = 1.0) {
+    wxImage img(f.width, f.height, true);
+    unsigned char* rgb = img.GetData();
+    if (!rgb) return img;
+    for (size_t i = 0; i < f.index.size(); ++i) {
+        const unsigned char v = (unsigned char)min(255.0, f.counts[i] * scale + 0.5);
+        unsigned char* p = rgb + (size_t)f.index[i] * 3;
+        p[0] = p[1] = p[2] = v;
+    }
+    return img;
+}
+
+// Ring averages over the nonzeros only. The zeros still count as samples: each ring's pixel
+// count comes from the map, so mean and standard error equal those of the dense frame.
+static vector<RadialAvgPoint> IntegrateSparse(const SparseFrame& f, const RadialBinMap& map, int* outValid = nullptr) {
+    const int bins = map.Bins();
+    vector<double> sum(bins), sumSq(bins);
+    for (size_t i = 0; i < f.index.size(); ++i) {
+        const int32_t k = map.bin[f.index[i]];
+        if (k < 0) continue;
+        const double v = f.counts[i];
+        sum[k] += v;
+        sumSq[k] += v * v;
+    }
+
+    vector<RadialAvgPoint> data;
+    data.reserve(bins);
+    int validCount = 0;
+    for (int k = 0; k < bins; ++k) {
+        const int R = map.Rmin + k * map.step;
+        const int n = (int)map.pixels[k];
+        if (n == 0) { data.push_back({ R, numeric_limits<double>::quiet_NaN(), 0 }); continue; }
+        const double var = n > 1 ? max(0.0, (sumSq[k] - sum[k] * sum[k] / n) / (n - 1)) : 0.0;
+        data.push_back({ R, sum[k] / n, n, n > 1 ? sqrt(var / n) : numeric_limits<double>::quiet_NaN() });
+        ++validCount;
+    }
+    if (outValid) *outValid = validCount;
+    return data;
+}
+
+// Histogram of pixel counts 0..bins-1 (higher counts land in the last bin); bin 0 is the zeros
+static void AddSparseHistogram(const SparseFrame& f, vector<uint64_t>& hist) {
+    if (hist.empty()) return;
+    const uint32_t last = (uint32_t)hist.size() - 1;
+    hist[0] += (uint64_t)f.width * f.height - f.index.size();
+    for (uint32_t c : f.counts) ++hist[min(c, last)];
+}
+
+// Column and row sums (projections onto x and y), accumulated into vectors of width and height
+static void AddSparseProjections(const SparseFrame& f, vector<double>& columns, vector<double>& rows) {
+    columns.resize(f.width);
+    rows.resize(f.height);
+    for (size_t i = 0; i < f.index.size(); ++i) {
+        columns[f.index[i] % f.width] += f.counts[i];
+        rows[f.index[i] / f.width] += f.counts[i];
+    }
+}
+
+// Many frames of one size in an .npz as compressed-row arrays: shape (height, width), offsets
+// (frames + 1, where frame f is entries offsets[f]..offsets[f+1]), index and counts (uint32)
+static bool WriteSparseFrames(const wxString& path, const vector<SparseFrame>& frames) {
+    if (frames.empty()) return false;
+    vector<uint64_t> offsets(1, 0);
+    for (const SparseFrame& f : frames) {
+        if (f.width != frames[0].width || f.height != frames[0].height) return false;
+        offsets.push_back(offsets.back() + f.index.size());
+    }
+    wxFileOutputStream file(path);
+    if (!file.IsOk()) return false;
+    wxZipOutputStream zip(file, 0);
+    const int64_t shape[2] = { frames[0].height, frames[0].width };
+    bool ok = zip.PutNextEntry("shape.npy") && WriteNpy(zip, "<i8", { 2 }, shape, sizeof(shape)) &&
+        zip.PutNextEntry("offsets.npy") && WriteNpy(zip, "<u8", { offsets.size() }, offsets.data(), offsets.size() * 8);
+    // index and counts are concatenated frame by frame straight into the entries
+    for (int column = 0; column < 2 && ok; ++column) {
+        ok = zip.PutNextEntry(column == 0 ? "index.npy" : "counts.npy") && WriteNpyHeader(zip, "<u4", { offsets.back() });
+        for (size_t i = 0; i < frames.size() && ok; ++i) {
+            const vector<uint32_t>& v = column == 0 ? frames[i].index : frames[i].counts;
+            if (v.empty()) continue;
+            zip.Write(v.data(), v.size() * 4);
+            ok = zip.LastWrite() == v.size() * 4;
+        }
+    }
+    return zip.Close() && ok && file.Close();
+}
+
+static bool ReadSparseFrames(const wxString& path, vector<SparseFrame>& frames, wxString* error) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return false; };
+    map<string, NpyArray> arrays;
+    if (!ReadNpz(path, arrays, error)) return false;
+    const NpyArray& shape = arrays["shape"];
+    const NpyArray& offsets = arrays["offsets"];
+    const NpyArray& index = arrays["index"];
+    const NpyArray& counts = arrays["counts"];
+    if (shape.Count() != 2 || offsets.Count() < 2 || index.Count() != counts.Count() || offsets.At(offsets.Count() - 1) != (double)index.Count())
+        return fail("No sparse frames (shape, offsets, index, counts) in " + path);
+    const int height = (int)shape.At(0), width = (int)shape.At(1);
+    const uint64_t pixels = (uint64_t)width * height;
+    if (width <= 0 || height <= 0 || pixels > UINT32_MAX) return fail("Invalid sparse frame shape in " + path);
+
+    // Plain uint32 columns are copied as they are; other integer types go through At()
+    auto column = [](const NpyArray& a, size_t begin, size_t end, vector<uint32_t>& out) {
+        out.resize(end - begin);
+        if (a.kind == 'u' && a.itemSize == 4) {
+            if (end > begin) memcpy(out.data(), a.data.data() + begin * 4, (end - begin) * 4);
+        }
+        else for (size_t i = begin; i < end; ++i) out[i - begin] = (uint32_t)a.At(i);
+    };
+    frames.assign((size_t)offsets.Count() - 1, SparseFrame());
+    for (size_t f = 0; f < frames.size(); ++f) {
+        const size_t begin = (size_t)offsets.At(f), end = (size_t)offsets.At(f + 1);
+        if (end < begin || end > index.Count()) return fail("Corrupt sparse frame offsets in " + path);
+        frames[f].width = width;
+        frames[f].height = height;
+        column(index, begin, end, frames[f].index);
+        column(counts, begin, end, frames[f].counts);
+        for (uint32_t i : frames[f].index) if (i >= pixels) return fail("Sparse pixel index out of range in " + path);
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Event-mode data
+// ---------------------------------------------------------------------------
+
+// One detected photon or neutron as recorded in event files and streams (16 bytes, little-endian)
+struct EventRecord {
+    uint16_t x, y;
+    uint32_t tof;     // Time of flight in ns since the source pulse; 0 without a pulsed source
+    uint64_t t;       // Arrival time in ns since the start of the run
+};
+static_assert(sizeof(EventRecord) == 16, "Event records are 16 bytes");
+
+// How events become frames: fixed-length time slices, optionally split into wavelength planes
+// by time of flight (neutrons: lambda [A] = 3956.03 * tof [s] / L [m])
+struct EventBinning {
+    int width = 0, height = 0;
+    double sliceSeconds = 1.0;
+    int wavelengthBins = 0;                   // 0: one plane, time of flight ignored
+    double lambdaMin = 1.0, lambdaMax = 10.0; // Angstrom
+    double flightPath = 10.0;                 // Source to detector, m
+
+    int Planes() const { return max(1, wavelengthBins); }
+    uint64_t SliceNs() const { return max<uint64_t>(1, (uint64_t)llround(sliceSeconds * 1e9)); }
+    double Wavelength(uint32_t tof) const { return 3956.034e-9 * tof / flightPath; }
+    double PlaneLambda(int plane) const { return lambdaMin + (lambdaMax - lambdaMin) * plane / Planes(); }
+
+    // Wavelength plane of an event, -1 when out of range
+    int Plane(uint32_t tof) const {
+        if (wavelengthBins <= 0) return 0;
+        const double u = (Wavelength(tof) - lambdaMin) / (lambdaMax - lambdaMin) * wavelengthBins;
+        return u >= 0.0 && u < wavelengthBins ? (int)u : -1;
+    }
+};
+
+// "width,height,sliceSeconds[,lambdaBins,lambdaMin,lambdaMax,flightPath]"
+static bool ParseEventBinning(const wxString& text, EventBinning& out, wxString* error) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return false; };
+    wxArrayString parts = wxSplit(text, ',');
+    EventBinning b;
+    long w = 0, h = 0, bins = 0;
+    if ((parts.size() != 3 && parts.size() != 7) || !parts[0].ToLong(&w) || !parts[1].ToLong(&h) || !parts[2].ToDouble(&b.sliceSeconds))
+        return fail("Use width,height,sliceSeconds[,lambdaBins,lambdaMin,lambdaMax,flightPath] like 2048,2048,0.1 or 256,256,1,50,1,10,20");
+    if (parts.size() == 7 && (!parts[3].ToLong(&bins) || !parts[4].ToDouble(&b.lambdaMin) || !parts[5].ToDouble(&b.lambdaMax) ||
+        !parts[6].ToDouble(&b.flightPath)))
+        return fail("Invalid wavelength binning.");
+    if (w < 1 || h < 1 || w > 65536 || h > 65536 || !(b.sliceSeconds > 0))
+        return fail("The detector needs 1..65536 pixels per side and a positive slice length.");
+    if (parts.size() == 7 && (bins < 1 || bins > 1000 || !(b.lambdaMin >= 0) || !(b.lambdaMax > b.lambdaMin) || !(b.flightPath > 0)))
+        return fail("Wavelength binning needs 1..1000 bins, 0 <= lambdaMin < lambdaMax and a positive flight path.");
+    b.width = (int)w;
+    b.height = (int)h;
+    b.wavelengthBins = (int)bins;
+    if ((uint64_t)b.width * b.height * b.Planes() > ((uint64_t)1 << 26))
+        return fail("width x height x lambdaBins must stay below 64M bins.");
+    out = b;
+    return true;
+}
+
+// Histograms an event stream into time slices (and wavelength planes) of sparse frames. Each
+// chunk of events is split across threads that bin their share into private per-slice lists;
+// after the chunk these are merged into the slice histograms, in parallel over slices. A slice
+// histogram starts as a plain list of bins, sorted and run-length counted when the slice is
+// emitted, and turns into a dense count array (plus the list of bins hit) once it holds more
+// events than a quarter of the bins, so memory follows the counts in short slices and is
+// bounded by the detector size in long ones. Events may arrive up to one slice out of order:
+// a slice is emitted once events two slices later have been seen (or at Finish()). Slices
+// without events are skipped; events for slices already emitted are counted as late and dropped.
+class EventHistogrammer {
+public:
+    typedef function<void(int64_t slice, const vector<SparseFrame>& planes)> EmitFn;
+
+    EventHistogrammer(const EventBinning& binning, EmitFn emit)
+        : m_binning(binning), m_emit(move(emit)), m_pixels((size_t)binning.width * binning.height),
+        m_bins(m_pixels * binning.Planes()), m_slots((int)max(1u, thread::hardware_concurrency())),
+        m_partials(m_slots), m_charge(MemTag::Histogram) {}
+    EventHistogrammer(const EventHistogrammer&) = delete;
+    EventHistogrammer& operator=(const EventHistogrammer&) = delete;
+
+    void Add(const EventRecord* events, size_t n) {
+        const uint64_t sliceNs = m_binning.SliceNs();
+        const int64_t emitted = m_next;
+        vector<uint64_t> dropped(m_slots), late(m_slots);
+        ParallelFor(0, m_slots, [&](int b, int e) {
+            for (int s = b; s < e; ++s) {
+                vector<Partial>& parts = m_partials[s];
+                Partial* cur = nullptr;
+                for (size_t i = n * s / m_slots; i < n * (s + 1) / m_slots; ++i) {
+                    const EventRecord& ev = events[i];
+                    const int plane = m_binning.Plane(ev.tof);
+                    if (ev.x >= m_binning.width || ev.y >= m_binning.height || plane < 0) { ++dropped[s]; continue; }
+                    const int64_t slice = (int64_t)(ev.t / sliceNs);
+                    if (slice < emitted) { ++late[s]; continue; }
+                    if (!cur || cur->slice != slice) cur = &Find(parts, slice);
+                    cur->bins.push_back((uint32_t)(plane * m_pixels + (size_t)ev.y * m_binning.width + ev.x));
+                }
+            }
+            });
+
+        // Merge the thread lists of each slice; slices are independent
+        vector<Slice*> merging;
+        for (vector<Partial>& parts : m_partials) {
+            for (Partial& p : parts) {
+                unique_ptr<Slice>& slice = m_open[p.slice];
+                if (!slice) slice.reset(new Slice);
+                if (slice->incoming.empty()) merging.push_back(slice.get());
+                slice->incoming.push_back(&p.bins);
+                m_latest = max(m_latest, p.slice);
+            }
+        }
+        ParallelFor(0, (int)merging.size(), [&](int b, int e) {
+            for (int i = b; i < e; ++i) Merge(*merging[i]);
+            });
+        for (vector<Partial>& parts : m_partials) parts.clear();
+
+        m_events += n;
+        for (int s = 0; s < m_slots; ++s) { m_dropped += dropped[s]; m_late += late[s]; }
+        EmitBefore(m_latest - 1);
+        UpdateCharge();
+    }
+
+    void Finish() {
+        EmitBefore(m_latest + 1);
+        UpdateCharge();
+    }
+
+    uint64_t Events() const { return m_events; }
+    uint64_t Dropped() const { return m_dropped; }
+    uint64_t Late() const { return m_late; }
+
+private:
+    struct Partial {
+        int64_t slice;
+        vector<uint32_t> bins;
+    };
+    struct Slice {
+        vector<uint32_t> list;                      // One entry per event while sparse
+        vector<uint32_t> n;                         // Planes x pixels counts once dense
+        vector<uint32_t> touched;                   // Bins with n > 0
+        vector<const vector<uint32_t>*> incoming;   // Thread lists of the current chunk
+    };
+
+    static Partial& Find(vector<Partial>& parts, int64_t slice) {
+        for (Partial& p : parts) if (p.slice == slice) return p;
+        parts.push_back({ slice, {} });
+        return parts.back();
+    }
+
+    void Merge(Slice& s) {
+        for (const vector<uint32_t>* bins : s.incoming) {
+            if (s.n.empty() && s.list.size() + bins->size() > m_bins / 4) {
+                s.n = AcquireDense();
+                for (uint32_t bin : s.list) if (s.n[bin]++ == 0) s.touched.push_back(bin);
+                vector<uint32_t>().swap(s.list);
+            }
+            if (s.n.empty()) s.list.insert(s.list.end(), bins->begin(), bins->end());
+            else for (uint32_t bin : *bins) if (s.n[bin]++ == 0) s.touched.push_back(bin);
+        }
+        s.incoming.clear();
+    }
+
+    // Zeroed count arrays are recycled between slices
+    vector<uint32_t> AcquireDense() {
+        lock_guard<mutex> lock(m_poolMutex);
+        if (m_dense.empty()) return vector<uint32_t>(m_bins, 0);
+        vector<uint32_t> n = move(m_dense.back());
+        m_dense.pop_back();
+        return n;
+    }
+
+    // Emit every open slice before `limit`, oldest first
+    void EmitBefore(int64_t limit) {
+        while (!m_open.empty() && m_open.begin()->first < limit) {
+            const int64_t slice = m_open.begin()->first;
+            unique_ptr<Slice> s = move(m_open.begin()->second);
+            m_open.erase(m_open.begin());
+            vector<SparseFrame> planes(m_binning.Planes());
+            for (SparseFrame& f : planes) { f.width = m_binning.width; f.height = m_binning.height; }
+
+            // Bins are plane-major, so sorting them orders each plane's pixels too
+            auto put = [&](uint32_t bin, uint32_t count) {
+                SparseFrame& f = planes[bin / m_pixels];
+                f.index.push_back((uint32_t)(bin % m_pixels));
+                f.counts.push_back(count);
+            };
+            if (s->n.empty()) {
+                sort(s->list.begin(), s->list.end());
+                for (size_t i = 0; i < s->list.size();) {
+                    size_t j = i + 1;
+                    while (j < s->list.size() && s->list[j] == s->list[i]) ++j;
+                    put(s->list[i], (uint32_t)(j - i));
+                    i = j;
+                }
+            }
+            else {
+                sort(s->touched.begin(), s->touched.end());
+                for (uint32_t bin : s->touched) { put(bin, s->n[bin]); s->n[bin] = 0; }
+                m_dense.push_back(move(s->n));
+            }
+            m_next = slice + 1;
+            m_emit(slice, planes);
+        }
+    }
+
+    void UpdateCharge() {
+        uint64_t bytes = m_dense.size() * m_bins * 4;
+        for (const auto& open : m_open) {
+            const Slice& s = *open.second;
+            bytes += (s.list.capacity() + s.n.size() + s.touched.capacity()) * 4;
+        }
+        m_charge.Set(bytes);
+    }
+
+    const EventBinning m_binning;
+    EmitFn m_emit;
+    const size_t m_pixels, m_bins;
+    const int m_slots;
+    vector<vector<Partial>> m_partials;      // Per thread, bins of the current chunk by slice
+    map<int64_t, unique_ptr<Slice>> m_open;  // Slices not yet emitted
+    vector<vector<uint32_t>> m_dense;        // Spare zeroed count arrays
+    mutex m_poolMutex;
+    MemCharge m_charge;
+    int64_t m_next = INT64_MIN;              // First slice not yet emitted
+    int64_t m_latest = INT64_MIN + 2;        // Newest slice seen
+    uint64_t m_events = 0, m_dropped = 0, m_late = 0;
+};
+
+#ifdef HAVE_HDF5
+// ---------------------------------------------------------------------------
+// HDF5 / NeXus (only when built against libhdf5)
+// ---------------------------------------------------------------------------
+
+// Owns an HDF5 identifier and closes it with the matching H5*close
+class H5Id {
+public:
+    H5Id(hid_t id, herr_t(*close)(hid_t)) : m_id(id), m_close(close) {}
+    H5Id(const H5Id&) = delete;
+    H5Id& operator=(const H5Id&) = delete;
+    ~H5Id() { if (m_id >= 0) m_close(m_id); }
+    operator hid_t() const { return m_id; }
+    bool IsOk() const { return m_id >= 0; }
+
+private:
+    hid_t m_id;
+    herr_t(*m_close)(hid_t);
+};
+
+static void H5WriteStringAttr(hid_t obj, const char* name, const char* value) {
+    H5Id type(H5Tcopy(H5T_C_S1), H5Tclose);
+    H5Tset_size(type, strlen(value));
+    H5Id space(H5Screate(H5S_SCALAR), H5Sclose);
+    H5Id attr(H5Acreate2(obj, name, type, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose);
+    H5Awrite(attr, type, value);
+}
+
+// Group with an NX_class attribute
+static hid_t H5CreateNxGroup(hid_t parent, const char* name, const char* nxClass) {
+    hid_t g = H5Gcreate2(parent, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (g >= 0) H5WriteStringAttr(g, "NX_class", nxClass);
+    return g;
+}
+
+// Chunked, shuffled and deflated dataset
+static hid_t H5CreateChunked(hid_t parent, const char* name, hid_t type, const vector<hsize_t>& dims, const vector<hsize_t>& chunk) {
+    H5Id space(H5Screate_simple((int)dims.size(), dims.data(), nullptr), H5Sclose);
+    H5Id plist(H5Pcreate(H5P_DATASET_CREATE), H5Pclose);
+    H5Pset_chunk(plist, (int)chunk.size(), chunk.data());
+    H5Pset_shuffle(plist);
+    H5Pset_deflate(plist, 4);
+    return H5Dcreate2(parent, name, type, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+}
+
+static bool H5HasDataset(hid_t file, const char* path) {
+    return H5Lexists(file, path, H5P_DEFAULT) > 0;
+}
+
+// 2D frame from /entry/data/data, scaled to 8-bit grey
+static bool ReadHdf5Frame(const wxString& path, wxImage& img, wxString* error, const FrameCorrection* corr = nullptr) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return false; };
+    H5Id file(H5Fopen(path.utf8_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    if (!file.IsOk() || !H5HasDataset(file, "/entry") || !H5HasDataset(file, "/entry/data") || !H5HasDataset(file, "/entry/data/data"))
+        return fail("No /entry/data/data frame in " + path);
+    H5Id dset(H5Dopen2(file, "/entry/data/data", H5P_DEFAULT), H5Dclose);
+    H5Id space(H5Dget_space(dset), H5Sclose);
+    hsize_t dims[2];
+    if (H5Sget_simple_extent_ndims(space) != 2 || H5Sget_simple_extent_dims(space, dims, nullptr) != 2)
+        return fail("The frame dataset is not two-dimensional.");
+
+    if (corr && !corr->Fits((int)dims[1], (int)dims[0], error)) return false;
+    vector<float> values((size_t)(dims[0] * dims[1]));
+    if (H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, values.data()) < 0) return fail("Failed to read frame data.");
+    img = wxImage((int)dims[1], (int)dims[0], false);
+    if (!img.GetData()) return fail("Failed to allocate image buffer.");
+    if (!ValuesToGray(values.size(), [&](size_t i) { return (double)values[i]; }, img.GetData(), corr)) return fail(STRETCHED_CORRECTION_ERROR);
+    return true;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Frame decoding and the process-wide decoded-frame cache
+// ---------------------------------------------------------------------------
+
+// Options that change the decoded pixels; part of the cache key. Corrections are applied in
+// counts of the frame's own exposure:
+//   grey - dark * t/t_dark - (background - dark * t_bg/t_dark) * (t T) / (t_bg T_bg)
+// then divided by the dark-subtracted flat (flat - dark * t_flat/t_dark) normalized to its mean,
+// plus the pedestal. Master frames are read with ReadMasterFrame.
+struct DecodeOptions {
+    wxString darkPath, backgroundPath, flatPath;   // Empty to skip that correction
+    double exposure = 1.0;                 // Of the frames being decoded, seconds
+    double darkExposure = 1.0;
+    double backgroundExposure = 1.0;       // Of the empty-cell background
+    double flatExposure = 1.0;
+    double transmission = 1.0;             // Of the sample
+    double backgroundTransmission = 1.0;   // Of the empty cell
+    double pedestal = 16.0;                // Grey levels added after correction; subtract it from profiles
+
+    wxString loadKey;                      // Key() as taken by CurrentDecodeOptions, so a load stats the masters once
+
+    bool HasCorrection() const { return !darkPath.IsEmpty() || !backgroundPath.IsEmpty() || !flatPath.IsEmpty(); }
+
+    wxString CachedKey() const { return loadKey.IsEmpty() ? Key() : loadKey; }
+
+    wxString Key() const {
+        if (!HasCorrection()) return "gray";
+        // Master files are named by path and modification time so rebuilt masters miss the cache
+        auto file = [](const wxString& path) {
+            wxFileName fn(path);
+            const long long mtime = fn.FileExists() && fn.GetModificationTime().IsValid() ? (long long)fn.GetModificationTime().GetTicks() : 0LL;
+            return path + "@" + wxString::Format("%lld", mtime);
+        };
+        return "gray|dark=" + (darkPath.IsEmpty() ? wxString() : file(darkPath)) +
+            "|bg=" + (backgroundPath.IsEmpty() ? wxString() : file(backgroundPath)) +
+            "|flat=" + (flatPath.IsEmpty() ? wxString() : file(flatPath)) +
+            wxString::Format("|t=%.17g,%.17g,%.17g,%.17g|T=%.17g,%.17g|p=%.17g", exposure, darkExposure, backgroundExposure, flatExposure,
+                transmission, backgroundTransmission, pedestal);
+    }
+};
+
+// "dark=path;background=path;flat=path;exposure=1;dark_exposure=1;background_exposure=1;
+// flat_exposure=1;transmission=1;background_transmission=1;pedestal=16", any subset; empty for no correction
+static bool ParseDecodeOptions(const wxString& text, DecodeOptions& out, wxString* error) {
+    DecodeOptions o;
+    for (wxString item : wxSplit(text, ';')) {
+        if (item.Trim().Trim(false).IsEmpty()) continue;
+        wxString key = item.BeforeFirst('='), value = item.AfterFirst('=');
+        key.Trim().Trim(false).MakeLower();
+        value.Trim().Trim(false);
+        double* number = key == "exposure" ? &o.exposure : key == "dark_exposure" ? &o.darkExposure :
+            key == "background_exposure" ? &o.backgroundExposure : key == "flat_exposure" ? &o.flatExposure :
+            key == "transmission" ? &o.transmission :
+            key == "background_transmission" ? &o.backgroundTransmission : key == "pedestal" ? &o.pedestal : nullptr;
+        if (key == "dark") o.darkPath = value;
+        else if (key == "background") o.backgroundPath = value;
+        else if (key == "flat") o.flatPath = value;
+        else if (!number || !value.ToDouble(number) || !(key == "pedestal" ? *number >= 0 && *number < 255 : *number > 0)) {
+            if (error) *error = "Invalid setting \"" + item + "\". Exposures and transmissions must be positive numbers "
+                "and the pedestal 0 to 254 grey levels.";
+            return false;
+        }
+    }
+    out = o;
+    return true;
+}
+
+static wxString FormatDecodeOptions(const DecodeOptions& o) {
+    if (!o.HasCorrection()) return wxString();
+    wxString s;
+    if (!o.darkPath.IsEmpty()) s += "dark=" + o.darkPath + ";";
+    if (!o.backgroundPath.IsEmpty()) s += "background=" + o.backgroundPath + ";";
+    if (!o.flatPath.IsEmpty()) s += "flat=" + o.flatPath + ";";
+    return s + wxString::Format("exposure=%g;dark_exposure=%g;background_exposure=%g;flat_exposure=%g;transmission=%g;background_transmission=%g;"
+        "pedestal=%g", o.exposure, o.darkExposure, o.backgroundExposure, o.flatExposure, o.transmission, o.backgroundTransmission, o.pedestal);
+}
+
+// Decode options used for frames opened and reduced from now on
+static mutex s_decodeOptionsMutex;
+static DecodeOptions s_decodeOptions;
+
+// Taken at the start of each load or job; the master files' state is resolved here once
+static DecodeOptions CurrentDecodeOptions() {
+    DecodeOptions opts;
+    {
+        lock_guard<mutex> lock(s_decodeOptionsMutex);
+        opts = s_decodeOptions;
+    }
+    opts.loadKey = opts.Key();
+    return opts;
+}
+
+static void SetCurrentDecodeOptions(const DecodeOptions& opts) {
+    lock_guard<mutex> lock(s_decodeOptionsMutex);
+    s_decodeOptions = opts;
+}
+
+// The folded correction for a set of options. The last one is kept, so a series decoded with
+// the same settings reads its master frames once.
+static shared_ptr<const FrameCorrection> GetFrameCorrection(const DecodeOptions& opts, wxString* error) {
+    static mutex s_mutex;
+    static wxString s_key;
+    static shared_ptr<const FrameCorrection> s_last;
+    if (!opts.HasCorrection()) return nullptr;
+    const wxString key = opts.CachedKey();
+    lock_guard<mutex> lock(s_mutex);
+    if (s_last && key == s_key) return s_last;
+
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return shared_ptr<const FrameCorrection>(); };
+    MasterFrame dark, bg, flat;
+    wxString msg;
+    if (!opts.darkPath.IsEmpty() && !ReadMasterFrame(opts.darkPath, dark, &msg)) return fail("Dark: " + msg);
+    if (!opts.backgroundPath.IsEmpty() && !ReadMasterFrame(opts.backgroundPath, bg, &msg)) return fail("Background: " + msg);
+    if (!opts.flatPath.IsEmpty() && !ReadMasterFrame(opts.flatPath, flat, &msg)) return fail("Flat: " + msg);
+    const MasterFrame* first = dark.IsOk() ? &dark : bg.IsOk() ? &bg : &flat;
+    for (const MasterFrame* m : { &dark, &bg, &flat })
+        if (m->IsOk() && (m->width != first->width || m->height != first->height))
+            return fail("The dark, background and flat frames differ in size.");
+
+    auto corr = make_shared<FrameCorrection>();
+    corr->width = first->width;
+    corr->height = first->height;
+    corr->pedestal = opts.pedestal;
+    const size_t n = (size_t)corr->width * corr->height;
+    const double darkScale = opts.exposure / opts.darkExposure;
+    const double bgDarkScale = opts.backgroundExposure / opts.darkExposure;
+    const double bgScale = opts.exposure * opts.transmission / (opts.backgroundExposure * opts.backgroundTransmission);
+    corr->offset.assign(n, 0.0f);
+    for (size_t i = 0; i < n; ++i) {
+        const double d = dark.IsOk() ? dark.mean[i] : 0.0;
+        const double b = bg.IsOk() ? bg.mean[i] - d * bgDarkScale : 0.0;
+        corr->offset[i] = (float)(d * darkScale + b * bgScale);
+    }
+    if (flat.IsOk()) {
+        const double flatDarkScale = opts.flatExposure / opts.darkExposure;
+        vector<double> response(n);
+        double sum = 0.0;
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i) {
+            response[i] = flat.mean[i] - (dark.IsOk() ? dark.mean[i] * flatDarkScale : 0.0);
+            if (response[i] > 0) { sum += response[i]; ++count; }
+        }
+        const double level = count ? sum / count : 1.0;
+        corr->gain.resize(n);
+        for (size_t i = 0; i < n; ++i) corr->gain[i] = response[i] > 0 ? (float)(level / response[i]) : 0.0f;   // Dead pixels read 0
+    }
+
+    MemoryAccounting::Add(MemTag::Calibration, 0, (int64_t)corr->Bytes() - (int64_t)(s_last ? s_last->Bytes() : 0));
+    s_key = key;
+    s_last = corr;
+    return corr;
+}
+
+// A decoded frame. Shared between windows and jobs through FrameHandle and never modified
+// after decoding; wxImage shares its buffer on copy, so holders that edit pixels must Copy() first.
+struct DecodedFrame {
+    wxString path;
+    wxImage image;                     // Grey replicated in all three RGB channels
+    bool isSynthetic = false;
+    SyntheticPatternParams synthetic;  // Ground truth for generated frames
+};
+typedef shared_ptr<const DecodedFrame> FrameHandle;
+
+// Recognize "SYNTH1 <spec>" at the start of a raw header or .synth sidecar
+static bool ParseSyntheticHeader(const wxString& header, SyntheticPatternParams& out) {
+    wxString spec;
+    if (!header.StartsWith(wxString(SYNTHETIC_TAG) + " ", &spec)) return false;
+    SyntheticPatternParams p;
+    if (!ParseSyntheticSpec(spec.Trim(), p)) return false;
+    out = p;
+    return true;
+}
+
+// Formats wxWidgets can decode itself (including generated PNG/TIFF frames)
+static bool IsNativeImagePath(const wxString& path) {
+    const wxString ext = wxFileName(path).GetExt().Lower();
+    return ext == "png" || ext == "tif" || ext == "tiff" || ext == "bmp" || ext == "jpg" || ext == "jpeg";
+}
+
+// Read and decode one file. Safe to call from worker threads: errors are returned, not shown.
+static FrameHandle DecodeFrameFile(const wxString& filepath, const DecodeOptions& opts, wxString* error) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return FrameHandle(); };
+    auto frame = make_shared<DecodedFrame>();
+    frame->path = filepath;
+    wxString corrError;
+    const shared_ptr<const FrameCorrection> corr = GetFrameCorrection(opts, &corrError);
+    if (opts.HasCorrection() && !corr) return fail(corrError);
+
+    // Array formats from analysis pipelines
+    const wxString ext = wxFileName(filepath).GetExt().Lower();
+    if (ext == "npy" || ext == "npz" || ext == "h5" || ext == "nxs") {
+        PerfScope loadTimer(PerfOp::Load);
+        wxString msg;
+        bool ok = false;
+        if (ext == "npy") ok = ReadNpyFrame(filepath, frame->image, &msg, corr.get());
+        else if (ext == "npz") ok = ReadNpzFrame(filepath, frame->image, &msg, corr.get());
+#ifdef HAVE_HDF5
+        else ok = ReadHdf5Frame(filepath, frame->image, &msg, corr.get());
+#else
+        else msg = "This build has no HDF5 support.";
+#endif
+        if (!ok) return fail(msg);
+        return frame;
+    }
+
+    if (IsNativeImagePath(filepath)) {
+        wxImage img;
+        {
+            PerfScope loadTimer(PerfOp::Load);
+            if (!img.LoadFile(filepath, wxBITMAP_TYPE_ANY) || !img.IsOk())
+                return fail("Failed to decode image: " + filepath);
+        }
+        if (corr && !corr->Fits(img.GetWidth(), img.GetHeight(), error)) return FrameHandle();
+        {
+            PerfScope decodeTimer(PerfOp::Decode);
+            unsigned char* rgb = img.GetData();
+            const int n = img.GetWidth() * img.GetHeight();
+            decodeTimer.SetPixels((uint64_t)n);
+            for (int i = 0; i < n; ++i) {
+                const double lum = 0.299 * rgb[i * 3] + 0.587 * rgb[i * 3 + 1] + 0.114 * rgb[i * 3 + 2];
+                unsigned char grey = corr ? corr->Apply(i, lum) : (unsigned char)round(lum);
+                rgb[i * 3 + 0] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = grey;
+            }
+        }
+        frame->image = img;
+
+        ifstream side((filepath + ".synth").mb_str());
+        string line;
+        if (side && getline(side, line)) frame->isSynthetic = ParseSyntheticHeader(wxString(line), frame->synthetic);
+        return frame;
+    }
+
+    PerfScope loadTimer(PerfOp::Load);
+    ifstream file(filepath.mb_str(), ios::binary);
+    if (!file) return fail("Failed to open file: " + filepath);
+
+    // read to end to determine size
+    file.seekg(0, ios::end);
+    streamoff sz = file.tellg();
+    if (sz <= 0 || sz < (streamoff)HEADER_OFFSET) return fail("File too small or invalid format");
+
+    // For legacy format we use fixed dimensions; if file too small, bail out
+    const int WIDTH = LEGACY_WIDTH, HEIGHT = LEGACY_HEIGHT, PIXEL_DEPTH = LEGACY_PIXEL_DEPTH;
+    const streamoff expected = (streamoff)WIDTH * HEIGHT * PIXEL_DEPTH;
+    if (sz - HEADER_OFFSET < expected) return fail("File does not contain expected image data (size mismatch).");
+    if (corr && !corr->Fits(WIDTH, HEIGHT, error)) return FrameHandle();
+
+    // Generated frames carry their parameters in the header
+    vector<char> header((size_t)HEADER_OFFSET + 1, 0);
+    file.seekg(0, ios::beg);
+    file.read(header.data(), HEADER_OFFSET);
+    frame->isSynthetic = ParseSyntheticHeader(wxString(header.data()), frame->synthetic);
+
+    file.seekg(HEADER_OFFSET, ios::beg);
+    vector<unsigned char> buffer((size_t)expected);
+    {
+        TraceScope io("read", "io", filepath.mb_str());
+        file.read(reinterpret_cast<char*>(buffer.data()), expected);
+    }
+    if (file.gcount() < expected) return fail("Failed to read image data.");
+
+    wxImage img(WIDTH, HEIGHT, false);
+    unsigned char* rgb = img.GetData();
+    if (!rgb) return fail("Failed to allocate image buffer.");
+
+    {
+        PerfScope decodeTimer(PerfOp::Decode);
+        decodeTimer.SetPixels((uint64_t)WIDTH * HEIGHT);
+        DecodeBgraToGray(buffer.data(), rgb, (size_t)WIDTH * HEIGHT, corr.get());
+    }
+    frame->image = img;
+    return frame;
+}
+
+// Decoded frames keyed by path, modification time, size and decode options. Frames still
+// referenced anywhere are found through weak references; a byte-bounded LRU keeps recently
+// used frames alive after their last window closes. Concurrent requests for the same key
+// wait on a single decode.
+class FrameCache {
+public:
+    struct Stats { uint64_t hits = 0, misses = 0, bytes = 0; size_t entries = 0; };
+
+    static FrameHandle Acquire(const wxString& path, const DecodeOptions& opts = DecodeOptions(),
+        wxString* error = nullptr, bool* outHit = nullptr) {
+        if (outHit) *outHit = false;
+        const string key = MakeKey(path, opts);
+
+        shared_future<Result> pending;
+        promise<Result> producer;
+        bool decodeHere = false;
+        {
+            lock_guard<mutex> lock(s_mutex);
+            RegisterEvictorOnce();
+            auto it = s_index.find(key);
+            if (it != s_index.end()) {
+                if (FrameHandle frame = it->second.lock()) {
+                    ++s_stats.hits;
+                    Touch(key, frame);
+                    if (outHit) *outHit = true;
+                    return frame;
+                }
+                s_index.erase(it);
+            }
+            auto fl = s_inflight.find(key);
+            if (fl != s_inflight.end()) pending = fl->second;
+            else {
+                ++s_stats.misses;
+                pending = producer.get_future().share();
+                s_inflight[key] = pending;
+                decodeHere = true;
+            }
+        }
+
+        if (decodeHere) {
+            Result r;
+            try {
+                r.frame = DecodeFrameFile(path, opts, &r.error);
+            }
+            catch (...) {
+                // Clear the slot so later calls retry, and hand the exception to the waiters
+                {
+                    lock_guard<mutex> lock(s_mutex);
+                    s_inflight.erase(key);
+                }
+                producer.set_exception(current_exception());
+                throw;
+            }
+            {
+                lock_guard<mutex> lock(s_mutex);
+                s_inflight.erase(key);
+                if (r.frame) {
+                    s_index[key] = r.frame;
+                    Touch(key, r.frame);
+                }
+            }
+            producer.set_value(r);
+        }
+        else if (outHit) *outHit = true;
+
+        const Result& r = pending.get();
+        if (!r.frame && error) *error = r.error;
+        return r.frame;
+    }
+
+    static void SetCapacity(uint64_t bytes) {
+        lock_guard<mutex> lock(s_mutex);
+        s_capacity = bytes;
+        TrimTo(s_capacity);
+    }
+
+    static void Clear() {
+        lock_guard<mutex> lock(s_mutex);
+        TrimTo(0);
+    }
+
+    static Stats GetStats() {
+        lock_guard<mutex> lock(s_mutex);
+        Stats st = s_stats;
+        st.bytes = s_bytes;
+        st.entries = s_lru.size();
+        return st;
+    }
+
+private:
+    struct Result { FrameHandle frame; wxString error; };
+    typedef list<pair<string, FrameHandle>> LruList;
+
+    static string MakeKey(const wxString& path, const DecodeOptions& opts) {
+        wxFileName fn(path);
+        const bool exists = fn.FileExists();
+        const long long mtime = exists && fn.GetModificationTime().IsValid() ? (long long)fn.GetModificationTime().GetTicks() : 0LL;
+        const unsigned long long size = exists ? (unsigned long long)fn.GetSize().GetValue() : 0ULL;
+        return string(fn.GetFullPath().utf8_str()) + "|" + to_string(mtime) + "|" + to_string(size) + "|" + string(opts.CachedKey().utf8_str());
+    }
+
+    // Move (or insert) a frame at the most-recently-used end. Caller holds s_mutex.
+    static void Touch(const string& key, const FrameHandle& frame) {
+        auto it = s_lruPos.find(key);
+        if (it != s_lruPos.end()) {
+            s_lru.splice(s_lru.begin(), s_lru, it->second);
+            return;
+        }
+        s_lru.emplace_front(key, frame);
+        s_lruPos[key] = s_lru.begin();
+        const uint64_t bytes = ImageBytes(frame->image);
+        s_bytes += bytes;
+        MemoryAccounting::Add(MemTag::Cache, 0, (int64_t)bytes);
+        TrimTo(s_capacity);
+    }
+
+    // Drop least-recently-used entries until at most `bytes` remain. Caller holds s_mutex.
+    static uint64_t TrimTo(uint64_t bytes) {
+        uint64_t freed = 0;
+        while (s_bytes > bytes && !s_lru.empty()) {
+            const uint64_t b = ImageBytes(s_lru.back().second->image);
+            s_lruPos.erase(s_lru.back().first);
+            s_lru.pop_back();
+            s_bytes -= b;
+            freed += b;
+            MemoryAccounting::Add(MemTag::Cache, 0, -(int64_t)b);
+        }
+        return freed;
+    }
+
+    // The cache is the first thing released when the memory budget is exceeded
+    static void RegisterEvictorOnce() {
+        if (s_evictorRegistered) return;
+        s_evictorRegistered = true;
+        MemoryAccounting::RegisterEvictor(0, [](uint64_t wanted) {
+            lock_guard<mutex> lock(s_mutex);
+            return TrimTo(s_bytes > wanted ? s_bytes - wanted : 0);
+        });
+    }
+
+    static mutex s_mutex;
+    static map<string, weak_ptr<const DecodedFrame>> s_index;
+    static map<string, shared_future<Result>> s_inflight;
+    static LruList s_lru;
+    static map<string, LruList::iterator> s_lruPos;
+    static uint64_t s_bytes;
+    static uint64_t s_capacity;
+    static Stats s_stats;
+    static bool s_evictorRegistered;
+};
+
+mutex FrameCache::s_mutex;
+map<string, weak_ptr<const DecodedFrame>> FrameCache::s_index;
+map<string, shared_future<FrameCache::Result>> FrameCache::s_inflight;
+FrameCache::LruList FrameCache::s_lru;
+map<string, FrameCache::LruList::iterator> FrameCache::s_lruPos;
+uint64_t FrameCache::s_bytes = 0;
+uint64_t FrameCache::s_capacity = (uint64_t)1 << 30;   // 1 GB of recently used frames
+FrameCache::Stats FrameCache::s_stats;
+bool FrameCache::s_evictorRegistered = false;
+
+// ---------------------------------------------------------------------------
+// Columnar profile store (memory-mapped, appendable)
+// ---------------------------------------------------------------------------
+
+// Read/write memory mapping of a whole file. Resize() remaps, so pointers from Data() are
+// invalidated by it.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    bool Open(const wxString& path, bool writable, bool create) {
+        Close();
+        m_writable = writable;
+#ifdef _WIN32
+        m_file = CreateFileW(path.wc_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr,
+            create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size)) { Close(); return false; }
+        m_size = (uint64_t)size.QuadPart;
+#else
+        m_fd = open(path.fn_str(), (writable ? O_RDWR : O_RDONLY) | (create ? O_CREAT | O_TRUNC : 0), 0644);
+        if (m_fd < 0) return false;
+        struct stat st;
+        if (fstat(m_fd, &st) != 0) { Close(); return false; }
+        m_size = (uint64_t)st.st_size;
+#endif
+        if (!Map()) { Close(); return false; }
+        return true;
+    }
+
+    bool Resize(uint64_t bytes) {
+        if (!m_writable) return false;
+        Unmap();
+#ifdef _WIN32
+        LARGE_INTEGER pos;
+        pos.QuadPart = (LONGLONG)bytes;
+        if (!SetFilePointerEx(m_file, pos, nullptr, FILE_BEGIN) || !SetEndOfFile(m_file)) return false;
+#else
+        if (ftruncate(m_fd, (off_t)bytes) != 0) return false;
+#endif
+        m_size = bytes;
+        return Map();
+    }
+
+    void Flush() {
+        if (!m_data || !m_writable) return;
+#ifdef _WIN32
+        FlushViewOfFile(m_data, 0);
+#else
+        msync(m_data, (size_t)m_size, MS_ASYNC);
+#endif
+    }
+
+    void Close() {
+        Unmap();
+#ifdef _WIN32
+        if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_fd >= 0) close(m_fd);
+        m_fd = -1;
+#endif
+        m_size = 0;
+    }
+
+    bool IsOpen() const {
+#ifdef _WIN32
+        return m_file != INVALID_HANDLE_VALUE;
+#else
+        return m_fd >= 0;
+#endif
+    }
+    unsigned char* Data() const { return m_data; }
+    uint64_t Size() const { return m_size; }
+
+private:
+    bool Map() {
+        if (m_size == 0) return true;   // Empty files cannot be mapped; Resize() maps later
+#ifdef _WIN32
+        m_mapping = CreateFileMappingW(m_file, nullptr, m_writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping) return false;
+        m_data = (unsigned char*)MapViewOfFile(m_mapping, m_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+#else
+        void* p = mmap(nullptr, (size_t)m_size, PROT_READ | (m_writable ? PROT_WRITE : 0), MAP_SHARED, m_fd, 0);
+        m_data = p == MAP_FAILED ? nullptr : (unsigned char*)p;
+#endif
+        return m_data != nullptr;
+    }
+
+    void Unmap() {
+#ifdef _WIN32
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        m_mapping = nullptr;
+#else
+        if (m_data) munmap(m_data, (size_t)m_size);
+#endif
+        m_data = nullptr;
+    }
+
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+    unsigned char* m_data = nullptr;
+    uint64_t m_size = 0;
+    bool m_writable = false;
+};
+
+// Per-frame row of the store's metadata table
+struct ProfileMeta {
+    char source[256];      // Source file path (UTF-8, truncated)
+    int64_t mtime;         // Source modification time, seconds since the epoch
+    float cx, cy;          // Integration centre
+    int32_t validBins;     // Bins with at least one sample
+    int32_t synthetic;     // 1 when the source is a generated frame
+};
+
+// Binary store of many radial profiles over one shared radial axis. Layout (native endian):
+//   header page | axis (bins doubles) | chunk 0 | chunk 1 | ...
+// Each chunk holds CHUNK_FRAMES frames as page-aligned columns: intensity and error
+// (float, frames x bins, row-major), count (int32, frames x bins) and the metadata table.
+// Whole chunks are preallocated, so appending writes into the mapping and only grows the
+// file once per chunk. Reading any number of profiles is a single mmap.
+class ProfileStore {
+public:
+    static const uint32_t DEFAULT_CHUNK_FRAMES = 256;
+
+    bool Create(const wxString& path, const vector<double>& axis, uint32_t chunkFrames, wxString* error) {
+        Close();
+        if (axis.empty() || chunkFrames == 0) return Fail(error, "Profile store needs a non-empty axis.");
+        if (!m_file.Open(path, true, true)) return Fail(error, "Could not create profile store: " + path);
+
+        const uint64_t axisBytes = AlignPage(axis.size() * sizeof(double));
+        if (!m_file.Resize(PAGE + axisBytes)) return Fail(error, "Could not size profile store: " + path);
+        Header* h = Head();
+        memcpy(h->magic, MAGIC, sizeof(h->magic));
+        h->version = VERSION;
+        h->bins = (uint32_t)axis.size();
+        h->chunkFrames = chunkFrames;
+        h->frames = 0;
+        h->chunks = 0;
+        h->firstChunk = PAGE + axisBytes;
+        memcpy(m_file.Data() + PAGE, axis.data(), axis.size() * sizeof(double));
+        return true;
+    }
+
+    bool Open(const wxString& path, bool writable, wxString* error) {
+        Close();
+        if (!m_file.Open(path, writable, false)) return Fail(error, "Could not open profile store: " + path);
+        if (m_file.Size() < PAGE || memcmp(Head()->magic, MAGIC, sizeof(Head()->magic)) != 0 || Head()->version != VERSION)
+            return Fail(error, "Not a profile store: " + path);
+        const Header* h = Head();
+        if (h->bins == 0 || h->chunkFrames == 0 || h->frames > (uint64_t)h->chunks * h->chunkFrames ||
+            h->firstChunk + h->chunks * ChunkBytes() > m_file.Size())
+            return Fail(error, "Profile store is truncated: " + path);
+        return true;
+    }
+
+    void Close() {
+        m_file.Flush();
+        m_file.Close();
+    }
+
+    bool IsOpen() const { return m_file.IsOpen() && m_file.Data(); }
+    uint64_t Frames() const { return Head()->frames; }
+    uint32_t Bins() const { return Head()->bins; }
+    uint32_t ChunkFrames() const { return Head()->chunkFrames; }
+    const double* Axis() const { return (const double*)(m_file.Data() + PAGE); }
+
+    // Frame rows; valid until the next Append()
+    const float* Intensity(uint64_t frame) const { return (const float*)Column(frame, 0) + Row(frame); }
+    const float* Error(uint64_t frame) const { return (const float*)Column(frame, 1) + Row(frame); }
+    const int32_t* Count(uint64_t frame) const { return (const int32_t*)Column(frame, 2) + Row(frame); }
+    const ProfileMeta& Meta(uint64_t frame) const { return ((const ProfileMeta*)Column(frame, 3))[frame % Head()->chunkFrames]; }
+
+    // True when a sweep matches the store's axis
+    bool Accepts(const vector<RadialAvgPoint>& profile) const {
+        if (profile.size() != Bins()) return false;
+        const double* axis = Axis();
+        for (size_t i = 0; i < profile.size(); ++i)
+            if (axis[i] != (double)profile[i].R) return false;
+        return true;
+    }
+
+    bool Append(const vector<RadialAvgPoint>& profile, const ProfileMeta& meta, wxString* error) {
+        if (!Accepts(profile)) return Fail(error, "Profile does not match the store's radial axis.");
+        return AppendWith(meta, error, [&](float* I, float* E, int32_t* N) {
+            for (size_t i = 0; i < profile.size(); ++i) {
+                I[i] = (float)profile[i].avg;
+                E[i] = (float)profile[i].err;
+                N[i] = profile[i].samples;
+            }
+            });
+    }
+
+    // Append a row filled in place by fill(I, E, N), each Bins() long. For importers whose axis
+    // is not integer radii.
+    template <class Fill>
+    bool AppendWith(const ProfileMeta& meta, wxString* error, Fill&& fill) {
+        Header* h = Head();
+        if (h->frames == (uint64_t)h->chunks * h->chunkFrames) {
+            const uint64_t chunks = h->chunks + 1;
+            if (!m_file.Resize(h->firstChunk + chunks * ChunkBytes())) return Fail(error, "Could not grow profile store.");
+            h = Head();
+            h->chunks = chunks;
+        }
+
+        const uint64_t frame = h->frames;
+        fill((float*)Column(frame, 0) + Row(frame), (float*)Column(frame, 1) + Row(frame), (int32_t*)Column(frame, 2) + Row(frame));
+        ((ProfileMeta*)Column(frame, 3))[frame % h->chunkFrames] = meta;
+        h->frames = frame + 1;   // Published last so a torn append is simply not counted
+        return true;
+    }
+
+    vector<RadialAvgPoint> Profile(uint64_t frame) const {
+        vector<RadialAvgPoint> out(Bins());
+        const double* axis = Axis();
+        const float* I = Intensity(frame);
+        const float* E = Error(frame);
+        const int32_t* N = Count(frame);
+        for (size_t i = 0; i < out.size(); ++i) out[i] = { (int)axis[i], I[i], N[i], E[i] };
+        return out;
+    }
+
+    // Mean over all frames, weighted by inverse variance from the stored per-frame errors, with
+    // err = 1/sqrt(sum of weights). Where a contributing frame has no usable error the bin falls
+    // back to the sample-weighted mean and err is unknown (NaN).
+    vector<RadialAvgPoint> MeanProfile() const {
+        const uint32_t bins = Bins();
+        vector<double> sum(bins, 0.0), sumW(bins, 0.0), sumWI(bins, 0.0);
+        vector<int64_t> n(bins, 0);
+        vector<char> unweighted(bins, 0);
+        for (uint64_t f = 0; f < Frames(); ++f) {
+            const float* I = Intensity(f);
+            const float* E = Error(f);
+            const int32_t* N = Count(f);
+            for (uint32_t i = 0; i < bins; ++i) {
+                if (!isfinite(I[i]) || N[i] <= 0) continue;
+                sum[i] += (double)I[i] * N[i];
+                n[i] += N[i];
+                if (isfinite(E[i]) && E[i] > 0.0f) {
+                    const double w = 1.0 / ((double)E[i] * E[i]);
+                    sumW[i] += w;
+                    sumWI[i] += w * I[i];
+                }
+                else unweighted[i] = 1;
+            }
+        }
+        vector<RadialAvgPoint> out(bins);
+        const double* axis = Axis();
+        for (uint32_t i = 0; i < bins; ++i) {
+            const double nan = numeric_limits<double>::quiet_NaN();
+            const bool weighted = !unweighted[i] && sumW[i] > 0.0;
+            const double mean = weighted ? sumWI[i] / sumW[i] : n[i] > 0 ? sum[i] / n[i] : nan;
+            out[i] = { (int)axis[i], mean, (int)min<int64_t>(n[i], numeric_limits<int>::max()), weighted ? 1.0 / sqrt(sumW[i]) : nan };
+        }
+        return out;
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t bins;
+        uint32_t chunkFrames;
+        uint32_t reserved;
+        uint64_t frames;
+        uint64_t chunks;
+        uint64_t firstChunk;   // Byte offset of chunk 0
+    };
+    static constexpr uint64_t PAGE = 4096;
+    static constexpr uint32_t VERSION = 1;
+    static constexpr const char* MAGIC = "RPSTORE1";
+
+    static uint64_t AlignPage(uint64_t bytes) { return (bytes + PAGE - 1) / PAGE * PAGE; }
+    static bool Fail(wxString* error, const wxString& msg) { if (error) *error = msg; return false; }
+
+    Header* Head() const { return (Header*)m_file.Data(); }
+    uint64_t MatrixBytes() const { return AlignPage((uint64_t)Head()->chunkFrames * Head()->bins * 4); }
+    uint64_t MetaBytes() const { return AlignPage((uint64_t)Head()->chunkFrames * sizeof(ProfileMeta)); }
+    uint64_t ChunkBytes() const { return 3 * MatrixBytes() + MetaBytes(); }
+    uint64_t Row(uint64_t frame) const { return (frame % Head()->chunkFrames) * Head()->bins; }
+
+    // Column 0..2: intensity, error, count; column 3: metadata
+    unsigned char* Column(uint64_t frame, int column) const {
+        const uint64_t chunk = frame / Head()->chunkFrames;
+        return m_file.Data() + Head()->firstChunk + chunk * ChunkBytes() + (uint64_t)column * MatrixBytes();
+    }
+
+    MappedFile m_file;
+};
+
+static ProfileMeta MakeProfileMeta(const wxString& source, int cx, int cy, int validBins, bool synthetic) {
+    ProfileMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    const string utf8(source.utf8_str());
+    strncpy(meta.source, utf8.c_str(), sizeof(meta.source) - 1);
+    wxFileName fn(source);
+    meta.mtime = fn.FileExists() && fn.GetModificationTime().IsValid() ? (int64_t)fn.GetModificationTime().GetTicks() : 0;
+    meta.cx = (float)cx;
+    meta.cy = (float)cy;
+    meta.validBins = validBins;
+    meta.synthetic = synthetic ? 1 : 0;
+    return meta;
+}
+
+// Sweep each frame about its image centre and append the profiles in path order. Frames are
+// decoded and integrated in parallel blocks straight from disk (bypassing FrameCache, so a
+// long batch does not evict frames open in windows). Returns the number of frames stored;
+// unreadable frames are skipped.
+// With outlier parameters, each frame's hot pixels and zingers are flagged and left out of its profile.
+static int ReduceFramesToStore(const vector<wxString>& paths, ProfileStore& store, int Rmin, int Rmax, int step, wxString* error,
+    const OutlierParams* outliers = nullptr) {
+    const size_t BLOCK = 32;   // Frames decoded concurrently; bounds memory to a few frames per thread
+    const DecodeOptions opts = CurrentDecodeOptions();
+    int stored = 0;
+    for (size_t first = 0; first < paths.size(); first += BLOCK) {
+        const size_t n = min(BLOCK, paths.size() - first);
+        vector<vector<RadialAvgPoint>> profiles(n);
+        vector<ProfileMeta> metas(n);
+        ParallelFor(0, (int)n, [&](int b, int e) {
+            for (int i = b; i < e; ++i) {
+                FrameHandle frame = DecodeFrameFile(paths[first + i], opts, nullptr);
+                if (!frame) continue;
+                const int cx = frame->image.GetWidth() / 2;
+                const int cy = frame->image.GetHeight() / 2;
+                int valid = 0;
+                RunMask exclude;
+                if (outliers) {
+                    PerfScope timer(PerfOp::Outliers);
+                    exclude = FindOutlierPixels(frame->image, *outliers);
+                }
+                {
+                    PerfScope timer(PerfOp::Integrate);
+                    profiles[i] = RadialSweep(frame->image, cx, cy, Rmin, Rmax, step, &valid, exclude.IsEmpty() ? nullptr : &exclude);
+                }
+                metas[i] = MakeProfileMeta(paths[first + i], cx, cy, valid, frame->isSynthetic);
+            }
+            });
+        for (size_t i = 0; i < n; ++i) {
+            if (profiles[i].empty()) continue;
+            if (!store.Append(profiles[i], metas[i], error)) return stored;
+            ++stored;
+        }
+    }
+    return stored;
+}
+
+// Sparse frames integrated with one bin map about the frame centre, appended in order.
+// Histogram and projections, if given, accumulate over all frames.
+static int ReduceSparseToStore(const vector<SparseFrame>& frames, const vector<wxString>& sources, ProfileStore& store,
+    int Rmin, int Rmax, int step, wxString* error, vector<uint64_t>* hist = nullptr, vector<double>* columns = nullptr, vector<double>* rows = nullptr) {
+    if (frames.empty()) return 0;
+    const int cx = frames[0].width / 2, cy = frames[0].height / 2;
+    RadialBinMap map;
+    map.Build(frames[0].width, frames[0].height, cx, cy, Rmin, Rmax, step);
+    MemCharge mapCharge(MemTag::Profiles);
+    mapCharge.Set(map.Bytes());
+
+    const size_t BLOCK = 256;
+    int stored = 0;
+    for (size_t first = 0; first < frames.size(); first += BLOCK) {
+        const size_t n = min(BLOCK, frames.size() - first);
+        vector<vector<RadialAvgPoint>> profiles(n);
+        vector<int> valid(n);
+        ParallelFor(0, (int)n, [&](int b, int e) {
+            PerfScope timer(PerfOp::Sparse);
+            uint64_t nonzero = 0;
+            for (int i = b; i < e; ++i) {
+                const SparseFrame& f = frames[first + i];
+                if (f.width != map.width || f.height != map.height) continue;
+                profiles[i] = IntegrateSparse(f, map, &valid[i]);
+                nonzero += f.Nonzero();
+            }
+            timer.SetPixels(nonzero);
+            });
+        for (size_t i = 0; i < n; ++i) {
+            const SparseFrame& f = frames[first + i];
+            if (profiles[i].empty()) continue;
+            if (hist) AddSparseHistogram(f, *hist);
+            if (columns && rows) AddSparseProjections(f, *columns, *rows);
+            const wxString source = first + i < sources.size() ? sources[first + i] : wxString();
+            if (!store.Append(profiles[i], MakeProfileMeta(source, cx, cy, valid[i], false), error)) return stored;
+            ++stored;
+        }
+    }
+    return stored;
+}
+
+// ---------------------------------------------------------------------------
+// XPCS correlation
+// ---------------------------------------------------------------------------
+
+// Pixels of the q rings of a bin map gathered ring by ring, so every per-ring reduction runs
+// over one contiguous span. Rings without pixels are left out.
+struct RingPartition {
+    vector<uint32_t> pixels;      // Frame pixel indices, ring-major
+    vector<size_t> start;         // Span of ring r is pixels[start[r], start[r + 1])
+    vector<int> R;                // Radius of each ring
+
+    int Rings() const { return (int)R.size(); }
+    size_t Pixels() const { return pixels.size(); }
+    size_t Size(int r) const { return start[r + 1] - start[r]; }
+
+    static RingPartition FromMap(const RadialBinMap& map) {
+        RingPartition part;
+        vector<size_t> offset(map.Bins() + 1, 0);
+        for (int k = 0; k < map.Bins(); ++k) offset[k + 1] = offset[k] + map.pixels[k];
+        part.pixels.resize(offset.back());
+        vector<size_t> fill(offset.begin(), offset.end() - 1);
+        for (size_t i = 0; i < map.bin.size(); ++i) if (map.bin[i] >= 0) part.pixels[fill[map.bin[i]]++] = (uint32_t)i;
+        part.start.push_back(0);
+        for (int k = 0; k < map.Bins(); ++k) {
+            if (map.pixels[k] == 0) continue;
+            part.R.push_back(map.Rmin + k * map.step);
+            part.start.push_back(offset[k + 1]);
+        }
+        return part;
+    }
+
+    // Grey levels of the ring pixels, in partition order
+    void Gather(const wxImage& img, float* out) const {
+        const unsigned char* rgb = img.GetData();
+        for (size_t i = 0; i < pixels.size(); ++i) out[i] = rgb[(size_t)pixels[i] * 3];
+    }
+};
+
+// Sums of a*b, a and b over a span. Eight independent accumulators per sum let the compiler
+// vectorize the loop without reassociating floating-point additions.
+static void CorrelateSpan(const float* a, const float* b, size_t n, double& ab, double& sa, double& sb) {
+    double pab[8] = {}, pa[8] = {}, pb[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 8; ++k) {
+            pab[k] += (double)a[i + k] * b[i + k];
+            pa[k] += a[i + k];
+            pb[k] += b[i + k];
+        }
+    }
+    for (; i < n; ++i) { pab[0] += (double)a[i] * b[i]; pa[0] += a[i]; pb[0] += b[i]; }
+    for (int k = 0; k < 8; ++k) { ab += pab[k]; sa += pa[k]; sb += pb[k]; }
+}
+
+// Multi-tau intensity autocorrelation g2(q, tau) over a stream of frames. Level 0 keeps the last
+// m frames; every second frame at a level, the average of its last two goes up to the next, so
+// level l holds m frames of 2^l frame times each. Lags are 0..m-1 frames at level 0 and
+// m/2..m-1 steps of 2^l at level l, a quasi-logarithmic lag axis from a fixed buffer. Per ring and
+// lag, the ring averages of I(t)I(t-tau), I(t-tau) and I(t) are summed over time, and
+// g2 = <I(t)I(t-tau)> / (<I(t-tau)> <I(t)>). Memory is levels x m frames of ring pixels,
+// whatever the length of the series.
+class MultiTauCorrelator {
+public:
+    MultiTauCorrelator(RingPartition part, int buffers, int levels)
+        : m_part(move(part)), m_m(max(2, buffers / 2 * 2)), m_levels(max(1, levels)),
+        m_buf((size_t)m_levels * m_m * m_part.Pixels()), m_cur(m_levels, -1), m_count(m_levels, 0),
+        m_pairs(Lags(), 0), m_sums((size_t)Lags() * m_part.Rings() * 3, 0.0), m_charge(MemTag::Correlation) {
+        m_charge.Set(Bytes());
+    }
+
+    const RingPartition& Partition() const { return m_part; }
+    int Buffers() const { return m_m; }
+    int Levels() const { return m_levels; }
+    int Lags() const { return m_m + (m_levels - 1) * m_m / 2; }
+    uint64_t Frames() const { return m_count[0]; }
+    uint64_t Bytes() const { return m_buf.size() * sizeof(float) + m_sums.size() * sizeof(double); }
+
+    // Lag k in frame times
+    double Lag(int k) const {
+        if (k < m_m) return k;
+        const int l = 1 + (k - m_m) / (m_m / 2);
+        const int i = m_m / 2 + (k - m_m) % (m_m / 2);
+        return (double)i * (1 << l);
+    }
+
+    // One frame of ring pixels as gathered by RingPartition
+    void Add(const float* frame) { Push(0, frame); }
+
+    // g2 of ring r for every lag; NaN for lags not reached yet
+    vector<double> G2(int r) const {
+        vector<double> g(Lags(), numeric_limits<double>::quiet_NaN());
+        for (int k = 0; k < Lags(); ++k) {
+            if (m_pairs[k] == 0) continue;
+            const double* s = &m_sums[((size_t)k * m_part.Rings() + r) * 3];
+            const double n = (double)m_pairs[k];
+            if (s[1] > 0 && s[2] > 0) g[k] = (s[0] / n) / ((s[1] / n) * (s[2] / n));
+        }
+        return g;
+    }
+
+private:
+    float* Slot(int level, int i) { return &m_buf[((size_t)level * m_m + i) * m_part.Pixels()]; }
+
+    void Push(int level, const float* frame) {
+        m_cur[level] = (m_cur[level] + 1) % m_m;
+        float* dst = Slot(level, m_cur[level]);
+        if (dst != frame) memcpy(dst, frame, m_part.Pixels() * sizeof(float));
+        const uint64_t count = ++m_count[level];
+
+        // Lags available at this level: all buffered frames at level 0, the upper half above it
+        const int first = level == 0 ? 0 : m_m / 2;
+        const int last = (int)min<uint64_t>(count - 1, m_m - 1);
+        if (last >= first) {
+            const int base = level == 0 ? 0 : m_m + (level - 1) * m_m / 2 - m_m / 2;
+            const int rings = m_part.Rings();
+            ParallelFor(0, rings, [&](int r0, int r1) {
+                for (int r = r0; r < r1; ++r) {
+                    const size_t offset = m_part.start[r], n = m_part.Size(r);
+                    for (int i = first; i <= last; ++i) {
+                        const float* past = Slot(level, (m_cur[level] - i + m_m) % m_m);
+                        double ab = 0.0, a = 0.0, b = 0.0;
+                        CorrelateSpan(past + offset, dst + offset, n, ab, a, b);
+                        double* s = &m_sums[((size_t)(base + i) * rings + r) * 3];
+                        s[0] += ab / n;
+                        s[1] += a / n;
+                        s[2] += b / n;
+                    }
+                }
+                });
+            for (int i = first; i <= last; ++i) ++m_pairs[base + i];
+        }
+
+        // Every second frame, the average of the last two moves up a level
+        if (level + 1 < m_levels && count % 2 == 0) {
+            const float* prev = Slot(level, (m_cur[level] - 1 + m_m) % m_m);
+            float* up = Slot(level + 1, (m_cur[level + 1] + 1) % m_m);
+            const size_t n = m_part.Pixels();
+            for (size_t p = 0; p < n; ++p) up[p] = 0.5f * (prev[p] + dst[p]);
+            Push(level + 1, up);
+        }
+    }
+
+    const RingPartition m_part;
+    const int m_m, m_levels;
+    vector<float> m_buf;          // Levels x m frames of ring pixels
+    vector<int> m_cur;            // Newest slot per level
+    vector<uint64_t> m_count;     // Frames received per level
+    vector<uint64_t> m_pairs;     // Frame pairs summed per lag
+    vector<double> m_sums;        // Lags x rings x (I(t)I(t-tau), I(t-tau), I(t)) ring averages
+    MemCharge m_charge;
+};
+
+// Frames of a series in path order, decoded in parallel blocks. `start` sees the first decodable
+// frame, which fixes the size, and may refuse the series (false, having set *error); `add` then
+// sees every frame of that size in order. Frames that cannot be decoded or differ in size are
+// skipped. Shared by the correlation paths so they read a series the same way.
+template <class Start, class Add>
+static bool ForEachSeriesFrame(const vector<wxString>& paths, Start&& start, Add&& add, wxString* error) {
+    const DecodeOptions opts = CurrentDecodeOptions();
+    const size_t BLOCK = 16;
+    bool started = false;
+    int width = 0, height = 0;
+    for (size_t first = 0; first < paths.size(); first += BLOCK) {
+        const size_t n = min(BLOCK, paths.size() - first);
+        vector<FrameHandle> frames(n);
+        ParallelFor(0, (int)n, [&](int b, int e) {
+            for (int i = b; i < e; ++i) frames[i] = DecodeFrameFile(paths[first + i], opts, nullptr);
+            });
+        for (const FrameHandle& f : frames) {
+            if (!f) continue;
+            const wxImage& img = f->image;
+            if (!started) {
+                if (!start(img)) return false;
+                started = true;
+                width = img.GetWidth();
+                height = img.GetHeight();
+            }
+            if (img.GetWidth() != width || img.GetHeight() != height) continue;
+            add(img);
+        }
+    }
+    if (!started && error) *error = "None of the frames could be decoded.";
+    return started;
+}
+
+// Frames in path order through a multi-tau correlator over the rings Rmin..Rmax about the frame
+// centre. Enough levels are used to reach the whole series.
+static unique_ptr<MultiTauCorrelator> CorrelateFrames(const vector<wxString>& paths, int Rmin, int Rmax, int step, int buffers,
+    wxString* error) {
+    unique_ptr<MultiTauCorrelator> out;
+    vector<float> frame;
+    auto start = [&](const wxImage& img) {
+        RadialBinMap map;
+        map.Build(img.GetWidth(), img.GetHeight(), img.GetWidth() / 2, img.GetHeight() / 2, Rmin, Rmax, step);
+        RingPartition part = RingPartition::FromMap(map);
+        if (part.Rings() == 0) {
+            if (error) *error = "No pixels fall in the rings.";
+            return false;
+        }
+        int levels = 1;
+        while ((uint64_t)buffers << (levels - 1) < paths.size()) ++levels;
+        frame.resize(part.Pixels());
+        out.reset(new MultiTauCorrelator(move(part), buffers, levels));
+        return true;
+    };
+    auto add = [&](const wxImage& img) {
+        PerfScope timer(PerfOp::Correlate);
+        timer.SetPixels(frame.size());
+        out->Partition().Gather(img, frame.data());
+        out->Add(frame.data());
+    };
+    if (!ForEachSeriesFrame(paths, start, add, error)) return nullptr;
+    return out;
+}
+
+// Dot product with eight independent float accumulators (vectorizes without reassociation)
+static float DotSpan(const float* a, const float* b, size_t n) {
+    float acc[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (int k = 0; k < 8; ++k) acc[k] += a[i + k] * b[i + k];
+    for (; i < n; ++i) acc[0] += a[i] * b[i];
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+// Frames x pixels of one q ring with every frame divided by its ring mean, the input of a
+// two-time correlation. A frame with no intensity in the ring is all zeros.
+struct RingSeries {
+    int R = 0, width = 0;         // Ring radius and width, pixels
+    RingPartition part;
+    size_t frames = 0;
+    vector<float> x;              // Frames x part.Pixels(), row-major
+
+    size_t Pixels() const { return part.Pixels(); }
+    uint64_t Bytes() const { return x.size() * sizeof(float); }
+
+    void AddFrame(const wxImage& img) {
+        const size_t P = Pixels();
+        x.resize((frames + 1) * P);
+        float* row = &x[frames * P];
+        part.Gather(img, row);
+        double sum = 0.0;
+        for (size_t p = 0; p < P; ++p) sum += row[p];
+        const float scale = sum > 0 ? (float)(P / sum) : 0.0f;
+        for (size_t p = 0; p < P; ++p) row[p] *= scale;
+        ++frames;
+    }
+};
+
+// Two-time correlation C(t1, t2) = x_t1 . x_t2 / P of a ring series, written as a frames x frames
+// float32 .npy. Rows are computed in bands sized to `bandBytes`, streamed to the file and then
+// dropped, so the full map never has to be in memory. The map is symmetric, so a band only
+// computes the columns from its first row on: its rows are written from there, and the part right
+// of the band is written again transposed, as the start of the rows below it, which later bands
+// skip. A band is a blocked matrix product: tiles of TJ frames by TP pixels stay in cache while
+// every row of the band is multiplied against them, and column tiles run in parallel. `preview`
+// receives the map block-averaged to at most previewSide x previewSide for display.
+static bool WriteTwoTimeNpy(const RingSeries& s, const wxString& path, uint64_t bandBytes, int previewSide,
+    vector<float>& preview, int& previewN) {
+    const size_t T = s.frames, P = s.Pixels();
+    if (T == 0 || P == 0) return false;
+    wxFileOutputStream file(path);
+    if (!file.IsOk() || !WriteNpyHeader(file, "<f4", { T, T })) return false;
+    const wxFileOffset data = file.TellO();
+    if (data == wxInvalidOffset) return false;
+    // n floats at element (row, col) of the map
+    auto writeAt = [&](size_t row, size_t col, const float* v, size_t n) {
+        return file.SeekO(data + (wxFileOffset)((row * T + col) * sizeof(float))) != wxInvalidOffset &&
+            file.Write(v, n * sizeof(float)).LastWrite() == n * sizeof(float);
+    };
+
+    const size_t TJ = 64, TP = 1024;
+    const size_t bandRows = (size_t)max<uint64_t>(1, min<uint64_t>(T, bandBytes / (T * sizeof(float))));
+    const size_t step = (T + previewSide - 1) / previewSide;
+    previewN = (int)((T + step - 1) / step);
+    vector<double> sum((size_t)previewN * previewN, 0.0);
+    vector<float> band(bandRows * T), column(bandRows);
+    MemCharge charge(MemTag::Correlation);
+    charge.Set((band.size() + column.size()) * sizeof(float) + sum.size() * sizeof(double));
+    const float* X = s.x.data();
+    const float norm = 1.0f / P;
+
+    for (size_t row0 = 0; row0 < T; row0 += bandRows) {
+        const size_t rows = min(bandRows, T - row0);
+        {
+            PerfScope timer(PerfOp::Correlate);
+            timer.SetPixels((uint64_t)rows * (T - row0));
+            ParallelFor((int)(row0 / TJ), (int)((T + TJ - 1) / TJ), [&](int t0, int t1) {
+                for (size_t t = (size_t)t0; t < (size_t)t1; ++t) {
+                    const size_t j0 = max(row0, t * TJ), j1 = min(T, (t + 1) * TJ);
+                    for (size_t i = 0; i < rows; ++i) fill(&band[i * T + j0], &band[i * T + j1], 0.0f);
+                    for (size_t p0 = 0; p0 < P; p0 += TP) {
+                        const size_t np = min(TP, P - p0);
+                        for (size_t i = 0; i < rows; ++i) {
+                            const float* a = X + (row0 + i) * P + p0;
+                            float* out = &band[i * T];
+                            for (size_t j = j0; j < j1; ++j) out[j] += DotSpan(a, X + j * P + p0, np);
+                        }
+                    }
+                    for (size_t i = 0; i < rows; ++i)
+                        for (size_t j = j0; j < j1; ++j) band[i * T + j] *= norm;
+                }
+                });
+        }
+        for (size_t i = 0; i < rows; ++i)
+            if (!writeAt(row0 + i, row0, &band[i * T + row0], T - row0)) return false;
+        for (size_t j = row0 + rows; j < T; ++j) {
+            for (size_t i = 0; i < rows; ++i) column[i] = band[i * T + j];
+            if (!writeAt(j, row0, column.data(), rows)) return false;
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            const size_t bi = (row0 + i) / step;
+            const float* src = &band[i * T];
+            for (size_t j = row0; j < T; ++j) {
+                sum[bi * previewN + j / step] += src[j];
+                if (j >= row0 + rows) sum[(j / step) * previewN + bi] += src[j];
+            }
+        }
+    }
+
+    // Block averages; edge blocks are smaller
+    preview.assign(sum.size(), 0.0f);
+    for (int bi = 0; bi < previewN; ++bi) {
+        const size_t hi = min(step, T - bi * step);
+        for (int bj = 0; bj < previewN; ++bj) {
+            const size_t wj = min(step, T - bj * step);
+            preview[(size_t)bi * previewN + bj] = (float)(sum[(size_t)bi * previewN + bj] / (hi * wj));
+        }
+    }
+    return file.Close();
+}
+
+// Series of the rings at radii R (each `width` pixels wide) about the frame centre, gathered from
+// frames in path order. Every ring pixel of every frame stays resident, so the series is refused
+// up front when it cannot fit under the memory budget (after evicting caches).
+static bool GatherRingSeries(const vector<wxString>& paths, const vector<int>& radii, int width, vector<RingSeries>& out, wxString* error) {
+    out.clear();
+    auto start = [&](const wxImage& img) {
+        const int w = img.GetWidth(), h = img.GetHeight();
+        uint64_t bytes = 0;
+        for (int R : radii) {
+            RadialBinMap map;
+            map.Build(w, h, w / 2, h / 2, R, R, width);
+            RingSeries s;
+            s.R = R;
+            s.width = width;
+            s.part = RingPartition::FromMap(map);
+            if (s.Pixels() == 0) {
+                if (error) *error = wxString::Format("No pixels fall in the ring at R = %d.", R);
+                return false;
+            }
+            bytes += (uint64_t)paths.size() * s.Pixels() * sizeof(float);
+            out.push_back(move(s));
+        }
+        if (!MemoryAccounting::MakeRoom(bytes)) {
+            if (error) *error = wxString::Format("The ring series need %.1f MB for %zu frames, more than the memory budget (%.1f MB) "
+                "leaves free. Use fewer frames, fewer or narrower rings, or raise the budget.",
+                bytes / 1048576.0, paths.size(), MemoryAccounting::GetBudget() / 1048576.0);
+            out.clear();
+            return false;
+        }
+        for (RingSeries& s : out) s.x.reserve(paths.size() * s.Pixels());
+        return true;
+    };
+    auto add = [&](const wxImage& img) { for (RingSeries& s : out) s.AddFrame(img); };
+    return ForEachSeriesFrame(paths, start, add, error);
+}
+
+// ---------------------------------------------------------------------------
+// Text export
+// ---------------------------------------------------------------------------
+
+// Buffered CSV output. Numbers are formatted with std::to_chars in their shortest round-trip
+// form straight into a large buffer that reaches the file (or gzip stream) in big writes.
+// Non-finite values are written as empty fields.
+class CsvWriter {
+public:
+    CsvWriter() = default;
+    CsvWriter(const CsvWriter&) = delete;
+    CsvWriter& operator=(const CsvWriter&) = delete;
+    ~CsvWriter() { Close(); }
+
+    // A ".gz" suffix streams the output through gzip (appending adds a gzip member)
+    bool Open(const wxString& path, bool append = false) {
+        Close();
+        if (append) m_file.reset(new wxFFileOutputStream(path, "ab"));
+        else m_file.reset(new wxFileOutputStream(path));
+        if (!m_file->IsOk()) { m_file.reset(); return false; }
+        // Fastest level: text compresses well even there, and higher levels would outweigh formatting
+        if (path.Lower().EndsWith(".gz")) m_zlib.reset(new wxZlibOutputStream(*m_file, wxZ_BEST_SPEED, wxZLIB_GZIP));
+        m_buf.resize(BUFFER_BYTES);
+        m_pos = 0;
+        m_failed = false;
+        return true;
+    }
+
+    void Number(double v) {
+        Reserve(32);
+        if (isfinite(v)) m_pos = to_chars(&m_buf[m_pos], &m_buf[m_pos] + 32, v).ptr - m_buf.data();
+    }
+    void Number(float v) {
+        Reserve(32);
+        if (isfinite(v)) m_pos = to_chars(&m_buf[m_pos], &m_buf[m_pos] + 32, v).ptr - m_buf.data();
+    }
+    void Integer(long long v) {
+        Reserve(24);
+        m_pos = to_chars(&m_buf[m_pos], &m_buf[m_pos] + 24, v).ptr - m_buf.data();
+    }
+
+    // Quoted only when it contains a separator, quote or line break
+    void Text(const wxString& s) {
+        const string utf8(s.utf8_str());
+        const bool quote = utf8.find_first_of(",\"\r\n") != string::npos;
+        Reserve(utf8.size() * 2 + 2);
+        if (quote) m_buf[m_pos++] = '"';
+        for (char c : utf8) {
+            if (c == '"') m_buf[m_pos++] = '"';
+            m_buf[m_pos++] = c;
+        }
+        if (quote) m_buf[m_pos++] = '"';
+    }
+
+    // Literal text, no quoting
+    void Raw(const char* s) {
+        const size_t n = strlen(s);
+        Reserve(n);
+        memcpy(&m_buf[m_pos], s, n);
+        m_pos += n;
+    }
+
+    void Sep() { Reserve(1); m_buf[m_pos++] = ','; }
+    void EndRow() { Reserve(1); m_buf[m_pos++] = '\n'; }
+
+    // Flushes and closes; false if any write failed
+    bool Close() {
+        if (!m_file) return !m_failed;
+        Flush();
+        if (m_zlib && !m_zlib->Close()) m_failed = true;
+        m_zlib.reset();
+        if (!m_file->Close()) m_failed = true;
+        m_file.reset();
+        return !m_failed;
+    }
+
+private:
+    static const size_t BUFFER_BYTES = 1 << 20;
+
+    void Reserve(size_t bytes) {
+        if (m_pos + bytes > m_buf.size()) {
+            Flush();
+            if (bytes > m_buf.size()) m_buf.resize(bytes);
+        }
+    }
+
+    void Flush() {
+        if (m_pos == 0 || !m_file) return;
+        wxOutputStream& out = m_zlib ? (wxOutputStream&)*m_zlib : (wxOutputStream&)*m_file;
+        out.Write(m_buf.data(), m_pos);
+        if (out.LastWrite() != m_pos) m_failed = true;
+        m_pos = 0;
+    }
+
+    unique_ptr<wxOutputStream> m_file;
+    unique_ptr<wxZlibOutputStream> m_zlib;
+    vector<char> m_buf;
+    size_t m_pos = 0;
+    bool m_failed = false;
+};
+
+// One sweep as R,avg,err,samples
+static bool WriteProfileCsv(const wxString& path, const vector<RadialAvgPoint>& data) {
+    CsvWriter csv;
+    if (!csv.Open(path)) return false;
+    csv.Raw("R,avg,err,samples");
+    csv.EndRow();
+    for (const auto& p : data) {
+        csv.Integer(p.R); csv.Sep();
+        csv.Number(p.avg); csv.Sep();
+        csv.Number(p.err); csv.Sep();
+        csv.Integer(p.samples);
+        csv.EndRow();
+    }
+    return csv.Close();
+}
+
+// Wide table of a whole store: one row per radial bin (R_px, the radius in pixels), an intensity
+// column per frame (named after its source file) and optionally an error column next to each.
+// The store is frames x bins, so bins are transposed in tiles to keep reads sequential.
+static bool WriteStoreCsv(const ProfileStore& store, const wxString& path, bool withErrors) {
+    CsvWriter csv;
+    if (!csv.Open(path)) return false;
+
+    const uint64_t frames = store.Frames();
+    const uint32_t bins = store.Bins();
+    csv.Text("R_px");
+    for (uint64_t f = 0; f < frames; ++f) {
+        const wxString name = wxFileName(wxString::FromUTF8(store.Meta(f).source)).GetFullName();
+        const wxString label = name.IsEmpty() ? wxString::Format("frame%llu", (unsigned long long)f) : name;
+        csv.Sep(); csv.Text("I:" + label);
+        if (withErrors) { csv.Sep(); csv.Text("err:" + label); }
+    }
+    csv.EndRow();
+
+    const uint32_t TILE = 64;   // Bins per tile
+    vector<float> tileI((size_t)TILE * frames), tileE(withErrors ? (size_t)TILE * frames : 0);
+    const double* axis = store.Axis();
+    for (uint32_t b0 = 0; b0 < bins; b0 += TILE) {
+        const uint32_t nb = min(TILE, bins - b0);
+        for (uint64_t f = 0; f < frames; ++f) {
+            const float* I = store.Intensity(f) + b0;
+            const float* E = store.Error(f) + b0;
+            for (uint32_t b = 0; b < nb; ++b) {
+                tileI[(size_t)b * frames + f] = I[b];
+                if (withErrors) tileE[(size_t)b * frames + f] = E[b];
+            }
+        }
+        for (uint32_t b = 0; b < nb; ++b) {
+            csv.Number(axis[b0 + b]);
+            const float* rowI = tileI.data() + (size_t)b * frames;
+            const float* rowE = withErrors ? tileE.data() + (size_t)b * frames : nullptr;
+            for (uint64_t f = 0; f < frames; ++f) {
+                csv.Sep(); csv.Number(rowI[f]);
+                if (rowE) { csv.Sep(); csv.Number(rowE[f]); }
+            }
+            csv.EndRow();
+        }
+    }
+    return csv.Close();
+}
+
+// Peak table of one profile, as written next to its CSV export
+static bool WritePeaksCsv(const wxString& path, const vector<ProfilePeak>& peaks) {
+    CsvWriter csv;
+    if (!csv.Open(path)) return false;
+    csv.Raw("peak,position,height,background,fwhm,area");
+    csv.EndRow();
+    for (size_t i = 0; i < peaks.size(); ++i) {
+        const ProfilePeak& p = peaks[i];
+        csv.Integer((long long)i); csv.Sep();
+        csv.Number(p.position); csv.Sep();
+        csv.Number(p.height); csv.Sep();
+        csv.Number(p.background); csv.Sep();
+        csv.Number(p.fwhm); csv.Sep();
+        csv.Number(p.area);
+        csv.EndRow();
+    }
+    return csv.Close();
+}
+
+// Peaks of every profile in a store, one row per peak tagged with its frame and source.
+// Profiles are independent, so frames are searched in parallel and written in order.
+// From `firstFrame` on, the rows are appended to an existing table (frames added since it was
+// written); without one the whole table is written.
+static bool WriteStorePeaksCsv(const ProfileStore& store, const wxString& path, const PeakParams& params, size_t* outPeaks = nullptr,
+    uint64_t firstFrame = 0) {
+    const uint64_t frames = store.Frames();
+    const uint32_t bins = store.Bins();
+    const bool append = firstFrame > 0 && wxFileExists(path);
+    if (!append) firstFrame = 0;
+    const vector<double> axis(store.Axis(), store.Axis() + bins);
+    vector<vector<ProfilePeak>> peaks((size_t)(frames - min(firstFrame, frames)));
+    ParallelFor(0, (int)peaks.size(), [&](int f0, int f1) {
+        for (int f = f0; f < f1; ++f) {
+            const float* I = store.Intensity(firstFrame + f);
+            peaks[f] = FindProfilePeaks(axis, vector<double>(I, I + bins), params);
+        }
+        });
+
+    CsvWriter csv;
+    if (!csv.Open(path, append)) return false;
+    if (!append) {
+        csv.Raw("frame,source,peak,position,height,background,fwhm,area");
+        csv.EndRow();
+    }
+    size_t total = 0;
+    for (size_t k = 0; k < peaks.size(); ++k) {
+        const uint64_t f = firstFrame + k;
+        const wxString source = wxString::FromUTF8(store.Meta(f).source);
+        for (size_t i = 0; i < peaks[k].size(); ++i) {
+            const ProfilePeak& p = peaks[k][i];
+            csv.Integer((long long)f); csv.Sep();
+            csv.Text(source); csv.Sep();
+            csv.Integer((long long)i); csv.Sep();
+            csv.Number(p.position); csv.Sep();
+            csv.Number(p.height); csv.Sep();
+            csv.Number(p.background); csv.Sep();
+            csv.Number(p.fwhm); csv.Sep();
+            csv.Number(p.area);
+            csv.EndRow();
+        }
+        total += peaks[k].size();
+    }
+    if (outPeaks) *outPeaks = total;
+    return csv.Close();
+}
+
+// Fits every profile of a store. Frames are split into one contiguous run per worker and each
+// profile is its own fit, warm-started from the previous frame's converged parameters (or
+// guessed when there are none), since neighbouring frames of a series usually differ little.
+static vector<FitResult> FitStore(const ProfileStore& store, const FitSpec& spec) {
+    const uint64_t frames = store.Frames();
+    const uint32_t bins = store.Bins();
+    const vector<double> axis(store.Axis(), store.Axis() + bins);
+    vector<FitResult> results((size_t)frames);
+    ParallelFor(0, (int)frames, [&](int f0, int f1) {
+        vector<double> y(bins), sigma(bins);
+        for (int f = f0; f < f1; ++f) {
+            const float* I = store.Intensity(f);
+            const float* E = store.Error(f);
+            for (uint32_t b = 0; b < bins; ++b) { y[b] = I[b]; sigma[b] = E[b]; }
+            const bool warm = f > f0 && results[f - 1].converged;
+            results[f] = FitProfile(spec, axis, y, sigma, warm ? results[f - 1].params : GuessFitParams(spec, axis, y));
+            if (warm && !results[f].converged)
+                results[f] = FitProfile(spec, axis, y, sigma, GuessFitParams(spec, axis, y));
+        }
+        });
+    return results;
+}
+
+// One row per frame: convergence, reduced chi-square, then each parameter and its error
+static bool WriteFitCsv(const ProfileStore& store, const FitSpec& spec, const vector<FitResult>& results, const wxString& path) {
+    CsvWriter csv;
+    if (!csv.Open(path)) return false;
+    csv.Raw("frame,source,converged,iterations,points,chi2");
+    const vector<string> names = spec.ParamNames();
+    for (const auto& nm : names) { csv.Sep(); csv.Text(nm); csv.Sep(); csv.Text("err:" + nm); }
+    csv.EndRow();
+    for (size_t f = 0; f < results.size(); ++f) {
+        const FitResult& r = results[f];
+        csv.Integer((long long)f); csv.Sep();
+        csv.Text(wxString::FromUTF8(store.Meta(f).source)); csv.Sep();
+        csv.Integer(r.converged ? 1 : 0); csv.Sep();
+        csv.Integer(r.iterations); csv.Sep();
+        csv.Integer(r.points); csv.Sep();
+        csv.Number(r.chi2);
+        for (size_t k = 0; k < names.size(); ++k) {
+            csv.Sep(); if (k < r.params.size()) csv.Number(r.params[k]);
+            csv.Sep(); if (k < r.errors.size()) csv.Number(r.errors[k]);
+        }
+        csv.EndRow();
+    }
+    return csv.Close();
+}
+
+// Multi-tau g2 as a wide table: lag in frame times, then one column per q ring; the pixels row
+// gives each ring's pixel count. Lags not reached by the series are left out.
+static bool WriteG2Csv(const MultiTauCorrelator& corr, double frameSeconds, const wxString& path) {
+    CsvWriter csv;
+    if (!csv.Open(path)) return false;
+    const RingPartition& part = corr.Partition();
+    csv.Raw(frameSeconds > 0 ? "lag,tau_s" : "lag");
+    for (int r = 0; r < part.Rings(); ++r) { csv.Sep(); csv.Text(wxString::Format("g2:R%d", part.R[r])); }
+    csv.EndRow();
+    csv.Raw(frameSeconds > 0 ? "pixels," : "pixels");
+    for (int r = 0; r < part.Rings(); ++r) { csv.Sep(); csv.Integer((long long)part.Size(r)); }
+    csv.EndRow();
+
+    vector<vector<double>> g2(part.Rings());
+    for (int r = 0; r < part.Rings(); ++r) g2[r] = corr.G2(r);
+    for (int k = 0; k < corr.Lags(); ++k) {
+        bool any = false;
+        for (int r = 0; r < part.Rings(); ++r) any = any || isfinite(g2[r][k]);
+        if (!any) continue;
+        csv.Number(corr.Lag(k));
+        if (frameSeconds > 0) { csv.Sep(); csv.Number(corr.Lag(k) * frameSeconds); }
+        for (int r = 0; r < part.Rings(); ++r) { csv.Sep(); csv.Number(g2[r][k]); }
+        csv.EndRow();
+    }
+    return csv.Close();
+}
+
+// Statistics of fixed ROIs through a sequence of frames, one row per frame and ROI. Each frame
+// costs one table build; the next frame is decoded while the current one is measured.
+static int TrackROIsToCsv(const vector<wxString>& paths, const ROIManager& rois, const wxString& csvPath, wxString* error) {
+    CsvWriter csv;
+    if (!csv.Open(csvPath)) { if (error) *error = "Could not write " + csvPath; return 0; }
+    csv.Raw("frame,source,roi,x,y,width,height,pixels,sum,mean,variance,min,max");
+    csv.EndRow();
+
+    FrameTables tables;
+    MemCharge mem(MemTag::Tables);
+    const DecodeOptions opts = CurrentDecodeOptions();
+    auto decode = [&opts](const wxString& path) { return DecodeFrameFile(path, opts, nullptr); };
+    future<FrameHandle> next = async(launch::async, decode, paths.empty() ? wxString() : paths[0]);
+    int tracked = 0;
+    for (size_t f = 0; f < paths.size(); ++f) {
+        FrameHandle frame = next.get();
+        if (f + 1 < paths.size()) next = async(launch::async, decode, paths[f + 1]);
+        if (!frame) continue;
+        {
+            PerfScope timer(PerfOp::Integrate);
+            timer.SetPixels((uint64_t)frame->image.GetWidth() * frame->image.GetHeight());
+            tables.Build(frame->image);
+        }
+        mem.Set(tables.Bytes());
+        const vector<RoiStats> stats = rois.ComputeStats(tables);
+        const wxString name = wxFileName(paths[f]).GetFullName();
+        for (size_t r = 0; r < stats.size(); ++r) {
+            const wxRect& roi = rois.GetROIs()[r];
+            const RoiStats& st = stats[r];
+            csv.Integer((long long)f); csv.Sep();
+            csv.Text(name); csv.Sep();
+            csv.Integer((long long)r); csv.Sep();
+            csv.Integer(roi.x); csv.Sep();
+            csv.Integer(roi.y); csv.Sep();
+            csv.Integer(roi.width); csv.Sep();
+            csv.Integer(roi.height); csv.Sep();
+            csv.Integer((long long)st.pixels); csv.Sep();
+            csv.Number(st.sum); csv.Sep();
+            csv.Number(st.mean); csv.Sep();
+            csv.Number(st.variance); csv.Sep();
+            if (st.pixels) csv.Integer(st.min);
+            csv.Sep();
+            if (st.pixels) csv.Integer(st.max);
+            csv.EndRow();
+        }
+        ++tracked;
+    }
+    if (!csv.Close() && error) *error = "Could not write " + csvPath;
+    return tracked;
+}
+
+// Master frame from a stream of frames, one frame resident at a time. Each pixel keeps a
+// Welford running mean and sum of squared deviations, updated tile by tile in parallel.
+// With a reservoir, each pixel also keeps a uniform sample of at most `reservoir` of its
+// values; samples further than clipSigma robust sigmas (1.4826 MAD, at least one grey level)
+// from the sample median are rejected, so zingers and cosmic rays stay out of the mean.
+// The first `reservoir` frames only fill the sample and are clipped once it is full.
+struct MasterBuildOptions {
+    int reservoir = 0;            // Samples kept per pixel; 0 keeps plain statistics
+    double clipSigma = 5.0;
+};
+
+class MasterFrameBuilder {
+public:
+    explicit MasterFrameBuilder(const MasterBuildOptions& opts) : m_opts(opts) {
+        m_opts.reservoir = clamp(m_opts.reservoir, 0, 255);
+    }
+
+    bool Add(const wxImage& img, wxString* error) {
+        if (!img.IsOk()) return false;
+        if (m_frames == 0) {
+            m_w = img.GetWidth();
+            m_h = img.GetHeight();
+            const size_t n = (size_t)m_w * m_h;
+            m_mean.assign(n, 0.0f);
+            m_m2.assign(n, 0.0f);
+            m_count.assign(n, 0);
+            if (K()) {
+                m_sample.assign(n * K(), 0);
+                m_center.assign(n, 0.0f);
+                m_scale.assign(n, 0.0f);
+            }
+        }
+        else if (img.GetWidth() != m_w || img.GetHeight() != m_h) {
+            if (error) *error = wxString::Format("Frame is %dx%d, expected %dx%d.", img.GetWidth(), img.GetHeight(), m_w, m_h);
+            return false;
+        }
+
+        const unsigned char* rgb = img.GetData();
+        const uint32_t t = m_frames;
+        const int k = K();
+        atomic<uint64_t> rejected{ 0 };
+        ParallelFor(0, m_h, [&](int y0, int y1) {
+            uint64_t rej = 0;
+            for (size_t i = (size_t)y0 * m_w; i < (size_t)y1 * m_w; ++i) {
+                const uint8_t v = rgb[i * 3];
+                if (k == 0) { Update(i, v); continue; }
+                uint8_t* s = &m_sample[i * k];
+                if (t < (uint32_t)k) {
+                    s[t] = v;
+                    if (t + 1 == (uint32_t)k) rej += Prime(i, k);
+                    continue;
+                }
+                if (fabs(v - m_center[i]) > m_opts.clipSigma * m_scale[i]) ++rej;
+                else Update(i, v);
+                // Algorithm R: the value replaces a random slot with probability k / (t + 1)
+                const uint64_t j = (Mix((uint64_t)t << 32 | (uint64_t)(i & 0xffffffffu)) >> 32) * (t + 1) >> 32;
+                if (j < (uint64_t)k) s[j] = v;
+                if ((t + 1) % k == 0) Robust(i, k);
+            }
+            rejected += rej;
+            });
+        m_rejected += rejected;
+        ++m_frames;
+        return true;
+    }
+
+    MasterFrame Finish() {
+        // Fewer frames than the reservoir holds: clip against what was sampled
+        if (K() && m_frames > 0 && m_frames < (uint32_t)K()) {
+            const int k = (int)m_frames;
+            atomic<uint64_t> rejected{ 0 };
+            ParallelFor(0, m_h, [&](int y0, int y1) {
+                uint64_t rej = 0;
+                for (size_t i = (size_t)y0 * m_w; i < (size_t)y1 * m_w; ++i) rej += Prime(i, k);
+                rejected += rej;
+                });
+            m_rejected += rejected;
+        }
+        MasterFrame m;
+        m.width = m_w;
+        m.height = m_h;
+        m.frames = m_frames;
+        m.mean = m_mean;
+        m.count = m_count;
+        m.variance.resize(m_mean.size());
+        for (size_t i = 0; i < m_mean.size(); ++i)
+            m.variance[i] = m_count[i] > 1 ? m_m2[i] / (m_count[i] - 1) : numeric_limits<float>::quiet_NaN();
+        return m;
+    }
+
+    uint32_t Frames() const { return m_frames; }
+    uint64_t Rejected() const { return m_rejected; }
+    uint64_t Bytes() const { return (m_mean.size() + m_m2.size() + m_count.size() + m_center.size() + m_scale.size()) * 4 + m_sample.size(); }
+
+private:
+    int K() const { return m_opts.reservoir; }
+
+    void Update(size_t i, float v) {
+        const uint32_t n = ++m_count[i];
+        const float d = v - m_mean[i];
+        m_mean[i] += d / n;
+        m_m2[i] += d * (v - m_mean[i]);
+    }
+
+    // Median and scaled MAD of the first k samples of pixel i
+    void Robust(size_t i, int k) {
+        uint8_t v[256];
+        memcpy(v, &m_sample[i * K()], k);
+        nth_element(v, v + k / 2, v + k);
+        const int med = v[k / 2];
+        for (int j = 0; j < k; ++j) v[j] = (uint8_t)abs(v[j] - med);
+        nth_element(v, v + k / 2, v + k);
+        m_center[i] = (float)med;
+        m_scale[i] = max(1.0f, 1.4826f * v[k / 2]);
+    }
+
+    // Robust centre from the first k samples, which then enter the statistics clipped; returns rejections
+    uint64_t Prime(size_t i, int k) {
+        Robust(i, k);
+        uint64_t rej = 0;
+        for (int j = 0; j < k; ++j) {
+            const uint8_t v = m_sample[i * K() + j];
+            if (fabs(v - m_center[i]) > m_opts.clipSigma * m_scale[i]) ++rej;
+            else Update(i, v);
+        }
+        return rej;
+    }
+
+    static uint64_t Mix(uint64_t x) {   // splitmix64 finalizer
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    MasterBuildOptions m_opts;
+    int m_w = 0, m_h = 0;
+    uint32_t m_frames = 0;
+    uint64_t m_rejected = 0;
+    vector<float> m_mean, m_m2;
+    vector<uint32_t> m_count;
+    vector<uint8_t> m_sample;          // K samples per pixel, pixel-major
+    vector<float> m_center, m_scale;   // Robust centre and sigma from the sample
+};
+
+// Streams frames through a MasterFrameBuilder, decoding the next frame while the current one
+// is accumulated. Frames that fail to decode or differ in size are skipped and reported.
+static bool BuildMasterFrame(const vector<wxString>& paths, const MasterBuildOptions& opts, MasterFrame& out,
+    uint64_t* outRejected, wxString* error) {
+    MasterFrameBuilder builder(opts);
+    MemCharge mem(MemTag::Calibration);
+    // Masters are built from uncorrected frames
+    auto decode = [](const wxString& path) { return DecodeFrameFile(path, DecodeOptions(), nullptr); };
+    future<FrameHandle> next = async(launch::async, decode, paths.empty() ? wxString() : paths[0]);
+    int skipped = 0;
+    for (size_t f = 0; f < paths.size(); ++f) {
+        FrameHandle frame = next.get();
+        if (f + 1 < paths.size()) next = async(launch::async, decode, paths[f + 1]);
+        PerfScope timer(PerfOp::Integrate);
+        if (!frame || !builder.Add(frame->image, nullptr)) { ++skipped; continue; }
+        timer.SetPixels((uint64_t)frame->image.GetWidth() * frame->image.GetHeight());
+        mem.Set(builder.Bytes());
+    }
+    if (builder.Frames() == 0) { if (error) *error = "No frames could be read."; return false; }
+    if (skipped && error) *error = wxString::Format("%d frames were unreadable or of a different size and were skipped.", skipped);
+    out = builder.Finish();
+    if (outRejected) *outRejected = builder.Rejected();
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Array export and import (NumPy .npy/.npz, HDF5/NeXus)
+// ---------------------------------------------------------------------------
+
+// Frame as a 2D uint8 array; the grey channel is gathered one row at a time
+static bool WriteFrameNpy(wxOutputStream& out, const wxImage& img) {
+    const int w = img.GetWidth(), h = img.GetHeight();
+    if (!WriteNpyHeader(out, "|u1", { (uint64_t)h, (uint64_t)w })) return false;
+    const unsigned char* rgb = img.GetData();
+    vector<unsigned char> row((size_t)w);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) row[x] = rgb[((size_t)y * w + x) * 3];
+        out.Write(row.data(), row.size());
+        if (out.LastWrite() != row.size()) return false;
+    }
+    return true;
+}
+
+// One sweep as 1D arrays R, avg, err and samples
+static bool WriteProfileNpz(wxZipOutputStream& zip, const vector<RadialAvgPoint>& profile) {
+    const uint64_t n = profile.size();
+    vector<int32_t> R(n), samples(n);
+    vector<double> avg(n), err(n);
+    for (size_t i = 0; i < n; ++i) {
+        R[i] = profile[i].R;
+        avg[i] = profile[i].avg;
+        err[i] = profile[i].err;
+        samples[i] = profile[i].samples;
+    }
+    return zip.PutNextEntry("R.npy") && WriteNpy(zip, "<i4", { n }, R.data(), n * 4) &&
+        zip.PutNextEntry("avg.npy") && WriteNpy(zip, "<f8", { n }, avg.data(), n * 8) &&
+        zip.PutNextEntry("err.npy") && WriteNpy(zip, "<f8", { n }, err.data(), n * 8) &&
+        zip.PutNextEntry("samples.npy") && WriteNpy(zip, "<i4", { n }, samples.data(), n * 4);
+}
+
+// Store columns as frames x bins arrays, written chunk by chunk straight from the mapping
+static bool WriteStoreMatrixNpy(wxOutputStream& out, const ProfileStore& store, const char* descr, int column) {
+    const uint64_t frames = store.Frames();
+    const uint32_t bins = store.Bins();
+    if (!WriteNpyHeader(out, descr, { frames, bins })) return false;
+    for (uint64_t first = 0; first < frames; first += store.ChunkFrames()) {
+        const uint64_t rows = min<uint64_t>(store.ChunkFrames(), frames - first);
+        const void* p = column == 0 ? (const void*)store.Intensity(first)
+            : column == 1 ? (const void*)store.Error(first) : (const void*)store.Count(first);
+        const size_t bytes = (size_t)(rows * bins * 4);
+        out.Write(p, bytes);
+        if (out.LastWrite() != bytes) return false;
+    }
+    return true;
+}
+
+// Whole store as R_px (the radius in pixels), intensity, error, count plus the per-frame
+// metadata columns
+static bool WriteStoreNpz(const ProfileStore& store, const wxString& path) {
+    wxFileOutputStream file(path);
+    if (!file.IsOk()) return false;
+    wxZipOutputStream zip(file, 0);   // Stored like numpy.savez; the data is mostly incompressible floats
+
+    const uint64_t frames = store.Frames();
+    vector<char> source((size_t)frames * sizeof(ProfileMeta::source));
+    vector<int64_t> mtime(frames);
+    vector<float> cx(frames), cy(frames);
+    vector<int32_t> valid(frames);
+    for (uint64_t f = 0; f < frames; ++f) {
+        const ProfileMeta& m = store.Meta(f);
+        memcpy(&source[(size_t)f * sizeof(m.source)], m.source, sizeof(m.source));
+        mtime[f] = m.mtime;
+        cx[f] = m.cx;
+        cy[f] = m.cy;
+        valid[f] = m.validBins;
+    }
+
+    const bool ok =
+        zip.PutNextEntry("R_px.npy") && WriteNpy(zip, "<f8", { store.Bins() }, store.Axis(), store.Bins() * sizeof(double)) &&
+        zip.PutNextEntry("intensity.npy") && WriteStoreMatrixNpy(zip, store, "<f4", 0) &&
+        zip.PutNextEntry("error.npy") && WriteStoreMatrixNpy(zip, store, "<f4", 1) &&
+        zip.PutNextEntry("count.npy") && WriteStoreMatrixNpy(zip, store, "<i4", 2) &&
+        zip.PutNextEntry("source.npy") && WriteNpy(zip, "|S256", { frames }, source.data(), source.size()) &&
+        zip.PutNextEntry("mtime.npy") && WriteNpy(zip, "<i8", { frames }, mtime.data(), frames * 8) &&
+        zip.PutNextEntry("cx.npy") && WriteNpy(zip, "<f4", { frames }, cx.data(), frames * 4) &&
+        zip.PutNextEntry("cy.npy") && WriteNpy(zip, "<f4", { frames }, cy.data(), frames * 4) &&
+        zip.PutNextEntry("valid_bins.npy") && WriteNpy(zip, "<i4", { frames }, valid.data(), frames * 4);
+    return zip.Close() && ok && file.Close();
+}
+
+// Profiles are plotted and compared on integer pixel radii, so an imported axis has to be one
+static bool IsPixelRadiusAxis(const vector<double>& axis) {
+    for (double r : axis)
+        if (!(r >= 0.0 && r <= numeric_limits<int>::max() && r == floor(r))) return false;
+    return true;
+}
+
+// Profiles from an .npz with an R_px (or q) axis (bins) and intensity (frames x bins); error,
+// count and source are used when present
+static bool ImportStoreNpz(const wxString& path, const wxString& storePath, wxString* error) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return false; };
+    map<string, NpyArray> arrays;
+    if (!ReadNpz(path, arrays, error)) return false;
+    auto q = arrays.find("R_px");
+    if (q == arrays.end()) q = arrays.find("q");
+    auto I = arrays.find("intensity");
+    if (q == arrays.end() || I == arrays.end() || q->second.shape.size() != 1 || I->second.shape.size() != 2 ||
+        I->second.shape[1] != q->second.shape[0] || q->second.shape[0] == 0)
+        return fail("Expected R_px (bins) and intensity (frames x bins) arrays in " + path);
+    auto matching = [&](const char* name) {
+        auto it = arrays.find(name);
+        return it != arrays.end() && it->second.shape == I->second.shape && it->second.kind != 'S' ? &it->second : nullptr;
+    };
+    const NpyArray* E = matching("error");
+    const NpyArray* N = matching("count");
+    auto src = arrays.find("source");
+    const NpyArray* S = src != arrays.end() && src->second.kind == 'S' && src->second.shape.size() == 1 &&
+        src->second.shape[0] == I->second.shape[0] ? &src->second : nullptr;
+
+    const uint64_t frames = I->second.shape[0];
+    const uint32_t bins = (uint32_t)q->second.shape[0];
+    vector<double> axis(bins);
+    for (uint32_t i = 0; i < bins; ++i) axis[i] = q->second.At(i);
+    if (!IsPixelRadiusAxis(axis)) return fail("The q axis of " + path + " is not in whole pixel radii; only integer R axes can be imported.");
+
+    ProfileStore store;
+    if (!store.Create(storePath, axis, ProfileStore::DEFAULT_CHUNK_FRAMES, error)) return false;
+    for (uint64_t f = 0; f < frames; ++f) {
+        ProfileMeta meta;
+        memset(&meta, 0, sizeof(meta));
+        if (S) memcpy(meta.source, &S->data[(size_t)f * S->itemSize], min<size_t>(S->itemSize, sizeof(meta.source) - 1));
+        const size_t base = (size_t)(f * bins);
+        // meta is stored after the fill, so the valid-bin count computed there is kept
+        bool ok = store.AppendWith(meta, error, [&](float* rowI, float* rowE, int32_t* rowN) {
+            for (uint32_t b = 0; b < bins; ++b) {
+                rowI[b] = (float)I->second.At(base + b);
+                rowE[b] = E ? (float)E->At(base + b) : numeric_limits<float>::quiet_NaN();
+                rowN[b] = N ? (int32_t)N->At(base + b) : (isfinite(rowI[b]) ? 1 : 0);
+                if (isfinite(rowI[b])) ++meta.validBins;
+            }
+            });
+        if (!ok) return false;
+    }
+    return true;
+}
+
+#ifdef HAVE_HDF5
+static void H5WriteStringListAttr(hid_t obj, const char* name, const vector<string>& values) {
+    size_t len = 1;
+    for (const auto& v : values) len = max(len, v.size());
+    string packed;
+    for (const auto& v : values) packed += v + string(len - v.size(), '\0');
+    H5Id type(H5Tcopy(H5T_C_S1), H5Tclose);
+    H5Tset_size(type, len);
+    H5Tset_strpad(type, H5T_STR_NULLPAD);
+    const hsize_t n = values.size();
+    H5Id space(H5Screate_simple(1, &n, nullptr), H5Sclose);
+    H5Id attr(H5Acreate2(obj, name, type, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose);
+    H5Awrite(attr, type, packed.data());
+}
+
+static void H5WriteIntAttr(hid_t obj, const char* name, int value) {
+    H5Id space(H5Screate(H5S_SCALAR), H5Sclose);
+    H5Id attr(H5Acreate2(obj, name, H5T_NATIVE_INT, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose);
+    H5Awrite(attr, H5T_NATIVE_INT, &value);
+}
+
+// Contiguous 1D dataset written in one call
+static bool H5Write1D(hid_t parent, const char* name, hid_t fileType, hid_t memType, hsize_t n, const void* data) {
+    H5Id space(H5Screate_simple(1, &n, nullptr), H5Sclose);
+    H5Id dset(H5Dcreate2(parent, name, fileType, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Dclose);
+    return dset.IsOk() && (n == 0 || H5Dwrite(dset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0);
+}
+
+// NeXus file: /entry/data (NXdata) holds the frame; a sweep, if any, goes to /entry/profile
+static bool WriteFrameHdf5(const wxString& path, const wxImage& img, const vector<RadialAvgPoint>& profile) {
+    H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+    H5Id file(H5Fcreate(path.utf8_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT), H5Fclose);
+    if (!file.IsOk()) return false;
+    H5WriteStringAttr(file, "default", "entry");
+    H5Id entry(H5CreateNxGroup(file, "entry", "NXentry"), H5Gclose);
+    H5WriteStringAttr(entry, "default", "data");
+    H5Id data(H5CreateNxGroup(entry, "data", "NXdata"), H5Gclose);
+    H5WriteStringAttr(data, "signal", "data");
+
+    const hsize_t h = (hsize_t)img.GetHeight(), w = (hsize_t)img.GetWidth();
+    H5Id dset(H5CreateChunked(data, "data", H5T_STD_U8LE, { h, w }, { min<hsize_t>(h, 256), min<hsize_t>(w, 256) }), H5Dclose);
+    if (!dset.IsOk()) return false;
+    H5Id fileSpace(H5Dget_space(dset), H5Sclose);
+    const hsize_t rowDims[2] = { 1, w };
+    H5Id memSpace(H5Screate_simple(2, rowDims, nullptr), H5Sclose);
+    const unsigned char* rgb = img.GetData();
+    vector<unsigned char> row((size_t)w);
+    for (hsize_t y = 0; y < h; ++y) {
+        for (hsize_t x = 0; x < w; ++x) row[x] = rgb[(y * w + x) * 3];
+        const hsize_t start[2] = { y, 0 };
+        H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, start, nullptr, rowDims, nullptr);
+        if (H5Dwrite(dset, H5T_NATIVE_UCHAR, memSpace, fileSpace, H5P_DEFAULT, row.data()) < 0) return false;
+    }
+
+    if (profile.empty()) return true;
+    H5Id prof(H5CreateNxGroup(entry, "profile", "NXdata"), H5Gclose);
+    H5WriteStringAttr(prof, "signal", "I");
+    H5WriteStringAttr(prof, "axes", "R");
+    const hsize_t n = profile.size();
+    vector<double> R(n), I(n), E(n);
+    vector<int32_t> N(n);
+    for (size_t i = 0; i < n; ++i) { R[i] = profile[i].R; I[i] = profile[i].avg; E[i] = profile[i].err; N[i] = profile[i].samples; }
+    const bool ok = H5Write1D(prof, "R", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, n, R.data()) &&
+        H5Write1D(prof, "I", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, n, I.data()) &&
+        H5Write1D(prof, "I_errors", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, n, E.data()) &&
+        H5Write1D(prof, "counts", H5T_STD_I32LE, H5T_NATIVE_INT32, n, N.data());
+    if (ok) {
+        H5Id r(H5Dopen2(prof, "R", H5P_DEFAULT), H5Dclose);
+        H5WriteStringAttr(r, "units", "pixel");
+    }
+    return ok;
+}
+
+// NeXus file: /entry/data (NXdata) with I, I_errors and counts (frames x bins, chunked per store
+// chunk and deflated) over q, and per-frame metadata in /entry/frames
+static bool WriteStoreHdf5(const ProfileStore& store, const wxString& path) {
+    H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+    H5Id file(H5Fcreate(path.utf8_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT), H5Fclose);
+    if (!file.IsOk()) return false;
+    H5WriteStringAttr(file, "default", "entry");
+    H5Id entry(H5CreateNxGroup(file, "entry", "NXentry"), H5Gclose);
+    H5WriteStringAttr(entry, "default", "data");
+    H5Id data(H5CreateNxGroup(entry, "data", "NXdata"), H5Gclose);
+    H5WriteStringAttr(data, "signal", "I");
+    H5WriteStringListAttr(data, "axes", { ".", "q" });
+    H5WriteIntAttr(data, "q_indices", 1);
+
+    const uint64_t frames = store.Frames();
+    const hsize_t bins = store.Bins();
+    if (!H5Write1D(data, "q", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, bins, store.Axis())) return false;
+    {
+        H5Id q(H5Dopen2(data, "q", H5P_DEFAULT), H5Dclose);
+        H5WriteStringAttr(q, "units", "pixel");
+    }
+
+    const hsize_t chunkRows = max<hsize_t>(1, min<hsize_t>(frames, store.ChunkFrames()));
+    const char* names[3] = { "I", "I_errors", "counts" };
+    for (int column = 0; column < 3; ++column) {
+        const hid_t fileType = column == 2 ? H5T_STD_I32LE : H5T_IEEE_F32LE;
+        const hid_t memType = column == 2 ? H5T_NATIVE_INT32 : H5T_NATIVE_FLOAT;
+        H5Id dset(H5CreateChunked(data, names[column], fileType, { frames, bins }, { chunkRows, bins }), H5Dclose);
+        if (!dset.IsOk()) return false;
+        H5Id fileSpace(H5Dget_space(dset), H5Sclose);
+        for (uint64_t first = 0; first < frames; first += store.ChunkFrames()) {
+            const hsize_t count[2] = { min<hsize_t>(store.ChunkFrames(), frames - first), bins };
+            const hsize_t start[2] = { first, 0 };
+            H5Id memSpace(H5Screate_simple(2, count, nullptr), H5Sclose);
+            H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, start, nullptr, count, nullptr);
+            const void* p = column == 0 ? (const void*)store.Intensity(first)
+                : column == 1 ? (const void*)store.Error(first) : (const void*)store.Count(first);
+            if (H5Dwrite(dset, memType, memSpace, fileSpace, H5P_DEFAULT, p) < 0) return false;
+        }
+    }
+
+    H5Id meta(H5CreateNxGroup(entry, "frames", "NXcollection"), H5Gclose);
+    vector<char> source((size_t)frames * sizeof(ProfileMeta::source));
+    vector<int64_t> mtime(frames);
+    vector<float> cx(frames), cy(frames);
+    for (uint64_t f = 0; f < frames; ++f) {
+        const ProfileMeta& m = store.Meta(f);
+        memcpy(&source[(size_t)f * sizeof(m.source)], m.source, sizeof(m.source));
+        mtime[f] = m.mtime;
+        cx[f] = m.cx;
+        cy[f] = m.cy;
+    }
+    H5Id strType(H5Tcopy(H5T_C_S1), H5Tclose);
+    H5Tset_size(strType, sizeof(ProfileMeta::source));
+    return H5Write1D(meta, "source", strType, strType, frames, source.data()) &&
+        H5Write1D(meta, "mtime", H5T_STD_I64LE, H5T_NATIVE_INT64, frames, mtime.data()) &&
+        H5Write1D(meta, "cx", H5T_IEEE_F32LE, H5T_NATIVE_FLOAT, frames, cx.data()) &&
+        H5Write1D(meta, "cy", H5T_IEEE_F32LE, H5T_NATIVE_FLOAT, frames, cy.data());
+}
+
+// True for files with a profile table (as written by WriteStoreHdf5) rather than a frame
+static bool Hdf5HasProfiles(const wxString& path) {
+    H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+    H5Id file(H5Fopen(path.utf8_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    return file.IsOk() && H5HasDataset(file, "/entry") && H5HasDataset(file, "/entry/data") &&
+        H5HasDataset(file, "/entry/data/I") && H5HasDataset(file, "/entry/data/q");
+}
+
+// Profiles from /entry/data/{q,I[,I_errors,counts]}, read row by row into the store's mapping
+static bool ImportStoreHdf5(const wxString& path, const wxString& storePath, wxString* error) {
+    auto fail = [&](const wxString& msg) { if (error) *error = msg; return false; };
+    if (!Hdf5HasProfiles(path)) return fail("No /entry/data/I profile table in " + path);
+    H5Id file(H5Fopen(path.utf8_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    H5Id qSet(H5Dopen2(file, "/entry/data/q", H5P_DEFAULT), H5Dclose);
+    H5Id iSet(H5Dopen2(file, "/entry/data/I", H5P_DEFAULT), H5Dclose);
+    H5Id qSpace(H5Dget_space(qSet), H5Sclose);
+    H5Id iSpace(H5Dget_space(iSet), H5Sclose);
+    hsize_t qDims[1], iDims[2];
+    if (H5Sget_simple_extent_ndims(qSpace) != 1 || H5Sget_simple_extent_ndims(iSpace) != 2) return fail("Unexpected profile table shape.");
+    H5Sget_simple_extent_dims(qSpace, qDims, nullptr);
+    H5Sget_simple_extent_dims(iSpace, iDims, nullptr);
+    if (qDims[0] == 0 || iDims[1] != qDims[0]) return fail("Unexpected profile table shape.");
+
+    vector<double> axis((size_t)qDims[0]);
+    if (H5Dread(qSet, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, axis.data()) < 0) return fail("Failed to read q.");
+    if (!IsPixelRadiusAxis(axis)) return fail("The q axis of " + path + " is not in whole pixel radii; only integer R axes can be imported.");
+    const bool hasErr = H5HasDataset(file, "/entry/data/I_errors"), hasCount = H5HasDataset(file, "/entry/data/counts");
+    H5Id eSet(hasErr ? H5Dopen2(file, "/entry/data/I_errors", H5P_DEFAULT) : -1, H5Dclose);
+    H5Id nSet(hasCount ? H5Dopen2(file, "/entry/data/counts", H5P_DEFAULT) : -1, H5Dclose);
+
+    ProfileStore store;
+    if (!store.Create(storePath, axis, ProfileStore::DEFAULT_CHUNK_FRAMES, error)) return false;
+    const hsize_t count[2] = { 1, qDims[0] };
+    H5Id memSpace(H5Screate_simple(2, count, nullptr), H5Sclose);
+    for (hsize_t f = 0; f < iDims[0]; ++f) {
+        const hsize_t start[2] = { f, 0 };
+        bool readOk = true;
+        auto readRow = [&](hid_t dset, hid_t memType, void* dst) {
+            H5Id space(H5Dget_space(dset), H5Sclose);
+            H5Sselect_hyperslab(space, H5S_SELECT_SET, start, nullptr, count, nullptr);
+            if (H5Dread(dset, memType, memSpace, space, H5P_DEFAULT, dst) < 0) readOk = false;
+        };
+        ProfileMeta meta;
+        memset(&meta, 0, sizeof(meta));
+        if (!store.AppendWith(meta, error, [&](float* I, float* E, int32_t* N) {
+            readRow(iSet, H5T_NATIVE_FLOAT, I);
+            if (hasErr) readRow(eSet, H5T_NATIVE_FLOAT, E);
+            else fill(E, E + qDims[0], numeric_limits<float>::quiet_NaN());
+            if (hasCount) readRow(nSet, H5T_NATIVE_INT32, N);
+            else for (hsize_t b = 0; b < qDims[0]; ++b) N[b] = isfinite(I[b]) ? 1 : 0;
+            }))
+            return false;
+        if (!readOk) return fail("Failed to read profile row.");
+    }
+    return true;
+}
+#endif
+
+// Frame (and the last sweep) by file extension: .npy frame only, .npz frame plus
+// R/avg/err/samples, .h5/.nxs NeXus
+static bool WriteFrameArrays(const wxString& path, const wxImage& img, const vector<RadialAvgPoint>& profile, wxString* error) {
+    const wxString ext = wxFileName(path).GetExt().Lower();
+    bool ok = false;
+    if (ext == "npy") {
+        wxFileOutputStream file(path);
+        ok = file.IsOk() && WriteFrameNpy(file, img) && file.Close();
+    }
+    else if (ext == "npz") {
+        wxFileOutputStream file(path);
+        if (file.IsOk()) {
+            wxZipOutputStream zip(file, 0);
+            ok = zip.PutNextEntry("frame.npy") && WriteFrameNpy(zip, img) && (profile.empty() || WriteProfileNpz(zip, profile));
+            ok = zip.Close() && ok && file.Close();
+        }
+    }
+    else if (ext == "h5" || ext == "nxs") {
+#ifdef HAVE_HDF5
+        ok = WriteFrameHdf5(path, img, profile);
+#else
+        if (error) *error = "This build has no HDF5 support.";
+        return false;
+#endif
+    }
+    else {
+        if (error) *error = "Unknown array format: ." + ext;
+        return false;
+    }
+    if (!ok && error) *error = "Could not write " + path;
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// 2D FFT (FFTW when built with HAVE_FFTW, otherwise the built-in transform below)
+// ---------------------------------------------------------------------------
 
-    for (int k = 0; k < N; ++k) {
-        const double theta = (2.0 * PI * (double)k) / (double)N;
-        const double fx = (double)cx + (double)R * cos(theta);
-        const double fy = (double)cy + (double)R * sin(theta);
+typedef complex<double> Cplx;
 
-        const int x = (int)lround(fx);
-        const int y = (int)lround(fy);
+// Plain product: std::complex's operator* takes a slow library path to handle infinities
+static inline Cplx CMul(const Cplx& a, const Cplx& b) {
+    return Cplx(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
 
-        if (!InBounds(x, y, w, h)) continue;
+// Smallest size >= n with no prime factor above 5; both backends are fastest there
+static int NextFastFftSize(int n) {
+    for (int m = max(1, n);; ++m) {
+        int r = m;
+        for (int p : { 2, 3, 5 }) while (r % p == 0) r /= p;
+        if (r == 1) return m;
+    }
+}
 
-        const long long key = ((long long)x << 32) ^ (unsigned int)y;
-        if (visited.insert(key).second) {
-            sum += (double)GetGray(img, x, y);
-            ++count;
+// Complex FFT of one length, mixed radix in Stockham order: each stage reads one buffer and
+// writes the other, so the result needs no bit-reversal pass. Radix 4, 2, 3 and 5 butterflies are
+// written out; any other factor uses a direct DFT. Plans are built once per length and shared.
+class FftPlan {
+public:
+    explicit FftPlan(int n) : m_n(n) {
+        int rest = n, stride = 1;
+        auto addStage = [&](int r) {
+            Stage st;
+            st.r = r;
+            st.m = rest / r;
+            st.s = stride;
+            st.twiddles.resize((size_t)st.m * r);
+            for (int p = 0; p < st.m; ++p)
+                for (int k = 0; k < r; ++k) st.twiddles[(size_t)p * r + k] = polar(1.0, -2.0 * PI * p * k / rest);
+            for (int k = 0; k < r; ++k) st.roots.push_back(polar(1.0, -2.0 * PI * k / r));
+            m_stages.push_back(move(st));
+            rest /= r;
+            stride *= r;
+        };
+        while (rest % 4 == 0) addStage(4);
+        while (rest % 2 == 0) addStage(2);
+        for (int p = 3; rest > 1; p += 2)
+            while (rest % p == 0) addStage(p);
+    }
+
+    int Size() const { return m_n; }
+
+    // In place, sum x[j] exp(-2 pi i jk/n), unnormalised; work holds n values
+    void Forward(Cplx* x, Cplx* work) const {
+        Cplx* src = x;
+        Cplx* dst = work;
+        for (const Stage& st : m_stages) {
+            RunStage(st, src, dst);
+            swap(src, dst);
         }
+        if (src != x) copy(src, src + m_n, x);
     }
 
-    if (outUniqueSamples) *outUniqueSamples = count;
-    if (count == 0) return numeric_limits<double>::quiet_NaN();
-    return sum / (double)count;
+    // In place with exp(+2 pi i jk/n), unnormalised
+    void Inverse(Cplx* x, Cplx* work) const {
+        for (int i = 0; i < m_n; ++i) x[i] = conj(x[i]);
+        Forward(x, work);
+        for (int i = 0; i < m_n; ++i) x[i] = conj(x[i]);
+    }
+
+    static shared_ptr<const FftPlan> Get(int n) {
+        static mutex lock;
+        static map<int, shared_ptr<const FftPlan>> cache;
+        lock_guard<mutex> guard(lock);
+        shared_ptr<const FftPlan>& plan = cache[n];
+        if (!plan) plan = make_shared<FftPlan>(n);
+        return plan;
+    }
+
+private:
+    struct Stage {
+        int r, m, s;                 // Radix, remaining length / r, stride
+        vector<Cplx> twiddles;       // m x r
+        vector<Cplx> roots;          // r-th roots of unity
+    };
+
+    static void RunStage(const Stage& st, const Cplx* x, Cplx* y) {
+        const int r = st.r, m = st.m, s = st.s;
+        const size_t sm = (size_t)s * m;
+        vector<Cplx> a(r <= 5 ? 0 : r);
+        for (int p = 0; p < m; ++p) {
+            const Cplx* w = &st.twiddles[(size_t)p * r];
+            const Cplx* in = x + (size_t)s * p;
+            Cplx* out = y + (size_t)s * r * p;
+            if (r == 4) {
+                for (int q = 0; q < s; ++q) {
+                    const Cplx a0 = in[q], a1 = in[q + sm], a2 = in[q + 2 * sm], a3 = in[q + 3 * sm];
+                    const Cplx t0 = a0 + a2, t1 = a0 - a2, t2 = a1 + a3;
+                    const Cplx t3(a1.imag() - a3.imag(), a3.real() - a1.real());   // -i (a1 - a3)
+                    out[q] = t0 + t2;
+                    out[q + s] = CMul(t1 + t3, w[1]);
+                    out[q + 2 * s] = CMul(t0 - t2, w[2]);
+                    out[q + 3 * s] = CMul(t1 - t3, w[3]);
+                }
+            }
+            else if (r == 2) {
+                for (int q = 0; q < s; ++q) {
+                    const Cplx a0 = in[q], a1 = in[q + sm];
+                    out[q] = a0 + a1;
+                    out[q + s] = CMul(a0 - a1, w[1]);
+                }
+            }
+            else if (r == 3) {
+                const double h = sqrt(3.0) / 2.0;
+                for (int q = 0; q < s; ++q) {
+                    const Cplx a0 = in[q], a1 = in[q + sm], a2 = in[q + 2 * sm];
+                    const Cplx t1 = a1 + a2, t2 = a0 - 0.5 * t1, d = a1 - a2;
+                    const Cplx t3(h * d.imag(), -h * d.real());                   // -i sin(2 pi/3) (a1 - a2)
+                    out[q] = a0 + t1;
+                    out[q + s] = CMul(t2 + t3, w[1]);
+                    out[q + 2 * s] = CMul(t2 - t3, w[2]);
+                }
+            }
+            else if (r == 5) {
+                const double c1 = cos(2.0 * PI / 5), c2 = cos(4.0 * PI / 5), s1 = sin(2.0 * PI / 5), s2 = sin(4.0 * PI / 5);
+                for (int q = 0; q < s; ++q) {
+                    const Cplx a0 = in[q], a1 = in[q + sm], a2 = in[q + 2 * sm], a3 = in[q + 3 * sm], a4 = in[q + 4 * sm];
+                    const Cplx b1 = a1 + a4, b2 = a2 + a3, d1 = a1 - a4, d2 = a2 - a3;
+                    const Cplx t1 = a0 + c1 * b1 + c2 * b2, t2 = a0 + c2 * b1 + c1 * b2;
+                    const Cplx e1 = s1 * d1 + s2 * d2, e2 = s2 * d1 - s1 * d2;
+                    const Cplx u1(e1.imag(), -e1.real()), u2(e2.imag(), -e2.real());   // -i e
+                    out[q] = a0 + b1 + b2;
+                    out[q + s] = CMul(t1 + u1, w[1]);
+                    out[q + 2 * s] = CMul(t2 + u2, w[2]);
+                    out[q + 3 * s] = CMul(t2 - u2, w[3]);
+                    out[q + 4 * s] = CMul(t1 - u1, w[4]);
+                }
+            }
+            else {
+                for (int q = 0; q < s; ++q) {
+                    for (int j = 0; j < r; ++j) a[j] = in[q + j * sm];
+                    for (int k = 0; k < r; ++k) {
+                        Cplx sum = 0.0;
+                        for (int j = 0; j < r; ++j) sum += CMul(a[j], st.roots[(size_t)j * k % r]);
+                        out[q + (size_t)k * s] = CMul(sum, w[k]);
+                    }
+                }
+            }
+        }
+    }
+
+    int m_n;
+    vector<Stage> m_stages;
+};
+
+#ifdef HAVE_FFTW
+// One FFTW plan per shape and direction. Planning is not thread-safe but executing a plan on new
+// arrays is; FFTW_UNALIGNED lets those arrays be ordinary vectors.
+static fftw_plan FftwPlan(int w, int h, bool forward) {
+    static mutex lock;
+    static map<tuple<int, int, bool>, fftw_plan> cache;
+    lock_guard<mutex> guard(lock);
+    static const bool threaded = fftw_init_threads() != 0;
+    fftw_plan& plan = cache[make_tuple(w, h, forward)];
+    if (!plan) {
+        if (threaded) fftw_plan_with_nthreads((int)max(1u, thread::hardware_concurrency()));
+        double* r = fftw_alloc_real((size_t)w * h);
+        fftw_complex* c = fftw_alloc_complex((size_t)h * (w / 2 + 1));
+        const unsigned flags = FFTW_ESTIMATE | FFTW_UNALIGNED;
+        plan = forward ? fftw_plan_dft_r2c_2d(h, w, r, c, flags) : fftw_plan_dft_c2r_2d(h, w, c, r, flags);
+        fftw_free(r);
+        fftw_free(c);
+    }
+    return plan;
+}
+#else
+// Every column of an h x cols complex array in place. Eight columns are gathered per pass so
+// each row read covers whole cache lines.
+static void FftColumns(Cplx* data, int cols, int h, bool forward) {
+    const int BLOCK = 8;
+    const shared_ptr<const FftPlan> plan = FftPlan::Get(h);
+    ParallelFor(0, (cols + BLOCK - 1) / BLOCK, [&](int b0, int b1) {
+        vector<Cplx> col((size_t)BLOCK * h), work(h);
+        for (int b = b0; b < b1; ++b) {
+            const int c0 = b * BLOCK, nc = min(BLOCK, cols - c0);
+            for (int y = 0; y < h; ++y)
+                for (int c = 0; c < nc; ++c) col[(size_t)c * h + y] = data[(size_t)y * cols + c0 + c];
+            for (int c = 0; c < nc; ++c) {
+                if (forward) plan->Forward(&col[(size_t)c * h], work.data());
+                else plan->Inverse(&col[(size_t)c * h], work.data());
+            }
+            for (int y = 0; y < h; ++y)
+                for (int c = 0; c < nc; ++c) data[(size_t)y * cols + c0 + c] = col[(size_t)c * h + y];
+        }
+        });
+}
+#endif
+
+// Real h x w array to its half spectrum, h x (w/2 + 1) row-major, unnormalised. Without FFTW, rows
+// go two at a time through one complex transform (the second as the imaginary part) and are
+// separated by conjugate symmetry, then the columns are transformed.
+static void Fft2DForward(const double* in, int w, int h, Cplx* out) {
+#ifdef HAVE_FFTW
+    fftw_execute_dft_r2c(FftwPlan(w, h, true), const_cast<double*>(in), reinterpret_cast<fftw_complex*>(out));
+#else
+    const int hw = w / 2 + 1;
+    const shared_ptr<const FftPlan> plan = FftPlan::Get(w);
+    ParallelFor(0, (h + 1) / 2, [&](int p0, int p1) {
+        vector<Cplx> z(w), work(w);
+        for (int p = p0; p < p1; ++p) {
+            const double* a = in + (size_t)2 * p * w;
+            const double* b = 2 * p + 1 < h ? a + w : nullptr;
+            for (int x = 0; x < w; ++x) z[x] = Cplx(a[x], b ? b[x] : 0.0);
+            plan->Forward(z.data(), work.data());
+            Cplx* A = out + (size_t)2 * p * hw;
+            Cplx* B = A + hw;
+            for (int k = 0; k < hw; ++k) {
+                const Cplx zk = z[k], zc = conj(z[(w - k) % w]);
+                A[k] = 0.5 * (zk + zc);
+                if (b) B[k] = Cplx(0.5 * (zk.imag() - zc.imag()), 0.5 * (zc.real() - zk.real()));   // (zk - zc) / 2i
+            }
+        }
+        });
+    FftColumns(out, hw, h, true);
+#endif
+}
+
+// Half spectrum back to a real h x w array, scaled by w*h; `in` is overwritten
+static void Fft2DInverse(Cplx* in, int w, int h, double* out) {
+#ifdef HAVE_FFTW
+    fftw_execute_dft_c2r(FftwPlan(w, h, false), reinterpret_cast<fftw_complex*>(in), out);
+#else
+    const int hw = w / 2 + 1;
+    FftColumns(in, hw, h, false);
+    const shared_ptr<const FftPlan> plan = FftPlan::Get(w);
+    ParallelFor(0, (h + 1) / 2, [&](int p0, int p1) {
+        vector<Cplx> z(w), work(w);
+        for (int p = p0; p < p1; ++p) {
+            const Cplx* A = in + (size_t)2 * p * hw;
+            const Cplx* B = 2 * p + 1 < h ? A + hw : nullptr;
+            // Rebuild both full rows from their halves and pack them as A + iB
+            for (int k = 0; k < w; ++k) {
+                const Cplx a = k < hw ? A[k] : conj(A[w - k]);
+                const Cplx b = !B ? Cplx() : k < hw ? B[k] : conj(B[w - k]);
+                z[k] = Cplx(a.real() - b.imag(), a.imag() + b.real());
+            }
+            plan->Inverse(z.data(), work.data());
+            double* ra = out + (size_t)2 * p * w;
+            for (int x = 0; x < w; ++x) ra[x] = z[x].real();
+            if (B) for (int x = 0; x < w; ++x) ra[w + x] = z[x].imag();
+        }
+        });
+#endif
+}
+
+// A transformed region as a full plane, zero frequency (or zero shift) at (width/2, height/2)
+struct FftMap {
+    int width = 0, height = 0;
+    vector<float> values;
+};
+
+// Region with its mean removed, optionally under a separable Hann window, at the top left of a
+// zero-filled pw x ph array
+static vector<double> FftInput(const wxImage& img, const wxRect& roi, int pw, int ph, bool window) {
+    const int iw = img.GetWidth();
+    const unsigned char* rgb = img.GetData();
+    double mean = 0.0;
+    for (int y = roi.y; y < roi.GetBottom() + 1; ++y)
+        for (int x = roi.x; x < roi.GetRight() + 1; ++x) mean += rgb[((size_t)y * iw + x) * 3];
+    mean /= (double)roi.width * roi.height;
+
+    vector<double> wx(roi.width, 1.0), wy(roi.height, 1.0);
+    if (window) {
+        for (int x = 0; x < roi.width; ++x) wx[x] = 0.5 - 0.5 * cos(2.0 * PI * (x + 0.5) / roi.width);
+        for (int y = 0; y < roi.height; ++y) wy[y] = 0.5 - 0.5 * cos(2.0 * PI * (y + 0.5) / roi.height);
+    }
+    vector<double> data((size_t)pw * ph, 0.0);
+    ParallelFor(0, roi.height, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char* src = rgb + ((size_t)(roi.y + y) * iw + roi.x) * 3;
+            double* dst = &data[(size_t)y * pw];
+            for (int x = 0; x < roi.width; ++x) dst[x] = (src[x * 3] - mean) * wx[x] * wy[y];
+        }
+        });
+    return data;
+}
+
+// log10 power spectrum of a region: mean removed, Hann-windowed against edge leakage and
+// zero-padded to a fast size (which is then the map size)
+static FftMap PowerSpectrum(const wxImage& img, const wxRect& roi) {
+    FftMap result;
+    const int pw = NextFastFftSize(roi.width), ph = NextFastFftSize(roi.height), hw = pw / 2 + 1;
+    const vector<double> data = FftInput(img, roi, pw, ph, true);
+    vector<Cplx> spec((size_t)ph * hw);
+    Fft2DForward(data.data(), pw, ph, spec.data());
+
+    double peak = 0.0;
+    for (const Cplx& c : spec) peak = max(peak, norm(c));
+    const double floor = max(peak * 1e-12, 1e-300);
+    result.width = pw;
+    result.height = ph;
+    result.values.resize((size_t)pw * ph);
+    ParallelFor(0, ph, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const int ky = (y - ph / 2 + ph) % ph;
+            for (int x = 0; x < pw; ++x) {
+                const int kx = (x - pw / 2 + pw) % pw;
+                // Only non-negative kx are stored; the rest mirror through the origin
+                const Cplx& c = kx < hw ? spec[(size_t)ky * hw + kx] : spec[(size_t)((ph - ky) % ph) * hw + (pw - kx)];
+                result.values[(size_t)y * pw + x] = (float)log10(max(norm(c), floor));
+            }
+        }
+        });
+    return result;
+}
+
+// Autocorrelation of a region with its mean removed, normalised to 1 at zero shift, for shifts up
+// to half the region each way. The transform is padded to 1.5x so those shifts do not wrap.
+static FftMap Autocorrelation(const wxImage& img, const wxRect& roi) {
+    FftMap result;
+    const int pw = NextFastFftSize(roi.width + roi.width / 2), ph = NextFastFftSize(roi.height + roi.height / 2);
+    vector<double> data = FftInput(img, roi, pw, ph, false);
+    vector<Cplx> spec((size_t)ph * (pw / 2 + 1));
+    Fft2DForward(data.data(), pw, ph, spec.data());
+    for (Cplx& c : spec) c = norm(c);
+    Fft2DInverse(spec.data(), pw, ph, data.data());
+
+    const int rx = roi.width / 2, ry = roi.height / 2;
+    const double zero = data[0];
+    result.width = 2 * rx + 1;
+    result.height = 2 * ry + 1;
+    result.values.assign((size_t)result.width * result.height, 0.0f);
+    if (zero <= 0.0) return result;                      // Flat region
+    for (int v = -ry; v <= ry; ++v)
+        for (int u = -rx; u <= rx; ++u)
+            result.values[(size_t)(v + ry) * result.width + (u + rx)] = (float)(data[(size_t)((v + ph) % ph) * pw + (u + pw) % pw] / zero);
+    return result;
+}
+
+// Strongest power outside the window's central leakage, as a signed frequency in bins
+static bool DominantFrequency(const FftMap& spectrum, int& u, int& v) {
+    const int cx = spectrum.width / 2, cy = spectrum.height / 2;
+    float best = -numeric_limits<float>::infinity();
+    for (int y = 0; y < spectrum.height; ++y)
+        for (int x = 0; x < spectrum.width; ++x) {
+            if (abs(x - cx) <= 2 && abs(y - cy) <= 2) continue;
+            const float p = spectrum.values[(size_t)y * spectrum.width + x];
+            if (p > best) { best = p; u = x - cx; v = y - cy; }
+        }
+    return isfinite(best);
+}
+
+// Half width at half maximum of the central autocorrelation peak along x and y (the speckle size)
+static void CentralPeakWidth(const FftMap& acf, double& hx, double& hy) {
+    const int cx = acf.width / 2, cy = acf.height / 2;
+    auto walk = [&](int dx, int dy, int limit) {
+        float prev = 1.0f;
+        for (int i = 1; i <= limit; ++i) {
+            const float c = acf.values[(size_t)(cy + i * dy) * acf.width + (cx + i * dx)];
+            if (c < 0.5f) return i - 1 + (prev - 0.5) / (prev - c);
+            prev = c;
+        }
+        return numeric_limits<double>::quiet_NaN();
+    };
+    hx = walk(1, 0, cx);
+    hy = walk(0, 1, cy);
+}
+
+// ---------------------------------------------------------------------------
+// False colour
+// ---------------------------------------------------------------------------
+
+// 256-entry viridis table interpolated from nine anchors: perceptually uniform and still ordered
+// when printed in grey
+static const unsigned char* ViridisLut() {
+    static const vector<unsigned char> lut = [] {
+        static const unsigned char anchors[9][3] = { { 68, 1, 84 }, { 71, 44, 122 }, { 59, 81, 139 }, { 44, 113, 142 },
+            { 33, 144, 141 }, { 39, 173, 129 }, { 92, 200, 99 }, { 170, 220, 50 }, { 253, 231, 37 } };
+        vector<unsigned char> t(256 * 3);
+        for (int i = 0; i < 256; ++i) {
+            const double u = i / 255.0 * 8.0;
+            const int a = min(7, (int)u);
+            const double f = u - a;
+            for (int c = 0; c < 3; ++c) t[i * 3 + c] = (unsigned char)lround(anchors[a][c] + f * (anchors[a + 1][c] - anchors[a][c]));
+        }
+        return t;
+    }();
+    return lut.data();
+}
+
+// Scalar map through the colour table: lo maps to the first entry and hi to the last;
+// non-finite values are drawn mid-grey
+static wxImage ColormapImage(const float* values, int w, int h, double lo, double hi) {
+    wxImage img(w, h, false);
+    unsigned char* rgb = img.GetData();
+    if (!rgb) return img;
+    const unsigned char* lut = ViridisLut();
+    const double scale = hi > lo ? 255.0 / (hi - lo) : 0.0;
+    ParallelFor(0, h, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * w; i < (size_t)y1 * w; ++i) {
+            const float v = values[i];
+            if (!isfinite(v)) { rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = 128; continue; }
+            const int k = (int)min(255.0, max(0.0, (v - lo) * scale + 0.5));
+            memcpy(rgb + i * 3, lut + k * 3, 3);
+        }
+        });
+    return img;
+}
+
+// Display range between two percentiles (0..100) of the finite values
+static void PercentileRange(const float* values, size_t n, double pLo, double pHi, double& lo, double& hi) {
+    vector<float> v;
+    v.reserve(n);
+    for (size_t i = 0; i < n; ++i) if (isfinite(values[i])) v.push_back(values[i]);
+    lo = hi = 0.0;
+    if (v.empty()) return;
+    auto at = [&](double pct) {
+        const size_t k = (size_t)min<double>((double)v.size() - 1, max(0.0, pct / 100.0 * (v.size() - 1)));
+        nth_element(v.begin(), v.begin() + k, v.end());
+        return (double)v[k];
+    };
+    lo = at(pLo);
+    hi = at(pHi);
 }
 
 class PlotFrame : public wxFrame {
 public:
-    PlotFrame(wxWindow* parent, const std::vector<RadialAvgPoint>& data)
+    PlotFrame(wxWindow* parent, const std::vector<RadialAvgPoint>& data, const vector<ProfilePeak>& peaks = {})
         : wxFrame(parent, wxID_ANY, "Radial Average Plot", wxDefaultPosition, wxSize(700, 450)),
-        m_data(data)
+        m_data(data), m_peaks(peaks)
     {
         SetBackgroundStyle(wxBG_STYLE_PAINT);
         Bind(wxEVT_PAINT, &PlotFrame::OnPaint, this);
@@ -560,6 +6822,7 @@ public:
 
 private:
     std::vector<RadialAvgPoint> m_data;
+    vector<ProfilePeak> m_peaks;
 
     void OnResize(wxSizeEvent& evt) {
         Refresh();
@@ -567,87 +6830,674 @@ private:
     }
 
     void OnPaint(wxPaintEvent&) {
+        PerfScope timer(PerfOp::Paint);
         wxAutoBufferedPaintDC dc(this);
         dc.Clear();
 
-        if (m_data.empty()) {
-            dc.DrawText("No data. Run a radial sweep first.", 10, 10);
-            return;
+        if (m_data.empty()) {
+            dc.DrawText("No data. Run a radial sweep first.", 10, 10);
+            return;
+        }
+
+        // --- 1) Compute plot bounds (data min/max) ---
+        int minR = numeric_limits<int>::max();
+        int maxR = numeric_limits<int>::min();
+        double minY = numeric_limits<double>::infinity();
+        double maxY = -numeric_limits<double>::infinity();
+
+        for (const auto& p : m_data) {
+            if (!isfinite(p.avg)) continue;
+            minR = min(minR, p.R);
+            maxR = max(maxR, p.R);
+            minY = min(minY, p.avg);
+            maxY = max(maxY, p.avg);
+        }
+
+        if (minR == numeric_limits<int>::max()) {
+            dc.DrawText("All data points are invalid (NaN).", 10, 10);
+            return;
+        }
+
+        // Avoid zero range
+        if (maxR == minR) maxR = minR + 1;
+        if (maxY == minY) { maxY = minY + 1.0; }
+
+        // --- 2) Layout (margins + axes box) ---
+        const wxSize sz = GetClientSize();
+        const int left = 60, right = 20, top = 20, bottom = 50;
+        const int plotW = max(1, sz.x - left - right);
+        const int plotH = max(1, sz.y - top - bottom);
+
+        wxRect plotRect(left, top, plotW, plotH);
+
+        // Axes
+        dc.DrawLine(plotRect.GetLeft(), plotRect.GetBottom(),
+            plotRect.GetRight(), plotRect.GetBottom()); // X axis
+        dc.DrawLine(plotRect.GetLeft(), plotRect.GetTop(),
+            plotRect.GetLeft(), plotRect.GetBottom()); // Y axis
+
+        // Labels
+        dc.DrawText("R (pixels)", plotRect.GetLeft() + plotW / 2 - 30, sz.y - 30);
+        dc.DrawText("Avg", 10, plotRect.GetTop() + plotH / 2 - 10);
+
+        // Simple min/max annotations
+        dc.DrawText(wxString::Format("%d", minR), plotRect.GetLeft(), plotRect.GetBottom() + 5);
+        dc.DrawText(wxString::Format("%d", maxR), plotRect.GetRight() - 30, plotRect.GetBottom() + 5);
+        dc.DrawText(wxString::Format("%.1f", maxY), plotRect.GetLeft() - 55, plotRect.GetTop());
+        dc.DrawText(wxString::Format("%.1f", minY), plotRect.GetLeft() - 55, plotRect.GetBottom() - 15);
+
+        // --- 3) Mapping functions data -> screen ---
+        auto mapX = [&](int R) -> int {
+            double t = (double)(R - minR) / (double)(maxR - minR);
+            return plotRect.GetLeft() + (int)std::lround(t * plotW);
+            };
+        auto mapY = [&](double y) -> int {
+            double t = (y - minY) / (maxY - minY);
+            // invert Y (screen grows downward)
+            return plotRect.GetBottom() - (int)std::lround(t * plotH);
+            };
+
+        // --- 4) Draw polyline ---
+        vector<wxPoint> pts;
+        pts.reserve(m_data.size());
+
+        for (const auto& p : m_data) {
+            if (!isfinite(p.avg)) continue;
+            pts.emplace_back(mapX(p.R), mapY(p.avg));
+        }
+
+        if (pts.size() >= 2) {
+            dc.DrawLines((int)pts.size(), pts.data());
+        }
+        else if (pts.size() == 1) {
+            dc.DrawCircle(pts[0], 2);
+        }
+
+        // Peaks: a tick from the baseline to the apex, with the FWHM as a bar at half height
+        dc.SetPen(*wxRED_PEN);
+        for (const auto& p : m_peaks) {
+            const double t = (p.position - minR) / (double)(maxR - minR);
+            const int x = plotRect.GetLeft() + (int)lround(t * plotW);
+            const int half = (int)lround(p.fwhm / (maxR - minR) * plotW / 2);
+            const int yHalf = mapY(p.background + p.height / 2);
+            dc.DrawLine(x, mapY(p.background), x, mapY(p.background + p.height));
+            dc.DrawLine(x - half, yHalf, x + half, yHalf);
+        }
+    }
+};
+
+// Files that look like detector frames: everything except sidecars and analysis outputs
+static bool IsFrameCandidate(const wxFileName& fn) {
+    const wxString ext = fn.GetExt().Lower();
+    return fn.FileExists() && ext != "synth" && ext != "rps" && ext != "npz" && ext != "evt" && ext != "csv" && ext != "json" && ext != "txt";
+}
+
+// Frame files directly inside a folder, sorted by name
+static vector<wxString> FramesInFolder(const wxString& dir) {
+    vector<wxString> paths;
+    wxArrayString files;
+    wxDir::GetAllFiles(dir, &files, "", wxDIR_FILES);
+    for (const auto& f : files) if (IsFrameCandidate(wxFileName(f))) paths.push_back(f);
+    sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// ROIs frozen for a batch: rectangles, then mask ROIs rasterized for the defining frame's size
+struct RoiSnapshot {
+    vector<wxRect> rects;
+    vector<RunMask> masks;
+
+    size_t Count() const { return rects.size() + masks.size(); }
+    wxString Label(size_t i) const {
+        return i < rects.size() ? wxString::Format("ROI %zu", i) : wxString::Format("Mask %zu", i - rects.size());
+    }
+
+    static RoiSnapshot Take(const ROIManager& rois, int w, int h) {
+        RoiSnapshot snap;
+        snap.rects = rois.GetROIs();
+        for (size_t i = 0; i < rois.ShapeCount(); ++i) snap.masks.push_back(*rois.GetMask(i, w, h));
+        return snap;
+    }
+};
+
+// Intensity-versus-frame traces for every ROI over a list of frames, computed in the background.
+// Worker threads take frames in order from a shared counter, so traces fill from the start; each
+// frame is decoded, turned into tables once and measured for all ROIs, then its row is published.
+class RoiTraceJob {
+public:
+    RoiTraceJob(const vector<wxString>& paths, const RoiSnapshot& rois)
+        : m_paths(paths), m_rois(rois),
+        m_mean(paths.size() * rois.Count(), numeric_limits<double>::quiet_NaN()),
+        m_sum(paths.size() * rois.Count(), numeric_limits<double>::quiet_NaN()) {}
+    ~RoiTraceJob() { Cancel(); }
+
+    void Start() { m_thread = thread([this] { Run(); }); }
+    void Cancel() {
+        m_cancel = true;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    size_t Frames() const { return m_paths.size(); }
+    size_t RoiCount() const { return m_rois.Count(); }
+    const wxString& Path(size_t f) const { return m_paths[f]; }
+    wxString Label(size_t r) const { return m_rois.Label(r); }
+    int Done() const { return m_done; }
+    bool Finished() const { return m_finished; }
+
+    // Copies of the frames x ROIs tables; frames not yet measured are NaN
+    void Read(vector<double>& mean, vector<double>& sum) const {
+        lock_guard<mutex> lock(m_mutex);
+        mean = m_mean;
+        sum = m_sum;
+    }
+
+private:
+    void Run() {
+        atomic<size_t> next{ 0 };
+        const int slots = (int)max(1u, thread::hardware_concurrency());
+        ParallelFor(0, slots, [&](int, int) {
+            FrameTables tables;   // Reused across this worker's frames
+            vector<double> mean(m_rois.Count()), sum(m_rois.Count());
+            for (size_t f; !m_cancel && (f = next++) < m_paths.size();) {
+                FrameHandle frame = DecodeFrameFile(m_paths[f], m_decode, nullptr);
+                if (frame) {
+                    PerfScope timer(PerfOp::Integrate);
+                    timer.SetPixels((uint64_t)frame->image.GetWidth() * frame->image.GetHeight());
+                    tables.Build(frame->image, false);
+                    for (size_t r = 0; r < m_rois.Count(); ++r) {
+                        const RoiStats st = r < m_rois.rects.size() ? tables.Stats(m_rois.rects[r])
+                            : tables.Stats(m_rois.masks[r - m_rois.rects.size()]);
+                        mean[r] = st.mean;
+                        sum[r] = st.pixels ? st.sum : numeric_limits<double>::quiet_NaN();
+                    }
+                    lock_guard<mutex> lock(m_mutex);
+                    copy(mean.begin(), mean.end(), m_mean.begin() + f * m_rois.Count());
+                    copy(sum.begin(), sum.end(), m_sum.begin() + f * m_rois.Count());
+                }
+                ++m_done;
+            }
+            });
+        m_finished = true;
+    }
+
+    const vector<wxString> m_paths;
+    const RoiSnapshot m_rois;
+    const DecodeOptions m_decode = CurrentDecodeOptions();   // Corrections as when the job started
+    mutable mutex m_mutex;
+    vector<double> m_mean, m_sum;     // Frames x ROIs, row-major
+    atomic<int> m_done{ 0 };
+    atomic<bool> m_cancel{ false };
+    atomic<bool> m_finished{ false };
+    thread m_thread;
+};
+
+// Live plot of a RoiTraceJob: one line per ROI against frame number, redrawn as frames complete
+class RoiTraceFrame : public wxFrame {
+public:
+    RoiTraceFrame(wxWindow* parent, const vector<wxString>& paths, const RoiSnapshot& rois)
+        : wxFrame(parent, wxID_ANY, "ROI Traces", wxDefaultPosition, wxSize(800, 500)),
+        m_job(paths, rois), m_timer(this) {
+        m_plot = new wxPanel(this, wxID_ANY);
+        m_plot->SetBackgroundStyle(wxBG_STYLE_PAINT);
+
+        wxBoxSizer* barBox = new wxBoxSizer(wxHORIZONTAL);
+        m_statChoice = new wxChoice(this, wxID_ANY);
+        m_statChoice->Append("Mean");
+        m_statChoice->Append("Sum");
+        m_statChoice->SetSelection(0);
+        wxButton* exportBtn = new wxButton(this, wxID_ANY, "Export CSV...");
+        m_status = new wxStaticText(this, wxID_ANY, "");
+        barBox->Add(m_statChoice, 0, wxALL, 5);
+        barBox->Add(exportBtn, 0, wxALL, 5);
+        barBox->Add(m_status, 1, wxALIGN_CENTER_VERTICAL | wxALL, 5);
+
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        sizer->Add(barBox, 0, wxEXPAND);
+        sizer->Add(m_plot, 1, wxEXPAND);
+        SetSizer(sizer);
+
+        m_plot->Bind(wxEVT_PAINT, &RoiTraceFrame::OnPaint, this);
+        m_plot->Bind(wxEVT_SIZE, [this](wxSizeEvent& evt) { m_plot->Refresh(); evt.Skip(); });
+        m_statChoice->Bind(wxEVT_CHOICE, [this](wxCommandEvent&) { m_plot->Refresh(); });
+        exportBtn->Bind(wxEVT_BUTTON, &RoiTraceFrame::OnExport, this);
+        Bind(wxEVT_TIMER, [this](wxTimerEvent&) { OnRefresh(); });
+        Bind(wxEVT_CLOSE_WINDOW, [this](wxCloseEvent& evt) { m_timer.Stop(); m_job.Cancel(); evt.Skip(); });
+
+        m_start = chrono::steady_clock::now();
+        m_job.Start();
+        m_timer.Start(200);
+    }
+
+private:
+    RoiTraceJob m_job;
+    wxTimer m_timer;
+    wxPanel* m_plot{ nullptr };
+    wxChoice* m_statChoice{ nullptr };
+    wxStaticText* m_status{ nullptr };
+    vector<double> m_mean, m_sum;    // Latest copy of the job's tables
+    int m_shown = -1;                // Frames done at the last redraw
+    chrono::steady_clock::time_point m_start;
+    double m_seconds = 0.0;
+
+    void OnRefresh() {
+        // Finished is read before Done, so the last redraw covers every frame the job processed
+        const bool finished = m_job.Finished();
+        const int done = m_job.Done();
+        if (done == m_shown && !finished) return;
+        m_shown = done;
+        m_job.Read(m_mean, m_sum);
+        if (!finished) m_seconds = chrono::duration<double>(chrono::steady_clock::now() - m_start).count();
+        else m_timer.Stop();
+        m_status->SetLabel(wxString::Format("%d / %zu frames, %zu ROIs, %.1f s%s", done, m_job.Frames(), m_job.RoiCount(),
+            m_seconds, finished ? "" : " ..."));
+        m_plot->Refresh();
+    }
+
+    void OnPaint(wxPaintEvent&) {
+        PerfScope timer(PerfOp::Paint);
+        wxAutoBufferedPaintDC dc(m_plot);
+        dc.Clear();
+        const vector<double>& values = m_statChoice->GetSelection() == 1 ? m_sum : m_mean;
+        const size_t frames = m_job.Frames(), rois = m_job.RoiCount();
+
+        double minY = numeric_limits<double>::infinity(), maxY = -minY;
+        for (double v : values) if (isfinite(v)) { minY = min(minY, v); maxY = max(maxY, v); }
+        if (!isfinite(minY)) {
+            dc.DrawText("Waiting for the first frames...", 10, 10);
+            return;
+        }
+        if (maxY == minY) maxY = minY + 1.0;
+
+        const wxSize sz = m_plot->GetClientSize();
+        const int left = 60, right = 90, top = 20, bottom = 40;
+        const wxRect plotRect(left, top, max(1, sz.x - left - right), max(1, sz.y - top - bottom));
+        dc.DrawLine(plotRect.GetLeft(), plotRect.GetBottom(), plotRect.GetRight(), plotRect.GetBottom());
+        dc.DrawLine(plotRect.GetLeft(), plotRect.GetTop(), plotRect.GetLeft(), plotRect.GetBottom());
+        dc.DrawText("Frame", plotRect.GetLeft() + plotRect.width / 2 - 20, sz.y - 25);
+        dc.DrawText("0", plotRect.GetLeft(), plotRect.GetBottom() + 5);
+        dc.DrawText(wxString::Format("%zu", frames - 1), plotRect.GetRight() - 30, plotRect.GetBottom() + 5);
+        dc.DrawText(wxString::Format("%.4g", maxY), 5, plotRect.GetTop());
+        dc.DrawText(wxString::Format("%.4g", minY), 5, plotRect.GetBottom() - 15);
+
+        auto mapX = [&](size_t f) { return plotRect.GetLeft() + (int)lround(frames > 1 ? (double)f / (frames - 1) * plotRect.width : 0.0); };
+        auto mapY = [&](double y) { return plotRect.GetBottom() - (int)lround((y - minY) / (maxY - minY) * plotRect.height); };
+
+        static const wxColour colours[] = { wxColour(31, 119, 180), wxColour(255, 127, 14), wxColour(44, 160, 44),
+            wxColour(214, 39, 40), wxColour(148, 103, 189), wxColour(140, 86, 75), wxColour(227, 119, 194), wxColour(127, 127, 127) };
+        vector<wxPoint> pts;
+        for (size_t r = 0; r < rois; ++r) {
+            const wxColour& colour = colours[r % (sizeof(colours) / sizeof(colours[0]))];
+            dc.SetPen(wxPen(colour));
+            // Gaps (frames not done or unreadable) break the line
+            auto flush = [&] {
+                if (pts.size() >= 2) dc.DrawLines((int)pts.size(), pts.data());
+                else if (pts.size() == 1) dc.DrawCircle(pts[0], 1);
+                pts.clear();
+            };
+            for (size_t f = 0; f < frames; ++f) {
+                const double v = values[f * rois + r];
+                if (isfinite(v)) pts.emplace_back(mapX(f), mapY(v));
+                else flush();
+            }
+            flush();
+            if (r < 20) {
+                dc.SetTextForeground(colour);
+                dc.DrawText(m_job.Label(r), plotRect.GetRight() + 10, plotRect.GetTop() + 16 * (int)r);
+            }
+        }
+        dc.SetTextForeground(*wxBLACK);
+    }
+
+    void OnExport(wxCommandEvent&) {
+        wxFileDialog saveDlg(this, "Export ROI traces", "", "roi_traces.csv",
+            "CSV files (*.csv)|*.csv|Gzipped CSV (*.csv.gz)|*.csv.gz", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+        m_job.Read(m_mean, m_sum);
+
+        PerfScope timer(PerfOp::Export);
+        CsvWriter csv;
+        bool ok = csv.Open(saveDlg.GetPath());
+        if (ok) {
+            const size_t rois = m_job.RoiCount();
+            csv.Raw("frame,source");
+            for (size_t r = 0; r < rois; ++r) { csv.Sep(); csv.Text("mean:" + m_job.Label(r)); csv.Sep(); csv.Text("sum:" + m_job.Label(r)); }
+            csv.EndRow();
+            for (size_t f = 0; f < m_job.Frames(); ++f) {
+                csv.Integer((long long)f); csv.Sep();
+                csv.Text(wxFileName(m_job.Path(f)).GetFullName());
+                for (size_t r = 0; r < rois; ++r) {
+                    csv.Sep(); csv.Number(m_mean[f * rois + r]);
+                    csv.Sep(); csv.Number(m_sum[f * rois + r]);
+                }
+                csv.EndRow();
+            }
+            ok = csv.Close();
+        }
+        if (!ok) wxMessageBox("Could not write " + saveDlg.GetPath(), "ROI Traces", wxICON_ERROR);
+    }
+};
+
+// Event file or pipe read in chunks without blocking for long, so cancelling an ingest never waits
+// on a silent writer. POSIX opens non-blocking and polls. On Windows reads block: a pipe whose
+// writer is idle holds Cancel() until the writer sends or closes.
+class EventSource {
+public:
+    EventSource() = default;
+    EventSource(const EventSource&) = delete;
+    EventSource& operator=(const EventSource&) = delete;
+    ~EventSource() { Close(); }
+
+    bool Open(const wxString& path) {
+        Close();
+#ifdef _WIN32
+        m_in.open(path.fn_str(), ios::binary);
+        return (bool)m_in;
+#else
+        m_fd = open(path.fn_str(), O_RDONLY | O_NONBLOCK);
+        if (m_fd < 0) return false;
+        struct stat st;
+        m_pipe = fstat(m_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+        return true;
+#endif
+    }
+
+    void Close() {
+#ifdef _WIN32
+        m_in.close();
+#else
+        if (m_fd >= 0) close(m_fd);
+        m_fd = -1;
+#endif
+        m_ended = false;
+    }
+
+    // Bytes read, waiting up to waitMs for data; 0 when none arrived, -1 on a read error
+    ptrdiff_t Read(char* dst, size_t n, int waitMs) {
+#ifdef _WIN32
+        (void)waitMs;
+        m_in.read(dst, (streamsize)n);
+        m_ended = m_in.eof();
+        if (m_in.bad()) return -1;
+        return (ptrdiff_t)m_in.gcount();
+#else
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        const int ready = poll(&pfd, 1, waitMs);
+        if (ready < 0) return errno == EINTR ? 0 : -1;
+        if (ready == 0) return 0;          // A pipe with no data yet, or no writer yet
+        const ssize_t got = read(m_fd, dst, n);
+        if (got < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        // A file ends at a zero read; a pipe only once its writer has hung up
+        if (got == 0) m_ended = !m_pipe || (pfd.revents & POLLHUP);
+        return got;
+#endif
+    }
+
+    // True after a read found the end of the file, or the pipe's writer gone
+    bool Ended() const { return m_ended; }
+    void ClearEnded() {
+        m_ended = false;
+#ifdef _WIN32
+        m_in.clear();
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    ifstream m_in;
+#else
+    int m_fd = -1;
+    bool m_pipe = false;
+#endif
+    bool m_ended = false;
+};
+
+// Event ingest on a background thread: records are read in chunks from a file, a file that is
+// still being written (follow), or a named pipe standing in for the detector stream, and binned
+// by an EventHistogrammer. Every slice is integrated through one bin map about the detector
+// centre straight into a profile store; the newest slice is kept for the live view.
+class EventIngestJob {
+public:
+    EventIngestJob(const wxString& source, const EventBinning& binning, bool follow)
+        : m_source(source), m_binning(binning), m_follow(follow) {}
+    ~EventIngestJob() { Cancel(); }
+
+    bool OpenStore(const wxString& path, int Rmin, int Rmax, int step, wxString* error) {
+        vector<double> axis;
+        for (int R = Rmin; R <= Rmax; R += step) axis.push_back((double)R);
+        m_map.Build(m_binning.width, m_binning.height, m_binning.width / 2, m_binning.height / 2, Rmin, Rmax, step);
+        m_mapCharge.Set(m_map.Bytes());
+        return m_store.Create(path, axis, ProfileStore::DEFAULT_CHUNK_FRAMES, error);
+    }
+
+    void Start() { m_thread = thread([this] { Run(); }); }
+    void Cancel() {
+        m_cancel = true;
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    const EventBinning& Binning() const { return m_binning; }
+    uint64_t Events() const { return m_events; }
+    uint64_t Dropped() const { return m_dropped; }
+    uint64_t Late() const { return m_late; }
+    int64_t Slices() const { return m_slices; }
+    bool Finished() const { return m_finished; }
+    wxString Error() const {
+        lock_guard<mutex> lock(m_mutex);
+        return m_error;
+    }
+
+    // Newest slice with its wavelength planes summed; false when nothing new arrived since the last call
+    bool TakeLatest(SparseFrame& frame, int64_t& slice) {
+        lock_guard<mutex> lock(m_mutex);
+        if (!m_latestNew) return false;
+        m_latestNew = false;
+        frame = m_latest;
+        slice = m_latestSlice;
+        return true;
+    }
+
+private:
+    void Run() {
+        EventSource in;
+        if (!in.Open(m_source)) Fail("Could not open " + m_source);
+        EventHistogrammer hist(m_binning, [this](int64_t slice, const vector<SparseFrame>& planes) { OnSlice(slice, planes); });
+
+        const size_t CHUNK = 1 << 18;    // Events per read (4 MB)
+        const double IDLE_SECONDS = 5.0; // A followed file that stops growing this long is finished
+        vector<EventRecord> buffer(CHUNK);
+        char* bytes = reinterpret_cast<char*>(buffer.data());
+        size_t carry = 0;                // Bytes of a partial record kept at the front of the buffer
+        auto lastData = chrono::steady_clock::now();
+        while (!m_cancel) {
+            const ptrdiff_t read = in.Read(bytes + carry, CHUNK * sizeof(EventRecord) - carry, 100);
+            if (read < 0) { Fail("Error reading " + m_source); break; }
+            const size_t got = (size_t)read;
+            const size_t n = (carry + got) / sizeof(EventRecord);
+            if (n) {
+                TraceScope trace("events", "io", m_source.mb_str());
+                hist.Add(buffer.data(), n);
+                m_events = hist.Events();
+                m_dropped = hist.Dropped();
+                m_late = hist.Late();
+            }
+            carry = carry + got - n * sizeof(EventRecord);
+            if (carry) memmove(bytes, bytes + n * sizeof(EventRecord), carry);
+            if (got) lastData = chrono::steady_clock::now();
+            if (got || !in.Ended()) continue;   // Without data and not ended, Read() has already waited
+            if (!m_follow || chrono::duration<double>(chrono::steady_clock::now() - lastData).count() > IDLE_SECONDS) break;
+            in.ClearEnded();
+            this_thread::sleep_for(chrono::milliseconds(100));
         }
+        hist.Finish();
+        m_events = hist.Events();
+        m_dropped = hist.Dropped();
+        m_late = hist.Late();
+        m_store.Close();
+        m_finished = true;
+    }
 
-        // --- 1) Compute plot bounds (data min/max) ---
-        int minR = numeric_limits<int>::max();
-        int maxR = numeric_limits<int>::min();
-        double minY = numeric_limits<double>::infinity();
-        double maxY = -numeric_limits<double>::infinity();
+    void Fail(const wxString& msg) {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_error.IsEmpty()) m_error = msg;
+        m_cancel = true;
+    }
 
-        for (const auto& p : m_data) {
-            if (!isfinite(p.avg)) continue;
-            minR = min(minR, p.R);
-            maxR = max(maxR, p.R);
-            minY = min(minY, p.avg);
-            maxY = max(maxY, p.avg);
+    void OnSlice(int64_t slice, const vector<SparseFrame>& planes) {
+        const int cx = m_binning.width / 2, cy = m_binning.height / 2;
+        for (size_t p = 0; p < planes.size() && !m_cancel; ++p) {
+            int valid = 0;
+            vector<RadialAvgPoint> profile;
+            {
+                PerfScope timer(PerfOp::Sparse);
+                timer.SetPixels(planes[p].Nonzero());
+                profile = IntegrateSparse(planes[p], m_map, &valid);
+            }
+            const wxString label = planes.size() == 1 ? wxString::Format("%s#%lld", m_source, (long long)slice)
+                : wxString::Format("%s#%lld:%.3gA", m_source, (long long)slice, m_binning.PlaneLambda((int)p));
+            wxString error;
+            if (!m_store.Append(profile, MakeProfileMeta(label, cx, cy, valid, false), &error)) { Fail(error); return; }
         }
 
-        if (minR == numeric_limits<int>::max()) {
-            dc.DrawText("All data points are invalid (NaN).", 10, 10);
-            return;
+        // Planes summed for display
+        SparseFrame sum = planes[0];
+        for (size_t p = 1; p < planes.size(); ++p) {
+            SparseFrame merged;
+            merged.width = sum.width;
+            merged.height = sum.height;
+            size_t i = 0, j = 0;
+            const SparseFrame& b = planes[p];
+            while (i < sum.index.size() || j < b.index.size()) {
+                if (j == b.index.size() || (i < sum.index.size() && sum.index[i] < b.index[j])) {
+                    merged.index.push_back(sum.index[i]); merged.counts.push_back(sum.counts[i++]);
+                }
+                else if (i == sum.index.size() || b.index[j] < sum.index[i]) {
+                    merged.index.push_back(b.index[j]); merged.counts.push_back(b.counts[j++]);
+                }
+                else {
+                    merged.index.push_back(sum.index[i]); merged.counts.push_back(sum.counts[i++] + b.counts[j++]);
+                }
+            }
+            sum = move(merged);
         }
+        lock_guard<mutex> lock(m_mutex);
+        m_latest = move(sum);
+        m_latestSlice = slice;
+        m_latestNew = true;
+        ++m_slices;
+    }
 
-        // Avoid zero range
-        if (maxR == minR) maxR = minR + 1;
-        if (maxY == minY) { maxY = minY + 1.0; }
-
-        // --- 2) Layout (margins + axes box) ---
-        const wxSize sz = GetClientSize();
-        const int left = 60, right = 20, top = 20, bottom = 50;
-        const int plotW = max(1, sz.x - left - right);
-        const int plotH = max(1, sz.y - top - bottom);
+    const wxString m_source;
+    const EventBinning m_binning;
+    const bool m_follow;
+    RadialBinMap m_map;
+    MemCharge m_mapCharge{ MemTag::Profiles };
+    ProfileStore m_store;
+    mutable mutex m_mutex;
+    wxString m_error;
+    SparseFrame m_latest;
+    int64_t m_latestSlice = 0;
+    bool m_latestNew = false;
+    atomic<uint64_t> m_events{ 0 }, m_dropped{ 0 }, m_late{ 0 };
+    atomic<int64_t> m_slices{ 0 };
+    atomic<bool> m_cancel{ false };
+    atomic<bool> m_finished{ false };
+    thread m_thread;
+};
 
-        wxRect plotRect(left, top, plotW, plotH);
+// Live view of an EventIngestJob: the newest slice in an image panel, stretched so its highest
+// count is white, and the ingest counters in the status bar
+class EventIngestFrame : public wxFrame {
+public:
+    EventIngestFrame(wxWindow* parent, unique_ptr<EventIngestJob> job, const wxString& title)
+        : wxFrame(parent, wxID_ANY, "Event Ingest: " + title, wxDefaultPosition, wxSize(700, 700)),
+        m_job(move(job)), m_timer(this) {
+        CreateStatusBar(2);
+        m_view = new ImagePanel(this);
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        sizer->Add(m_view, 1, wxEXPAND);
+        SetSizer(sizer);
 
-        // Axes
-        dc.DrawLine(plotRect.GetLeft(), plotRect.GetBottom(),
-            plotRect.GetRight(), plotRect.GetBottom()); // X axis
-        dc.DrawLine(plotRect.GetLeft(), plotRect.GetTop(),
-            plotRect.GetLeft(), plotRect.GetBottom()); // Y axis
+        Bind(wxEVT_TIMER, [this](wxTimerEvent&) { OnRefresh(); });
+        Bind(wxEVT_SIZE, [this](wxSizeEvent& evt) { m_view->ZoomFit(); evt.Skip(); });
+        Bind(wxEVT_CLOSE_WINDOW, [this](wxCloseEvent& evt) { m_timer.Stop(); m_job->Cancel(); evt.Skip(); });
 
-        // Labels
-        dc.DrawText("R (pixels)", plotRect.GetLeft() + plotW / 2 - 30, sz.y - 30);
-        dc.DrawText("Avg", 10, plotRect.GetTop() + plotH / 2 - 10);
+        m_start = chrono::steady_clock::now();
+        m_job->Start();
+        m_timer.Start(250);
+    }
 
-        // Simple min/max annotations
-        dc.DrawText(wxString::Format("%d", minR), plotRect.GetLeft(), plotRect.GetBottom() + 5);
-        dc.DrawText(wxString::Format("%d", maxR), plotRect.GetRight() - 30, plotRect.GetBottom() + 5);
-        dc.DrawText(wxString::Format("%.1f", maxY), plotRect.GetLeft() - 55, plotRect.GetTop());
-        dc.DrawText(wxString::Format("%.1f", minY), plotRect.GetLeft() - 55, plotRect.GetBottom() - 15);
+private:
+    unique_ptr<EventIngestJob> m_job;
+    wxTimer m_timer;
+    ImagePanel* m_view{ nullptr };
+    chrono::steady_clock::time_point m_start;
+    bool m_reported = false;
+
+    void OnRefresh() {
+        // Finished is read before the latest slice is taken, so the slice that completes the job
+        // is always shown before the timer stops
+        const bool finished = m_job->Finished();
+        SparseFrame frame;
+        int64_t slice = 0;
+        if (m_job->TakeLatest(frame, slice)) {
+            uint32_t peak = 1;
+            for (uint32_t c : frame.counts) peak = max(peak, c);
+            m_view->ShowLiveImage(SparseToImage(frame, 255.0 / peak));
+            SetTitle(wxString::Format("Event Ingest: slice %lld, %zu pixels hit, max %u", (long long)slice, frame.Nonzero(), peak));
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - m_start).count();
+        SetStatusText(wxString::Format("%lld slices, %.3f M events (%.2f M/s), %llu dropped, %llu late%s",
+            (long long)m_job->Slices(), m_job->Events() / 1e6, m_job->Events() / 1e6 / max(seconds, 1e-3),
+            (unsigned long long)m_job->Dropped(), (unsigned long long)m_job->Late(), finished ? "" : " ..."), 0);
+        if (finished && !m_reported) {
+            m_reported = true;
+            m_timer.Stop();
+            const wxString error = m_job->Error();
+            if (!error.IsEmpty()) wxMessageBox(error, "Event Ingest", wxICON_ERROR);
+        }
+    }
+};
 
-        // --- 3) Mapping functions data -> screen ---
-        auto mapX = [&](int R) -> int {
-            double t = (double)(R - minR) / (double)(maxR - minR);
-            return plotRect.GetLeft() + (int)std::lround(t * plotW);
-            };
-        auto mapY = [&](double y) -> int {
-            double t = (y - minY) / (maxY - minY);
-            // invert Y (screen grows downward)
-            return plotRect.GetBottom() - (int)std::lround(t * plotH);
-            };
+// A false-colour map (two-time correlation and the like) with a colour bar. The map is shown in
+// an image panel, so it can be zoomed and panned like a frame.
+class ColormapFrame : public wxFrame {
+public:
+    ColormapFrame(wxWindow* parent, const wxString& title, const vector<float>& values, int w, int h, const wxString& status)
+        : wxFrame(parent, wxID_ANY, title, wxDefaultPosition, wxSize(700, 760)) {
+        CreateStatusBar(2);
+        PercentileRange(values.data(), values.size(), 1.0, 99.0, m_lo, m_hi);
+        m_view = new ImagePanel(this);
+        m_bar = new wxPanel(this, wxID_ANY, wxDefaultPosition, wxSize(-1, 40));
+        m_bar->SetBackgroundStyle(wxBG_STYLE_PAINT);
+        wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+        sizer->Add(m_view, 1, wxEXPAND);
+        sizer->Add(m_bar, 0, wxEXPAND);
+        SetSizer(sizer);
 
-        // --- 4) Draw polyline ---
-        vector<wxPoint> pts;
-        pts.reserve(m_data.size());
+        m_bar->Bind(wxEVT_PAINT, &ColormapFrame::OnPaintBar, this);
+        Bind(wxEVT_SIZE, [this](wxSizeEvent& evt) { m_view->ZoomFit(); m_bar->Refresh(); evt.Skip(); });
+        m_view->SetImage(ColormapImage(values.data(), w, h, m_lo, m_hi));
+        SetStatusText(status, 0);
+    }
 
-        for (const auto& p : m_data) {
-            if (!isfinite(p.avg)) continue;
-            pts.emplace_back(mapX(p.R), mapY(p.avg));
-        }
+private:
+    ImagePanel* m_view{ nullptr };
+    wxPanel* m_bar{ nullptr };
+    double m_lo = 0.0, m_hi = 1.0;    // 1st and 99th percentiles
 
-        if (pts.size() >= 2) {
-            dc.DrawLines((int)pts.size(), pts.data());
-        }
-        else if (pts.size() == 1) {
-            dc.DrawCircle(pts[0], 2);
+    void OnPaintBar(wxPaintEvent&) {
+        wxAutoBufferedPaintDC dc(m_bar);
+        dc.Clear();
+        const wxSize sz = m_bar->GetClientSize();
+        const int left = 60, right = 60, width = max(1, sz.x - left - right);
+        const unsigned char* lut = ViridisLut();
+        for (int x = 0; x < width; ++x) {
+            const int k = x * 255 / max(1, width - 1);
+            dc.SetPen(wxPen(wxColour(lut[k * 3], lut[k * 3 + 1], lut[k * 3 + 2])));
+            dc.DrawLine(left + x, 4, left + x, 20);
         }
+        dc.DrawText(wxString::Format("%.4g", m_lo), 5, 5);
+        dc.DrawText(wxString::Format("%.4g", m_hi), left + width + 5, 5);
     }
 };
 
@@ -657,7 +7507,10 @@ public:
         : wxFrame(parent, wxID_ANY, "Image Display", wxDefaultPosition, wxSize(820, 750)) {
         wxBoxSizer* vbox = new wxBoxSizer(wxVERTICAL);
 
+        m_memOwner = MemoryAccounting::RegisterOwner("Image: " + wxFileName(filepath).GetFullName());
         m_imagePanel = new ImagePanel(this);
+        m_imagePanel->SetMemoryOwner(m_memOwner);
+        m_memProfiles.SetOwner(m_memOwner);
 
         wxToolBar* toolbar = new wxToolBar(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxTB_HORIZONTAL | wxNO_BORDER);
         toolbar->AddTool(wxID_ZOOM_IN, "Zoom In", CreateLabeledBitmap("+"));
@@ -677,7 +7530,19 @@ public:
         m_circAvgId = wxWindow::NewControlId();
         m_radialSweepId = wxWindow::NewControlId();
         m_exportCsvId = wxWindow::NewControlId(); // optional
+        m_storeId = wxWindow::NewControlId();
+        m_arrayId = wxWindow::NewControlId();
         m_plotId = wxWindow::NewControlId();
+        m_diagId = wxWindow::NewControlId();
+        m_traceId = wxWindow::NewControlId();
+        m_benchId = wxWindow::NewControlId();
+        m_roiId = wxWindow::NewControlId();
+        m_maskId = wxWindow::NewControlId();
+        m_roiTraceId = wxWindow::NewControlId();
+        m_spotId = wxWindow::NewControlId();
+        m_outlierId = wxWindow::NewControlId();
+        m_fitId = wxWindow::NewControlId();
+        m_fftId = wxWindow::NewControlId();
 
         toolbar->AddTool(m_rotateId, "Rotate 90\xC2\xB0", CreateLabeledBitmap("R90"));
         toolbar->AddTool(m_flipHId, "Flip H", CreateLabeledBitmap("FH"));
@@ -692,7 +7557,19 @@ public:
         toolbar->AddTool(m_circAvgId, "CircAvg", CreateLabeledBitmap("CA"));
         toolbar->AddTool(m_radialSweepId, "RadialSweep", CreateLabeledBitmap("RS"));
         toolbar->AddTool(m_exportCsvId, "ExportCSV", CreateLabeledBitmap("CSV"));
+        toolbar->AddTool(m_storeId, "Store", CreateLabeledBitmap("Str"));
+        toolbar->AddTool(m_arrayId, "Export Arrays", CreateLabeledBitmap("Arr"));
         toolbar->AddTool(m_plotId, "Plot", CreateLabeledBitmap("Plot"));
+        toolbar->AddTool(m_diagId, "Diagnostics", CreateLabeledBitmap("Diag"));
+        toolbar->AddTool(m_traceId, "Trace", CreateLabeledBitmap("Trc"));
+        toolbar->AddTool(m_benchId, "Benchmark", CreateLabeledBitmap("Bnch"));
+        toolbar->AddTool(m_roiId, "ROI Statistics", CreateLabeledBitmap("ROI"));
+        toolbar->AddTool(m_maskId, "Mask ROI", CreateLabeledBitmap("Msk"));
+        toolbar->AddTool(m_roiTraceId, "ROI Traces", CreateLabeledBitmap("TrR"));
+        toolbar->AddTool(m_spotId, "Find Spots", CreateLabeledBitmap("Spt"));
+        toolbar->AddTool(m_outlierId, "Hot Pixels", CreateLabeledBitmap("Zng"));
+        toolbar->AddTool(m_fitId, "Fit Profile", CreateLabeledBitmap("LM"));
+        toolbar->AddTool(m_fftId, "FFT", CreateLabeledBitmap("FFT"));
         toolbar->Realize();
 
         vbox->Add(toolbar, 0, wxEXPAND);
@@ -708,7 +7585,7 @@ public:
         LoadImage(filepath);
 
         if (m_imagePanel->GetOriginalImage().IsOk()) {
-            auto* hist = new HistogramFrame(this, m_imagePanel->GetOriginalImage());
+            auto* hist = new HistogramFrame(this, m_imagePanel->GetOriginalImage(), m_memOwner);
             hist->Show();
         }
 
@@ -728,16 +7605,38 @@ public:
         Bind(wxEVT_TOOL, &ImageFrame::OnCircularAverage, this, m_circAvgId);
         Bind(wxEVT_TOOL, &ImageFrame::OnRadialSweep, this, m_radialSweepId);
         Bind(wxEVT_TOOL, &ImageFrame::OnExportRadialCSV, this, m_exportCsvId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnAppendToStore, this, m_storeId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnExportArrays, this, m_arrayId);
         Bind(wxEVT_TOOL, &ImageFrame::OnShowPlot, this, m_plotId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnShowDiagnostics, this, m_diagId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnToggleTrace, this, m_traceId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnBenchmark, this, m_benchId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnROIStats, this, m_roiId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnMaskROI, this, m_maskId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnROITraces, this, m_roiTraceId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnFindSpots, this, m_spotId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnFindOutliers, this, m_outlierId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnFitProfile, this, m_fitId);
+        Bind(wxEVT_TOOL, &ImageFrame::OnFrameFft, this, m_fftId);
 
         Centre();
     }
 
+    ~ImageFrame() override { MemoryAccounting::UnregisterOwner(m_memOwner); }
+
 private:
     ImagePanel* m_imagePanel{ nullptr };
     ResultsFrame* m_resultsFrame{ nullptr };
+    int m_memOwner = 0;
+    MemCharge m_memProfiles{ MemTag::Profiles };
 
     vector<RadialAvgPoint> m_radialAvgData;
+    vector<ProfilePeak> m_peaks;          // Peaks of m_radialAvgData
+    FitSpec m_lastFitSpec;                // Last profile fit, the warm start for the next one
+    FitResult m_lastFit;
+    FrameHandle m_frame;                  // Decoded frame as loaded (shared, immutable)
+    SyntheticPatternParams m_synthetic;   // Ground truth when the frame was generated
+    bool m_isSynthetic = false;
 
     int m_rotateId;
     int m_flipHId;
@@ -751,7 +7650,20 @@ private:
     int m_circAvgId;
     int m_radialSweepId;
     int m_exportCsvId;
+    int m_storeId;
+    int m_arrayId;
     int m_plotId;
+    int m_diagId;
+    int m_traceId;
+    int m_benchId;
+    int m_roiId;
+    int m_maskId;
+    int m_roiTraceId;
+    int m_spotId;
+    int m_outlierId;
+    int m_fitId;
+    int m_fftId;
+    vector<int> m_spotMarks;              // Annotation ids of the last spot search
 
     wxBitmap CreateLabeledBitmap(const wxString& label) {
         wxBitmap bmp(24, 24);
@@ -771,7 +7683,7 @@ private:
 #endif
         wxFileDialog pdlg(this, "Select Plugin", "", "", pluginFilter, wxFD_OPEN);
         if (pdlg.ShowModal() == wxID_OK) {
-            wxImage img = m_imagePanel->GetOriginalImage();
+            wxImage img = m_imagePanel->GetOriginalImage().Copy();   // Plugins filter in place
             if (img.IsOk() && PluginLoader::LoadPlugin(pdlg.GetPath(), img)) {
                 m_imagePanel->SetImage(img);
                 m_resultsFrame->AddResult("Applied plugin successfully.");
@@ -784,55 +7696,30 @@ private:
 
     void LoadImage(const wxString& filepath) {
         if (filepath.IsEmpty()) return;
-        ifstream file(filepath.mb_str(), ios::binary);
-        if (!file) {
-            wxMessageBox("Failed to open file: " + filepath, "Open", wxICON_ERROR);
-            return;
-        }
-
-        // read to end to determine size
-        file.seekg(0, ios::end);
-        streamoff sz = file.tellg();
-        if (sz <= 0 || sz < (streamoff)HEADER_OFFSET) {
-            wxMessageBox("File too small or invalid format", "Open", wxICON_ERROR);
-            return;
-        }
-
-        file.seekg(HEADER_OFFSET, ios::beg);
-        // For legacy format we use fixed dimensions; if file too small, bail out
-        const int WIDTH = 2082, HEIGHT = 2217, PIXEL_DEPTH = 4;
-        const streamoff expected = (streamoff)WIDTH * HEIGHT * PIXEL_DEPTH;
-        if (sz - HEADER_OFFSET < expected) {
-            wxMessageBox("File does not contain expected image data (size mismatch).", "Open", wxICON_ERROR);
-            return;
-        }
 
-        vector<unsigned char> buffer((size_t)expected);
-        file.read(reinterpret_cast<char*>(buffer.data()), expected);
-        if (file.gcount() < expected) {
-            wxMessageBox("Failed to read image data.", "Open", wxICON_ERROR);
+        // Another window (or job) may already hold this frame decoded
+        wxString error;
+        bool shared = false;
+        const DecodeOptions opts = CurrentDecodeOptions();
+        FrameHandle frame = FrameCache::Acquire(filepath, opts, &error, &shared);
+        if (!frame) {
+            wxMessageBox(error, "Open", wxICON_ERROR);
             return;
         }
 
-        wxImage img(WIDTH, HEIGHT, true);
-        unsigned char* rgb = img.GetData();
-        if (!rgb) { wxMessageBox("Failed to allocate image buffer.", "Open", wxICON_ERROR); return; }
-
-        for (int i = 0; i < WIDTH * HEIGHT; ++i) {
-            unsigned char r = buffer[i * 4 + 2];
-            unsigned char g = buffer[i * 4 + 1];
-            unsigned char b = buffer[i * 4 + 0];
-            unsigned char grey = (unsigned char)round(0.299 * r + 0.587 * g + 0.114 * b);
-            rgb[i * 3 + 0] = grey;
-            rgb[i * 3 + 1] = grey;
-            rgb[i * 3 + 2] = grey;
-        }
-        m_imagePanel->SetImage(img);
+        m_frame = frame;
+        m_isSynthetic = frame->isSynthetic;
+        m_synthetic = frame->synthetic;
+        m_imagePanel->SetImage(frame->image);
 
         if (m_resultsFrame) {
+            const wxImage& img = frame->image;
             m_resultsFrame->AddResult(wxString::Format("Loaded image: %s", filepath));
             m_resultsFrame->AddResult(wxString::Format("Width: %d, Height: %d", img.GetWidth(), img.GetHeight()));
             m_resultsFrame->AddResult("Successfully loaded and converted to grayscale.");
+            if (opts.HasCorrection()) m_resultsFrame->AddResult("Corrected while decoding: " + FormatDecodeOptions(opts));
+            if (shared) m_resultsFrame->AddResult("Reused decoded frame from the frame cache.");
+            if (m_isSynthetic) m_resultsFrame->AddResult("Synthetic frame: " + FormatSyntheticSpec(m_synthetic));
         }
     }
 
@@ -921,12 +7808,26 @@ private:
             "Copy : Copy selected region\n"
             "Plug : Load and apply an image filter plugin (.dll/.so)\n"
             "Undo : Revert to previous image\n"
+            "Str : Append the last radial sweep to a profile store (.rps)\n"
+            "Arr : Export the frame (and last sweep) as NumPy .npy/.npz or NeXus HDF5\n"
+            "Diag : Show operation latency statistics\n"
+            "Trc : Start/stop tracing; on stop, save a Chrome trace (open in Perfetto)\n"
+            "Bnch : Benchmark analysis kernels on this image (IPC and misses/pixel on Linux)\n"
+            "ROI : Add the selection as an ROI and report sum/mean/variance/min/max of all ROIs\n"
+            "Msk : Add (or, with an N: prefix, replace) a polygon/ellipse/annulus/sector ROI and integrate inside it\n"
+            "TrR : Plot every ROI's intensity against frame number through a folder, live\n"
+            "Spt : Find Bragg spots (local background, threshold, connected components); keep as marks, ROIs or masks\n"
+            "Zng : Flag hot pixels and cosmic rays against the local median; flagged pixels are left out of integrations\n"
+            "LM  : Fit the profile (Gaussian/Lorentzian/pseudo-Voigt peak on a polynomial, Guinier, Porod, sphere)\n"
+            "FFT : Power spectrum or autocorrelation of the selection (or the whole frame) in false colour\n"
             "?\t: Show this help dialog\n\n"
             "Mouse Interaction Guide:\n\n"
             "• Left-click on image: Start selection / Show pixel info\n"
             "• Click and drag: Select a rectangular region\n"
             "• Scroll wheel: Zoom in/out\n"
-            "• Release mouse after dragging: Finalize selection\n\n"
+            "• Release mouse after dragging: Finalize selection\n"
+            "• Right-click > Annotate: Draw text, rectangles, ellipses, arrows or polygons\n"
+            "• Delete: Remove the annotation or ROI under the cursor (Shift+Delete: all ROIs)\n\n"
             "Tip: You can crop, copy, or cut the selected region using toolbar buttons.";
 
         wxMessageBox(helpText, "Help", wxOK | wxICON_INFORMATION, this);
@@ -950,17 +7851,22 @@ private:
         const int cy = img.GetHeight() / 2;
 
         int uniqueSamples = 0;
-        const double avg = CircularAverageNearest(img, cx, cy, (int)R, &uniqueSamples);
+        double avg;
+        {
+            PerfScope timer(PerfOp::Integrate);
+            avg = CircularAverageNearest(img, cx, cy, (int)R, &uniqueSamples, nullptr, ExcludedPixels());
+            timer.SetPixels((uint64_t)uniqueSamples);
+        }
 
         if (!std::isfinite(avg)) {
-            m_resultsFrame->AddResult(wxString::Format("R=%ld: no valid samples (circle outside image?).", R));
+            m_resultsFrame->AddResult(wxString::Format("R=%ld: no valid samples (circle outside image?).", R), "CircAvg", LogLevel::Warning);
             return;
         }
 
         m_resultsFrame->AddResult(wxString::Format(
             "Circular average (nearest) | center=(%d,%d) R=%ld | uniqueSamples=%d | avg=%.3f",
             cx, cy, R, uniqueSamples, avg
-        ));
+        ), "CircAvg", LogLevel::Info, avg);
     }
 
     void OnRadialSweep(wxCommandEvent&) {
@@ -989,76 +7895,563 @@ private:
             }
         }
 
-        // Center choice: Phase 2 uses image center
-        const int cx = img.GetWidth() / 2;
-        const int cy = img.GetHeight() / 2;
-
-        // Clear old results
-        m_radialAvgData.clear();
-        m_radialAvgData.reserve((size_t)((Rmax - Rmin) / step + 1));
+        // Center choice: Phase 2 uses image center
+        const int cx = img.GetWidth() / 2;
+        const int cy = img.GetHeight() / 2;
+
+        // Clear old results
+        const auto sweepStart = chrono::steady_clock::now();
+        int validCount = 0;
+        {
+            PerfScope timer(PerfOp::Integrate);
+            m_radialAvgData = RadialSweep(img, cx, cy, (int)Rmin, (int)Rmax, (int)step, &validCount, ExcludedPixels());
+            m_memProfiles.Set(m_radialAvgData.size() * sizeof(RadialAvgPoint));
+            uint64_t samples = 0;
+            for (const auto& p : m_radialAvgData) samples += (uint64_t)p.samples;
+            timer.SetPixels(samples);
+        }
+
+        m_resultsFrame->AddResult(wxString::Format(
+            "Radial sweep complete. center=(%d,%d)  R=[%ld..%ld] step=%ld  points=%zu  valid=%d",
+            cx, cy, Rmin, Rmax, step, m_radialAvgData.size(), validCount
+        ), "Sweep");
+
+        if (m_isSynthetic && img.GetWidth() == m_synthetic.width && img.GetHeight() == m_synthetic.height)
+            ReportSyntheticAccuracy(img, cx, cy, (int)Rmin, (int)Rmax, (int)step,
+                chrono::duration<double, milli>(chrono::steady_clock::now() - sweepStart).count());
+
+        // Print a small preview (first 5 + last 5)
+        auto printPoint = [&](const RadialAvgPoint& p) {
+            if (std::isfinite(p.avg))
+                m_resultsFrame->AddResult(wxString::Format("R=%d  avg=%.3f  samples=%d", p.R, p.avg, p.samples), "Sweep", LogLevel::Info, p.avg);
+            else
+                m_resultsFrame->AddResult(wxString::Format("R=%d  avg=NaN  samples=%d", p.R, p.samples), "Sweep");
+            };
+
+        const size_t n = m_radialAvgData.size();
+        for (size_t i = 0; i < n && i < 5; ++i) printPoint(m_radialAvgData[i]);
+        if (n > 10) m_resultsFrame->AddResult("...");
+        for (size_t i = (n > 5 ? std::max((size_t)5, n - 5) : 0); i < n; ++i) {
+            if (i >= 5 && i < n - 5) continue;
+            printPoint(m_radialAvgData[i]);
+        }
+        UpdatePeaks();
+    }
+
+    // Peak table of the current profile, logged and kept for the plot and exports
+    void UpdatePeaks() {
+        m_peaks = FindProfilePeaks(m_radialAvgData, PeakParams());
+        m_resultsFrame->AddResult(wxString::Format("%zu peaks in the profile", m_peaks.size()), "Peaks");
+        for (const auto& p : m_peaks)
+            m_resultsFrame->AddResult(wxString::Format("R=%.2f  height=%.3f  background=%.3f  fwhm=%.2f  area=%.2f",
+                p.position, p.height, p.background, p.fwhm, p.area), "Peaks", LogLevel::Info, p.height);
+    }
+
+    // Compare the sweep against the analytic profile of a generated frame. The analytic profile
+    // has no beamstop or gaps, so the frame is re-measured with those pixels left out, as the
+    // generator leaves them at zero rather than drawing from the profile.
+    void ReportSyntheticAccuracy(const wxImage& img, int cx, int cy, int Rmin, int Rmax, int step, double sweepMs) {
+        const RunMask masked = SyntheticMaskRuns(m_synthetic, ExcludedPixels());
+        const vector<RadialAvgPoint> measured = RadialSweep(img, cx, cy, Rmin, Rmax, step, nullptr, &masked);
+        double sumSq = 0.0, bias = 0.0, maxAbs = 0.0;
+        int n = 0;
+        for (const auto& p : measured) {
+            if (!isfinite(p.avg) || p.R <= m_synthetic.beamstopRadius) continue;
+            const double d = p.avg - SyntheticProfile(m_synthetic, p.R);
+            sumSq += d * d;
+            bias += d;
+            maxAbs = max(maxAbs, fabs(d));
+            ++n;
+        }
+        if (n == 0) return;
+
+        m_resultsFrame->AddResult(wxString::Format(
+            "Synthetic check: rms=%.3f  bias=%.3f  maxAbs=%.3f over %d radii  (beam offset %.1f,%.1f px)  sweep=%.1f ms",
+            sqrt(sumSq / n), bias / n, maxAbs, n, m_synthetic.cx - cx, m_synthetic.cy - cy, sweepMs), "Synthetic", LogLevel::Info, sqrt(sumSq / n));
+    }
+
+    void OnExportRadialCSV(wxCommandEvent&) {
+        if (m_radialAvgData.empty()) {
+            wxMessageBox("No radial data to export. Run a sweep first.", "Export CSV", wxICON_INFORMATION);
+            return;
+        }
+
+        wxFileDialog saveDlg(this, "Save radial averages as CSV", "", "radial_avg.csv",
+            "CSV files (*.csv)|*.csv|Gzipped CSV (*.csv.gz)|*.csv.gz", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        PerfScope timer(PerfOp::Export);
+        if (!WriteProfileCsv(saveDlg.GetPath(), m_radialAvgData)) {
+            wxMessageBox("Could not write file.", "Export CSV", wxICON_ERROR);
+            return;
+        }
+        // Peak table alongside: radial_avg.csv -> radial_avg.peaks.csv
+        wxString base = saveDlg.GetPath();
+        if (base.Lower().EndsWith(".gz")) base.RemoveLast(3);
+        if (base.Lower().EndsWith(".csv")) base.RemoveLast(4);
+        if (!WritePeaksCsv(base + ".peaks.csv", m_peaks))
+            wxMessageBox("Could not write peak table.", "Export CSV", wxICON_ERROR);
+
+        m_resultsFrame->AddResult("Exported radial averages to CSV: " + saveDlg.GetPath());
+    }
+
+    // Append the last sweep to a profile store, creating the store if it does not exist
+    void OnAppendToStore(wxCommandEvent&) {
+        if (m_radialAvgData.empty()) {
+            wxMessageBox("No radial data to store. Run a sweep first.", "Profile Store", wxICON_INFORMATION);
+            return;
+        }
+
+        wxFileDialog dlg(this, "Append radial profile to store", "", "profiles.rps",
+            "Profile stores (*.rps)|*.rps", wxFD_SAVE);
+        if (dlg.ShowModal() != wxID_OK) return;
+
+        PerfScope timer(PerfOp::Export);
+        ProfileStore store;
+        wxString error;
+        vector<double> axis;
+        for (const auto& p : m_radialAvgData) axis.push_back(p.R);
+        int valid = 0;
+        for (const auto& p : m_radialAvgData) if (isfinite(p.avg)) ++valid;
+        wxImage img = m_imagePanel->GetOriginalImage();
+        const ProfileMeta meta = MakeProfileMeta(m_frame ? m_frame->path : wxString(),
+            img.GetWidth() / 2, img.GetHeight() / 2, valid, m_isSynthetic);
+
+        const bool ok = wxFileExists(dlg.GetPath())
+            ? store.Open(dlg.GetPath(), true, &error)
+            : store.Create(dlg.GetPath(), axis, ProfileStore::DEFAULT_CHUNK_FRAMES, &error);
+        if (!ok || !store.Append(m_radialAvgData, meta, &error)) {
+            wxMessageBox(error, "Profile Store", wxICON_ERROR);
+            return;
+        }
+        // Only the new profile's peaks are added to the table
+        if (!WriteStorePeaksCsv(store, dlg.GetPath() + ".peaks.csv", PeakParams(), nullptr, store.Frames() - 1))
+            wxMessageBox("Could not write the store's peak table.", "Profile Store", wxICON_ERROR);
+
+        m_resultsFrame->AddResult(wxString::Format("Appended profile %llu to store: ",
+            (unsigned long long)store.Frames()) + dlg.GetPath());
+    }
+
+    // Frame and last sweep as arrays for downstream Python tools
+    void OnExportArrays(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
+
+        wxString wildcard = "NumPy array (*.npy)|*.npy|NumPy archive with profile (*.npz)|*.npz";
+#ifdef HAVE_HDF5
+        wildcard += "|NeXus/HDF5 (*.nxs;*.h5)|*.nxs;*.h5";
+#endif
+        wxFileDialog saveDlg(this, "Export frame as arrays", "", "frame.npz", wildcard, wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        PerfScope timer(PerfOp::Export);
+        wxString error;
+        if (!WriteFrameArrays(saveDlg.GetPath(), img, m_radialAvgData, &error)) {
+            wxMessageBox(error, "Export Arrays", wxICON_ERROR);
+            return;
+        }
+        m_resultsFrame->AddResult("Exported arrays: " + saveDlg.GetPath());
+    }
+
+    void OnShowDiagnostics(wxCommandEvent&) {
+        auto* df = new DiagnosticsFrame(this);
+        df->Show();
+    }
+
+    // Add the selection (if any) as an ROI, then measure every ROI from one set of frame tables
+    void OnROIStats(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
+        m_imagePanel->AddSelectionAsROI();
+        const ROIManager& rois = m_imagePanel->GetROIManager();
+        if (rois.IsEmpty()) {
+            wxMessageBox("Drag a selection first; each use of this tool adds it as an ROI.", "ROI Statistics", wxICON_INFORMATION);
+            return;
+        }
+
+        FrameTables tables;
+        {
+            PerfScope timer(PerfOp::Integrate);
+            timer.SetPixels((uint64_t)img.GetWidth() * img.GetHeight());
+            tables.Build(img);
+        }
+        const vector<RoiStats> stats = rois.ComputeStats(tables);
+        for (size_t i = 0; i < stats.size(); ++i) {
+            const wxRect& r = rois.GetROIs()[i];
+            const RoiStats& st = stats[i];
+            if (st.pixels == 0) {
+                m_resultsFrame->AddResult(wxString::Format("ROI %zu (%d,%d %dx%d): outside the image", i, r.x, r.y, r.width, r.height),
+                    "ROI", LogLevel::Warning);
+                continue;
+            }
+            m_resultsFrame->AddResult(wxString::Format(
+                "ROI %zu (%d,%d %dx%d) | pixels=%llu sum=%.0f mean=%.3f var=%.3f min=%d max=%d",
+                i, r.x, r.y, r.width, r.height, (unsigned long long)st.pixels, st.sum, st.mean, st.variance, st.min, st.max
+            ), "ROI", LogLevel::Info, st.mean);
+        }
+    }
+
+    // Flagged pixels for the integrators, or null when nothing is flagged
+    const RunMask* ExcludedPixels() const {
+        const RunMask& mask = m_imagePanel->GetPixelMask();
+        return mask.IsEmpty() ? nullptr : &mask;
+    }
+
+    // Flag pixels far above their local median; they join the panel's exclusion mask
+    void OnFindOutliers(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
+
+        wxTextEntryDialog dlg(this, "Enter radius,sigma,minExcess (window (2*radius+1)^2; flag pixels above the local\n"
+            "median by sigma robust sigmas and at least minExcess grey levels)", "Hot Pixels", "2,6,8");
+        if (dlg.ShowModal() != wxID_OK) return;
+        OutlierParams p;
+        long radius = 0;
+        wxArrayString parts = wxSplit(dlg.GetValue(), ',');
+        if (parts.size() != 3 || !parts[0].ToLong(&radius) || !parts[1].ToDouble(&p.sigma) || !parts[2].ToDouble(&p.minExcess) ||
+            radius < 1 || radius > 100 || p.sigma <= 0 || p.minExcess < 0) {
+            wxMessageBox("Invalid input. Use radius,sigma,minExcess like 2,6,8 (radius 1..100)", "Hot Pixels", wxICON_WARNING);
+            return;
+        }
+        p.radius = (int)radius;
+
+        RunMask mask;
+        const auto start = chrono::steady_clock::now();
+        {
+            PerfScope timer(PerfOp::Outliers);
+            timer.SetPixels((uint64_t)img.GetWidth() * img.GetHeight());
+            mask = FindOutlierPixels(img, p);
+        }
+        const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        m_imagePanel->SetPixelMask(mask);
+        m_resultsFrame->AddResult(wxString::Format("%llu pixels flagged in %zu runs (%.1f ms); excluded from CA, RS and Msk profiles",
+            (unsigned long long)mask.Pixels(), mask.Runs().size(), ms), "HotPixels", LogLevel::Info, (double)mask.Pixels());
+    }
+
+    // 2D power spectrum (periodicity) or autocorrelation (speckle size, alignment) of the selection,
+    // or of the whole frame when nothing is selected
+    void OnFrameFft(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
+        wxTextEntryDialog dlg(this, "Enter power or acf (power spectrum or autocorrelation of the selection,\n"
+            "or of the whole frame when nothing is selected)", "FFT", "power");
+        if (dlg.ShowModal() != wxID_OK) return;
+        const wxString mode = dlg.GetValue().Trim().Trim(false).Lower();
+        if (mode != "power" && mode != "acf") {
+            wxMessageBox("Invalid mode. Use power or acf.", "FFT", wxICON_WARNING);
+            return;
+        }
+        wxRect roi = m_imagePanel->GetImageSelection();
+        if (roi.width < 2 || roi.height < 2) roi = wxRect(0, 0, img.GetWidth(), img.GetHeight());
+
+        const auto start = chrono::steady_clock::now();
+        FftMap result;
+        {
+            PerfScope timer(PerfOp::Fft);
+            timer.SetPixels((uint64_t)roi.width * roi.height);
+            result = mode == "power" ? PowerSpectrum(img, roi) : Autocorrelation(img, roi);
+        }
+        const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        const wxString region = wxString::Format("%d,%d %dx%d", roi.x, roi.y, roi.width, roi.height);
+        wxString summary;
+        if (mode == "power") {
+            int u = 0, v = 0;
+            if (DominantFrequency(result, u, v)) {
+                const double fx = (double)u / result.width, fy = (double)v / result.height;
+                summary = wxString::Format("strongest frequency (%d, %d) bins: period %.2f px at %.1f deg",
+                    u, v, 1.0 / hypot(fx, fy), atan2(fy, fx) * 180.0 / PI);
+            }
+        }
+        else {
+            double hx = 0.0, hy = 0.0;
+            CentralPeakWidth(result, hx, hy);
+            summary = wxString::Format("central peak HWHM %.2f px (x), %.2f px (y)", hx, hy);
+        }
+        m_resultsFrame->AddResult(wxString::Format("%s of %s (%dx%d, %.1f ms): %s", mode == "power" ? "Power spectrum" : "Autocorrelation",
+            region, result.width, result.height, ms, summary), "FFT");
+        (new ColormapFrame(this, mode == "power" ? "Power spectrum (log10)" : "Autocorrelation", result.values, result.width, result.height,
+            region + (mode == "power" ? ": zero frequency at the centre" : ": zero shift at the centre")))->Show();
+    }
+
+    // Levenberg-Marquardt fit of the current profile, warm-started from the last fit of the same model
+    void OnFitProfile(wxCommandEvent&) {
+        if (m_radialAvgData.empty()) {
+            wxMessageBox("No radial data to fit. Run a sweep first.", "Fit Profile", wxICON_INFORMATION);
+            return;
+        }
+        wxTextEntryDialog dlg(this, "Enter model[,bgDegree[,Rmin,Rmax]]\n"
+            "Models: gaussian, lorentzian, pseudovoigt (peak on a polynomial of bgDegree), guinier, porod, sphere",
+            "Fit Profile", "gaussian,1");
+        if (dlg.ShowModal() != wxID_OK) return;
+        FitSpec spec;
+        wxString error;
+        if (!ParseFitSpec(dlg.GetValue(), spec, &error)) {
+            wxMessageBox(error, "Fit Profile", wxICON_WARNING);
+            return;
+        }
+
+        vector<double> x, y, sigma;
+        for (const auto& p : m_radialAvgData) { x.push_back(p.R); y.push_back(p.avg); sigma.push_back(p.err); }
+        const bool warm = m_lastFit.converged && m_lastFitSpec.model == spec.model && m_lastFitSpec.bgDegree == spec.bgDegree;
+        FitResult fit = FitProfile(spec, x, y, sigma, warm ? m_lastFit.params : GuessFitParams(spec, x, y));
+        if (warm && !fit.converged) fit = FitProfile(spec, x, y, sigma, GuessFitParams(spec, x, y));
+        if (fit.params.empty()) {
+            wxMessageBox("Too few points in range to fit.", "Fit Profile", wxICON_WARNING);
+            return;
+        }
+        m_lastFitSpec = spec;
+        m_lastFit = fit;
+
+        m_resultsFrame->AddResult(wxString::Format("%s fit over %d points: %s after %d iterations, reduced chi2=%.4g",
+            dlg.GetValue(), fit.points, fit.converged ? "converged" : "not converged", fit.iterations, fit.chi2),
+            "Fit", fit.converged ? LogLevel::Info : LogLevel::Warning, fit.chi2);
+        const vector<string> names = spec.ParamNames();
+        for (size_t k = 0; k < names.size(); ++k)
+            m_resultsFrame->AddResult(wxString::Format("%s = %.6g +- %.2g", names[k], fit.params[k], fit.errors[k]), "Fit");
+    }
+
+    // Add or replace a polygon, ellipse, annulus or sector ROI, report every mask ROI's statistics
+    // and integrate a radial profile inside the new one
+    void OnMaskROI(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
+        const int w = img.GetWidth(), h = img.GetHeight();
+        const ROIManager& rois = m_imagePanel->GetROIManager();
+
+        const wxString initial = rois.ShapeCount() > 0 ? FormatRoiShape(rois.GetShape(rois.ShapeCount() - 1))
+            : wxString::Format("annulus %d,%d,50,200", w / 2, h / 2);
+        wxTextEntryDialog dlg(this,
+            "polygon x,y,x,y,...  |  ellipse cx,cy,rx,ry  |  annulus cx,cy,rin,rout  |  sector cx,cy,rin,rout,deg0,deg1\n"
+            "Prefix with N: to replace mask ROI N.", "Mask ROI", initial);
+        if (dlg.ShowModal() != wxID_OK) return;
+
+        wxString spec = dlg.GetValue().Trim().Trim(false);
+        long replace = -1;
+        if (spec.Contains(":") && !spec.BeforeFirst(':').Trim().ToLong(&replace)) replace = -1;
+        if (replace >= 0) spec = spec.AfterFirst(':').Trim(false);
+        RoiShape shape;
+        if (!ParseRoiShape(spec, shape) || replace >= (long)rois.ShapeCount()) {
+            wxMessageBox("Invalid shape. Use e.g. \"sector 512,512,40,300,30,60\" or \"0: ellipse 100,100,40,20\".", "Mask ROI", wxICON_WARNING);
+            return;
+        }
+        size_t index;
+        if (replace >= 0) { index = (size_t)replace; m_imagePanel->SetShapeROI(index, shape); }
+        else index = m_imagePanel->AddShapeROI(shape);
+
+        FrameTables tables;
+        {
+            PerfScope timer(PerfOp::Integrate);
+            timer.SetPixels((uint64_t)w * h);
+            tables.Build(img);
+        }
+        for (size_t i = 0; i < rois.ShapeCount(); ++i) {
+            const shared_ptr<const RunMask> held = rois.GetMask(i, w, h);
+            const RunMask& mask = *held;
+            const RoiStats st = tables.Stats(mask);
+            if (st.pixels == 0) {
+                m_resultsFrame->AddResult(wxString::Format("Mask ROI %zu (%s): no pixels inside the image", i, FormatRoiShape(rois.GetShape(i))),
+                    "Mask", LogLevel::Warning);
+                continue;
+            }
+            m_resultsFrame->AddResult(wxString::Format("Mask ROI %zu (%s) | runs=%zu pixels=%llu sum=%.0f mean=%.3f var=%.3f min=%d max=%d",
+                i, FormatRoiShape(rois.GetShape(i)), mask.Runs().size(), (unsigned long long)st.pixels, st.sum, st.mean, st.variance, st.min, st.max),
+                "Mask", LogLevel::Info, st.mean);
+        }
+
+        // Integrate around the shape's own center (the image center for polygons)
+        const bool centered = shape.kind != RoiShape::Polygon;
+        const double cx = centered ? shape.cx : w / 2.0, cy = centered ? shape.cy : h / 2.0;
+        const wxRect b = shape.Bounds();
+        int Rmin = 0, Rmax = 0;
+        if (shape.kind == RoiShape::Sector) { Rmin = (int)floor(shape.rInner); Rmax = (int)ceil(shape.rOuter); }
+        else for (const wxPoint& c : { b.GetTopLeft(), wxPoint(b.x + b.width, b.y), wxPoint(b.x, b.y + b.height), wxPoint(b.x + b.width, b.y + b.height) })
+            Rmax = max(Rmax, (int)ceil(hypot(c.x - cx, c.y - cy)));
+        int valid = 0;
+        {
+            PerfScope timer(PerfOp::Integrate);
+            const shared_ptr<const RunMask> held = rois.GetMask(index, w, h);
+            const RunMask& mask = *held;
+            timer.SetPixels(mask.Pixels());
+            m_radialAvgData = RadialProfileInMask(img, mask, cx, cy, Rmin, Rmax, 1, &valid, ExcludedPixels());
+            m_memProfiles.Set(m_radialAvgData.size() * sizeof(RadialAvgPoint));
+        }
+        m_resultsFrame->AddResult(wxString::Format("Masked radial profile of mask ROI %zu: center=(%.1f,%.1f) R=[%d..%d] valid=%d (Plot/CSV/Str use it)",
+            index, cx, cy, Rmin, Rmax, valid), "Mask");
+        UpdatePeaks();
+    }
+
+    // Trace this frame's ROIs through every frame of a folder in the background, plotting as it goes
+    void OnROITraces(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
+        const ROIManager& rois = m_imagePanel->GetROIManager();
+        if (rois.IsEmpty() && rois.ShapeCount() == 0) {
+            wxMessageBox("Define ROIs first (ROI or Msk tools).", "ROI Traces", wxICON_INFORMATION);
+            return;
+        }
+
+        const wxString here = m_frame ? wxFileName(m_frame->path).GetPath() : wxString();
+        wxDirDialog dlg(this, "Folder of frames to trace", here);
+        if (dlg.ShowModal() != wxID_OK) return;
+        const vector<wxString> paths = FramesInFolder(dlg.GetPath());
+        if (paths.empty()) {
+            wxMessageBox("No frames in " + dlg.GetPath(), "ROI Traces", wxICON_INFORMATION);
+            return;
+        }
+        (new RoiTraceFrame(this, paths, RoiSnapshot::Take(rois, img.GetWidth(), img.GetHeight())))->Show();
+        m_resultsFrame->AddResult(wxString::Format("Tracing %zu ROIs through %zu frames in %s",
+            rois.GetROIs().size() + rois.ShapeCount(), paths.size(), dlg.GetPath()), "Trace");
+    }
+
+    // Mark the spots of this frame, optionally keeping them as rectangle ROIs or ellipse mask ROIs
+    void OnFindSpots(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
 
-        int validCount = 0;
-        for (int R = (int)Rmin; R <= (int)Rmax; R += (int)step) {
-            int samples = 0;
-            double avg = CircularAverageNearest(img, cx, cy, R, &samples);
+        SpotParams params;
+        wxTextEntryDialog dlg(this, "Enter sigma,window,minPixels,maxPixels (threshold in local standard deviations above "
+            "the mean of a (2*window+1)^2 box)", "Find Spots", "5,7,2,10000");
+        if (dlg.ShowModal() != wxID_OK) return;
+        wxArrayString parts = wxSplit(dlg.GetValue(), ',');
+        long window = 0, minPixels = 0, maxPixels = 0;
+        if (parts.size() != 4 || !parts[0].ToDouble(&params.sigma) || !parts[1].ToLong(&window) || !parts[2].ToLong(&minPixels) ||
+            !parts[3].ToLong(&maxPixels) || params.sigma < 0 || window < 1 || minPixels < 1 || maxPixels < minPixels) {
+            wxMessageBox("Invalid input. Use sigma,window,minPixels,maxPixels like 5,7,2,10000", "Find Spots", wxICON_WARNING);
+            return;
+        }
+        params.window = (int)window;
+        params.minPixels = (int)minPixels;
+        params.maxPixels = (int)maxPixels;
 
-            // Store NaN too if you want, but usually keep only valid
-            if (std::isfinite(avg) && samples > 0) {
-                m_radialAvgData.push_back({ R, avg, samples });
-                ++validCount;
-            }
-            else {
-                // keep invalid points if you want gaps later; your call:
-                m_radialAvgData.push_back({ R, std::numeric_limits<double>::quiet_NaN(), samples });
+        const auto start = chrono::steady_clock::now();
+        vector<Spot> spots;
+        {
+            PerfScope timer(PerfOp::Integrate);
+            timer.SetPixels((uint64_t)img.GetWidth() * img.GetHeight());
+            FrameTables tables;
+            tables.Build(img, false);
+            spots = FindSpots(img, tables, params);
+        }
+        const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        for (int id : m_spotMarks) m_imagePanel->RemoveAnnotation(id);
+        m_spotMarks.clear();
+        for (const Spot& s : spots)
+            m_spotMarks.push_back(m_imagePanel->AddAnnotation({ AnnotationShape::Marker, { wxPoint((int)s.x, (int)s.y) }, wxString(), wxRect() }));
+        m_resultsFrame->AddResult(wxString::Format("Found %zu spots in %.1f ms (sigma=%g window=%d pixels=%d..%d)",
+            spots.size(), ms, params.sigma, params.window, params.minPixels, params.maxPixels), "Spots", LogLevel::Info, (double)spots.size());
+
+        vector<const Spot*> brightest;
+        for (const Spot& s : spots) brightest.push_back(&s);
+        sort(brightest.begin(), brightest.end(), [](const Spot* a, const Spot* b) { return a->intensity > b->intensity; });
+        for (size_t i = 0; i < brightest.size() && i < 10; ++i) {
+            const Spot& s = *brightest[i];
+            m_resultsFrame->AddResult(wxString::Format("Spot at (%.2f, %.2f) | I=%.0f pixels=%d peak=%d sigma=(%.2f, %.2f)",
+                s.x, s.y, s.intensity, s.pixels, s.peak, s.sigmaX, s.sigmaY), "Spots", LogLevel::Info, s.intensity);
+        }
+        if (spots.empty()) return;
+
+        wxArrayString choices;
+        choices.Add("Markers only");
+        choices.Add("Also add each spot's bounding box as an ROI");
+        choices.Add("Also add each spot as an ellipse mask ROI (2 sigma)");
+        wxSingleChoiceDialog keep(this, wxString::Format("%zu spots found.", spots.size()), "Find Spots", choices);
+        if (keep.ShowModal() != wxID_OK) return;
+        for (const Spot& s : spots) {
+            if (keep.GetSelection() == 1) m_imagePanel->AddROI(s.bounds);
+            if (keep.GetSelection() == 2) {
+                RoiShape e;
+                e.kind = RoiShape::Ellipse;
+                e.cx = s.x; e.cy = s.y;
+                e.rx = max(1.0, 2.0 * s.sigmaX); e.ry = max(1.0, 2.0 * s.sigmaY);
+                m_imagePanel->AddShapeROI(e);
             }
         }
+    }
 
-        m_resultsFrame->AddResult(wxString::Format(
-            "Radial sweep complete. center=(%d,%d)  R=[%ld..%ld] step=%ld  points=%zu  valid=%d",
-            cx, cy, Rmin, Rmax, step, m_radialAvgData.size(), validCount
-        ));
+    // Time each analysis kernel on the current image (median of several runs). Where
+    // perf_event_open works, report IPC and cache/branch misses per pixel next to the time.
+    void OnBenchmark(wxCommandEvent&) {
+        wxImage img = m_imagePanel->GetOriginalImage();
+        if (!img.IsOk()) return;
 
-        // Print a small preview (first 5 + last 5)
-        auto printPoint = [&](const RadialAvgPoint& p) {
-            if (std::isfinite(p.avg))
-                m_resultsFrame->AddResult(wxString::Format("R=%d  avg=%.3f  samples=%d", p.R, p.avg, p.samples));
-            else
-                m_resultsFrame->AddResult(wxString::Format("R=%d  avg=NaN  samples=%d", p.R, p.samples));
-            };
+        wxBusyCursor busy;
+        const int reps = 5;
+        const int w = img.GetWidth(), h = img.GetHeight();
+        const uint64_t framePixels = (uint64_t)w * h;
+        HardwareCounters counters;   // Opened here so the kernels' worker threads inherit it
+        volatile size_t sink = 0;    // Keeps results observable to the optimizer
+
+        m_resultsFrame->AddResult(wxString::Format("Benchmark on %dx%d, median of %d runs", w, h, reps));
+        if (!counters.IsOpen())
+            m_resultsFrame->AddResult("Hardware counters unavailable (" + counters.GetError() + "); timing only.", "Benchmark", LogLevel::Warning);
+
+        auto run = [&](const char* name, uint64_t pixels, const function<void()>& kernel) {
+            vector<double> ms;
+            CounterSample total;
+            for (int r = 0; r < reps; ++r) {
+                const CounterSample c0 = counters.Read();
+                const auto t0 = chrono::steady_clock::now();
+                kernel();
+                ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+                total += counters.Read() - c0;
+            }
+            sort(ms.begin(), ms.end());
 
-        const size_t n = m_radialAvgData.size();
-        for (size_t i = 0; i < n && i < 5; ++i) printPoint(m_radialAvgData[i]);
-        if (n > 10) m_resultsFrame->AddResult("...");
-        for (size_t i = (n > 5 ? std::max((size_t)5, n - 5) : 0); i < n; ++i) {
-            if (i >= 5 && i < n - 5) continue;
-            printPoint(m_radialAvgData[i]);
+            wxString line = wxString::Format("%-10s %9.2f ms", name, ms[ms.size() / 2]);
+            if (counters.IsOpen() && pixels > 0) {
+                const double px = (double)pixels * reps;
+                line += wxString::Format("  IPC %.2f  cache-miss/px %.4f  branch-miss/px %.4f",
+                    total.Ipc(), total.cacheMisses / px, total.branchMisses / px);
+            }
+            m_resultsFrame->AddResult(line, "Benchmark", LogLevel::Info, ms[ms.size() / 2]);
+        };
+
+        // Legacy BGRA layout rebuilt from the current image
+        vector<unsigned char> bgra((size_t)framePixels * 4);
+        const unsigned char* rgb = img.GetData();
+        for (size_t i = 0; i < framePixels; ++i) {
+            bgra[i * 4 + 0] = rgb[i * 3 + 2];
+            bgra[i * 4 + 1] = rgb[i * 3 + 1];
+            bgra[i * 4 + 2] = rgb[i * 3 + 0];
+            bgra[i * 4 + 3] = 255;
         }
-    }
+        vector<unsigned char> decoded((size_t)framePixels * 3);
+        run("decode", framePixels, [&] { DecodeBgraToGray(bgra.data(), decoded.data(), (size_t)framePixels); sink = sink + decoded[0]; });
 
-    void OnExportRadialCSV(wxCommandEvent&) {
-        if (m_radialAvgData.empty()) {
-            wxMessageBox("No radial data to export. Run a sweep first.", "Export CSV", wxICON_INFORMATION);
-            return;
-        }
+        run("histogram", framePixels, [&] { sink = sink + (size_t)ComputeLuminanceHistogram(img)[0]; });
 
-        wxFileDialog saveDlg(this, "Save radial averages as CSV", "", "radial_avg.csv",
-            "CSV files (*.csv)|*.csv", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
-        if (saveDlg.ShowModal() != wxID_OK) return;
+        const int halfW = max(1, w / 2), halfH = max(1, h / 2);
+        run("rescale", (uint64_t)halfW * halfH, [&] { sink = sink + (size_t)img.Scale(halfW, halfH, wxIMAGE_QUALITY_HIGH).GetWidth(); });
+
+        // Sample count for the sweep is the number of pixels the integrator touches
+        uint64_t sweepSamples = 0;
+        for (const auto& p : RadialSweep(img, w / 2, h / 2, 0, min(w, h) / 2, 1)) sweepSamples += (uint64_t)p.samples;
+        run("integrate", sweepSamples, [&] { sink = sink + RadialSweep(img, w / 2, h / 2, 0, min(w, h) / 2, 1).size(); });
+
+        SyntheticPatternParams synth = m_isSynthetic ? m_synthetic : SyntheticPatternParams();
+        run("synthetic", (uint64_t)synth.width * synth.height, [&] { sink = sink + RenderSyntheticPattern(synth).size(); });
+    }
 
-        std::ofstream out(saveDlg.GetPath().ToStdString());
-        if (!out) {
-            wxMessageBox("Could not open file for writing.", "Export CSV", wxICON_ERROR);
+    // First click starts recording, second click stops and saves the trace
+    void OnToggleTrace(wxCommandEvent&) {
+        if (!TraceRecorder::Enabled()) {
+            TraceRecorder::Start();
+            SetStatusText("Tracing...", 0);
             return;
         }
 
-        out << "R,avg,samples\n";
-        for (const auto& p : m_radialAvgData) {
-            out << p.R << ",";
-            if (isfinite(p.avg)) out << p.avg;
-            out << "," << p.samples << "\n";
-        }
+        TraceRecorder::Stop();
+        SetStatusText("Ready", 0);
+        wxFileDialog dlg(this, "Save trace", "", "trace.json", "Trace files (*.json)|*.json", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (dlg.ShowModal() != wxID_OK) return;
 
-        m_resultsFrame->AddResult("Exported radial averages to CSV: " + saveDlg.GetPath());
+        size_t events = 0;
+        if (TraceRecorder::Save(dlg.GetPath(), &events))
+            m_resultsFrame->AddResult(wxString::Format("Saved %zu trace events to %s", events, dlg.GetPath()));
+        else
+            wxMessageBox("Could not write trace file.", "Trace", wxICON_ERROR);
     }
 
     void OnShowPlot(wxCommandEvent&) {
@@ -1066,7 +8459,7 @@ private:
             wxMessageBox("No radial data to plot. Run RadialSweep first.", "Plot", wxICON_INFORMATION);
             return;
         }
-        auto* pf = new PlotFrame(this, m_radialAvgData);
+        auto* pf = new PlotFrame(this, m_radialAvgData, m_peaks);
         pf->Show();
     }
 };
@@ -1088,9 +8481,33 @@ public:
         wxButton* addFileBtn = new wxButton(this, wxID_ANY, "Add File");
         wxButton* addFolderBtn = new wxButton(this, wxID_ANY, "Add Folder");
         wxButton* delBtn = new wxButton(this, wxID_ANY, "Delete Selected");
+        wxButton* synthBtn = new wxButton(this, wxID_ANY, "Synthetic...");
+        wxButton* memBtn = new wxButton(this, wxID_ANY, "Memory");
+        wxButton* batchBtn = new wxButton(this, wxID_ANY, "Batch Reduce...");
+        wxButton* sparseBtn = new wxButton(this, wxID_ANY, "Sparse Reduce...");
+        wxButton* eventsBtn = new wxButton(this, wxID_ANY, "Ingest Events...");
+        wxButton* g2Btn = new wxButton(this, wxID_ANY, "XPCS g2...");
+        wxButton* twoTimeBtn = new wxButton(this, wxID_ANY, "Two-Time...");
+        wxButton* storeCsvBtn = new wxButton(this, wxID_ANY, "Export Store...");
+        wxButton* trackBtn = new wxButton(this, wxID_ANY, "Track ROIs...");
+        wxButton* fitBtn = new wxButton(this, wxID_ANY, "Fit Store...");
+        wxButton* masterBtn = new wxButton(this, wxID_ANY, "Build Dark/Flat...");
+        wxButton* corrBtn = new wxButton(this, wxID_ANY, "Corrections...");
         btnBox->Add(addFileBtn, 0, wxALL, 5);
         btnBox->Add(addFolderBtn, 0, wxALL, 5);
         btnBox->Add(delBtn, 0, wxALL, 5);
+        btnBox->Add(synthBtn, 0, wxALL, 5);
+        btnBox->Add(memBtn, 0, wxALL, 5);
+        btnBox->Add(batchBtn, 0, wxALL, 5);
+        btnBox->Add(sparseBtn, 0, wxALL, 5);
+        btnBox->Add(eventsBtn, 0, wxALL, 5);
+        btnBox->Add(g2Btn, 0, wxALL, 5);
+        btnBox->Add(twoTimeBtn, 0, wxALL, 5);
+        btnBox->Add(storeCsvBtn, 0, wxALL, 5);
+        btnBox->Add(trackBtn, 0, wxALL, 5);
+        btnBox->Add(fitBtn, 0, wxALL, 5);
+        btnBox->Add(masterBtn, 0, wxALL, 5);
+        btnBox->Add(corrBtn, 0, wxALL, 5);
         vbox->Add(btnBox, 0, wxALIGN_LEFT);
 
         SetSizer(vbox);
@@ -1098,6 +8515,18 @@ public:
         addFileBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnAddFile, this);
         addFolderBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnAddFolder, this);
         delBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnDeleteSelected, this);
+        synthBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnGenerateSynthetic, this);
+        memBtn->Bind(wxEVT_BUTTON, [this](wxCommandEvent&) { (new MemoryFrame(this))->Show(); });
+        batchBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnBatchReduce, this);
+        sparseBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnSparseReduce, this);
+        eventsBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnIngestEvents, this);
+        g2Btn->Bind(wxEVT_BUTTON, &FileBrowser::OnCorrelate, this);
+        twoTimeBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnTwoTime, this);
+        storeCsvBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnExportStore, this);
+        trackBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnTrackROIs, this);
+        fitBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnFitStore, this);
+        masterBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnBuildMaster, this);
+        corrBtn->Bind(wxEVT_BUTTON, &FileBrowser::OnCorrections, this);
         m_listCtrl->Bind(wxEVT_LIST_ITEM_ACTIVATED, &FileBrowser::OnItemActivated, this);
     }
 
@@ -1155,9 +8584,661 @@ private:
         }
     }
 
+    // Generate a series of synthetic frames into a folder and add them to the list
+    void OnGenerateSynthetic(wxCommandEvent&) {
+        SyntheticPatternParams params;
+        wxTextEntryDialog specDlg(this,
+            "Pattern parameters (key=value, space separated).\n"
+            "rings=radius:amplitude:width;...  module/gap=WxH (0x0 disables)  stop=beamstop radius",
+            "Synthetic Pattern", FormatSyntheticSpec(params));
+        if (specDlg.ShowModal() != wxID_OK) return;
+        if (!ParseSyntheticSpec(specDlg.GetValue(), params)) {
+            wxMessageBox("Invalid pattern specification.", "Synthetic Pattern", wxICON_WARNING);
+            return;
+        }
+
+        wxTextEntryDialog outDlg(this, "Enter frames,format (raw, png or tiff)", "Synthetic Pattern", "1,raw");
+        if (outDlg.ShowModal() != wxID_OK) return;
+        long frames = 0;
+        wxArrayString parts = wxSplit(outDlg.GetValue(), ',');
+        const wxString format = parts.size() == 2 ? parts[1].Lower() : wxString();
+        if (parts.size() != 2 || !parts[0].ToLong(&frames) || frames <= 0 ||
+            (format != "raw" && format != "png" && format != "tiff")) {
+            wxMessageBox("Invalid input. Use frames,format like 10,raw", "Synthetic Pattern", wxICON_WARNING);
+            return;
+        }
+        if (format == "raw" && (params.width != LEGACY_WIDTH || params.height != LEGACY_HEIGHT)) {
+            wxMessageBox(wxString::Format("The raw layout requires %dx%d frames.", LEGACY_WIDTH, LEGACY_HEIGHT),
+                "Synthetic Pattern", wxICON_WARNING);
+            return;
+        }
+
+        wxDirDialog dirDlg(this, "Select output folder");
+        if (dirDlg.ShowModal() != wxID_OK) return;
+
+        wxBusyCursor busy;
+        const unsigned baseSeed = params.seed;
+        for (long i = 0; i < frames; ++i) {
+            params.seed = baseSeed + (unsigned)i;   // Independent noise per frame
+            const vector<unsigned char> gray = RenderSyntheticPattern(params);
+            wxFileName out(dirDlg.GetPath(), wxString::Format("synth_%04ld.%s", i, format));
+
+            bool ok = (format == "raw")
+                ? WriteLegacyRawFrame(out.GetFullPath(), gray, params)
+                : WriteNativeFrame(out.GetFullPath(), format == "png" ? wxBITMAP_TYPE_PNG : wxBITMAP_TYPE_TIFF, gray, params);
+            if (!ok) {
+                wxMessageBox("Failed to write " + out.GetFullPath(), "Synthetic Pattern", wxICON_ERROR);
+                break;
+            }
+            m_items.push_back(out);
+        }
+        UpdateList();
+    }
+
+    // Frames of the selected folder, or every frame in the list when no folder is selected; sorted
+    vector<wxString> CollectFramePaths() const {
+        vector<wxString> paths;
+        long sel = m_listCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+        if (sel != -1 && m_items[sel].DirExists()) return FramesInFolder(m_items[sel].GetFullPath());
+        for (const auto& fn : m_items) if (IsFrameCandidate(fn)) paths.push_back(fn.GetFullPath());
+        sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    // Radially integrate every frame in the list (or in the selected folder) into one profile store
+    void OnBatchReduce(wxCommandEvent&) {
+        const vector<wxString> paths = CollectFramePaths();
+        if (paths.empty()) {
+            wxMessageBox("No frames to reduce. Add files or select a folder.", "Batch Reduce", wxICON_INFORMATION);
+            return;
+        }
+
+        wxTextEntryDialog dlg(this, wxString::Format("%zu frames. Enter Rmin,Rmax,step[,zingerSigma] (e.g., 0,600,5 or 0,600,5,6\n"
+            "to leave out pixels 6 robust sigmas above their 5x5 median)", paths.size()),
+            "Batch Reduce", "0,600,5");
+        if (dlg.ShowModal() != wxID_OK) return;
+        long Rmin = 0, Rmax = 0, step = 1;
+        OutlierParams outliers;
+        wxArrayString parts = wxSplit(dlg.GetValue(), ',');
+        if ((parts.size() != 3 && parts.size() != 4) || !parts[0].ToLong(&Rmin) || !parts[1].ToLong(&Rmax) || !parts[2].ToLong(&step) ||
+            step <= 0 || Rmax < Rmin || (parts.size() == 4 && (!parts[3].ToDouble(&outliers.sigma) || outliers.sigma <= 0))) {
+            wxMessageBox("Invalid input. Use Rmin,Rmax,step[,zingerSigma] like 0,600,5 or 0,600,5,6", "Batch Reduce", wxICON_WARNING);
+            return;
+        }
+
+        wxFileDialog saveDlg(this, "Save profile store", "", "profiles.rps",
+            "Profile stores (*.rps)|*.rps", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        vector<double> axis;
+        for (long R = Rmin; R <= Rmax; R += step) axis.push_back((double)R);
+
+        wxBusyCursor busy;
+        const auto start = chrono::steady_clock::now();
+        ProfileStore store;
+        wxString error;
+        if (!store.Create(saveDlg.GetPath(), axis, ProfileStore::DEFAULT_CHUNK_FRAMES, &error)) {
+            wxMessageBox(error, "Batch Reduce", wxICON_ERROR);
+            return;
+        }
+        const int stored = ReduceFramesToStore(paths, store, (int)Rmin, (int)Rmax, (int)step, &error, parts.size() == 4 ? &outliers : nullptr);
+        size_t peaks = 0;
+        if (!WriteStorePeaksCsv(store, saveDlg.GetPath() + ".peaks.csv", PeakParams(), &peaks) && error.IsEmpty())
+            error = "Could not write the peak table.";
+        store.Close();
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        const wxString summary = wxString::Format("Stored %d of %zu frames (%zu bins, %zu peaks) in %.1f s.", stored, paths.size(), axis.size(), peaks, seconds);
+        if (!error.IsEmpty()) wxMessageBox(summary + "\n\n" + error, "Batch Reduce", wxICON_WARNING);
+        else wxMessageBox(summary, "Batch Reduce", wxICON_INFORMATION);
+        m_items.push_back(wxFileName(saveDlg.GetPath()));
+        UpdateList();
+    }
+
+    // Radial profiles of low-count frames through their nonzero pixels. The source is a selected
+    // sparse archive (.npz), or the frames in the list, which are then also saved as one.
+    void OnSparseReduce(wxCommandEvent&) {
+        vector<SparseFrame> frames;
+        vector<wxString> sources;
+        wxString error;
+        wxString archive;
+        long sel = m_listCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+        if (sel != -1 && m_items[sel].GetExt().Lower() == "npz") {
+            wxBusyCursor busy;
+            archive = m_items[sel].GetFullPath();
+            if (!ReadSparseFrames(archive, frames, &error)) {
+                wxMessageBox(error, "Sparse Reduce", wxICON_ERROR);
+                return;
+            }
+            for (size_t f = 0; f < frames.size(); ++f) sources.push_back(wxString::Format("%s#%zu", archive, f));
+        }
+        else {
+            sources = CollectFramePaths();
+            if (sources.empty()) {
+                wxMessageBox("No frames to reduce. Add files, select a folder or select a sparse archive (.npz).", "Sparse Reduce", wxICON_INFORMATION);
+                return;
+            }
+        }
+
+        wxTextEntryDialog dlg(this, wxString::Format("%zu frames. Enter Rmin,Rmax,step (e.g., 0,600,5)", sources.size()),
+            "Sparse Reduce", "0,600,5");
+        if (dlg.ShowModal() != wxID_OK) return;
+        long Rmin = 0, Rmax = 0, step = 1;
+        wxArrayString parts = wxSplit(dlg.GetValue(), ',');
+        if (parts.size() != 3 || !parts[0].ToLong(&Rmin) || !parts[1].ToLong(&Rmax) || !parts[2].ToLong(&step) ||
+            step <= 0 || Rmax < Rmin) {
+            wxMessageBox("Invalid input. Use Rmin,Rmax,step like 0,600,5", "Sparse Reduce", wxICON_WARNING);
+            return;
+        }
+
+        wxFileDialog saveDlg(this, "Save profile store", "", "profiles.rps",
+            "Profile stores (*.rps)|*.rps", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+        const wxString storePath = saveDlg.GetPath();
+        const wxString base = storePath.Lower().EndsWith(".rps") ? storePath.Left(storePath.length() - 4) : storePath;
+
+        wxBusyCursor busy;
+        if (archive.IsEmpty()) {
+            // Decode and keep only the nonzeros; frames of another size than the first are dropped
+            frames.resize(sources.size());
+            const DecodeOptions opts = CurrentDecodeOptions();
+            ParallelFor(0, (int)sources.size(), [&](int b, int e) {
+                for (int i = b; i < e; ++i) {
+                    FrameHandle frame = DecodeFrameFile(sources[i], opts, nullptr);
+                    if (frame) frames[i] = MakeSparseFrame(frame->image);
+                }
+                });
+            size_t kept = 0;
+            int width = 0, height = 0;
+            for (size_t i = 0; i < frames.size(); ++i) {
+                if (frames[i].width == 0) continue;
+                if (width == 0) { width = frames[i].width; height = frames[i].height; }
+                if (frames[i].width != width || frames[i].height != height) continue;
+                if (kept != i) { frames[kept] = move(frames[i]); sources[kept] = sources[i]; }
+                ++kept;
+            }
+            frames.resize(kept);
+            sources.resize(kept);
+            if (frames.empty()) {
+                wxMessageBox("None of the frames could be decoded.", "Sparse Reduce", wxICON_ERROR);
+                return;
+            }
+            archive = base + ".sparse.npz";
+            if (!WriteSparseFrames(archive, frames)) {
+                wxMessageBox("Could not write " + archive, "Sparse Reduce", wxICON_ERROR);
+                return;
+            }
+            m_items.push_back(wxFileName(archive));
+        }
+
+        vector<double> axis;
+        for (long R = Rmin; R <= Rmax; R += step) axis.push_back((double)R);
+        ProfileStore store;
+        if (!store.Create(storePath, axis, ProfileStore::DEFAULT_CHUNK_FRAMES, &error)) {
+            wxMessageBox(error, "Sparse Reduce", wxICON_ERROR);
+            return;
+        }
+        const auto start = chrono::steady_clock::now();
+        vector<uint64_t> hist(256);
+        vector<double> columns, rows;
+        const int stored = ReduceSparseToStore(frames, sources, store, (int)Rmin, (int)Rmax, (int)step, &error, &hist, &columns, &rows);
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        size_t peaks = 0;
+        if (!WriteStorePeaksCsv(store, storePath + ".peaks.csv", PeakParams(), &peaks) && error.IsEmpty())
+            error = "Could not write the peak table.";
+        store.Close();
+
+        // Count histogram and projections summed over all frames
+        {
+            wxFileOutputStream file(base + ".counts.npz");
+            wxZipOutputStream zip(file, 0);
+            const bool ok = file.IsOk() &&
+                zip.PutNextEntry("histogram.npy") && WriteNpy(zip, "<u8", { hist.size() }, hist.data(), hist.size() * 8) &&
+                zip.PutNextEntry("columns.npy") && WriteNpy(zip, "<f8", { columns.size() }, columns.data(), columns.size() * 8) &&
+                zip.PutNextEntry("rows.npy") && WriteNpy(zip, "<f8", { rows.size() }, rows.data(), rows.size() * 8);
+            if ((!zip.Close() || !ok || !file.Close()) && error.IsEmpty()) error = "Could not write " + base + ".counts.npz";
+        }
+
+        uint64_t nonzero = 0;
+        for (const SparseFrame& f : frames) nonzero += f.Nonzero();
+        const double density = (double)nonzero / ((double)frames.size() * frames[0].width * frames[0].height);
+        const wxString summary = wxString::Format("Stored %d of %zu frames (%zu bins, %zu peaks).\n%.3f%% of pixels nonzero; integrated in %.3f s (%.1f us per frame).",
+            stored, frames.size(), axis.size(), peaks, 100.0 * density, seconds, 1e6 * seconds / max<size_t>(1, frames.size()));
+        if (!error.IsEmpty()) wxMessageBox(summary + "\n\n" + error, "Sparse Reduce", wxICON_WARNING);
+        else wxMessageBox(summary, "Sparse Reduce", wxICON_INFORMATION);
+        m_items.push_back(wxFileName(storePath));
+        UpdateList();
+    }
+
+    // Bin an event file (16-byte x, y, tof, t records) into time slices, shown live and integrated into a profile store
+    void OnIngestEvents(wxCommandEvent&) {
+        wxString source;
+        long sel = m_listCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+        if (sel != -1 && m_items[sel].GetExt().Lower() == "evt") source = m_items[sel].GetFullPath();
+        else {
+            wxFileDialog openDlg(this, "Select event file or pipe", "", "", "Event files (*.evt)|*.evt|All files (*.*)|*.*", wxFD_OPEN);
+            if (openDlg.ShowModal() != wxID_OK) return;
+            source = openDlg.GetPath();
+        }
+
+        wxTextEntryDialog dlg(this, "Enter width,height,sliceSeconds[,lambdaBins,lambdaMin,lambdaMax,flightPath]\n"
+            "(wavelengths in Angstrom from time of flight over the flight path in m; e.g., 2048,2048,0.1 or 256,256,1,50,1,10,20)",
+            "Ingest Events", "2048,2048,0.1");
+        if (dlg.ShowModal() != wxID_OK) return;
+        EventBinning binning;
+        wxString error;
+        if (!ParseEventBinning(dlg.GetValue(), binning, &error)) {
+            wxMessageBox(error, "Ingest Events", wxICON_WARNING);
+            return;
+        }
+
+        wxTextEntryDialog rangeDlg(this, "Enter Rmin,Rmax,step for the slice profiles (e.g., 0,600,5)", "Ingest Events", "0,600,5");
+        if (rangeDlg.ShowModal() != wxID_OK) return;
+        long Rmin = 0, Rmax = 0, step = 1;
+        wxArrayString parts = wxSplit(rangeDlg.GetValue(), ',');
+        if (parts.size() != 3 || !parts[0].ToLong(&Rmin) || !parts[1].ToLong(&Rmax) || !parts[2].ToLong(&step) ||
+            step <= 0 || Rmax < Rmin) {
+            wxMessageBox("Invalid input. Use Rmin,Rmax,step like 0,600,5", "Ingest Events", wxICON_WARNING);
+            return;
+        }
+
+        wxFileDialog saveDlg(this, "Save slice profiles", "", wxFileName(source).GetName() + ".rps",
+            "Profile stores (*.rps)|*.rps", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+        const bool follow = wxMessageBox("Keep reading as the file grows (until no data arrives for 5 s)?", "Ingest Events",
+            wxYES_NO | wxICON_QUESTION, this) == wxYES;
+
+        unique_ptr<EventIngestJob> job(new EventIngestJob(source, binning, follow));
+        if (!job->OpenStore(saveDlg.GetPath(), (int)Rmin, (int)Rmax, (int)step, &error)) {
+            wxMessageBox(error, "Ingest Events", wxICON_ERROR);
+            return;
+        }
+        (new EventIngestFrame(this, move(job), wxFileName(source).GetFullName()))->Show();
+        m_items.push_back(wxFileName(saveDlg.GetPath()));
+        UpdateList();
+    }
+
+    // Multi-tau g2(q, tau) of the frame series in the list (or the selected folder), as a CSV table
+    void OnCorrelate(wxCommandEvent&) {
+        const vector<wxString> paths = CollectFramePaths();
+        if (paths.size() < 2) {
+            wxMessageBox("Correlation needs a series of frames. Add files or select a folder.", "XPCS g2", wxICON_INFORMATION);
+            return;
+        }
+
+        wxTextEntryDialog dlg(this, wxString::Format("%zu frames. Enter Rmin,Rmax,step[,buffers[,frameSeconds]]\n"
+            "(q rings about the frame centre; buffers per multi-tau level, even; e.g., 10,200,10,16,0.001)", paths.size()),
+            "XPCS g2", "10,200,10,16");
+        if (dlg.ShowModal() != wxID_OK) return;
+        long Rmin = 0, Rmax = 0, step = 1, buffers = 16;
+        double frameSeconds = 0.0;
+        wxArrayString parts = wxSplit(dlg.GetValue(), ',');
+        if (parts.size() < 3 || parts.size() > 5 || !parts[0].ToLong(&Rmin) || !parts[1].ToLong(&Rmax) || !parts[2].ToLong(&step) ||
+            (parts.size() > 3 && !parts[3].ToLong(&buffers)) || (parts.size() > 4 && !parts[4].ToDouble(&frameSeconds)) ||
+            step <= 0 || Rmax < Rmin || Rmin < 0 || buffers < 4 || buffers > 256 || buffers % 2 != 0 || frameSeconds < 0) {
+            wxMessageBox("Invalid input. Use Rmin,Rmax,step[,buffers[,frameSeconds]] like 10,200,10,16 (buffers even, 4..256)",
+                "XPCS g2", wxICON_WARNING);
+            return;
+        }
+
+        wxFileDialog saveDlg(this, "Save g2 table", "", "g2.csv",
+            "CSV files (*.csv)|*.csv|Gzipped CSV (*.csv.gz)|*.csv.gz", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        wxBusyCursor busy;
+        const auto start = chrono::steady_clock::now();
+        wxString error;
+        unique_ptr<MultiTauCorrelator> corr = CorrelateFrames(paths, (int)Rmin, (int)Rmax, (int)step, (int)buffers, &error);
+        if (!corr) {
+            wxMessageBox(error, "XPCS g2", wxICON_ERROR);
+            return;
+        }
+        if (!WriteG2Csv(*corr, frameSeconds, saveDlg.GetPath())) {
+            wxMessageBox("Could not write " + saveDlg.GetPath(), "XPCS g2", wxICON_ERROR);
+            return;
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        wxMessageBox(wxString::Format("Correlated %llu frames over %d rings (%zu pixels) in %.1f s.\n"
+            "%d levels of %d buffers, %d lags; %.1f MB of buffers.",
+            (unsigned long long)corr->Frames(), corr->Partition().Rings(), corr->Partition().Pixels(), seconds,
+            corr->Levels(), corr->Buffers(), corr->Lags(), corr->Bytes() / 1048576.0), "XPCS g2", wxICON_INFORMATION);
+    }
+
+    // Two-time correlation maps of chosen rings over the frame series, saved as .npy and shown in false colour
+    void OnTwoTime(wxCommandEvent&) {
+        const vector<wxString> paths = CollectFramePaths();
+        if (paths.size() < 2) {
+            wxMessageBox("Correlation needs a series of frames. Add files or select a folder.", "Two-Time", wxICON_INFORMATION);
+            return;
+        }
+
+        wxTextEntryDialog dlg(this, wxString::Format("%zu frames. Enter ringWidth,R[,R...] (rings about the frame centre, e.g., 10,50,120)",
+            paths.size()), "Two-Time", "10,50");
+        if (dlg.ShowModal() != wxID_OK) return;
+        wxArrayString parts = wxSplit(dlg.GetValue(), ',');
+        long width = 0;
+        vector<int> radii;
+        bool ok = parts.size() >= 2 && parts[0].ToLong(&width) && width > 0;
+        for (size_t i = 1; ok && i < parts.size(); ++i) {
+            long R = 0;
+            ok = parts[i].ToLong(&R) && R >= 0;
+            radii.push_back((int)R);
+        }
+        if (!ok) {
+            wxMessageBox("Invalid input. Use ringWidth,R[,R...] like 10,50,120", "Two-Time", wxICON_WARNING);
+            return;
+        }
+
+        wxFileDialog saveDlg(this, "Save two-time maps (one .npy per ring)", "", "twotime.npy",
+            "NumPy arrays (*.npy)|*.npy", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+        wxFileName base(saveDlg.GetPath());
+
+        wxBusyCursor busy;
+        const auto start = chrono::steady_clock::now();
+        vector<RingSeries> series;
+        wxString error;
+        if (!GatherRingSeries(paths, radii, (int)width, series, &error)) {
+            wxMessageBox(error, "Two-Time", wxICON_ERROR);
+            return;
+        }
+        MemCharge charge(MemTag::Correlation);
+        uint64_t bytes = 0;
+        for (const RingSeries& s : series) bytes += s.Bytes();
+        charge.Set(bytes);
+
+        const uint64_t BAND_BYTES = 256ull << 20;   // Rows of the map computed and written at a time
+        const int PREVIEW = 1024;
+        for (const RingSeries& s : series) {
+            wxFileName fn(base);
+            fn.SetName(wxString::Format("%s_R%d", base.GetName(), s.R));
+            vector<float> preview;
+            int n = 0;
+            if (!WriteTwoTimeNpy(s, fn.GetFullPath(), BAND_BYTES, PREVIEW, preview, n)) {
+                wxMessageBox("Could not write " + fn.GetFullPath(), "Two-Time", wxICON_ERROR);
+                return;
+            }
+            const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            const size_t stride = (s.frames + n - 1) / n;
+            (new ColormapFrame(this, wxString::Format("Two-time C(t1, t2), R = %d", s.R), preview, n, n,
+                wxString::Format("%zu frames x %zu pixels; %zu frames per display pixel; t1 down, t2 across; %.1f s",
+                    s.frames, s.Pixels(), stride, seconds)))->Show();
+            m_items.push_back(fn);
+        }
+        UpdateList();
+    }
+
+    // ROI statistics through every frame, written as a long CSV (frame, roi, sum, mean, ...)
+    void OnTrackROIs(wxCommandEvent&) {
+        const vector<wxString> paths = CollectFramePaths();
+        if (paths.empty()) {
+            wxMessageBox("No frames to track. Add files or select a folder.", "Track ROIs", wxICON_INFORMATION);
+            return;
+        }
+
+        wxTextEntryDialog dlg(this, wxString::Format("%zu frames. Enter ROIs as x,y,width,height separated by ';'", paths.size()),
+            "Track ROIs", "0,0,64,64");
+        if (dlg.ShowModal() != wxID_OK) return;
+        ROIManager rois;
+        for (wxString spec : wxSplit(dlg.GetValue(), ';')) {
+            if (spec.Trim().Trim(false).IsEmpty()) continue;
+            long v[4];
+            wxArrayString parts = wxSplit(spec, ',');
+            bool ok = parts.size() == 4;
+            for (size_t i = 0; ok && i < 4; ++i) ok = parts[i].Trim().Trim(false).ToLong(&v[i]);
+            if (!ok || v[2] <= 0 || v[3] <= 0) {
+                wxMessageBox("Invalid ROI \"" + spec + "\". Use x,y,width,height like 10,20,64,64", "Track ROIs", wxICON_WARNING);
+                return;
+            }
+            rois.AddROI(wxRect((int)v[0], (int)v[1], (int)v[2], (int)v[3]));
+        }
+        if (rois.IsEmpty()) return;
+
+        wxFileDialog saveDlg(this, "Save ROI statistics", "", "roi_stats.csv",
+            "CSV files (*.csv)|*.csv|Gzipped CSV (*.csv.gz)|*.csv.gz", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        wxBusyCursor busy;
+        const auto start = chrono::steady_clock::now();
+        wxString error;
+        const int tracked = TrackROIsToCsv(paths, rois, saveDlg.GetPath(), &error);
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        const wxString summary = wxString::Format("Tracked %zu ROIs through %d of %zu frames in %.1f s.",
+            rois.GetROIs().size(), tracked, paths.size(), seconds);
+        if (!error.IsEmpty()) wxMessageBox(summary + "\n\n" + error, "Track ROIs", wxICON_WARNING);
+        else wxMessageBox(summary, "Track ROIs", wxICON_INFORMATION);
+    }
+
+    // Dark, background and flat corrections applied while frames are decoded
+    void OnCorrections(wxCommandEvent&) {
+        wxTextEntryDialog dlg(this, "Corrections for frames opened or reduced from now on (empty for none):\n"
+            "dark=path;background=path;flat=path;exposure=s;dark_exposure=s;background_exposure=s;\n"
+            "flat_exposure=s;transmission=T;background_transmission=T;pedestal=grey\n"
+            "(the pedestal, default 16, is added after correction so negative residuals are not clipped to 0)",
+            "Corrections", FormatDecodeOptions(CurrentDecodeOptions()));
+        if (dlg.ShowModal() != wxID_OK) return;
+        DecodeOptions opts;
+        wxString error;
+        if (!ParseDecodeOptions(dlg.GetValue(), opts, &error)) {
+            wxMessageBox(error, "Corrections", wxICON_WARNING);
+            return;
+        }
+        // Read the masters now so a bad path is reported here rather than on every frame
+        if (opts.HasCorrection()) {
+            wxBusyCursor busy;
+            const auto corr = GetFrameCorrection(opts, &error);
+            if (!corr) {
+                wxMessageBox(error, "Corrections", wxICON_ERROR);
+                return;
+            }
+        }
+        SetCurrentDecodeOptions(opts);
+        wxMessageBox(opts.HasCorrection() ? "Frames will be corrected while decoding:\n" + FormatDecodeOptions(opts)
+            : wxString("Corrections are off."), "Corrections", wxICON_INFORMATION);
+    }
+
+    // Master dark or flat (per-pixel mean and variance) from the listed frames, streamed one at a time
+    void OnBuildMaster(wxCommandEvent&) {
+        const vector<wxString> paths = CollectFramePaths();
+        if (paths.empty()) {
+            wxMessageBox("No frames to combine. Add files or select a folder.", "Build Dark/Flat", wxICON_INFORMATION);
+            return;
+        }
+
+        wxTextEntryDialog dlg(this, wxString::Format("%zu frames. Enter outlier rejection as reservoir,clipSigma\n"
+            "(samples kept per pixel, 0 for plain mean and variance; e.g., 16,5)", paths.size()),
+            "Build Dark/Flat", "16,5");
+        if (dlg.ShowModal() != wxID_OK) return;
+        MasterBuildOptions opts;
+        long reservoir = 0;
+        wxArrayString parts = wxSplit(dlg.GetValue(), ',');
+        if (parts.size() != 2 || !parts[0].ToLong(&reservoir) || !parts[1].ToDouble(&opts.clipSigma) ||
+            reservoir < 0 || reservoir > 255 || opts.clipSigma <= 0) {
+            wxMessageBox("Invalid input. Use reservoir,clipSigma like 16,5 (reservoir 0..255)", "Build Dark/Flat", wxICON_WARNING);
+            return;
+        }
+        opts.reservoir = (int)reservoir;
+
+        wxFileDialog saveDlg(this, "Save master frame", "", "master_dark.npz",
+            "NumPy archive (*.npz)|*.npz", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        wxBusyCursor busy;
+        const auto start = chrono::steady_clock::now();
+        MasterFrame master;
+        uint64_t rejected = 0;
+        wxString error;
+        const bool ok = BuildMasterFrame(paths, opts, master, &rejected, &error);
+        if (!error.IsEmpty()) wxMessageBox(error, "Build Dark/Flat", ok ? wxICON_WARNING : wxICON_ERROR);
+        if (!ok) return;
+        if (!WriteMasterFrame(saveDlg.GetPath(), master)) {
+            wxMessageBox("Could not write " + saveDlg.GetPath(), "Build Dark/Flat", wxICON_ERROR);
+            return;
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        double level = 0.0, noise = 0.0;
+        size_t noiseCount = 0;
+        for (size_t i = 0; i < master.mean.size(); ++i) {
+            level += master.mean[i];
+            if (isfinite(master.variance[i])) { noise += master.variance[i]; ++noiseCount; }
+        }
+        const double samples = (double)master.frames * master.mean.size();
+        wxMessageBox(wxString::Format("Combined %u frames of %dx%d in %.1f s.\nMean level %.3f, mean variance %.3f, %.4f%% of samples rejected.",
+            master.frames, master.width, master.height, seconds, level / master.mean.size(),
+            noiseCount ? noise / noiseCount : 0.0, samples > 0 ? 100.0 * rejected / samples : 0.0), "Build Dark/Flat", wxICON_INFORMATION);
+        m_items.push_back(wxFileName(saveDlg.GetPath()));
+        UpdateList();
+    }
+
+    // Fit one model to every profile of the selected store, written as a parameter table
+    void OnFitStore(wxCommandEvent&) {
+        long sel = m_listCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+        if (sel == -1 || m_items[sel].GetExt().Lower() != "rps") {
+            wxMessageBox("Select a profile store (.rps) first.", "Fit Store", wxICON_INFORMATION);
+            return;
+        }
+
+        ProfileStore store;
+        wxString error;
+        if (!store.Open(m_items[sel].GetFullPath(), false, &error)) {
+            wxMessageBox(error, "Fit Store", wxICON_ERROR);
+            return;
+        }
+
+        wxTextEntryDialog dlg(this, wxString::Format("%llu profiles. Enter model[,bgDegree[,xmin,xmax]]\n"
+            "Models: gaussian, lorentzian, pseudovoigt, guinier, porod, sphere", (unsigned long long)store.Frames()),
+            "Fit Store", "gaussian,1");
+        if (dlg.ShowModal() != wxID_OK) return;
+        FitSpec spec;
+        if (!ParseFitSpec(dlg.GetValue(), spec, &error)) {
+            wxMessageBox(error, "Fit Store", wxICON_WARNING);
+            return;
+        }
+
+        wxFileDialog saveDlg(this, "Save fit parameters", "", m_items[sel].GetName() + ".fit.csv",
+            "CSV files (*.csv)|*.csv|Gzipped CSV (*.csv.gz)|*.csv.gz", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        wxBusyCursor busy;
+        const auto start = chrono::steady_clock::now();
+        const vector<FitResult> results = FitStore(store, spec);
+        if (!WriteFitCsv(store, spec, results, saveDlg.GetPath())) {
+            wxMessageBox("Could not write " + saveDlg.GetPath(), "Fit Store", wxICON_ERROR);
+            return;
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        const size_t converged = count_if(results.begin(), results.end(), [](const FitResult& r) { return r.converged; });
+        wxMessageBox(wxString::Format("Fitted %zu profiles (%zu converged) in %.1f s.", results.size(), converged, seconds),
+            "Fit Store", wxICON_INFORMATION);
+    }
+
+    // Write the selected profile store as a wide CSV (one column per frame), NumPy .npz or NeXus HDF5
+    void OnExportStore(wxCommandEvent&) {
+        long sel = m_listCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+        if (sel == -1 || m_items[sel].GetExt().Lower() != "rps") {
+            wxMessageBox("Select a profile store (.rps) first.", "Export Store", wxICON_INFORMATION);
+            return;
+        }
+
+        ProfileStore store;
+        wxString error;
+        if (!store.Open(m_items[sel].GetFullPath(), false, &error)) {
+            wxMessageBox(error, "Export Store", wxICON_ERROR);
+            return;
+        }
+
+        wxString wildcard = "CSV files (*.csv)|*.csv|Gzipped CSV (*.csv.gz)|*.csv.gz|NumPy archive (*.npz)|*.npz";
+#ifdef HAVE_HDF5
+        wildcard += "|NeXus/HDF5 (*.nxs;*.h5)|*.nxs;*.h5";
+#endif
+        wxFileDialog saveDlg(this, "Export profiles", "", m_items[sel].GetName() + ".csv",
+            wildcard, wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+        const wxString path = saveDlg.GetPath();
+        const wxString ext = wxFileName(path).GetExt().Lower();
+        const bool csv = ext == "csv" || ext == "gz";
+        const bool withErrors = csv && wxMessageBox("Include an error column for each frame?", "Export Store",
+            wxYES_NO | wxICON_QUESTION, this) == wxYES;
+
+        wxBusyCursor busy;
+        const auto start = chrono::steady_clock::now();
+        bool ok;
+        {
+            PerfScope timer(PerfOp::Export);
+            if (csv) ok = WriteStoreCsv(store, path, withErrors);
+            else if (ext == "npz") ok = WriteStoreNpz(store, path);
+#ifdef HAVE_HDF5
+            else if (ext == "h5" || ext == "nxs") ok = WriteStoreHdf5(store, path);
+#endif
+            else ok = false;
+        }
+        if (!ok) {
+            wxMessageBox("Could not write " + path, "Export Store", wxICON_ERROR);
+            return;
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        wxMessageBox(wxString::Format("Wrote %llu profiles x %u bins in %.1f s.",
+            (unsigned long long)store.Frames(), store.Bins(), seconds), "Export Store", wxICON_INFORMATION);
+    }
+
+    // Convert an .npz (or NeXus profile table) into a profile store next to it, then plot it
+    void ImportProfiles(const wxFileName& fn) {
+        wxFileName storePath(fn.GetPath(), fn.GetName() + ".rps");
+        wxFileDialog saveDlg(this, "Import profiles into store", storePath.GetPath(), storePath.GetFullName(),
+            "Profile stores (*.rps)|*.rps", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+        if (saveDlg.ShowModal() != wxID_OK) return;
+
+        wxBusyCursor busy;
+        wxString error;
+#ifdef HAVE_HDF5
+        const bool ok = fn.GetExt().Lower() == "npz" ? ImportStoreNpz(fn.GetFullPath(), saveDlg.GetPath(), &error)
+            : ImportStoreHdf5(fn.GetFullPath(), saveDlg.GetPath(), &error);
+#else
+        const bool ok = ImportStoreNpz(fn.GetFullPath(), saveDlg.GetPath(), &error);
+#endif
+        if (!ok) {
+            wxMessageBox(error, "Import Profiles", wxICON_ERROR);
+            return;
+        }
+        m_items.push_back(wxFileName(saveDlg.GetPath()));
+        UpdateList();
+        OpenProfileStore(saveDlg.GetPath());
+    }
+
+    // Plot the mean profile of a store
+    void OpenProfileStore(const wxString& path) {
+        ProfileStore store;
+        wxString error;
+        if (!store.Open(path, false, &error)) {
+            wxMessageBox(error, "Profile Store", wxICON_ERROR);
+            return;
+        }
+        if (store.Frames() == 0) {
+            wxMessageBox("The profile store is empty.", "Profile Store", wxICON_INFORMATION);
+            return;
+        }
+        auto* pf = new PlotFrame(nullptr, store.MeanProfile());
+        pf->SetTitle(wxString::Format("Mean of %llu profiles - ", (unsigned long long)store.Frames()) + wxFileName(path).GetFullName());
+        pf->Show();
+    }
+
     void OnItemActivated(wxListEvent& event) {
         wxFileName fn = m_items[event.GetIndex()];
-        if (fn.FileExists()) {
+        const wxString ext = fn.GetExt().Lower();
+        if (fn.FileExists() && ext == "rps") {
+            OpenProfileStore(fn.GetFullPath());
+        }
+        else if (fn.FileExists() && ext == "npz" && !NpzHasFrame(fn.GetFullPath())) {
+            ImportProfiles(fn);
+        }
+#ifdef HAVE_HDF5
+        else if (fn.FileExists() && (ext == "h5" || ext == "nxs") && Hdf5HasProfiles(fn.GetFullPath())) {
+            ImportProfiles(fn);
+        }
+#endif
+        else if (fn.FileExists()) {
             auto* frame = new ImageFrame(nullptr, fn.GetFullPath());
             frame->Show();
         }
@@ -1207,6 +9288,7 @@ class MyApp : public wxApp {
 public:
     bool OnInit() override {
         wxInitAllImageHandlers();
+        TraceRecorder::SetThreadName("main");
 
         wxFrame* frame = new wxFrame(nullptr, wxID_ANY, "File Browser", wxDefaultPosition, wxSize(800, 500));
         new FileBrowser(frame);